@@ -19,12 +19,12 @@ Entities.append(
                       Template("attribute_layers_custom", template = "EntityTable", types = ["entity_ref","Varying"] )
                      ],
         variables = [ Variable("attribute_layers" , "Layers"),
-                      Variable("attribute_layers_fvec2" , "TextureCoordsData"),
-                      Variable("attribute_layers_fvec3" , "TangentsData"),
-                      Variable("attribute_layers_fvec3" , "BitangentsData"),
-                      Variable("attribute_layers_fvec3" , "NormalsData"),
-                      Variable("attribute_layers_fvec4" , "ColorsData"),
-                      Variable("attribute_layers_custom" , "CustomData")
+                      Variable("attribute_layers_fvec2" , "TextureCoordsData", lazy = True),
+                      Variable("attribute_layers_fvec3" , "TangentsData", lazy = True),
+                      Variable("attribute_layers_fvec3" , "BitangentsData", lazy = True),
+                      Variable("attribute_layers_fvec3" , "NormalsData", lazy = True),
+                      Variable("attribute_layers_fvec4" , "ColorsData", lazy = True),
+                      Variable("attribute_layers_custom" , "CustomData", lazy = True)
                       ]
         )
     )
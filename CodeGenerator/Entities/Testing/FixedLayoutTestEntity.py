@@ -0,0 +1,18 @@
+# ISD Copyright (c) 2021 Ulrik Lindahl
+# Licensed under the MIT license
+# https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+from Entities import *
+
+Entities.append(
+    Entity(
+        name = "FixedLayoutTestEntity", 
+        dependencies = [],
+        variables = [ Variable("string", "Name"),
+                      Variable("u32", "Flags"),
+                      Variable("hash", "ContentHash"),
+                      Variable("fvec3", "Position"),
+                      Variable("hash", "SourceHash") ],
+        packet_type = False # only compiled into the test project, the variables are read as one fixed layout
+        )
+    )
@@ -9,6 +9,7 @@ Entities.append(
         name = "TestEntity", 
         dependencies = [],
         variables = [ Variable("string", "Name"),
-                      Variable("string", "OptionalText", optional = True ) ]
+                      Variable("string", "OptionalText", optional = True ) ],
+        packet_type = False # only compiled into the test project, which registers it when needed
         )
     )
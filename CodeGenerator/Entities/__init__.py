@@ -2,14 +2,16 @@
 # Licensed under the MIT license
 # https://github.com/Cooolrik/ISD/blob/main/LICENSE
 
+import sys
 import CodeGeneratorHelpers as hlp
 
 class Entity:
-	def __init__(self, name, variables, dependencies = [], templates = []):
+	def __init__(self, name, variables, dependencies = [], templates = [], packet_type = True):
 		self.Name = name
 		self.Dependencies = dependencies
 		self.Templates = templates
 		self.Variables = variables
+		self.PacketType = packet_type # if set, the entity is registered by register_entity_packet_types
 
 class Dependency:
 	def __init__(self, name, include_in_header = False ):
@@ -44,12 +46,13 @@ class Template:
 		self.Declaration += '>;'
 
 class Variable:
-	def __init__(self, type, name, optional = False, vector = False, indexed = False ):
+	def __init__(self, type, name, optional = False, vector = False, indexed = False, lazy = False ):
 		self.Type = type
 		self.Name = name
 		self.Optional = optional
 		self.Vector = vector
 		self.IndexedVector = indexed
+		self.Lazy = lazy # if set, the section can be read on first access instead of with the entity (see lazy_section and EntityReader::SetLazyReading)
 		if self.IndexedVector and not self.Vector:
 			sys.exit("Variable.__init__: IndexedVector requires Vector flag to be set as well")
 
@@ -82,6 +85,15 @@ class Variable:
 		# check if this is a simple value which is a base type
 		self.IsSimpleBaseType = self.BaseType and self.IsSimpleValue
 
+		# only sections which are always in the stream can be lazy, so not base types, and not optional or vectors of entities
+		if self.Lazy:
+			if self.IsBaseType:
+				sys.exit("Variable.__init__: Lazy requires an entity type, not a base type")
+			if self.Optional:
+				sys.exit("Variable.__init__: Lazy can not be combined with the Optional flag")
+			if self.Vector:
+				sys.exit("Variable.__init__: Lazy can not be combined with the Vector flag")
+
 
 	 
 # define the Entities list, we will fill this in in the submodules
@@ -95,3 +107,4 @@ from .Scene import SceneLayer
 from .Geometry import Mesh
 from .Geometry import AttributeLayer
 from .Testing import TestEntity
+from .Testing import FixedLayoutTestEntity
@@ -3,6 +3,76 @@
 # https://github.com/Cooolrik/ISD/blob/main/LICENSE
 import CodeGeneratorHelpers as hlp
 import Entities as ents
+import uuid
+
+# the type ids of the entities are name based uuids, so they are stable as long as the entity name is not changed
+entity_type_id_namespace = uuid.uuid5(uuid.NAMESPACE_URL, 'https://github.com/Cooolrik/ISD/Entities')
+
+def EntityTypeIdInitializer(entity):
+	type_id = uuid.uuid5(entity_type_id_namespace, entity.Name)
+	data4 = ','.join(f'0x{b:02x}' for b in type_id.bytes[8:16])
+	return f'{{0x{type_id.time_low:08x},0x{type_id.time_mid:04x},0x{type_id.time_hi_version:04x},{{{data4}}}}}'
+
+# the value of a variable in the entity. lazy sections are read on first access of the value
+def VariableValue(var):
+	if var.Lazy:
+		return f'v_{var.Name}.value()'
+	return f'v_{var.Name}'
+
+# the size of the items of the base types which can be read in a fixed layout, which are the types that are stored as plain 
+# values. bools, uuids and strings are converted when read, and are always read one by one
+fixed_layout_item_sizes = {'i8':1,'i16':2,'i32':4,'i64':8,'u8':1,'u16':2,'u32':4,'u64':8,'float':4,'double':8,'hash':1}
+
+# hashes are stored as raw bytes which are never byte swapped, so they are read as items of 1 byte, but each hash is 32 bytes
+sizeof_hash = 32
+
+def FixedLayoutValueSize(var):
+	if var.BaseVariant.item_type == 'hash':
+		return sizeof_hash * var.BaseVariant.num_items_per_object
+	return fixed_layout_item_sizes[var.BaseVariant.item_type] * var.BaseVariant.num_items_per_object
+
+def IsFixedLayoutVariable(var):
+	if not var.IsSimpleBaseType:
+		return False
+	if var.BaseVariant.overrides_type:
+		return False
+	return var.BaseVariant.item_type in fixed_layout_item_sizes
+
+# split the variables of the entity into runs of variables. consecutive fixed layout variables are placed in the same run, 
+# and all other variables are in runs of their own. runs with more than one variable are read as fixed layouts
+def GetVariableRuns(entity):
+	runs = []
+	for var in entity.Variables:
+		if IsFixedLayoutVariable(var) and len(runs) > 0 and IsFixedLayoutVariable(runs[-1][-1]):
+			runs[-1].append(var)
+		else:
+			runs.append([var])
+	return runs
+
+def ImplementFixedLayout(entity,run,layout_name):
+	lines = []
+
+	fingerprint = []
+	fields = []
+	block_start = 0
+	for var in run:
+		value_size = FixedLayoutValueSize(var)
+		item_size = fixed_layout_item_sizes[var.BaseVariant.item_type]
+		key_size = len(var.Name)
+		fingerprint.append(f'(u8)ValueType::VT_{var.BaseType.name}')
+		fingerprint.append(f'{value_size + key_size}')
+		fingerprint.extend(f"'{c}'" for c in var.Name)
+		fields.append(f'{{{block_start + 2},{value_size},{item_size},{key_size}}}')
+		block_start += 2 + value_size + key_size
+
+	var_names = ', '.join(f'"{var.Name}"' for var in run)
+	lines.append(f'    // fixed layout of the variables {var_names}')
+	lines.append(f'    static const u8 {layout_name}_fingerprint[] = {{ {",".join(fingerprint)} }};')
+	lines.append(f'    static const EntityFixedLayoutField {layout_name}_fields[] = {{ {",".join(fields)} }};')
+	lines.append(f'    static const EntityFixedLayout {layout_name} = {{ {block_start}, {layout_name}_fingerprint, {layout_name}_fields, {len(run)} }};')
+	lines.append('')
+
+	return lines
 
 def CreateEntityHeader(entity):
 	lines = []
@@ -18,6 +88,10 @@ def CreateEntityHeader(entity):
 		if dep.IncludeInHeader:
 			lines.append(f'#include "ISD_{dep.Name}.h"')
 
+	# lazy sections need the lazy_section template
+	if any(var.Lazy for var in entity.Variables):
+		lines.append('#include "ISD_lazy_section.h"')
+
 	lines.append('')
 	lines.append('namespace ISD')
 	lines.append('    {')
@@ -41,6 +115,10 @@ def CreateEntityHeader(entity):
 	lines.append('            friend MF;')
 	lines.append('')
 
+	lines.append('            // the id of the entity type, which identifies the type in serialized packets')
+	lines.append('            static const uuid TypeId;')
+	lines.append('')
+
 	lines.append(f'            {entity.Name}() = default;')
 	lines.append(f'            {entity.Name}( const {entity.Name} &rval );')
 	lines.append(f'            {entity.Name} &operator=( const {entity.Name} &rval );')
@@ -60,6 +138,8 @@ def CreateEntityHeader(entity):
 	for var in entity.Variables:
 		if var.IsSimpleBaseType:
 			lines.append(f'            {var.TypeString} v_{var.Name} = {{}};')
+		elif var.Lazy:
+			lines.append(f'            lazy_section<{var.TypeString}> v_{var.Name};')
 		else:
 			lines.append(f'            {var.TypeString} v_{var.Name};')
 
@@ -69,8 +149,8 @@ def CreateEntityHeader(entity):
 	# create accessor ref for variables, const and non-const versions
 	for var in entity.Variables:
 		lines.append(f'            // accessor for referencing variable {var.Name}')
-		lines.append(f'            const {var.TypeString} & {var.Name}() const {{ return this->v_{var.Name}; }}')
-		lines.append(f'            {var.TypeString} & {var.Name}() {{ return this->v_{var.Name}; }}')
+		lines.append(f'            const {var.TypeString} & {var.Name}() const {{ return this->{VariableValue(var)}; }}')
+		lines.append(f'            {var.TypeString} & {var.Name}() {{ return this->{VariableValue(var)}; }}')
 		lines.append('')
 
 	lines.append('        };')
@@ -91,7 +171,14 @@ def CreateEntityHeader(entity):
 	lines.append(f'            static bool Write( const {entity.Name} &obj, EntityWriter &writer );')
 	lines.append(f'            static bool Read( {entity.Name} &obj, EntityReader &reader );')
 	lines.append('')
+	lines.append(f'            static bool MeasureSerializedSize( const {entity.Name} &obj, const EntityWriter &writer, u64 &dest_size, std::vector<u64> *dest_block_sizes = nullptr );')
+	lines.append('')
 	lines.append(f'            static bool Validate( const {entity.Name} &obj, EntityValidator &validator );')
+	if any(var.Lazy for var in entity.Variables):
+		lines.append('')
+		lines.append('            // read the lazy sections of the object which are not read yet. returns false if any of them fails to read, in which case ')
+		lines.append('            // the failed sections are empty. the accessors of a failed section report the failure as a debug sanity check')
+		lines.append(f'            static bool ReadLazySections( const {entity.Name} &obj );')
 	lines.append('        };')
 	lines.append('')
 	
@@ -136,6 +223,9 @@ def ImplementClearCall(entity,var):
 			lines.append(f'        obj.v_{var.Name}.reset();')
 		else:
 			lines.append(f'        obj.v_{var.Name} = {{}};')
+	elif var.Lazy:
+		lines.append(f'        obj.v_{var.Name}.reset_source();')
+		lines.append(f'        {var.Type}::MF::Clear( obj.{VariableValue(var)} );')
 	else:
 		lines.append(f'        {var.Type}::MF::Clear( obj.v_{var.Name} );')
 
@@ -152,6 +242,9 @@ def ImplementDeepCopyCall(entity,var):
 	if var.IsBaseType:
 		# we have a base type, add the copy code directly
 		lines.append(f'        dest.v_{var.Name} = source->v_{var.Name};')
+	elif var.Lazy:
+		# copy the lazy section, which shares the values in the stream if the section is not read yet
+		lines.append(f'        dest.v_{var.Name} = source->v_{var.Name};')
 	else:
 		# this is an entity type
 		if var.Optional:
@@ -189,7 +282,7 @@ def ImplementEqualsCall(entity,var):
 			lines.append(f'            ) )')
 			lines.append('            return false;')
 		else:
-			lines.append(f'        if( !{entity.Name}::{var.Type}::MF::Equals( &lvar->v_{var.Name} , &rvar->v_{var.Name} ) )')
+			lines.append(f'        if( !{entity.Name}::{var.Type}::MF::Equals( &lvar->{VariableValue(var)} , &rvar->{VariableValue(var)} ) )')
 			lines.append('            return false;')
 
 	lines.append('')
@@ -220,7 +313,7 @@ def ImplementWriterCall(entity,var):
 			lines.append('                return false;')
 			lines.append('            }')
 		else:
-			lines.append(f'        if( !{entity.Name}::{var.Type}::MF::Write( obj.v_{var.Name}, *section_writer ) )')
+			lines.append(f'        if( !{entity.Name}::{var.Type}::MF::Write( obj.{VariableValue(var)}, *section_writer ) )')
 			lines.append('            return false;')
 		lines.append('        writer.EndWriteSection( section_writer );')
 		lines.append('        section_writer = nullptr;')
@@ -244,6 +337,30 @@ def ImplementReaderCall(entity,var):
 		lines.append(f'        if( !success )')
 		lines.append(f'            return false;')
 		lines.append('')
+	elif var.Lazy:
+		# a lazy section, if the reader reads lazily, skip the section and keep the view of its values, which are read on first access.
+		# otherwise, read the section directly
+		lines.append(f'        // read lazy section "{var.Name}"')
+		lines.append('        if( reader.GetLazyReading() )')
+		lines.append('            {')
+		lines.append(f'            success = reader.SkipSection( ISDKeyMacro("{var.Name}") , {value_can_be_null}, section_values, section_values_size );')
+		lines.append('            if( !success )')
+		lines.append('                return false;')
+		lines.append(f'            if( !obj.v_{var.Name}.set_source( reader, section_values, section_values_size ) )')
+		lines.append('                return false;')
+		lines.append('            }')
+		lines.append('        else')
+		lines.append('            {')
+		lines.append(f'            std::tie(section_reader,success) = reader.BeginReadSection( ISDKeyMacro("{var.Name}") , {value_can_be_null} );')
+		lines.append('            if( !success )')
+		lines.append('                return false;')
+		lines.append(f'            obj.v_{var.Name}.reset_source();')
+		lines.append(f'            if( !{entity.Name}::{var.Type}::MF::Read( obj.{VariableValue(var)}, *section_reader ) )')
+		lines.append('                return false;')
+		lines.append('            reader.EndReadSection( section_reader );')
+		lines.append('            section_reader = nullptr;')
+		lines.append('            }')
+		lines.append('')
 	else:
 		# not a base type, so an entity. add a block
 		lines.append(f'        // read section "{var.Name}"')
@@ -283,7 +400,7 @@ def ImplementValidatorCall(entity,var):
 			lines.append('                return false;')
 			lines.append('            }')
 		else:
-			lines.append(f'        success = {var.Type}::MF::Validate( obj.v_{var.Name} , validator );')
+			lines.append(f'        success = {var.Type}::MF::Validate( obj.{VariableValue(var)} , validator );')
 			lines.append('        if( !success )')
 			lines.append('            return false;')
 		lines.append('')
@@ -314,6 +431,15 @@ def CreateEntitySource(entity):
 	lines.append('namespace ISD')
 	lines.append('    {')
 	
+	lines.append(f'    const uuid {entity.Name}::TypeId = {EntityTypeIdInitializer(entity)};')
+	lines.append('')
+
+	# the fixed layouts of the runs of fixed size variables
+	runs = GetVariableRuns(entity)
+	for run_index,run in enumerate(runs):
+		if len(run) > 1:
+			lines.extend(ImplementFixedLayout(entity,run,f'fixed_layout_{run_index}'))
+
 	# check if there are entities in the variable list
 	vars_have_entity = False
 	for var in entity.Variables:
@@ -362,6 +488,13 @@ def CreateEntitySource(entity):
 	lines.append('        }')
 	lines.append('')
 
+	# size code
+	lines.append(f'    bool {entity.Name}::MF::MeasureSerializedSize( const {entity.Name} &obj, const EntityWriter &writer, u64 &dest_size, std::vector<u64> *dest_block_sizes )')
+	lines.append('        {')
+	lines.append('        return writer.MeasureWrite( obj, dest_size, dest_block_sizes );')
+	lines.append('        }')
+	lines.append('')
+
 	# writer code
 	lines.append(f'    bool {entity.Name}::MF::Write( const {entity.Name} &obj, EntityWriter &writer )')
 	lines.append('        {')
@@ -381,9 +514,27 @@ def CreateEntitySource(entity):
 	lines.append('        bool success = true;')
 	if vars_have_entity:
 		lines.append('        EntityReader *section_reader = nullptr;')
-	lines.append('')
-	for var in entity.Variables:
-		lines.extend(ImplementReaderCall(entity,var))
+	if any(var.Lazy for var in entity.Variables):
+		lines.append('        const u8 *section_values = nullptr;')
+		lines.append('        u64 section_values_size = 0;')
+	lines.append('')
+	for run_index,run in enumerate(runs):
+		if len(run) > 1:
+			# read the fixed layout in one pass, and fall back to reading the variables one by one if the stream does not match
+			var_names = ', '.join(f'"{var.Name}"' for var in run)
+			var_pointers = ', '.join(f'&obj.v_{var.Name}' for var in run)
+			lines.append(f'        // read the variables {var_names} as a fixed layout, or one by one if the stream differs from the layout')
+			lines.append(f'        void * const fixed_layout_{run_index}_values[] = {{ {var_pointers} }};')
+			lines.append(f'        if( !reader.ReadFixedLayout( fixed_layout_{run_index}, fixed_layout_{run_index}_values ) )')
+			lines.append('            {')
+			run_lines = []
+			for var in run:
+				run_lines.extend(ImplementReaderCall(entity,var))
+			lines.extend(('    ' + line) if line else line for line in run_lines[:-1])
+			lines.append('            }')
+			lines.append('')
+		else:
+			lines.extend(ImplementReaderCall(entity,run[0]))
 	lines.append('        return true;')
 	lines.append('        }')
 	lines.append('')
@@ -399,12 +550,65 @@ def CreateEntitySource(entity):
 	lines.append('        }')
 	lines.append('')
 
+	# lazy sections read code
+	if any(var.Lazy for var in entity.Variables):
+		lines.append(f'    bool {entity.Name}::MF::ReadLazySections( const {entity.Name} &obj )')
+		lines.append('        {')
+		lines.append('        bool success = true;')
+		for var in entity.Variables:
+			if var.Lazy:
+				lines.append(f'        if( !obj.v_{var.Name}.read() )')
+				lines.append('            success = false;')
+		lines.append('        return success;')
+		lines.append('        }')
+		lines.append('')
+
 	lines.append('    };')
 	hlp.write_lines_to_file(f"../ISD/ISD_{entity.Name}.cpp",lines)
 
 
+def CreateEntityPacketTypes():
+	lines = []
+	lines.append('// ISD Copyright (c) 2021 Ulrik Lindahl')
+	lines.append('// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE')
+	lines.append('')
+	lines.append('#pragma once')
+	lines.append('')
+	lines.append('namespace ISD')
+	lines.append('    {')
+	lines.append('    class PacketTypeRegistry;')
+	lines.append('')
+	lines.append('    // register the packet types of all the generated entities in the registry')
+	lines.append('    void register_entity_packet_types( PacketTypeRegistry &registry );')
+	lines.append('    };')
+	hlp.write_lines_to_file("../ISD/ISD_EntityPacketTypes.h",lines)
+
+	lines = []
+	lines.append('// ISD Copyright (c) 2021 Ulrik Lindahl')
+	lines.append('// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE')
+	lines.append('')
+	lines.append('#include "ISD_Types.h"')
+	lines.append('#include "ISD_PacketSerializer.h"')
+	lines.append('#include "ISD_EntityPacketTypes.h"')
+	lines.append('')
+	for entity in ents.Entities:
+		if entity.PacketType:
+			lines.append(f'#include "ISD_{entity.Name}.h"')
+	lines.append('')
+	lines.append('namespace ISD')
+	lines.append('    {')
+	lines.append('    void register_entity_packet_types( PacketTypeRegistry &registry )')
+	lines.append('        {')
+	for entity in ents.Entities:
+		if entity.PacketType:
+			lines.append(f'        registry.Register<{entity.Name}>();')
+	lines.append('        }')
+	lines.append('    };')
+	hlp.write_lines_to_file("../ISD/ISD_EntityPacketTypes.cpp",lines)
+
 def run():
 	for entity in ents.Entities:
 		CreateEntityHeader(entity)
 		CreateEntitySource(entity)
+	CreateEntityPacketTypes()
 
@@ -3,6 +3,10 @@
 
 import CodeGeneratorHelpers as hlp
 
+# bools are bit-packed, strings are variable length, and uuids are always stored big-endian, so these cannot be viewed directly in the stream
+def is_viewable_base_type( basetype ):
+	return basetype.name not in ['Bool','String','Uuid']
+
 def ISD_EntityReader_h():
 	lines = []
 	lines.append('// ISD Copyright (c) 2021 Ulrik Lindahl')
@@ -20,31 +24,95 @@ def ISD_EntityReader_h():
 	lines.append('        {')
 	lines.append('        private:')
 	lines.append('            MemoryReadStream &sstream;')
-	lines.append('            const u64 end_position;')
+	lines.append('            u64 end_position;')
 	lines.append('')
-	lines.append('            std::unique_ptr<EntityReader> active_subsection;')
+	lines.append('            EntityReader *active_subsection = nullptr;')
+	lines.append('            std::unique_ptr<EntityReader> subsection_reader; // the reader of the subsections, which is reused by each subsection')
 	lines.append('            size_t active_subsection_array_size = 0;')
 	lines.append('            size_t active_subsection_index = ~0;')
 	lines.append('            u64 active_subsection_end_pos = 0;')
 	lines.append('')
+	lines.append('            u64 section_end_position; // the end of the section which is read, where its directory ends')
+	lines.append('            bool section_was_seeked = false; // set if Seek has moved the stream in the section')
+	lines.append('')
+	lines.append('            bool tolerant_reading = false;')
+	lines.append('')
+	lines.append('            bool lazy_reading = false;')
+	lines.append('')
+	lines.append('            uint parallel_thread_count = 0;')
+	lines.append('')
+	lines.append('            // if tolerant reading is set, skip to the value of the key among the values left in the section. returns false if the value ')
+	lines.append('            // is not found (the stream is not moved), and true if it is found or tolerant reading is not set')
+	lines.append('            bool skip_to_value( ValueType VT, const char *key, const u8 key_length, const u64 small_value_size );')
+	lines.append('')
+	lines.append('            // set up the subsection reader to read a new subsection which ends at end_of_section, and set it as the active subsection')
+	lines.append('            EntityReader *begin_subsection( const u64 end_of_section );')
+	lines.append('')
 	lines.append('        public:')
 	lines.append('            EntityReader( MemoryReadStream &_sstream );')
 	lines.append('            EntityReader( MemoryReadStream &_sstream , const u64 _end_position );')
 	lines.append('')
+	lines.append('            // TolerantReading, if set, reads streams written with other versions of the entities. Values which the reader does not ')
+	lines.append('            // know of are skipped, using the size of their blocks, and optional values and sections which are missing in the stream ')
+	lines.append('            // are read as empty. Values which are not optional must still be in the stream. The setting is inherited by the sections ')
+	lines.append('            // which are read using the reader.')
+	lines.append('            void SetTolerantReading( bool value );')
+	lines.append('            bool GetTolerantReading() const;')
+	lines.append('')
+	lines.append('            // ParallelThreadCount, if more than 1, lets ReadSectionsInArray read the sections on up to that many threads, the calling thread and ')
+	lines.append('            // threads of the shared thread_pool. The sizes of the sections are scanned first, and the sections are then read concurrently, each ')
+	lines.append('            // thread with its own stream over the same data. The setting is inherited by the sections which are read using the reader, also when ')
+	lines.append('            // read in parallel, so nested sections arrays are split over the pool as well. 0 or 1 reads serially (the default). ')
+	lines.append('            void SetParallelThreadCount( uint thread_count );')
+	lines.append('            uint GetParallelThreadCount() const;')
+	lines.append('')
+	lines.append('            // LazyReading, if set, lets the generated entities skip their lazy sections (see lazy_section), which are then read on first ')
+	lines.append('            // access instead of with the entity. If not set, the lazy sections are read with the entity, like all other sections (the default). ')
+	lines.append('            // The setting is inherited by the sections which are read using the reader, and by the lazy sections.')
+	lines.append('            void SetLazyReading( bool value );')
+	lines.append('            bool GetLazyReading() const;')
+	lines.append('')
 	lines.append('            // Read a section. ')
 	lines.append('            // If the section is null, the section is directly closed, nullptr+success is returned ')
 	lines.append('            // from BeginReadSection, and EndReadSection shall not be called.')
 	lines.append('            std::tuple<EntityReader *, bool> BeginReadSection( const char *key, const u8 key_length, const bool null_object_is_allowed );')
 	lines.append('            bool EndReadSection( const EntityReader *section_reader );')
 	lines.append('')
+	lines.append('            // Skip a section without reading it, and return a view of the values of the section in the stream, so the section ')
+	lines.append('            // can be read later (see lazy_section). If the section is null, dest_values is set to nullptr and dest_values_size to 0.')
+	lines.append('            // The framing of the blocks in the section is validated, so a corrupted section fails here, and only the values are left to decode.')
+	lines.append('            bool SkipSection( const char *key, const u8 key_length, const bool null_object_is_allowed, const u8 *&dest_values, u64 &dest_values_size );')
+	lines.append('')
+	lines.append('            // the stream which is read by the reader')
+	lines.append('            const MemoryReadStream &GetStream() const { return this->sstream; }')
+	lines.append('')
 	lines.append('            // Build a sections array. ')
 	lines.append('            // If the section is null, the section array is directly closed, nullptr+0+success is returned ')
 	lines.append('            // from BeginReadSectionsArray, and EndReadSectionsArray shall not be called.')
 	lines.append('            std::tuple<EntityReader *, size_t, bool> BeginReadSectionsArray( const char *key, const u8 key_length, const bool null_object_is_allowed, std::vector<i32> *dest_index = nullptr );')
 	lines.append('            bool BeginReadSectionInArray( const EntityReader *sections_array_reader , const size_t section_index, bool *dest_section_has_data = nullptr /* if nullptr, object is not allowed to be empty*/ );')
 	lines.append('            bool EndReadSectionInArray( const EntityReader *sections_array_reader , const size_t section_index );')
+	lines.append('            // read the next section_count sections of the array, calling read_section with the index (0 to section_count-1) and reader of each section. ')
+	lines.append('            // the reader is nullptr if the section is null. if ParallelThreadCount is set, the sections are read in parallel, so read_section must be ')
+	lines.append('            // thread safe, and only write to data of the section index. an exception thrown by read_section on any thread is rethrown on the ')
+	lines.append('            // calling thread, once all threads are done.')
+	lines.append('            bool ReadSectionsInArray( const EntityReader *sections_array_reader, const size_t section_count, bool (*read_section)( void *context, size_t section_index, EntityReader *section_reader ), void *context );')
 	lines.append('            bool EndReadSectionsArray( const EntityReader *sections_array_reader );')
 	lines.append('')
+	lines.append('            // Read a run of fixed size values, which the generated entities write in a fixed layout (see EntityFixedLayout). The ')
+	lines.append('            // fingerprint of the layout is validated once, and the values are then copied from their offsets in the run to dest_values, ')
+	lines.append('            // one pointer per field. If the stream does not match the layout, false is returned, and the stream is not moved, so the ')
+	lines.append('            // values can be read one by one with Read instead.')
+	lines.append('            bool ReadFixedLayout( const EntityFixedLayout &layout, void * const *dest_values );')
+	lines.append('')
+	lines.append('            // Seek moves the stream to the value of the key, using the directory of the section (see EntityWriter::SetWriteDirectory), ')
+	lines.append('            // so the value can then be read with Read, ReadView or BeginReadSection. After a seek, the values of the section can be read ')
+	lines.append('            // in any order. Returns false, and does not move the stream, if the section has no directory or the key is not in it.')
+	lines.append('            bool Seek( const char *key, const u8 key_length );')
+	lines.append('')
+	lines.append('            // Seek to the value of the key and read it')
+	lines.append('            template <class T> bool ReadByKey( const char *key, const u8 key_length, T &value );')
+	lines.append('')
 	lines.append('            // The Read function template, specifically implemented below for all supported value types.')
 	lines.append('            template <class T> bool Read( const char *key, const u8 key_length, T &value );')
 	lines.append('')
@@ -71,6 +139,27 @@ def ISD_EntityReader_h():
 			lines.append('            template <> bool Read<optional_idx_vector<' + type_impl_name + '>>( const char *key, const u8 key_length, optional_idx_vector<' + type_impl_name + '> &value );')
 		lines.append('')
 
+	lines.append('            // The ReadView function template, specifically implemented below for all array types which can be viewed directly in the stream.')
+	lines.append('            // The views point into the stream data, and are only possible if the byte order is not flipped, and the values are aligned in memory.')
+	lines.append('            // If a view is not possible, false is returned and the stream is not moved, so the value can be read with Read instead.')
+	lines.append('            // Null (empty optional) arrays are returned as empty views.')
+	lines.append('            template <class T> bool ReadView( const char *key, const u8 key_length, T &value );')
+	lines.append('')
+
+	# print the array view types
+	for basetype in hlp.base_types:
+		if not is_viewable_base_type( basetype ):
+			continue
+		type_name = 'VT_Array_' + basetype.name
+		lines.append('            // ' + type_name )
+		for type_impl in basetype.variants:
+			if type_impl.overrides_type:
+				continue
+			type_impl_name = type_impl.implementing_type
+			lines.append('            template <> bool ReadView<array_view<' + type_impl_name + '>>( const char *key, const u8 key_length, array_view<' + type_impl_name + '> &value );')
+			lines.append('            template <> bool ReadView<idx_array_view<' + type_impl_name + '>>( const char *key, const u8 key_length, idx_array_view<' + type_impl_name + '> &value );')
+		lines.append('')
+
 	lines.append('		};')
 	lines.append('')
 	lines.append('	// Read method. Specialized for all supported value types.')
@@ -78,6 +167,19 @@ def ISD_EntityReader_h():
 	lines.append('		{')
 	lines.append('		static_assert(false, "Error: EntityReader::Read template: The value type T cannot be serialized.");')
 	lines.append('		}')
+	lines.append('')
+	lines.append('	template <class T> bool EntityReader::ReadByKey( const char *key, const u8 key_length, T &value )')
+	lines.append('		{')
+	lines.append('		if( !this->Seek( key, key_length ) )')
+	lines.append('			return false;')
+	lines.append('		return this->Read<T>( key, key_length, value );')
+	lines.append('		}')
+	lines.append('')
+	lines.append('	// ReadView method. Specialized for all supported array view types.')
+	lines.append('	template <class T> bool EntityReader::ReadView( const char *key, const u8 key_length, T &value )')
+	lines.append('		{')
+	lines.append('		static_assert(false, "Error: EntityReader::ReadView template: The value type T cannot be viewed.");')
+	lines.append('		}')
 	lines.append('	};')
 	hlp.write_lines_to_file("../ISD/ISD_EntityReader.h",lines)
 
@@ -95,11 +197,11 @@ def ISD_EntityReader_cpp():
 	lines.append('')
 	lines.append('namespace ISD')
 	lines.append('	{')
-	lines.append('	EntityReader::EntityReader( MemoryReadStream &_sstream ) : sstream( _sstream ) , end_position( _sstream.GetSize() )')
+	lines.append('	EntityReader::EntityReader( MemoryReadStream &_sstream ) : sstream( _sstream ) , end_position( _sstream.GetSize() ) , section_end_position( _sstream.GetSize() )')
 	lines.append('		{')
 	lines.append('		}')
 	lines.append('')
-	lines.append('	EntityReader::EntityReader( MemoryReadStream &_sstream , const u64 _end_position ) : sstream( _sstream ) , end_position( _end_position )')
+	lines.append('	EntityReader::EntityReader( MemoryReadStream &_sstream , const u64 _end_position ) : sstream( _sstream ) , end_position( _end_position ) , section_end_position( _end_position )')
 	lines.append('		{')
 	lines.append('		}')
 	lines.append('')
@@ -113,6 +215,12 @@ def ISD_EntityReader_cpp():
 			item_type = str(type_impl.item_type)
 			num_items_per_object = str(type_impl.num_items_per_object)
 
+			# the size of the value in small blocks, strings are stored in large blocks
+			if basetype.name == 'String':
+				small_value_size = '0'
+			else:
+				small_value_size = f'sizeof({item_type})*{num_items_per_object}'
+
 			if type_impl.overrides_type:
 
 				lines.append(f'	// {implementing_type}: using {item_type} to read')
@@ -236,6 +344,7 @@ def ISD_EntityReader_cpp():
 				lines.append(f'	// {type_name}: {implementing_type}')
 				lines.append(f'	template <> bool EntityReader::Read<{implementing_type}>( const char *key, const u8 key_length, {implementing_type} &dest_variable )')
 				lines.append(f'		{{')
+				lines.append(f'		this->skip_to_value( ValueType::{type_name}, key, key_length, {small_value_size} );')
 				lines.append(f'		reader_status status = read_single_item<ValueType::{type_name},{implementing_type}>(this->sstream, key, key_length, false, &(dest_variable) );')
 				lines.append(f'		return status != reader_status::fail;')
 				lines.append(f'		}}')
@@ -244,6 +353,11 @@ def ISD_EntityReader_cpp():
 				lines.append(f'	// {type_name}: optional_value<{implementing_type}>' )
 				lines.append(f'	template <> bool EntityReader::Read<optional_value<{implementing_type}>>( const char *key, const u8 key_length, optional_value<{implementing_type}> &dest_variable )')
 				lines.append(f'		{{')
+				lines.append(f'		if( !this->skip_to_value( ValueType::{type_name}, key, key_length, {small_value_size} ) )')
+				lines.append(f'			{{')
+				lines.append(f'			dest_variable.reset();')
+				lines.append(f'			return true;')
+				lines.append(f'			}}')
 				lines.append(f'		dest_variable.set();')
 				lines.append(f'		reader_status status = read_single_item<ValueType::{type_name},{implementing_type}>(this->sstream, key, key_length, true, &(dest_variable.value()) );')
 				lines.append(f'		if( status == reader_status::success_empty )')
@@ -255,6 +369,7 @@ def ISD_EntityReader_cpp():
 				lines.append(f'	// {type_name}: std::vector<{implementing_type}>' )
 				lines.append(f'	template <> bool EntityReader::Read<std::vector<{implementing_type}>>( const char *key, const u8 key_length, std::vector<{implementing_type}> &dest_variable )')
 				lines.append(f'		{{')
+				lines.append(f'		this->skip_to_value( ValueType::{array_type_name}, key, key_length, 0 );')
 				lines.append(f'		reader_status status = read_array<ValueType::{array_type_name},{implementing_type}>(this->sstream, key, key_length, false, &(dest_variable), nullptr );')
 				lines.append(f'		return status != reader_status::fail;')
 				lines.append(f'		}}')
@@ -263,6 +378,11 @@ def ISD_EntityReader_cpp():
 				lines.append(f'	// {type_name}: optional_vector<{implementing_type}>' )
 				lines.append(f'	template <> bool EntityReader::Read<optional_vector<{implementing_type}>>( const char *key, const u8 key_length, optional_vector<{implementing_type}> &dest_variable )')
 				lines.append(f'		{{')
+				lines.append(f'		if( !this->skip_to_value( ValueType::{array_type_name}, key, key_length, 0 ) )')
+				lines.append(f'			{{')
+				lines.append(f'			dest_variable.reset();')
+				lines.append(f'			return true;')
+				lines.append(f'			}}')
 				lines.append(f'		dest_variable.set();')
 				lines.append(f'		reader_status status = read_array<ValueType::{array_type_name},{implementing_type}>(this->sstream, key, key_length, true, &(dest_variable.values()), nullptr );')
 				lines.append(f'		if( status == reader_status::success_empty )')
@@ -274,6 +394,7 @@ def ISD_EntityReader_cpp():
 				lines.append(f'	// {type_name}: idx_vector<{implementing_type}>' )
 				lines.append(f'	template <> bool EntityReader::Read<idx_vector<{implementing_type}>>( const char *key, const u8 key_length, idx_vector<{implementing_type}> &dest_variable )')
 				lines.append(f'		{{')
+				lines.append(f'		this->skip_to_value( ValueType::{array_type_name}, key, key_length, 0 );')
 				lines.append(f'		reader_status status = read_array<ValueType::{array_type_name},{implementing_type}>(this->sstream, key, key_length, false, &(dest_variable.values()), &(dest_variable.index()) );')
 				lines.append(f'		return status != reader_status::fail;')
 				lines.append(f'		}}')
@@ -282,6 +403,11 @@ def ISD_EntityReader_cpp():
 				lines.append(f'	// {type_name}: optional_idx_vector<{implementing_type}>' )
 				lines.append(f'	template <> bool EntityReader::Read<optional_idx_vector<{implementing_type}>>( const char *key, const u8 key_length, optional_idx_vector<{implementing_type}> &dest_variable )')
 				lines.append(f'		{{')
+				lines.append(f'		if( !this->skip_to_value( ValueType::{array_type_name}, key, key_length, 0 ) )')
+				lines.append(f'			{{')
+				lines.append(f'			dest_variable.reset();')
+				lines.append(f'			return true;')
+				lines.append(f'			}}')
 				lines.append(f'		dest_variable.set();')
 				lines.append(f'		reader_status status = read_array<ValueType::{array_type_name},{implementing_type}>(this->sstream, key, key_length, true, &(dest_variable.values()), &(dest_variable.index()) );')
 				lines.append(f'		if( status == reader_status::success_empty )')
@@ -289,7 +415,33 @@ def ISD_EntityReader_cpp():
 				lines.append(f'		return status != reader_status::fail;')
 				lines.append(f'		}}')
 				lines.append(f'')
-				
+
+	# print the array view types
+	for basetype in hlp.base_types:
+		if not is_viewable_base_type( basetype ):
+			continue
+		array_type_name = 'VT_Array_' + basetype.name
+		for type_impl in basetype.variants:
+			if type_impl.overrides_type:
+				continue
+			implementing_type = str(type_impl.implementing_type)
+
+			lines.append(f'	// {array_type_name}: array_view<{implementing_type}>' )
+			lines.append(f'	template <> bool EntityReader::ReadView<array_view<{implementing_type}>>( const char *key, const u8 key_length, array_view<{implementing_type}> &dest_variable )')
+			lines.append(f'		{{')
+			lines.append(f'		this->skip_to_value( ValueType::{array_type_name}, key, key_length, 0 );')
+			lines.append(f'		return read_array_view<ValueType::{array_type_name},{implementing_type}>(this->sstream, key, key_length, &(dest_variable), nullptr );')
+			lines.append(f'		}}')
+			lines.append(f'')
+
+			lines.append(f'	// {array_type_name}: idx_array_view<{implementing_type}>' )
+			lines.append(f'	template <> bool EntityReader::ReadView<idx_array_view<{implementing_type}>>( const char *key, const u8 key_length, idx_array_view<{implementing_type}> &dest_variable )')
+			lines.append(f'		{{')
+			lines.append(f'		this->skip_to_value( ValueType::{array_type_name}, key, key_length, 0 );')
+			lines.append(f'		return read_array_view<ValueType::{array_type_name},{implementing_type}>(this->sstream, key, key_length, &(dest_variable.values()), &(dest_variable.index()) );')
+			lines.append(f'		}}')
+			lines.append(f'')
+
 	lines.append('	};')
 	hlp.write_lines_to_file("../ISD/ISD_EntityReader.cpp",lines)
 
@@ -20,17 +20,54 @@ def ISD_EntityWriter_h():
 	lines.append('        {')
 	lines.append('        private:')
 	lines.append('            MemoryWriteStream &dstream;')
-	lines.append('            const u64 start_position;')
+	lines.append('            u64 start_position;')
 	lines.append('')
-	lines.append('            std::unique_ptr<EntityWriter> active_subsection;')
+	lines.append('            EntityWriter *active_subsection = nullptr;')
+	lines.append('            std::unique_ptr<EntityWriter> subsection_writer; // the writer of the subsections, which is reused by each subsection')
 	lines.append('')
 	lines.append('            size_t active_array_size = 0;')
 	lines.append('            size_t active_array_index = ~0;')
 	lines.append('            u64 active_array_index_start_position = 0;')
 	lines.append('')
+	lines.append('            u8 array_payload_alignment = 0;')
+	lines.append('')
+	lines.append('            bool write_directory = false;')
+	lines.append('            std::vector<std::pair<u64,u64>> directory_entries; // the key hashes and stream positions of the values written by the writer')
+	lines.append('')
+	lines.append('            uint parallel_thread_count = 0;')
+	lines.append('')
+	lines.append('            // add the value which is written at the current position to the directory, if directories are written')
+	lines.append('            void add_directory_entry( const char *key, const u8 key_length );')
+	lines.append('')
+	lines.append('            // set up the subsection writer to write a new subsection, and set it as the active subsection')
+	lines.append('            EntityWriter *begin_subsection();')
+	lines.append('')
+	lines.append('            // write the object to a measure only stream, using the same settings as the writer')
+	lines.append('            bool measure_write( bool (*write_function)( const void *object, EntityWriter &writer ), const void *object, u64 &dest_size, std::vector<u64> *dest_block_sizes ) const;')
+	lines.append('')
 	lines.append('        public:')
 	lines.append('            EntityWriter( MemoryWriteStream &_dstream );')
 	lines.append('')
+	lines.append('            // ArrayPayloadAlignment, if set, pads the values of arrays to start at an aligned position (such as 16 or 64 bytes) relative to the start ')
+	lines.append('            // of the stream, so that they can be accessed directly in the stream. The alignment must be a power of 2, or 0 for no padding (the default).')
+	lines.append('            // The setting is inherited by the sections which are written using the writer. ')
+	lines.append('            bool SetArrayPayloadAlignment( u8 alignment );')
+	lines.append('            u8 GetArrayPayloadAlignment() const;')
+	lines.append('')
+	lines.append('            // WriteDirectory, if set, ends each section with a directory of the keys of its values, so readers can read a value directly ')
+	lines.append('            // with EntityReader::Seek, without reading the values before it. The setting is inherited by the sections which are written ')
+	lines.append('            // using the writer. Sections write their directory when they end, call WriteDirectory after the last value for the top level values.')
+	lines.append('            void SetWriteDirectory( bool value );')
+	lines.append('            bool GetWriteDirectory() const;')
+	lines.append('            bool WriteDirectory();')
+	lines.append('')
+	lines.append('            // ParallelThreadCount, if more than 1, lets WriteSectionsInArray encode the sections on up to that many threads, the calling thread and ')
+	lines.append('            // threads of the shared thread_pool. The sections are encoded into separate streams which are then appended in order, so the data is ')
+	lines.append('            // identical to the data of a serial write. The setting is inherited by the sections which are written using the writer, also when written ')
+	lines.append('            // in parallel, so nested sections arrays are split over the pool as well. 0 or 1 writes serially (the default). ')
+	lines.append('            void SetParallelThreadCount( uint thread_count );')
+	lines.append('            uint GetParallelThreadCount() const;')
+	lines.append('')
 	lines.append('            // Build a section. ')
 	lines.append('            EntityWriter *BeginWriteSection( const char *key, const u8 key_length );')
 	lines.append('            bool EndWriteSection( const EntityWriter *section_writer );')
@@ -40,9 +77,23 @@ def ISD_EntityWriter_h():
 	lines.append('            EntityWriter *BeginWriteSectionsArray( const char *key, const u8 key_length, const size_t array_size, const std::vector<i32> *index = nullptr );')
 	lines.append('            bool BeginWriteSectionInArray( const EntityWriter *sections_array_writer , const size_t section_index );')
 	lines.append('            bool EndWriteSectionInArray( const EntityWriter *sections_array_writer , const size_t section_index );')
+	lines.append('            // write the next section_count sections of the array, calling write_section with the index (0 to section_count-1) and writer of each section. ')
+	lines.append('            // if ParallelThreadCount is set, the sections are written in parallel, so write_section must be thread safe. The sections are written serially ')
+	lines.append('            // if ArrayPayloadAlignment is set (as the padding depends on the position in the stream), or if the stream measures or has a list of BlockSizes.')
+	lines.append('            // an exception thrown by write_section on any thread is rethrown on the calling thread, once all threads are done.')
+	lines.append('            bool WriteSectionsInArray( const EntityWriter *sections_array_writer, const size_t section_count, bool (*write_section)( const void *context, size_t section_index, EntityWriter &section_writer ), const void *context );')
 	lines.append('            bool EndWriteSectionsArray( const EntityWriter *sections_array_writer );')
 	lines.append('            bool WriteNullSectionsArray( const char *key, const u8 key_length );')
 	lines.append('')
+	lines.append('            // MeasureWrite computes the size of an object (an entity or a template with an MF class) if it is written by the writer at the current ')
+	lines.append('            // position of the stream, with the settings of the writer. If dest_block_sizes is set, it receives the sizes of all blocks of the object, which ')
+	lines.append('            // can be set on the stream with MemoryWriteStream::SetBlockSizes to write the object in one forward pass, without patching the block sizes.')
+	lines.append('            // The object is measured by running its Write on a measure only stream, which copies no data. Computing the sizes field by field would')
+	lines.append('            // have to repeat the array padding, directories and fixed layouts of Write, which depend on the position and the settings of the writer,')
+	lines.append('            // so the sizes would drift from the written data. The cost is that the object is walked twice, and lazy sections are read, as by Write.')
+	lines.append('            // MF::MeasureSerializedSize of the entities and templates calls MeasureWrite.')
+	lines.append('            template <class T> bool MeasureWrite( const T &object, u64 &dest_size, std::vector<u64> *dest_block_sizes = nullptr ) const;')
+	lines.append('')
 	lines.append('            // The Write function template, specifically implemented below for all supported value types.')
 	lines.append('            template <class T> bool Write( const char *key, const u8 key_length, const T &value );')
 	lines.append('')
@@ -76,6 +127,11 @@ def ISD_EntityWriter_h():
 	lines.append('		{')
 	lines.append('		static_assert(false, "Error: EntityWriter::Write template: The value type T cannot be serialized.");')
 	lines.append('		}')
+	lines.append('')
+	lines.append('	template <class T> bool EntityWriter::MeasureWrite( const T &object, u64 &dest_size, std::vector<u64> *dest_block_sizes ) const')
+	lines.append('		{')
+	lines.append('		return this->measure_write( []( const void *object, EntityWriter &writer ) { return T::MF::Write( *(const T *)object, writer ); }, &object, dest_size, dest_block_sizes );')
+	lines.append('		}')
 	lines.append('	};')
 	hlp.write_lines_to_file("../ISD/ISD_EntityWriter.h",lines)
 
@@ -183,6 +239,7 @@ def ISD_EntityWriter_cpp():
 				lines.append(f'	// {type_name}: {implementing_type}')
 				lines.append(f'	template <> bool EntityWriter::Write<{implementing_type}>( const char *key, const u8 key_length, const {implementing_type} &src_variable )')
 				lines.append(f'		{{')
+				lines.append(f'		this->add_directory_entry( key, key_length );')
 				lines.append(f'		return write_single_value<ValueType::{type_name},{implementing_type}>( this->dstream, key, key_length, &src_variable );')
 				lines.append(f'		}}')
 				lines.append(f'')
@@ -191,6 +248,7 @@ def ISD_EntityWriter_cpp():
 				lines.append(f'	template <> bool EntityWriter::Write<optional_value<{implementing_type}>>( const char *key, const u8 key_length, const optional_value<{implementing_type}> &src_variable )')
 				lines.append(f'		{{')
 				lines.append(f'		const {implementing_type} *p_src_variable = (src_variable.has_value()) ? &(src_variable.value()) : nullptr;')
+				lines.append(f'		this->add_directory_entry( key, key_length );')
 				lines.append(f'		return write_single_value<ValueType::{type_name},{implementing_type}>( this->dstream, key, key_length, p_src_variable );')
 				lines.append(f'		}}')
 				lines.append(f'')
@@ -198,7 +256,8 @@ def ISD_EntityWriter_cpp():
 				lines.append(f'	//  {array_type_name}: std::vector<{implementing_type}>' )
 				lines.append(f'	template <> bool EntityWriter::Write<std::vector<{implementing_type}>>( const char *key, const u8 key_length, const std::vector<{implementing_type}> &src_variable )')
 				lines.append(f'		{{')
-				lines.append(f'		return write_array<ValueType::{array_type_name},{implementing_type}>(this->dstream, key, key_length, &src_variable , nullptr );')
+				lines.append(f'		this->add_directory_entry( key, key_length );')
+				lines.append(f'		return write_array<ValueType::{array_type_name},{implementing_type}>(this->dstream, key, key_length, &src_variable , nullptr, this->array_payload_alignment );')
 				lines.append(f'		}}')
 				lines.append(f'')
 				
@@ -206,14 +265,16 @@ def ISD_EntityWriter_cpp():
 				lines.append(f'	template <> bool EntityWriter::Write<optional_vector<{implementing_type}>>( const char *key, const u8 key_length, const optional_vector<{implementing_type}> &src_variable )')
 				lines.append(f'		{{')
 				lines.append(f'		const std::vector<{implementing_type}> *p_src_variable = (src_variable.has_value()) ? &(src_variable.values()) : nullptr;')
-				lines.append(f'		return write_array<ValueType::{array_type_name},{implementing_type}>(this->dstream, key, key_length, p_src_variable , nullptr );')
+				lines.append(f'		this->add_directory_entry( key, key_length );')
+				lines.append(f'		return write_array<ValueType::{array_type_name},{implementing_type}>(this->dstream, key, key_length, p_src_variable , nullptr, this->array_payload_alignment );')
 				lines.append(f'		}}')
 				lines.append(f'')
 				
 				lines.append(f'	//  {array_type_name}: idx_vector<{implementing_type}>' )
 				lines.append(f'	template <> bool EntityWriter::Write<idx_vector<{implementing_type}>>( const char *key, const u8 key_length, const idx_vector<{implementing_type}> &src_variable )')
 				lines.append(f'		{{')
-				lines.append(f'		return write_array<ValueType::{array_type_name},{implementing_type}>(this->dstream, key, key_length, &(src_variable.values()) , &(src_variable.index()) );')
+				lines.append(f'		this->add_directory_entry( key, key_length );')
+				lines.append(f'		return write_array<ValueType::{array_type_name},{implementing_type}>(this->dstream, key, key_length, &(src_variable.values()) , &(src_variable.index()), this->array_payload_alignment );')
 				lines.append(f'		}}')
 				lines.append(f'')
 				
@@ -222,7 +283,8 @@ def ISD_EntityWriter_cpp():
 				lines.append(f'		{{')
 				lines.append(f'		const std::vector<{implementing_type}> *p_src_values = (src_variable.has_value()) ? &(src_variable.values()) : nullptr;')
 				lines.append(f'		const std::vector<i32> *p_src_index = (src_variable.has_value()) ? &(src_variable.index()) : nullptr;')
-				lines.append(f'		return write_array<ValueType::{array_type_name},{implementing_type}>(this->dstream, key, key_length, p_src_values , p_src_index );')
+				lines.append(f'		this->add_directory_entry( key, key_length );')
+				lines.append(f'		return write_array<ValueType::{array_type_name},{implementing_type}>(this->dstream, key, key_length, p_src_values , p_src_index, this->array_payload_alignment );')
 				lines.append(f'		}}')
 				lines.append(f'')
 				
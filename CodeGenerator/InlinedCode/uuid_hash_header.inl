@@ -2,6 +2,28 @@
 #ifdef _WIN32
 #define __INLINE_ISEQUAL_GUID
 #include <guiddef.h>
+#else
+// define GUID with the same layout as on windows
+#ifndef GUID_DEFINED
+#define GUID_DEFINED
+struct GUID
+	{
+	std::uint32_t Data1;
+	std::uint16_t Data2;
+	std::uint16_t Data3;
+	std::uint8_t Data4[8];
+	};
+
+inline bool operator==( const GUID &Left, const GUID &Right ) 
+	{
+	return memcmp( &Left, &Right, sizeof( GUID ) ) == 0;
+	};
+
+inline bool operator!=( const GUID &Left, const GUID &Right ) 
+	{
+	return memcmp( &Left, &Right, sizeof( GUID ) ) != 0;
+	};
+#endif//GUID_DEFINED
 #endif//_WIN32
 
 // define UUID
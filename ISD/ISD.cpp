@@ -2,181 +2,967 @@
 // Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
 
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#else
+#include <sys/stat.h>
+#include <cstdlib>
+#endif
 
+#include <algorithm>
 #include <iostream>
-#include <locale>      
+#include <locale>
 
 #include "ISD.h"
 #include "ISD_MemoryReadStream.h"
-#include "ISD_SHA256.h"
+#include "ISD_BlobHash.h"
+#include "ISD_EntityDependencies.h"
 
 
 using namespace ISD;
 using std::pair;
 using std::make_pair;
 
-Status EntityLoader::Initialize( const std::string &path )
+#ifdef _WIN32
+static const char path_separator = '\\';
+#else
+static const char path_separator = '/';
+#endif
+
+MemoryReadStream Entity::GetReadStream( bool flip_byte_order ) const
+	{
+	MemoryReadStream sstream( this->Data, this->DataSize, flip_byte_order );
+	sstream.SetDataOwner( this->shared_from_this() );
+	return sstream;
+	}
+
+Status Entity::VerifyRange( u64 offset, u64 size ) const
+	{
+	if( !this->Verifier )
+		{
+		if( offset > this->DataSize || size > this->DataSize - offset )
+			{
+			return Status::EParam;
+			}
+		return Status::Ok;
+		}
+	return this->Verifier->VerifyRange( offset, size );
+	}
+
+EntityLoader::EntityLoader() : PrefetchedBytes( 0 )
+	{
+	// when a prefetched entity is evicted before it is requested, it no longer counts as prefetched
+	this->LoadedEntities.SetEvictionCallback( [this]( const Entity &entity ) { this->ClaimPrefetchedEntity( entity.GetUUID() ); } );
+	}
+
+EntityLoader::~EntityLoader()
+	{
+	// stop the workers, and cancel all the queued and in flight loads
+	std::vector<pair<UUID, std::vector<load_callback>>> cancelled_callbacks;
+		{
+		std::lock_guard<std::mutex> guard( this->LoadQueueMutex );
+		this->StopWorkers = true;
+		for( uint priority = 0; priority < LoadPriorityCount; ++priority )
+			{
+			this->LoadQueues[priority].clear();
+			this->ReadQueues[priority].clear();
+			}
+		for( auto it = this->ActiveLoads.begin(); it != this->ActiveLoads.end(); )
+			{
+			active_load &load = *it->second;
+			load.cancelled = true;
+			cancelled_callbacks.emplace_back( it->first, std::move( load.callbacks ) );
+			load.callbacks.clear();
+
+			// the loads in flight are removed by the workers when they stop
+			if( load.stage == load_stage::queued_read || load.stage == load_stage::queued_load )
+				{
+				it = this->ActiveLoads.erase( it );
+				}
+			else
+				{
+				++it;
+				}
+			}
+		}
+	this->LoadQueueCondition.notify_all();
+	this->ReadQueueCondition.notify_all();
+	for( const auto &cancelled : cancelled_callbacks )
+		{
+		for( const load_callback &callback : cancelled.second )
+			{
+			callback( cancelled.first, Status::ECancelled, nullptr );
+			}
+		}
+
+	// wait for the workers to stop
+	if( this->IOThread.joinable() )
+		{
+		this->IOThread.join();
+		}
+	for( std::thread &worker : this->WorkerThreads )
+		{
+		worker.join();
+		}
+	}
+
+Status EntityLoader::Initialize( const std::string &path, uint worker_thread_count, LoadMode load_mode )
 	{
 	if( !this->Path.empty() )
 		{
 		return Status::EAlreadyInitialized;
 		}
+	this->Mode = load_mode;
 
+#ifdef _WIN32
 	std::wstring wpath = widen( path );
 
 	// make path absolute
 	wpath = full_path( wpath );
 
-	// make sure it is a directory 
+	// make sure it is a directory
 	DWORD file_attributes = GetFileAttributesW( wpath.c_str() );
-	if( file_attributes != FILE_ATTRIBUTE_DIRECTORY )
+	if( file_attributes == INVALID_FILE_ATTRIBUTES || (file_attributes & FILE_ATTRIBUTE_DIRECTORY) == 0 )
+		{
+		return Status::EParam; // invalid path
+		}
+
+	this->Path = narrow( wpath );
+#else
+	// make path absolute
+	char *absolute_path = ::realpath( path.c_str(), nullptr );
+	if( !absolute_path )
 		{
 		return Status::EParam; // invalid path
 		}
+	std::string apath = absolute_path;
+	free( absolute_path );
 
-	this->Path = wpath;
+	// make sure it is a directory
+	struct stat path_stat = {};
+	if( ::stat( apath.c_str(), &path_stat ) != 0 || !S_ISDIR( path_stat.st_mode ) )
+		{
+		return Status::EParam; // invalid path
+		}
+
+	this->Path = apath;
+#endif
+
+	// load the index of the store, if it has one
+	const std::string index_file_path = this->Path + path_separator + EntityStoreIndexFileName;
+	Status index_status = this->StoreIndex.Load( index_file_path );
+	if( index_status == Status::Ok )
+		{
+		this->HasStoreIndex = true;
+		}
+	else if( index_status != Status::ECantOpen )
+		{
+		ISDErrorLog << "The index file " << index_file_path << " can not be loaded, and is ignored" << ISDErrorLogEnd;
+		}
+
+	// set up the batched reads. if io_uring is used, the reads are done on the IO thread
+	if( this->Mode == LoadMode::Read )
+		{
+		Status status = this->BatchReader.Initialize();
+		if( status != Status::Ok )
+			{
+			return status;
+			}
+		if( this->BatchReader.IsUsingIoUring() )
+			{
+			this->IOThread = std::thread( &EntityLoader::IOThreadProcedure, this );
+			}
+		}
+
+	// start the workers
+	if( worker_thread_count == 0 )
+		{
+		worker_thread_count = std::max( std::thread::hardware_concurrency(), 1u );
+		}
+	for( uint i = 0; i < worker_thread_count; ++i )
+		{
+		this->WorkerThreads.emplace_back( &EntityLoader::WorkerThreadProcedure, this );
+		}
 
 	return Status::Ok;
 	}
 
-struct LoadThreadParams
+std::string EntityLoader::GetEntityFilePath( const UUID &uuid ) const
 	{
-	UUID uuid; // id of entity to load
-	std::wstring path; // root path of the entities on disk
-	};
+	// the files are sharded in two levels of directories
+	return this->Path + path_separator + entity_store_relative_path( uuid );
+	}
 
-static DWORD WINAPI LoadThreadProcedure( _In_ LPVOID lpParameter )
+std::string EntityLoader::GetFlatEntityFilePath( const UUID &uuid ) const
 	{
-	const uint hash_size = 32;
-
-	// get the params
-	LoadThreadParams *params = (LoadThreadParams *)lpParameter;
-	UUID uuid = params->uuid;
-	std::wstring path = params->path;
-	free( params );
+	// stores written before the sharding have the files directly in the root, which is tried if the sharded file is missing
+	return this->Path + path_separator + entity_store_flat_relative_path( uuid );
+	}
 
-	// create the file name from the uuid
-	u8 top_byte = (uuid.Data1 >> 24) & 0xff;
-	std::wstring dir_name = widen(value_to_hex_string( top_byte ));
-	std::wstring file_name = widen(value_to_hex_string( uuid )) + L".dat";
-	std::wstring file_path = path + L"\\" + file_name;
+Status EntityLoader::AddPackFile( const std::string &pack_file_path )
+	{
+	if( this->Path.empty() )
+		{
+		return Status::ENotInitialized;
+		}
 
-	// open the file
-	HANDLE file_handle = ::CreateFileW( file_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_READONLY, nullptr );
-	if( file_handle == INVALID_HANDLE_VALUE )
+	std::unique_ptr<PackFile> pack( new PackFile() );
+	Status status = pack->Open( pack_file_path );
+	if( status != Status::Ok )
 		{
-		// failed to open the file
-		return (DWORD)Status::ECantOpen;
+		return status;
 		}
+	this->Packs.push_back( std::move( pack ) );
+	return Status::Ok;
+	}
 
-	// get the size
-	LARGE_INTEGER dfilesize = {};
-	if( !::GetFileSizeEx( file_handle, &dfilesize ) )
+PackFile *EntityLoader::FindPackedEntity( const UUID &uuid, entity_index_entry &dest_entry, u64 &dest_entry_index ) const
+	{
+	for( const std::unique_ptr<PackFile> &pack : this->Packs )
 		{
-		// failed to get the size
-		return (DWORD)Status::ECantOpen;
+		if( pack->Find( uuid, dest_entry, dest_entry_index ) )
+			{
+			return pack.get();
+			}
 		}
-	u64 total_bytes_to_read = dfilesize.QuadPart;
+	return nullptr;
+	}
 
-	// cant be less in size than the size of the hash at the end
-	if( total_bytes_to_read < hash_size )
+EntityLoader::load_stage EntityLoader::GetFirstLoadStage( const UUID &uuid ) const
+	{
+	if( !this->IOThread.joinable() )
 		{
-		return (DWORD)Status::ECorrupted;
+		return load_stage::queued_load;
 		}
+	entity_index_entry entry;
+	u64 entry_index = 0;
+	return this->FindPackedEntity( uuid, entry, entry_index ) ? load_stage::queued_load : load_stage::queued_read;
+	}
 
-	// read in all of the file
-	std::vector<u8> allocation;
-	allocation.resize( total_bytes_to_read );
-	if( allocation.size() != total_bytes_to_read )
+Status EntityLoader::FindStoredEntity( const UUID &uuid, entity_index_entry &dest_entry ) const
+	{
+	if( this->Path.empty() )
 		{
-		// failed to allocate the memory
-		return (DWORD)Status::ECantAllocate;
+		return Status::ENotInitialized;
 		}
-	u8 *buffer = allocation.data();
 
-	u64 bytes_read = 0;
-	while( bytes_read < total_bytes_to_read )
+	u64 entry_index = 0;
+	if( this->FindPackedEntity( uuid, dest_entry, entry_index ) )
 		{
-		// check how much to read and cap each read at UINT_MAX
-		u64 bytes_left = total_bytes_to_read - bytes_read;
-		u32 bytes_to_read_this_time = UINT_MAX;
-		if( bytes_left < UINT_MAX )
-			bytes_to_read_this_time = (u32)bytes_left;
+		return Status::Ok;
+		}
 
-		// read in bytes into the memory allocation
-		DWORD bytes_that_were_read = 0;
-		if( !::ReadFile( file_handle, &buffer[bytes_read], bytes_to_read_this_time, &bytes_that_were_read, nullptr ) )
+	// entities which are not in the index may have been added after the index was built, so they are stat'ed, as LoadEntity 
+	// loads them from their files as well
+	if( this->HasStoreIndex )
+		{
+		const entity_index_entry *entry = this->StoreIndex.Find( uuid );
+		if( entry )
 			{
-			// failed to read
-			return (DWORD)Status::ECantRead;
+			dest_entry = *entry;
+			return Status::Ok;
 			}
+		}
 
-		// update number of bytes that were read
-		bytes_read += bytes_that_were_read;
+	dest_entry = entity_index_entry();
+	dest_entry.uuid = uuid;
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA file_attributes = {};
+	if( !::GetFileAttributesExW( widen( this->GetEntityFilePath( uuid ) ).c_str(), GetFileExInfoStandard, &file_attributes )
+		&& !::GetFileAttributesExW( widen( this->GetFlatEntityFilePath( uuid ) ).c_str(), GetFileExInfoStandard, &file_attributes ) )
+		{
+		return Status::ECantOpen;
+		}
+	dest_entry.size = ( (u64)file_attributes.nFileSizeHigh << 32 ) | file_attributes.nFileSizeLow;
+#else
+	struct stat file_stat = {};
+	if( ::stat( this->GetEntityFilePath( uuid ).c_str(), &file_stat ) != 0
+		&& ::stat( this->GetFlatEntityFilePath( uuid ).c_str(), &file_stat ) != 0 )
+		{
+		return Status::ECantOpen;
 		}
+	dest_entry.size = (u64)file_stat.st_size;
+#endif
+	return Status::Ok;
+	}
 
-	::CloseHandle( file_handle );
+void EntityLoader::SetPrefetchPolicy( uint max_depth, u64 max_bytes, const package_ref_resolver &resolver )
+	{
+	this->PrefetchMaxDepth = resolver ? max_depth : 0;
+	this->PrefetchMaxBytes = max_bytes;
+	this->PrefetchResolver = resolver;
+	}
 
-	// calculate the sha256 hash on the data, and make sure it compares correctly with the hash
-	const u64 data_size = total_bytes_to_read - hash_size;
-	SHA256 sha( buffer, data_size );
-	u8 digest[hash_size];
-	sha.GetDigest( digest );
-	if( memcmp( digest, &buffer[data_size], hash_size ) != 0 )
+Status EntityLoader::SetVerifiedFileCache( const std::string &cache_file_path )
+	{
+	return this->VerifiedFiles.SetCacheFile( cache_file_path );
+	}
+
+Status EntityLoader::LoadPackedEntity( const UUID &uuid, active_load &load, PackFile &pack, u64 entry_index, const entity_index_entry &entry, std::unique_ptr<Entity> &dest_entity, uint verify_thread_count )
+	{
+	// the blob must have the trailer of the table entry
+	const u8 *blob = pack.GetBlob( entry );
+	std::unique_ptr<BlobVerifier> verifier( new BlobVerifier() );
+	Status status = verifier->Setup( blob, entry.size );
+	if( status != Status::Ok )
+		{
+		return status;
+		}
+	if( verifier->GetRootHash() != entry.root_hash )
 		{
-		// sha hash does not compare correctly, file is corrupted
-		return (DWORD)Status::ECorrupted;
+		return Status::ECorrupted;
 		}
+	const u64 data_size = verifier->GetDataSize();
 
-	// set up a memory stream and deserializer
-	MemoryReadStream is( buffer, data_size, false );
+	// verify the data, the first time the blob is loaded, unless it is verified on access
+	if( pack.IsBlobVerified( entry_index ) )
+		{
+		verifier.reset();
+		}
+	else if( !this->VerifyOnAccess )
+		{
+		if( load.cancelled )
+			{
+			return Status::ECancelled;
+			}
+		status = verifier->VerifyAll( verify_thread_count );
+		if( status != Status::Ok )
+			{
+			// the hash does not compare correctly, pack is corrupted
+			return status;
+			}
+		pack.SetBlobVerified( entry_index );
+		verifier.reset();
+		}
+
+	// the entity shares the mapping of the pack, and keeps the verifier if the data is verified on access
+	dest_entity = std::unique_ptr<Entity>( new Entity( uuid, pack.GetMapping(), blob, data_size, std::move( verifier ) ) );
+
+	return Status::Ok;
+	}
+
+Status EntityLoader::LoadMappedEntity( const UUID &uuid, active_load &load, std::unique_ptr<Entity> &dest_entity, uint verify_thread_count )
+	{
+	std::shared_ptr<MappedFile> mapping = std::make_shared<MappedFile>();
+	Status status = mapping->Open( this->GetEntityFilePath( uuid ) );
+	if( status == Status::ECantOpen )
+		{
+		status = mapping->Open( this->GetFlatEntityFilePath( uuid ) );
+		}
+	if( status != Status::Ok )
+		{
+		return status;
+		}
 
+	// read the hash trailer, and verify the data, unless this version of the file is already verified, or it is verified on access
+	std::unique_ptr<BlobVerifier> verifier( new BlobVerifier() );
+	status = verifier->Setup( mapping->GetData(), mapping->GetSize() );
+	if( status != Status::Ok )
+		{
+		return status;
+		}
+	const u64 data_size = verifier->GetDataSize();
+	if( this->VerifiedFiles.IsVerified( mapping->GetIdentity(), verifier->GetRootHash() ) )
+		{
+		verifier.reset();
+		}
+	else if( !this->VerifyOnAccess )
+		{
+		if( load.cancelled )
+			{
+			return Status::ECancelled;
+			}
+		status = verifier->VerifyAll( verify_thread_count );
+		if( status != Status::Ok )
+			{
+			// the hash does not compare correctly, file is corrupted
+			return status;
+			}
+		this->VerifiedFiles.SetVerified( mapping->GetIdentity(), verifier->GetRootHash() );
+		verifier.reset();
+		}
 
+	// keep the mapping in the entity, the trailer is left mapped after the data, and is used by the verifier if the data is verified on access
+	const u8 *data = mapping->GetData();
+	dest_entity = std::unique_ptr<Entity>( new Entity( uuid, std::move( mapping ), data, data_size, std::move( verifier ) ) );
 
+	return Status::Ok;
+	}
 
+Status EntityLoader::LoadEntity( const UUID &uuid, active_load &load, std::unique_ptr<Entity> &dest_entity, uint verify_thread_count )
+	{
+	// packed entities are always used directly from the mapped pack
+	entity_index_entry entry;
+	u64 entry_index = 0;
+	PackFile *pack = this->FindPackedEntity( uuid, entry, entry_index );
+	if( pack )
+		{
+		return this->LoadPackedEntity( uuid, load, *pack, entry_index, entry, dest_entity, verify_thread_count );
+		}
 
+	if( this->Mode == LoadMode::Mapped )
+		{
+		return this->LoadMappedEntity( uuid, load, dest_entity, verify_thread_count );
+		}
 
+	Status status = Status::Ok;
 
+	// read the file, unless it was already read by the IO thread
+	std::vector<u8> allocation = std::move( load.data );
+	if( !load.has_data )
+		{
+		status = FileBatchReader::ReadWholeFile( this->GetEntityFilePath( uuid ), allocation );
+		if( status == Status::ECantOpen )
+			{
+			status = FileBatchReader::ReadWholeFile( this->GetFlatEntityFilePath( uuid ), allocation );
+			}
+		if( status != Status::Ok )
+			{
+			return status;
+			}
+		}
 
+	// stop before the data is hashed, if the load has been cancelled
+	if( load.cancelled )
+		{
+		return Status::ECancelled;
+		}
 
+	// read the hash trailer, and verify the data. chunked blobs are verified in parallel
+	BlobVerifier verifier;
+	status = verifier.Setup( allocation.data(), allocation.size() );
+	if( status != Status::Ok )
+		{
+		return status;
+		}
+	status = verifier.VerifyAll( verify_thread_count );
+	if( status != Status::Ok )
+		{
+		// the hash does not compare correctly, file is corrupted
+		return status;
+		}
 
+	// drop the trailer, and keep the data in the entity
+	allocation.resize( verifier.GetDataSize() );
+	dest_entity = std::unique_ptr<Entity>( new Entity( uuid, std::move( allocation ) ) );
 
-	//UUID uuid = pstream->Read<UUID>();
+	return Status::Ok;
+	}
 
-	return (DWORD)Status::Ok;
+void EntityLoader::QueueActiveLoad( const UUID &uuid, active_load &load )
+	{
+	// any earlier entry of the load is now stale
+	queue_entry entry;
+	entry.uuid = uuid;
+	entry.sequence = ++this->QueueSequence;
+	load.sequence = entry.sequence;
+
+	const uint priority = (uint)load.priority;
+	if( load.stage == load_stage::queued_read )
+		{
+		this->ReadQueues[priority].push_back( entry );
+		}
+	else
+		{
+		this->LoadQueues[priority].push_back( entry );
+		}
 	}
 
-Status EntityLoader::AsyncLoadEntity( const UUID &uuid )
+bool EntityLoader::QueuesAreEmpty( const std::deque<queue_entry> *queues )
 	{
-	LoadThreadParams *params = (LoadThreadParams *)malloc( sizeof( LoadThreadParams ) );
-	if( !params )
+	for( uint priority = 0; priority < LoadPriorityCount; ++priority )
 		{
-		return Status::ECantAllocate;
+		if( !queues[priority].empty() )
+			return false;
 		}
-	params->uuid = uuid;
-	params->path = this->Path;
+	return true;
+	}
 
+bool EntityLoader::PopQueuedLoad( std::deque<queue_entry> *queues, UUID &dest_uuid, std::shared_ptr<active_load> &dest_load )
+	{
+	for( uint priority = 0; priority < LoadPriorityCount; ++priority )
+		{
+		while( !queues[priority].empty() )
+			{
+			const queue_entry entry = queues[priority].front();
+			queues[priority].pop_front();
+
+			// skip entries of loads which have been cancelled, finished or re-prioritized since the entry was queued
+			auto it = this->ActiveLoads.find( entry.uuid );
+			if( it == this->ActiveLoads.end() || it->second->sequence != entry.sequence )
+				{
+				continue;
+				}
+
+			active_load &load = *it->second;
+			load.stage = ( load.stage == load_stage::queued_read ) ? load_stage::reading : load_stage::loading;
+			dest_uuid = entry.uuid;
+			dest_load = it->second;
+			return true;
+			}
+		}
+	return false;
+	}
 
-	DWORD thread_id = {};
-	HANDLE thread_handle = CreateThread( nullptr, 0, LoadThreadProcedure, (void *)params, 0, &thread_id );
-	if( !thread_handle )
+Status EntityLoader::RequestLoad( const UUID &uuid, LoadPriority priority, uint prefetch_depth, const load_callback &callback, u64 prefetch_size )
+	{
+	std::shared_ptr<const Entity> loaded;
+	bool queued = false;
+	load_stage queued_stage = load_stage::queued_load;
 		{
-		return Status::ECantAllocate;
+		std::lock_guard<std::mutex> guard( this->LoadQueueMutex );
+		if( this->StopWorkers )
+			{
+			return Status::ECancelled;
+			}
+
+		// merge with the active load. the entity is published before the active load is removed, so 
+		// while the mutex is held, a loaded entity is always found in one of them
+		auto it = this->ActiveLoads.find( uuid );
+		if( it != this->ActiveLoads.end() )
+			{
+			if( prefetch_depth > 0 )
+				{
+				return Status::Ok;
+				}
+
+			active_load &load = *it->second;
+			if( callback )
+				{
+				load.callbacks.push_back( callback );
+				}
+			load.prefetch_depth = 0;
+			load.cancelled = false;
+			if( priority < load.priority )
+				{
+				load.priority = priority;
+				if( load.stage == load_stage::queued_read || load.stage == load_stage::queued_load )
+					{
+					this->QueueActiveLoad( uuid, load );
+					}
+				}
+			return Status::Ok;
+			}
+
+		// already loaded? the handle is only needed for the callback
+		if( callback )
+			{
+			loaded = this->LoadedEntities.Find( uuid );
+			}
+		else if( this->LoadedEntities.Contains( uuid ) )
+			{
+			return Status::Ok;
+			}
+
+		if( !loaded )
+			{
+			// prefetches count towards the prefetch budget from when they are queued. the budget is checked and reserved
+			// under the mutex, so concurrent prefetches can not exceed it
+			if( prefetch_depth > 0 )
+				{
+				if( this->PrefetchedBytes.load() + prefetch_size > this->PrefetchMaxBytes )
+					{
+					return Status::Ok;
+					}
+				if( this->PrefetchedEntities.insert( make_pair( uuid, prefetch_size ) ) )
+					{
+					this->PrefetchedBytes += prefetch_size;
+					}
+				}
+
+			// retry entities which failed earlier
+			this->FailedEntities.erase( uuid );
+
+			// queue the load, on the IO thread if the reads are batched, otherwise directly on the workers
+			std::shared_ptr<active_load> load = std::make_shared<active_load>();
+			load->priority = priority;
+			load->stage = this->GetFirstLoadStage( uuid );
+			queued_stage = load->stage;
+			load->prefetch_depth = prefetch_depth;
+			if( callback )
+				{
+				load->callbacks.push_back( callback );
+				}
+			this->QueueActiveLoad( uuid, *load );
+			this->ActiveLoads.insert( make_pair( uuid, std::move( load ) ) );
+			queued = true;
+			}
 		}
 
+	if( queued )
+		{
+		if( queued_stage == load_stage::queued_read )
+			{
+			this->ReadQueueCondition.notify_one();
+			}
+		else
+			{
+			this->LoadQueueCondition.notify_one();
+			}
+		}
+	else if( loaded )
+		{
+		callback( uuid, Status::Ok, loaded );
+		}
 	return Status::Ok;
 	}
 
-pair<bool, Status> EntityLoader::IsEntityLoaded( const UUID &uuid )
+void EntityLoader::FinishLoad( const UUID &uuid, const std::shared_ptr<active_load> &load, Status status, std::shared_ptr<const Entity> entity )
+	{
+	std::vector<load_callback> callbacks;
+	uint prefetch_depth = 0;
+	bool queued = false;
+	load_stage queued_stage = load_stage::queued_load;
+		{
+		std::lock_guard<std::mutex> guard( this->LoadQueueMutex );
+		if( load->cancelled )
+			{
+			// the callbacks were called by CancelLoad, drop the entity
+			status = Status::ECancelled;
+			entity = nullptr;
+			}
+		else if( status == Status::ECancelled && !this->StopWorkers )
+			{
+			// the load stopped for a cancel, but was requested again before it stopped, so start over
+			load->stage = this->GetFirstLoadStage( uuid );
+			queued_stage = load->stage;
+			load->has_data = false;
+			load->data.clear();
+			this->QueueActiveLoad( uuid, *load );
+			queued = true;
+			}
+
+		if( !queued )
+			{
+			prefetch_depth = load->prefetch_depth;
+
+			// release the size which was reserved when the prefetch was queued
+			if( prefetch_depth > 0 )
+				{
+				this->ClaimPrefetchedEntity( uuid );
+				}
+
+			if( status == Status::Ok )
+				{
+				// count prefetched entities with their loaded size, until they are requested
+				if( prefetch_depth > 0 )
+					{
+					const u64 entity_size = EntityCache::GetEntitySize( *entity );
+					if( this->PrefetchedEntities.insert( make_pair( uuid, entity_size ) ) )
+						{
+						this->PrefetchedBytes += entity_size;
+						}
+					}
+
+				// publish the entity before removing the active load, so it is always found in one of them
+				this->LoadedEntities.Insert( entity );
+				}
+			else if( status != Status::ECancelled )
+				{
+				this->FailedEntities.insert( make_pair( uuid, status ) );
+				}
+			callbacks = std::move( load->callbacks );
+			load->callbacks.clear();
+			this->ActiveLoads.erase( uuid );
+			}
+		}
+
+	if( queued )
+		{
+		if( queued_stage == load_stage::queued_read )
+			{
+			this->ReadQueueCondition.notify_one();
+			}
+		else
+			{
+			this->LoadQueueCondition.notify_one();
+			}
+		return;
+		}
+
+	for( const load_callback &callback : callbacks )
+		{
+		callback( uuid, status, entity );
+		}
+
+	// queue the entities it references
+	if( status == Status::Ok && prefetch_depth < this->PrefetchMaxDepth )
+		{
+		this->PrefetchReferencedEntities( *entity, prefetch_depth + 1 );
+		}
+	}
+
+void EntityLoader::ClaimPrefetchedEntity( const UUID &uuid )
+	{
+	pair<u64, bool> prefetched = this->PrefetchedEntities.find( uuid );
+	if( prefetched.second && this->PrefetchedEntities.erase( uuid ) == 1 )
+		{
+		this->PrefetchedBytes -= prefetched.first;
+		}
+	}
+
+void EntityLoader::PrefetchReferencedEntities( const Entity &entity, uint prefetch_depth )
+	{
+	// all of the data is parsed for refs, so an entity which is verified on access is verified first
+	if( entity.VerifyRange( 0, entity.GetDataSize() ) != Status::Ok )
+		{
+		return;
+		}
+
+	// the refs of entities which are not entity data, or malformed, are skipped. any refs found before the error are still prefetched
+	std::vector<hash> refs;
+	collect_package_refs( entity.GetData(), entity.GetDataSize(), refs );
+
+	for( const hash &ref : refs )
+		{
+		// stop when the budget is used up by the prefetched, queued and in flight prefetches
+		if( this->PrefetchedBytes.load() >= this->PrefetchMaxBytes )
+			{
+			return;
+			}
+
+		UUID uuid;
+		if( !this->PrefetchResolver( ref, uuid ) )
+			{
+			continue;
+			}
+
+		// the size of the stored entity (which includes the hash trailer) is reserved until the entity is loaded. 
+		// entities which are not stored are skipped
+		entity_index_entry entry;
+		if( this->FindStoredEntity( uuid, entry ) != Status::Ok )
+			{
+			continue;
+			}
+		const u64 prefetch_size = sizeof( Entity ) + entry.size;
+
+		// entities which are already loaded, queued or being loaded are skipped, as are entities which do not fit in the budget
+		this->RequestLoad( uuid, LoadPriority::Prefetch, prefetch_depth, load_callback(), prefetch_size );
+		}
+	}
+
+void EntityLoader::WorkerThreadProcedure()
+	{
+	for(;;)
+		{
+		// wait for an entity to load, in priority order
+		UUID uuid;
+		std::shared_ptr<active_load> load;
+		bool queue_is_empty = false;
+			{
+			std::unique_lock<std::mutex> lock( this->LoadQueueMutex );
+			this->LoadQueueCondition.wait( lock, [this]() { return this->StopWorkers || !QueuesAreEmpty( this->LoadQueues ); } );
+			if( this->StopWorkers )
+				{
+				return;
+				}
+			if( !this->PopQueuedLoad( this->LoadQueues, uuid, load ) )
+				{
+				// only stale entries
+				continue;
+				}
+			queue_is_empty = QueuesAreEmpty( this->LoadQueues );
+			}
+
+		// if there is nothing else to load, verify the data with the help of the shared thread_pool, otherwise leave the cores to the other workers
+		const uint verify_thread_count = queue_is_empty ? 0 : 1;
+
+		std::unique_ptr<Entity> entity;
+		Status status = this->LoadEntity( uuid, *load, entity, verify_thread_count );
+		this->FinishLoad( uuid, load, status, std::shared_ptr<const Entity>( std::move( entity ) ) );
+		}
+	}
+
+void EntityLoader::IOThreadProcedure()
+	{
+	std::vector<pair<UUID, std::shared_ptr<active_load>>> batch_loads;
+	std::vector<std::string> batch_paths;
+	for(;;)
+		{
+		// wait for entities to read, and take the queued in priority order, up to what the reader has in flight at once. 
+		// a larger batch would hold on to loads which a later, more urgent request could otherwise be read before
+		batch_loads.clear();
+		batch_paths.clear();
+			{
+			std::unique_lock<std::mutex> lock( this->LoadQueueMutex );
+			this->ReadQueueCondition.wait( lock, [this]() { return this->StopWorkers || !QueuesAreEmpty( this->ReadQueues ); } );
+			if( this->StopWorkers )
+				{
+				return;
+				}
+			UUID uuid;
+			std::shared_ptr<active_load> load;
+			while( batch_loads.size() < this->BatchReader.GetQueueDepth() && this->PopQueuedLoad( this->ReadQueues, uuid, load ) )
+				{
+				batch_loads.emplace_back( uuid, std::move( load ) );
+				}
+			}
+		for( const auto &batch_load : batch_loads )
+			{
+			batch_paths.push_back( this->GetEntityFilePath( batch_load.first ) );
+			}
+
+		// read the batch, and pass each completed file on to the workers for verification
+		this->BatchReader.ReadBatch( batch_paths, [this, &batch_loads]( size_t file_index, Status status, std::vector<u8> &data )
+			{
+			const UUID &uuid = batch_loads[file_index].first;
+			const std::shared_ptr<active_load> &load = batch_loads[file_index].second;
+
+			// a file which is missing in the sharded layout is passed on unread, and the worker tries the flat layout of older stores
+			if( status == Status::Ok || status == Status::ECantOpen )
+				{
+				std::unique_lock<std::mutex> lock( this->LoadQueueMutex );
+				if( !load->cancelled )
+					{
+					load->stage = load_stage::queued_load;
+					load->has_data = ( status == Status::Ok );
+					if( load->has_data )
+						{
+						load->data = std::move( data );
+						}
+					this->QueueActiveLoad( uuid, *load );
+					lock.unlock();
+					this->LoadQueueCondition.notify_one();
+					return;
+					}
+				status = Status::ECancelled;
+				}
+			this->FinishLoad( uuid, load, status, nullptr );
+			} );
+		}
+	}
+
+Status EntityLoader::AsyncLoadEntity( const UUID &uuid, LoadPriority priority, const load_callback &callback )
+	{
+	if( this->Path.empty() )
+		{
+		return Status::ENotInitialized;
+		}
+	if( (uint)priority >= LoadPriorityCount )
+		{
+		return Status::EParam;
+		}
+
+	// requested entities no longer count as prefetched
+	this->ClaimPrefetchedEntity( uuid );
+
+	return this->RequestLoad( uuid, priority, 0, callback );
+	}
+
+std::future<pair<std::shared_ptr<const Entity>, Status>> EntityLoader::AsyncLoadEntityFuture( const UUID &uuid, LoadPriority priority )
+	{
+	typedef std::promise<pair<std::shared_ptr<const Entity>, Status>> load_promise;
+	std::shared_ptr<load_promise> promise = std::make_shared<load_promise>();
+	std::future<pair<std::shared_ptr<const Entity>, Status>> future = promise->get_future();
+
+	Status status = this->AsyncLoadEntity( uuid, priority, [promise]( const UUID &, Status load_status, const std::shared_ptr<const Entity> &entity )
+		{
+		promise->set_value( make_pair( entity, load_status ) );
+		} );
+	if( status != Status::Ok )
+		{
+		promise->set_value( make_pair( std::shared_ptr<const Entity>(), status ) );
+		}
+	return future;
+	}
+
+bool EntityLoader::SetLoadPriority( const UUID &uuid, LoadPriority priority )
+	{
+	if( (uint)priority >= LoadPriorityCount )
+		{
+		return false;
+		}
+
+	std::lock_guard<std::mutex> guard( this->LoadQueueMutex );
+	auto it = this->ActiveLoads.find( uuid );
+	if( it == this->ActiveLoads.end() )
+		{
+		return false;
+		}
+	active_load &load = *it->second;
+	if( load.stage != load_stage::queued_read && load.stage != load_stage::queued_load )
+		{
+		return false;
+		}
+
+	// move the load to the back of the queue of the new priority, the old entry is left as stale
+	if( load.priority != priority )
+		{
+		load.priority = priority;
+		this->QueueActiveLoad( uuid, load );
+		}
+	return true;
+	}
+
+bool EntityLoader::CancelLoad( const UUID &uuid )
 	{
-	return make_pair(false, Status::Ok);
+	std::vector<load_callback> callbacks;
+		{
+		std::lock_guard<std::mutex> guard( this->LoadQueueMutex );
+		auto it = this->ActiveLoads.find( uuid );
+		if( it == this->ActiveLoads.end() || it->second->cancelled )
+			{
+			return false;
+			}
+		active_load &load = *it->second;
+		callbacks = std::move( load.callbacks );
+		load.callbacks.clear();
+
+		// queued loads are removed directly, and their queue entries are left as stale.
+		// loads in flight are removed by the worker or IO thread at the next stage
+		if( load.stage == load_stage::queued_read || load.stage == load_stage::queued_load )
+			{
+			if( load.prefetch_depth > 0 )
+				{
+				this->ClaimPrefetchedEntity( uuid );
+				}
+			this->ActiveLoads.erase( it );
+			}
+		else
+			{
+			load.cancelled = true;
+			}
+		}
+
+	for( const load_callback &callback : callbacks )
+		{
+		callback( uuid, Status::ECancelled, nullptr );
+		}
+	return true;
 	}
 
-pair<const Entity *, Status> EntityLoader::GetLoadedEntity( const UUID &uuid )
+pair<bool, Status> EntityLoader::IsEntityLoaded( const UUID &uuid )
 	{
+	if( this->LoadedEntities.Contains( uuid ) )
+		{
+		return make_pair( true, Status::Ok );
+		}
+
+	pair<Status, bool> failed = this->FailedEntities.find( uuid );
+	if( failed.second )
+		{
+		return make_pair( false, failed.first );
+		}
 
-	return make_pair( nullptr, Status::Ok);
+	return make_pair( false, Status::Ok );
 	}
 
+pair<std::shared_ptr<const Entity>, Status> EntityLoader::GetLoadedEntity( const UUID &uuid )
+	{
+	// the returned handle pins the entity in the cache
+	std::shared_ptr<const Entity> loaded = this->LoadedEntities.Find( uuid );
+	if( loaded )
+		{
+		this->ClaimPrefetchedEntity( uuid );
+		return make_pair( loaded, Status::Ok );
+		}
+
+	pair<Status, bool> failed = this->FailedEntities.find( uuid );
+	if( failed.second )
+		{
+		return make_pair( std::shared_ptr<const Entity>(), failed.first );
+		}
+
+	return make_pair( std::shared_ptr<const Entity>(), Status::Ok );
+	}
@@ -4,32 +4,280 @@
 #pragma once
 
 #include "ISD_Types.h"
+#include "ISD_FileBatchReader.h"
+#include "ISD_MappedFile.h"
+#include "ISD_MemoryReadStream.h"
+#include "ISD_EntityCache.h"
+#include "ISD_EntityStore.h"
+#include "ISD_PackFile.h"
+#include "ISD_BlobHash.h"
 
 #include <map>
 #include <mutex>
+#include <memory>
+#include <deque>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <atomic>
+#include <unordered_map>
 
 namespace ISD
 	{
-	class Entity
+	// a loaded entity, with the verified data of the entity file (excluding the hash trailer)
+	// the data is either read into memory, or a mapping of the file. mapped entities which are loaded with verify on
+	// access (see EntityLoader::SetVerifyOnAccess) are not verified when loaded, and the ranges of the data must be 
+	// verified with VerifyRange before they are used
+	class Entity : public std::enable_shared_from_this<Entity>
 		{
+		private:
+			UUID Uuid = {};
+			std::vector<u8> Allocation;
+			std::shared_ptr<const MappedFile> Mapping; // the mapped entity file or pack file, which can be shared by entities
+			const u8 *Data = nullptr;
+			u64 DataSize = 0;
+			std::unique_ptr<BlobVerifier> Verifier; // set if the data is verified on access
+
 		public:
+			Entity( const UUID &uuid, std::vector<u8> &&allocation ) : Uuid( uuid ), Allocation( std::move( allocation ) ), Data( Allocation.data() ), DataSize( Allocation.size() ) {}
+			Entity( const UUID &uuid, std::shared_ptr<const MappedFile> mapping, const u8 *data, u64 data_size, std::unique_ptr<BlobVerifier> verifier = nullptr ) : Uuid( uuid ), Mapping( std::move( mapping ) ), Data( data ), DataSize( data_size ), Verifier( std::move( verifier ) ) {}
+
+			const UUID &GetUUID() const { return this->Uuid; }
+			const u8 *GetData() const { return this->Data; }
+			u64 GetDataSize() const { return this->DataSize; }
+			bool IsMapped() const { return this->Mapping != nullptr; }
+
+			// true if the data is verified on access, and not when the entity was loaded
+			bool IsVerifiedOnAccess() const { return this->Verifier != nullptr; }
+
+			// verify the chunks of the data which overlap the range [offset, offset+size). verified chunks are remembered, so 
+			// each chunk is only hashed once. returns Ok directly if the data was verified when loaded, ECorrupted if the range 
+			// does not match the hash, and EParam if the range is outside the data. thread safe
+			Status VerifyRange( u64 offset, u64 size ) const;
 
+			// a read stream of the data, which has the entity as its data owner, so values which are read from the stream and 
+			// reference the data (see lazy_section) keep the entity alive. the entity must be held by a shared_ptr, as the 
+			// entities of the EntityLoader are
+			MemoryReadStream GetReadStream( bool flip_byte_order = false ) const;
 		};
 
+	// The EntityLoader loads entities from the store directory set in Initialize, on a fixed pool of worker threads.
+	// If the store has an index file, it is loaded in Initialize, and queries of which entities are in the store are
+	// answered from the index, without accessing the entity files. Entities which are not in the index are looked up
+	// in the store directory, so an index which is older than the store still finds all entities.
+	// Pack files can be added to the loader. Entities are looked up in the packs first, and loaded directly from 
+	// the mapped packs in both load modes, and the entities which are not in any pack are loaded from their loose files.
+	// Load requests are queued by priority, and requests for entities which are already loaded or in flight are merged.
+	// A queued load can be re-prioritized or cancelled. Loads in flight are cancelled cooperatively, between the read,
+	// the hash verification and the publishing of the entity. Completion is reported through callbacks or futures,
+	// or can be polled with IsEntityLoaded.
+	// If the batch reader uses io_uring, the files are read in batches on a separate IO thread, and the
+	// workers only verify the data of the completed reads.
+	// In Mapped mode, the entity files are memory mapped instead of read, and files which have already been 
+	// verified (in this process, or in any process sharing the verified file cache) are not hashed again.
+	// With verify on access, mapped entities are instead verified in chunks, as their data is used.
+	// If a prefetch policy is set, the package_refs of each loaded entity are resolved to entities, which are 
+	// queued to be loaded at Prefetch priority, up to a maximum depth and byte limit.
 	class EntityLoader
 		{
+		public:
+			enum class LoadMode
+				{
+				Read, // read the entity files into memory
+				Mapped, // memory map the entity files
+				};
+
+			// the priority of a load. queued loads are started in priority order, and in request order within a priority
+			enum class LoadPriority
+				{
+				Interactive = 0, // a user is waiting for the entity
+				High = 1,
+				Normal = 2,
+				Low = 3,
+				Prefetch = 4, // speculative loads, started only when no other loads are queued
+				};
+			static const uint LoadPriorityCount = 5;
+
+			// called when a load completes, with the entity, or nullptr and the error (ECancelled if the load was cancelled).
+			// called on a worker thread, or directly in the requesting call if the entity is already loaded
+			using load_callback = std::function<void( const UUID &uuid, Status status, const std::shared_ptr<const Entity> &entity )>;
+
+			// resolves a package_ref to the uuid of the entity which holds the package. returns false if the ref can not be resolved.
+			// called on the worker threads, so it must be thread safe
+			using package_ref_resolver = std::function<bool( const hash &package_ref, UUID &dest_uuid )>;
+
 		private:
-			std::wstring Path;
+			// the stage of an active load
+			enum class load_stage
+				{
+				queued_read, // queued in the read queues of the IO thread
+				reading, // being read by the IO thread
+				queued_load, // queued in the load queues of the workers
+				loading, // being loaded by a worker
+				};
+
+			// the state of a queued or in flight load. guarded by the LoadQueueMutex, except cancelled
+			struct active_load
+				{
+				LoadPriority priority = LoadPriority::Normal;
+				u64 sequence = 0; // the sequence number of the current queue entry of the load
+				load_stage stage = load_stage::queued_load;
+				uint prefetch_depth = 0; // 0 for requested entities, otherwise the number of refs from the requested entity
+				bool has_data = false; // true if the data has been read by the IO thread
+				std::vector<u8> data;
+				std::atomic<bool> cancelled;
+				std::vector<load_callback> callbacks;
+
+				active_load() : cancelled( false ) {}
+				};
+
+			// the queues hold entries of the loads. entries which do not match the sequence number of the load are stale,
+			// (the load was re-prioritized or cancelled), and are skipped
+			struct queue_entry
+				{
+				UUID uuid = {};
+				u64 sequence = 0;
+				};
+
+			std::string Path;
+			LoadMode Mode = LoadMode::Read;
+			VerifiedFileCache VerifiedFiles; // the mapped files which have been verified
+			bool VerifyOnAccess = false; // mapped entities are verified on access, instead of when loaded
+			EntityIndex StoreIndex; // the index of the store, if it has an index file
+			bool HasStoreIndex = false;
+			std::vector<std::unique_ptr<PackFile>> Packs; // the pack files, searched in the order they were added
+
+			EntityCache LoadedEntities; // the entities which have been loaded and verified
+			thread_safe_map<UUID, Status> FailedEntities; // the entities which failed to load, with the error
+
+			// the active loads, the pool of worker threads, and the queues of entities to load
+			std::unordered_map<UUID, std::shared_ptr<active_load>> ActiveLoads;
+			std::vector<std::thread> WorkerThreads;
+			std::deque<queue_entry> LoadQueues[LoadPriorityCount];
+			u64 QueueSequence = 0; // the sequence number of the last queue entry
+			std::mutex LoadQueueMutex;
+			std::condition_variable LoadQueueCondition;
+			bool StopWorkers = false;
+
+			// the batched reads, and the queues of entities to read, if io_uring is used
+			FileBatchReader BatchReader;
+			std::thread IOThread;
+			std::deque<queue_entry> ReadQueues[LoadPriorityCount];
+			std::condition_variable ReadQueueCondition;
+
+			// the prefetch policy, and the prefetched entities which have not yet been requested, with their sizes. queued and
+			// in flight prefetches are counted with the size of the stored entity, until they are loaded
+			uint PrefetchMaxDepth = 0;
+			u64 PrefetchMaxBytes = 0;
+			package_ref_resolver PrefetchResolver;
+			thread_safe_map<UUID, u64> PrefetchedEntities;
+			std::atomic<u64> PrefetchedBytes;
+
+			std::string GetEntityFilePath( const UUID &uuid ) const;
+			std::string GetFlatEntityFilePath( const UUID &uuid ) const;
+			void WorkerThreadProcedure();
+			void IOThreadProcedure();
+			Status LoadEntity( const UUID &uuid, active_load &load, std::unique_ptr<Entity> &dest_entity, uint verify_thread_count );
+			Status LoadMappedEntity( const UUID &uuid, active_load &load, std::unique_ptr<Entity> &dest_entity, uint verify_thread_count );
+			Status LoadPackedEntity( const UUID &uuid, active_load &load, PackFile &pack, u64 entry_index, const entity_index_entry &entry, std::unique_ptr<Entity> &dest_entity, uint verify_thread_count );
+
+			// find the pack which holds the entity, or nullptr if the entity is not in any pack
+			PackFile *FindPackedEntity( const UUID &uuid, entity_index_entry &dest_entry, u64 &dest_entry_index ) const;
 
-			thread_safe_map<UUID, const Entity *> LoadedEntities;
-			thread_safe_map<UUID, void *> ActiveThreads;
+			// the stage a new load starts in. packed entities are not read by the IO thread
+			load_stage GetFirstLoadStage( const UUID &uuid ) const;
+
+			// request a load, or merge the request with the active load of the entity. requests of prefetches are not merged
+			// with active loads, and are only queued if prefetch_size fits in the prefetch budget. if the entity is already 
+			// loaded, the callback is called directly
+			Status RequestLoad( const UUID &uuid, LoadPriority priority, uint prefetch_depth, const load_callback &callback, u64 prefetch_size = 0 );
+
+			// add a queue entry of the load, in the queue of its stage and priority. the LoadQueueMutex must be held
+			void QueueActiveLoad( const UUID &uuid, active_load &load );
+
+			// returns true if all the queues are empty, including stale entries
+			static bool QueuesAreEmpty( const std::deque<queue_entry> *queues );
+
+			// pop the first valid entry of the highest priority, skipping stale entries, and move the load to the next stage. 
+			// returns false if there are no valid entries. the LoadQueueMutex must be held
+			bool PopQueuedLoad( std::deque<queue_entry> *queues, UUID &dest_uuid, std::shared_ptr<active_load> &dest_load );
+
+			// publish the entity if the load succeeded and was not cancelled, remove the active load, and call its callbacks.
+			// if the load stopped because it was cancelled, but it has been requested again since, it is queued again
+			void FinishLoad( const UUID &uuid, const std::shared_ptr<active_load> &load, Status status, std::shared_ptr<const Entity> entity );
+
+			void PrefetchReferencedEntities( const Entity &entity, uint prefetch_depth );
+			void ClaimPrefetchedEntity( const UUID &uuid );
 
 		public:
-			Status Initialize( const std::string &path );
+			EntityLoader();
+			EntityLoader( const EntityLoader & ) = delete;
+			EntityLoader &operator=( const EntityLoader & ) = delete;
+			~EntityLoader();
+
+			// set the store directory of the entity files, and start worker_thread_count workers (0 = the number of hardware threads).
+			// the index file of the store is loaded if there is one, an invalid index file is ignored
+			Status Initialize( const std::string &path, uint worker_thread_count = 0, LoadMode load_mode = LoadMode::Read );
+
+			// returns true if the index file of the store was loaded in Initialize
+			bool HasEntityIndex() const { return this->HasStoreIndex; }
+
+			// add a pack file, which is mapped until the loader is destroyed. should be called before any entities are requested
+			Status AddPackFile( const std::string &pack_file_path );
+
+			// find the entity in the packs, or else in the store. returns ECantOpen if the entity is not found. the entry of a 
+			// packed entity is the entry of the pack. in the store, the index is searched first, if there is one. entities which
+			// are not in the index (added after the index was built) are stat'ed, and the root hash is left zero. entities which 
+			// have been removed after the index was built are still found, and fail to load with ECantOpen
+			Status FindStoredEntity( const UUID &uuid, entity_index_entry &dest_entry ) const;
 
-			Status AsyncLoadEntity( const UUID &uuid );
+			// in Mapped mode, load and append the verified files to a cache file, so files verified by other
+			// processes, or earlier runs, are not hashed again. should be called before any entities are loaded
+			Status SetVerifiedFileCache( const std::string &cache_file_path );
+
+			// if set, mapped entities (in Mapped mode, and all packed entities) which have not been verified before are not verified 
+			// when loaded, only the hash trailer is checked. the data is verified in chunks, when the ranges are verified with 
+			// Entity::VerifyRange. entities read into memory are always verified when loaded. off by default.
+			// should be called before any entities are requested
+			void SetVerifyOnAccess( bool verify_on_access ) { this->VerifyOnAccess = verify_on_access; }
+			bool GetVerifyOnAccess() const { return this->VerifyOnAccess; }
+
+			// prefetch the entities referenced by package_refs of the loaded entities, resolved by the resolver, at most
+			// max_depth refs away from a requested entity (0 disables prefetching, the default). an entity is only prefetched
+			// if it fits in max_bytes, together with the prefetched entities which have not been requested yet, and the queued 
+			// and in flight prefetches, which are counted with the size of the stored entity.
+			// should be called before any entities are requested
+			void SetPrefetchPolicy( uint max_depth, u64 max_bytes, const package_ref_resolver &resolver );
+
+			// queue the entity to be loaded. returns Ok if queued, or if it is already loaded or queued. if the load is 
+			// already queued at a lower priority, it is raised to the priority. the callback (if set) is called when the load 
+			// completes, directly if the entity is already loaded.
+			Status AsyncLoadEntity( const UUID &uuid, LoadPriority priority = LoadPriority::Normal, const load_callback &callback = load_callback() );
+
+			// queue the entity to be loaded, like AsyncLoadEntity, and return a future of the entity and the status of the load
+			std::future<std::pair<std::shared_ptr<const Entity>, Status>> AsyncLoadEntityFuture( const UUID &uuid, LoadPriority priority = LoadPriority::Normal );
+
+			// change the priority of a queued load. returns false if the entity is not queued (not requested, or already being loaded)
+			bool SetLoadPriority( const UUID &uuid, LoadPriority priority );
+
+			// cancel a queued or in flight load. queued loads are removed directly, loads in flight stop at the next stage.
+			// the callbacks of the load are called with ECancelled. returns false if the entity is not queued or being loaded
+			bool CancelLoad( const UUID &uuid );
+
+			// set the memory budget in bytes of the loaded entities (0 = unlimited, the default). when the budget is
+			// exceeded, the least recently used entities which are not pinned by a handle are evicted
+			void SetCacheBudget( u64 budget ) { this->LoadedEntities.SetBudget( budget ); }
+			u64 GetCacheBudget() const { return this->LoadedEntities.GetBudget(); }
+			u64 GetCacheUsedBytes() const { return this->LoadedEntities.GetUsedBytes(); }
+
+			// returns true if the entity is loaded. if the entity failed to load, returns false and the error
+			// an entity which has been evicted or cancelled is not loaded, and must be requested again
 			std::pair<bool, Status> IsEntityLoaded( const UUID &uuid );
-			std::pair<const Entity *, Status> GetLoadedEntity( const UUID &uuid );
+
+			// returns a handle to the entity if loaded, or nullptr. if the entity failed to load, returns nullptr and the error
+			// the entity is pinned in memory for as long as the handle (or any copy of it) is alive
+			std::pair<std::shared_ptr<const Entity>, Status> GetLoadedEntity( const UUID &uuid );
 		};
 
-	};
\ No newline at end of file
+	};
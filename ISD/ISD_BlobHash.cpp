@@ -0,0 +1,277 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#include "ISD_BlobHash.h"
+#include "ISD_SHA256.h"
+#include "ISD_parallel_for.h"
+
+#include <algorithm>
+
+namespace ISD
+	{
+	// number of chunks which are hashed together as a batch, to use the multi-buffer lanes of the SHA256 implementation
+	static const u64 chunk_batch_size = 8;
+
+	static u64 get_chunk_count( u64 data_size, u64 chunk_size )
+		{
+		const u64 chunk_count = ( data_size + chunk_size - 1 ) / chunk_size;
+		return ( chunk_count > 0 ) ? chunk_count : 1;
+		}
+
+	// hash the chunks in [first_chunk, first_chunk+chunk_count) as a batch
+	static void calculate_chunk_hashes( const u8 *data, u64 data_size, u64 chunk_size, u64 first_chunk, u64 chunk_count, hash *dest_hashes )
+		{
+		const u8 *chunk_data[chunk_batch_size];
+		size_t chunk_lengths[chunk_batch_size];
+		for( u64 i = 0; i < chunk_count; ++i )
+			{
+			const u64 chunk_start = ( first_chunk + i ) * chunk_size;
+			chunk_data[i] = &data[chunk_start];
+			chunk_lengths[i] = (size_t)std::min( chunk_size, data_size - chunk_start );
+			}
+		SHA256::CalculateDigests( (size_t)chunk_count, chunk_data, chunk_lengths, dest_hashes );
+		}
+
+	// calculate the root hash of the chunk hashes, see the description of the format in the header
+	static hash calculate_root_hash( const u8 *chunk_hashes, u64 chunk_count, u64 data_size, u64 chunk_size )
+		{
+		std::vector<hash> level( (size_t)chunk_count );
+		memcpy( level.data(), chunk_hashes, (size_t)chunk_count * sizeof( hash ) );
+
+		while( level.size() > 1 )
+			{
+			const size_t pair_count = level.size() / 2;
+			for( size_t i = 0; i < pair_count; ++i )
+				{
+				SHA256 sha( level[i * 2].digest, sizeof( hash ) );
+				sha.Update( level[i * 2 + 1].digest, sizeof( hash ) );
+				sha.GetDigest( level[i].digest );
+				}
+
+			// move up the odd hash as is
+			if( level.size() & 1 )
+				{
+				level[pair_count] = level.back();
+				level.resize( pair_count + 1 );
+				}
+			else
+				{
+				level.resize( pair_count );
+				}
+			}
+
+		hash root;
+		SHA256 sha( level[0].digest, sizeof( hash ) );
+		sha.Update( (const u8 *)&data_size, sizeof( u64 ) );
+		sha.Update( (const u8 *)&chunk_size, sizeof( u64 ) );
+		sha.GetDigest( root.digest );
+		return root;
+		}
+
+	std::vector<u8> calculate_blob_trailer( const u8 *data, u64 data_size, u64 chunk_size, uint thread_count )
+		{
+		std::vector<u8> trailer;
+
+		// single hash 
+		if( chunk_size == 0 )
+			{
+			trailer.resize( sizeof( hash ) );
+			SHA256 sha( data, (size_t)data_size );
+			sha.GetDigest( trailer.data() );
+			return trailer;
+			}
+
+		const u64 chunk_count = get_chunk_count( data_size, chunk_size );
+		const u64 chunk_hashes_size = chunk_count * sizeof( hash );
+		trailer.resize( (size_t)( chunk_hashes_size + sizeof( u64 ) * 2 + sizeof( hash ) + sizeof( u64 ) ) );
+
+		// hash the chunks in batches, in parallel
+		hash *chunk_hashes = (hash *)trailer.data();
+		const u64 batch_count = ( chunk_count + chunk_batch_size - 1 ) / chunk_batch_size;
+		parallel_for( (size_t)batch_count, [&]( size_t batch_index )
+			{
+			const u64 first_chunk = batch_index * chunk_batch_size;
+			const u64 batch_chunk_count = std::min( chunk_batch_size, chunk_count - first_chunk );
+			calculate_chunk_hashes( data, data_size, chunk_size, first_chunk, batch_chunk_count, &chunk_hashes[first_chunk] );
+			}, thread_count );
+
+		const hash root = calculate_root_hash( trailer.data(), chunk_count, data_size, chunk_size );
+
+		u8 *dest = &trailer[(size_t)chunk_hashes_size];
+		memcpy( dest, &data_size, sizeof( u64 ) );
+		dest += sizeof( u64 );
+		memcpy( dest, &chunk_size, sizeof( u64 ) );
+		dest += sizeof( u64 );
+		memcpy( dest, &root, sizeof( hash ) );
+		dest += sizeof( hash );
+		memcpy( dest, &BlobChunkedHashMagic, sizeof( u64 ) );
+
+		return trailer;
+		}
+
+	Status BlobVerifier::Setup( const u8 *blob, u64 blob_size )
+		{
+		if( this->Data )
+			{
+			return Status::EAlreadyInitialized;
+			}
+
+		const u64 chunked_footer_size = sizeof( u64 ) * 2 + sizeof( hash ) + sizeof( u64 );
+
+		// check for the magic value of the chunked trailer
+		u64 magic = 0;
+		if( blob_size >= sizeof( u64 ) )
+			{
+			memcpy( &magic, &blob[blob_size - sizeof( u64 )], sizeof( u64 ) );
+			}
+
+		if( magic == BlobChunkedHashMagic && blob_size >= chunked_footer_size )
+			{
+			const u8 *footer = &blob[blob_size - chunked_footer_size];
+			u64 data_size = 0;
+			u64 chunk_size = 0;
+			hash root_hash;
+			memcpy( &data_size, &footer[0], sizeof( u64 ) );
+			memcpy( &chunk_size, &footer[sizeof( u64 )], sizeof( u64 ) );
+			memcpy( &root_hash, &footer[sizeof( u64 ) * 2], sizeof( hash ) );
+
+			// make sure the sizes add up to the size of the blob (without overflowing)
+			const u64 space_before_footer = blob_size - chunked_footer_size;
+			if( chunk_size == 0 || data_size > space_before_footer )
+				{
+				ISDErrorLog << "The chunked hash trailer of the blob is invalid" << ISDErrorLogEnd;
+				return Status::ECorrupted;
+				}
+			const u64 chunk_count = get_chunk_count( data_size, chunk_size );
+			if( chunk_count > ( space_before_footer - data_size ) / sizeof( hash ) 
+				|| data_size + chunk_count * sizeof( hash ) != space_before_footer )
+				{
+				ISDErrorLog << "The chunked hash trailer of the blob does not match the size of the blob" << ISDErrorLogEnd;
+				return Status::ECorrupted;
+				}
+
+			// the chunk hashes must match the root hash
+			const u8 *chunk_hashes = &blob[data_size];
+			if( calculate_root_hash( chunk_hashes, chunk_count, data_size, chunk_size ) != root_hash )
+				{
+				ISDErrorLog << "The chunk hashes of the blob do not match the root hash" << ISDErrorLogEnd;
+				return Status::ECorrupted;
+				}
+
+			this->DataSize = data_size;
+			this->ChunkSize = chunk_size;
+			this->ChunkCount = chunk_count;
+			this->ChunkHashes = chunk_hashes;
+			this->RootHash = root_hash;
+			this->Chunked = true;
+			}
+		else
+			{
+			// single hash, treated as one chunk covering all the data
+			if( blob_size < sizeof( hash ) )
+				{
+				ISDErrorLog << "The blob is too small to have a hash" << ISDErrorLogEnd;
+				return Status::ECorrupted;
+				}
+			this->DataSize = blob_size - sizeof( hash );
+			this->ChunkSize = ( this->DataSize > 0 ) ? this->DataSize : 1;
+			this->ChunkCount = 1;
+			this->ChunkHashes = &blob[this->DataSize];
+			memcpy( &this->RootHash, this->ChunkHashes, sizeof( hash ) );
+			this->Chunked = false;
+			}
+
+		this->Data = blob;
+		this->ChunkStates.reset( new std::atomic<chunk_state>[(size_t)this->ChunkCount] );
+		for( u64 i = 0; i < this->ChunkCount; ++i )
+			{
+			this->ChunkStates[(size_t)i].store( chunk_state::unverified );
+			}
+
+		return Status::Ok;
+		}
+
+	bool BlobVerifier::VerifyChunks( u64 first_chunk, u64 chunk_count )
+		{
+		// skip if all of the chunks are already checked
+		bool all_checked = true;
+		for( u64 i = 0; i < chunk_count; ++i )
+			{
+			const chunk_state state = this->ChunkStates[(size_t)( first_chunk + i )].load();
+			if( state == chunk_state::corrupted )
+				return false;
+			if( state == chunk_state::unverified )
+				all_checked = false;
+			}
+		if( all_checked )
+			return true;
+
+		hash chunk_hashes[chunk_batch_size];
+		calculate_chunk_hashes( this->Data, this->DataSize, this->ChunkSize, first_chunk, chunk_count, chunk_hashes );
+
+		bool valid = true;
+		for( u64 i = 0; i < chunk_count; ++i )
+			{
+			const u64 chunk_index = first_chunk + i;
+			const bool chunk_valid = memcmp( chunk_hashes[i].digest, &this->ChunkHashes[chunk_index * sizeof( hash )], sizeof( hash ) ) == 0;
+			this->ChunkStates[(size_t)chunk_index].store( chunk_valid ? chunk_state::verified : chunk_state::corrupted );
+			valid = valid && chunk_valid;
+			}
+		return valid;
+		}
+
+	Status BlobVerifier::VerifyAll( uint thread_count )
+		{
+		if( !this->Data )
+			{
+			return Status::ENotInitialized;
+			}
+
+		const u64 batch_count = ( this->ChunkCount + chunk_batch_size - 1 ) / chunk_batch_size;
+		std::atomic<bool> valid( true );
+		parallel_for( (size_t)batch_count, [&]( size_t batch_index )
+			{
+			const u64 first_chunk = batch_index * chunk_batch_size;
+			const u64 batch_chunk_count = std::min( chunk_batch_size, this->ChunkCount - first_chunk );
+			if( !this->VerifyChunks( first_chunk, batch_chunk_count ) )
+				{
+				valid.store( false );
+				}
+			}, thread_count );
+
+		if( !valid.load() )
+			{
+			ISDErrorLog << "The data of the blob does not match the hash" << ISDErrorLogEnd;
+			return Status::ECorrupted;
+			}
+		return Status::Ok;
+		}
+
+	Status BlobVerifier::VerifyRange( u64 offset, u64 size )
+		{
+		if( !this->Data )
+			{
+			return Status::ENotInitialized;
+			}
+		if( offset > this->DataSize || size > this->DataSize - offset )
+			{
+			return Status::EParam;
+			}
+		if( size == 0 )
+			{
+			return Status::Ok;
+			}
+
+		const u64 first_chunk = offset / this->ChunkSize;
+		const u64 end_chunk = ( offset + size + this->ChunkSize - 1 ) / this->ChunkSize;
+		for( u64 chunk = first_chunk; chunk < end_chunk; chunk += chunk_batch_size )
+			{
+			if( !this->VerifyChunks( chunk, std::min( chunk_batch_size, end_chunk - chunk ) ) )
+				{
+				ISDErrorLog << "The data of the blob in the range does not match the hash" << ISDErrorLogEnd;
+				return Status::ECorrupted;
+				}
+			}
+		return Status::Ok;
+		}
+	};
@@ -0,0 +1,86 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#pragma once
+
+#include "ISD_Types.h"
+
+#include <atomic>
+#include <memory>
+
+namespace ISD
+	{
+	// Blobs on disk end with a trailer which is used to verify the integrity of the data. There are two formats of the trailer:
+	//
+	// Single hash (the original format):
+	//		u8 Data[DataSize];
+	//		hash DataHash; // sha256 of all of the Data
+	//
+	// Chunked hash, where the Data is split into fixed size chunks, which can be verified independently and in parallel:
+	//		u8 Data[DataSize];
+	//		hash ChunkHashes[ChunkCount]; // sha256 of each chunk. ChunkCount = DataSize / ChunkSize, rounded up, but at least 1
+	//		u64 DataSize;
+	//		u64 ChunkSize;
+	//		hash RootHash; // the merkle root of the chunk hashes
+	//		u64 Magic; // BlobChunkedHashMagic
+	//
+	// The merkle tree is built bottom up, level by level, by hashing pairs of hashes as sha256( left , right ). An odd hash at the end 
+	// of a level is moved up as is. The RootHash is the sha256 of the top hash, DataSize and ChunkSize, so the layout is covered as well.
+	// A single hash blob ends with a hash, so it is identified by not ending with the magic value. 
+	const u64 BlobChunkedHashMagic = 0x314b4e4843445349; // "ISDCHNK1"
+	const u64 BlobDefaultChunkSize = 1024*1024;
+
+	// calculate the trailer of a blob with the data, to be written after the data.
+	// chunk_size 0 calculates the single hash trailer. the chunks are hashed on thread_count threads (0 = all hardware threads)
+	std::vector<u8> calculate_blob_trailer( const u8 *data, u64 data_size, u64 chunk_size = BlobDefaultChunkSize, uint thread_count = 0 );
+
+	// Verifies the data of a blob, using the trailer. Verified chunks are remembered, so each chunk is only hashed once.
+	// The verification methods are thread safe, but the blob memory must stay valid and unchanged while the verifier is used.
+	class BlobVerifier
+		{
+		private:
+			const u8 *Data = nullptr;
+			u64 DataSize = 0;
+			u64 ChunkSize = 0;
+			u64 ChunkCount = 0;
+			const u8 *ChunkHashes = nullptr; // points into the trailer of the blob
+			hash RootHash = {};
+			bool Chunked = false;
+
+			enum class chunk_state : u8
+				{
+				unverified = 0,
+				verified = 1,
+				corrupted = 2,
+				};
+			std::unique_ptr<std::atomic<chunk_state>[]> ChunkStates;
+
+			// verify the chunks in [first_chunk, first_chunk+chunk_count), at most 8 chunks, hashed as a batch
+			bool VerifyChunks( u64 first_chunk, u64 chunk_count );
+
+		public:
+			// parse the trailer of the blob, and check that it is consistent. 
+			// returns ECorrupted if the blob is too small, or the chunked trailer does not match its root hash
+			Status Setup( const u8 *blob, u64 blob_size );
+
+			// the size of the data of the blob, excluding the trailer
+			u64 GetDataSize() const { return this->DataSize; }
+
+			// true if the blob has a chunked hash trailer, false for a single hash
+			bool IsChunked() const { return this->Chunked; }
+
+			// the hash which covers all of the blob, the root hash for chunked blobs, or the single hash
+			const hash &GetRootHash() const { return this->RootHash; }
+
+			// the size of each chunk which is verified as a unit. for single hash blobs, this is the whole data
+			u64 GetChunkSize() const { return this->ChunkSize; }
+
+			// verify all the data, spreading the chunks over thread_count threads of the shared thread_pool (0 = all hardware threads).
+			// returns ECorrupted if any chunk does not match its hash
+			Status VerifyAll( uint thread_count = 0 );
+
+			// verify only the chunks which overlap the data range [offset, offset+size), on the calling thread. 
+			// returns ECorrupted if any of them does not match its hash, EParam if the range is outside the data
+			Status VerifyRange( u64 offset, u64 size );
+		};
+	};
@@ -0,0 +1,216 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#include "ISD_CpuFeatures.h"
+
+#include <cstdlib>
+
+#if defined(ISD_CPU_X86)
+#include <immintrin.h>
+#elif defined(ISD_CPU_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace ISD
+	{
+	// scalar byte swap of one word
+	template <class T> inline T swap_word( T value );
+#ifdef _MSC_VER
+	template<> inline u16 swap_word<u16>( u16 value ) { return _byteswap_ushort( value ); }
+	template<> inline u32 swap_word<u32>( u32 value ) { return _byteswap_ulong( value ); }
+	template<> inline u64 swap_word<u64>( u64 value ) { return _byteswap_uint64( value ); }
+#else
+	template<> inline u16 swap_word<u16>( u16 value ) { return __builtin_bswap16( value ); }
+	template<> inline u32 swap_word<u32>( u32 value ) { return __builtin_bswap32( value ); }
+	template<> inline u64 swap_word<u64>( u64 value ) { return __builtin_bswap64( value ); }
+#endif
+
+	// scalar fallback, also used for the tails of the vectorized kernels
+	template <class T> static void copy_and_swap_scalar( T *dest, const T *src, size_t count )
+		{
+		for( size_t i = 0; i < count; ++i )
+			{
+			T value;
+			memcpy( &value, &src[i], sizeof( T ) ); // src and dest are not necessarily aligned
+			value = swap_word<T>( value );
+			memcpy( &dest[i], &value, sizeof( T ) );
+			}
+		}
+
+#if defined(ISD_CPU_X86)
+
+	// the pshufb masks which reverses the bytes of each word in a 16 byte lane
+	template <class T> struct swap_mask;
+	template<> struct swap_mask<u16> { static constexpr u8 bytes[16] = { 1,0, 3,2, 5,4, 7,6, 9,8, 11,10, 13,12, 15,14 }; };
+	template<> struct swap_mask<u32> { static constexpr u8 bytes[16] = { 3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12 }; };
+	template<> struct swap_mask<u64> { static constexpr u8 bytes[16] = { 7,6,5,4,3,2,1,0, 15,14,13,12,11,10,9,8 }; };
+	constexpr u8 swap_mask<u16>::bytes[16];
+	constexpr u8 swap_mask<u32>::bytes[16];
+	constexpr u8 swap_mask<u64>::bytes[16];
+
+	template <class T> ISD_TARGET_SSSE3 static void copy_and_swap_ssse3( T *dest, const T *src, size_t count )
+		{
+		const __m128i mask = _mm_loadu_si128( (const __m128i *)swap_mask<T>::bytes );
+		const size_t words_per_vector = 16 / sizeof( T );
+
+		const u8 *psrc = (const u8 *)src;
+		u8 *pdest = (u8 *)dest;
+		size_t i = 0;
+
+		// two vectors per iteration, both loaded before storing, so in-place swaps are safe
+		for( ; i + 2 * words_per_vector <= count; i += 2 * words_per_vector )
+			{
+			__m128i v0 = _mm_loadu_si128( (const __m128i *)( psrc ) );
+			__m128i v1 = _mm_loadu_si128( (const __m128i *)( psrc + 16 ) );
+			_mm_storeu_si128( (__m128i *)( pdest ), _mm_shuffle_epi8( v0, mask ) );
+			_mm_storeu_si128( (__m128i *)( pdest + 16 ), _mm_shuffle_epi8( v1, mask ) );
+			psrc += 32;
+			pdest += 32;
+			}
+		for( ; i + words_per_vector <= count; i += words_per_vector )
+			{
+			__m128i v = _mm_loadu_si128( (const __m128i *)psrc );
+			_mm_storeu_si128( (__m128i *)pdest, _mm_shuffle_epi8( v, mask ) );
+			psrc += 16;
+			pdest += 16;
+			}
+
+		copy_and_swap_scalar<T>( &dest[i], &src[i], count - i );
+		}
+
+	template <class T> ISD_TARGET_AVX2 static void copy_and_swap_avx2( T *dest, const T *src, size_t count )
+		{
+		// vpshufb shuffles within each 128 bit lane, so the same mask is used in both lanes
+		const __m128i mask128 = _mm_loadu_si128( (const __m128i *)swap_mask<T>::bytes );
+		const __m256i mask = _mm256_broadcastsi128_si256( mask128 );
+		const size_t words_per_vector = 32 / sizeof( T );
+
+		const u8 *psrc = (const u8 *)src;
+		u8 *pdest = (u8 *)dest;
+		size_t i = 0;
+
+		for( ; i + 4 * words_per_vector <= count; i += 4 * words_per_vector )
+			{
+			__m256i v0 = _mm256_loadu_si256( (const __m256i *)( psrc ) );
+			__m256i v1 = _mm256_loadu_si256( (const __m256i *)( psrc + 32 ) );
+			__m256i v2 = _mm256_loadu_si256( (const __m256i *)( psrc + 64 ) );
+			__m256i v3 = _mm256_loadu_si256( (const __m256i *)( psrc + 96 ) );
+			_mm256_storeu_si256( (__m256i *)( pdest ), _mm256_shuffle_epi8( v0, mask ) );
+			_mm256_storeu_si256( (__m256i *)( pdest + 32 ), _mm256_shuffle_epi8( v1, mask ) );
+			_mm256_storeu_si256( (__m256i *)( pdest + 64 ), _mm256_shuffle_epi8( v2, mask ) );
+			_mm256_storeu_si256( (__m256i *)( pdest + 96 ), _mm256_shuffle_epi8( v3, mask ) );
+			psrc += 128;
+			pdest += 128;
+			}
+		for( ; i + words_per_vector <= count; i += words_per_vector )
+			{
+			__m256i v = _mm256_loadu_si256( (const __m256i *)psrc );
+			_mm256_storeu_si256( (__m256i *)pdest, _mm256_shuffle_epi8( v, mask ) );
+			psrc += 32;
+			pdest += 32;
+			}
+		if( i + words_per_vector / 2 <= count )
+			{
+			__m128i v = _mm_loadu_si128( (const __m128i *)psrc );
+			_mm_storeu_si128( (__m128i *)pdest, _mm_shuffle_epi8( v, mask128 ) );
+			i += words_per_vector / 2;
+			}
+
+		copy_and_swap_scalar<T>( &dest[i], &src[i], count - i );
+		}
+
+	enum class byte_swap_kernel
+		{
+		scalar,
+		ssse3,
+		avx2,
+		};
+
+	static byte_swap_kernel select_byte_swap_kernel()
+		{
+		const cpu_features &features = get_cpu_features();
+		if( features.avx2 )
+			return byte_swap_kernel::avx2;
+		if( features.ssse3 )
+			return byte_swap_kernel::ssse3;
+		return byte_swap_kernel::scalar;
+		}
+
+	// note: if used before the static initialization of this file, the value is zero, which is the scalar kernel
+	static const byte_swap_kernel cpu_byte_swap_kernel = select_byte_swap_kernel();
+
+	template <class T> static void copy_and_swap_dispatch( T *dest, const T *src, size_t count )
+		{
+		switch( cpu_byte_swap_kernel )
+			{
+			case byte_swap_kernel::avx2:
+				copy_and_swap_avx2<T>( dest, src, count );
+				break;
+			case byte_swap_kernel::ssse3:
+				copy_and_swap_ssse3<T>( dest, src, count );
+				break;
+			default:
+				copy_and_swap_scalar<T>( dest, src, count );
+				break;
+			}
+		}
+
+#elif defined(ISD_CPU_NEON)
+
+	// NEON is always available on the targets which define __ARM_NEON, so no runtime check is needed
+	template <class T> inline uint8x16_t reverse_words( uint8x16_t v );
+	template<> inline uint8x16_t reverse_words<u16>( uint8x16_t v ) { return vrev16q_u8( v ); }
+	template<> inline uint8x16_t reverse_words<u32>( uint8x16_t v ) { return vrev32q_u8( v ); }
+	template<> inline uint8x16_t reverse_words<u64>( uint8x16_t v ) { return vrev64q_u8( v ); }
+
+	template <class T> static void copy_and_swap_dispatch( T *dest, const T *src, size_t count )
+		{
+		const size_t words_per_vector = 16 / sizeof( T );
+
+		const u8 *psrc = (const u8 *)src;
+		u8 *pdest = (u8 *)dest;
+		size_t i = 0;
+
+		for( ; i + 2 * words_per_vector <= count; i += 2 * words_per_vector )
+			{
+			uint8x16_t v0 = vld1q_u8( psrc );
+			uint8x16_t v1 = vld1q_u8( psrc + 16 );
+			vst1q_u8( pdest, reverse_words<T>( v0 ) );
+			vst1q_u8( pdest + 16, reverse_words<T>( v1 ) );
+			psrc += 32;
+			pdest += 32;
+			}
+		for( ; i + words_per_vector <= count; i += words_per_vector )
+			{
+			vst1q_u8( pdest, reverse_words<T>( vld1q_u8( psrc ) ) );
+			psrc += 16;
+			pdest += 16;
+			}
+
+		copy_and_swap_scalar<T>( &dest[i], &src[i], count - i );
+		}
+
+#else
+
+	template <class T> static void copy_and_swap_dispatch( T *dest, const T *src, size_t count )
+		{
+		copy_and_swap_scalar<T>( dest, src, count );
+		}
+
+#endif
+
+	template<> void copy_and_swap_byte_order<u16>( u16 *dest , const u16 *src , size_t count )
+		{
+		copy_and_swap_dispatch<u16>( dest, src, count );
+		}
+
+	template<> void copy_and_swap_byte_order<u32>( u32 *dest , const u32 *src , size_t count )
+		{
+		copy_and_swap_dispatch<u32>( dest, src, count );
+		}
+
+	template<> void copy_and_swap_byte_order<u64>( u64 *dest , const u64 *src , size_t count )
+		{
+		copy_and_swap_dispatch<u64>( dest, src, count );
+		}
+	};
@@ -0,0 +1,78 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#include "ISD_CpuFeatures.h"
+
+#ifdef ISD_CPU_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace ISD
+	{
+#ifdef ISD_CPU_X86
+	static void cpuid( u32 function_id, u32 subfunction_id, u32 regs[4] )
+		{
+#ifdef _MSC_VER
+		int info[4] = {};
+		__cpuidex( info, (int)function_id, (int)subfunction_id );
+		for( uint i = 0; i < 4; ++i )
+			regs[i] = (u32)info[i];
+#else
+		__cpuid_count( function_id, subfunction_id, regs[0], regs[1], regs[2], regs[3] );
+#endif
+		}
+
+	// returns true if the os saves the xmm and ymm registers on context switches
+	static bool os_saves_ymm_registers()
+		{
+#ifdef _MSC_VER
+		return ( _xgetbv( 0 ) & 0x6 ) == 0x6;
+#else
+		u32 eax = 0, edx = 0;
+		__asm__( "xgetbv" : "=a"( eax ), "=d"( edx ) : "c"( 0 ) );
+		return ( eax & 0x6 ) == 0x6;
+#endif
+		}
+
+	static cpu_features detect_cpu_features()
+		{
+		cpu_features features;
+
+		u32 regs[4] = {};
+		cpuid( 0, 0, regs );
+		const u32 max_function_id = regs[0];
+		if( max_function_id < 1 )
+			return features;
+
+		cpuid( 1, 0, regs );
+		features.ssse3 = ( regs[2] & ( 1 << 9 ) ) != 0;
+		features.sse41 = ( regs[2] & ( 1 << 19 ) ) != 0;
+		const bool has_osxsave = ( regs[2] & ( 1 << 27 ) ) != 0;
+		const bool has_avx = ( regs[2] & ( 1 << 28 ) ) != 0;
+
+		if( max_function_id >= 7 )
+			{
+			cpuid( 7, 0, regs );
+			features.avx2 = has_osxsave && has_avx && ( regs[1] & ( 1 << 5 ) ) != 0 && os_saves_ymm_registers();
+			features.sha = ( regs[1] & ( 1 << 29 ) ) != 0;
+			}
+
+		return features;
+		}
+#else
+	static cpu_features detect_cpu_features()
+		{
+		return cpu_features();
+		}
+#endif
+
+	const cpu_features &get_cpu_features()
+		{
+		static const cpu_features features = detect_cpu_features();
+		return features;
+		}
+	};
@@ -0,0 +1,39 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#pragma once
+
+#include "ISD_Types.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define ISD_CPU_X86
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define ISD_CPU_NEON
+#endif
+
+// gcc and clang need the target set on functions which use instruction set intrinsics 
+// that the rest of the library is not compiled for. msvc allows the intrinsics anywhere
+#if defined(ISD_CPU_X86) && !defined(_MSC_VER)
+#define ISD_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define ISD_TARGET_AVX2 __attribute__((target("avx2")))
+#define ISD_TARGET_SHANI __attribute__((target("sha,sse4.1,ssse3")))
+#else
+#define ISD_TARGET_SSSE3
+#define ISD_TARGET_AVX2
+#define ISD_TARGET_SHANI
+#endif
+
+namespace ISD
+	{
+	// the instruction set extensions which are supported by the cpu (and the os) that the process runs on
+	struct cpu_features
+		{
+		bool ssse3 = false;
+		bool sse41 = false;
+		bool avx2 = false;
+		bool sha = false; // the sha-ni extensions
+		};
+
+	// get the features of the cpu. the features are detected on the first call
+	const cpu_features &get_cpu_features();
+	};
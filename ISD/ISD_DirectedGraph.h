@@ -176,6 +176,11 @@ namespace ISD
 				return true;
 				}
 
+			static bool MeasureSerializedSize( const _MgmCl &obj, const EntityWriter &writer, u64 &dest_size, std::vector<u64> *dest_block_sizes = nullptr )
+				{
+				return writer.MeasureWrite( obj, dest_size, dest_block_sizes );
+				}
+
 			static bool Write( const _MgmCl &obj , EntityWriter &writer )
 				{
 				// store the roots 
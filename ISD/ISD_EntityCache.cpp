@@ -0,0 +1,114 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#include "ISD_EntityCache.h"
+#include "ISD.h"
+
+namespace ISD
+	{
+	u64 EntityCache::GetEntitySize( const Entity &entity )
+		{
+		return sizeof( Entity ) + entity.GetDataSize();
+		}
+
+	void EntityCache::Evict()
+		{
+		if( this->Budget == 0 )
+			{
+			return;
+			}
+
+		// walk from the least recently used. the handles are only copied while the mutex is held, so an entity
+		// which is only referenced by the cache can not be pinned while it is evicted.
+		// the most recently used entity is always kept, so an entity larger than the budget can still be loaded
+		entity_list::iterator it = this->Entities.end();
+		while( this->UsedBytes > this->Budget && it != this->Entities.begin() )
+			{
+			--it;
+			if( it == this->Entities.begin() )
+				{
+				break;
+				}
+			if( it->use_count() > 1 )
+				{
+				// pinned, skip
+				continue;
+				}
+
+			this->UsedBytes -= GetEntitySize( **it );
+			this->Lookup.erase( (*it)->GetUUID() );
+			if( this->EvictionCallback )
+				{
+				this->EvictionCallback( **it );
+				}
+			it = this->Entities.erase( it );
+			}
+		}
+
+	void EntityCache::SetEvictionCallback( const eviction_callback &callback )
+		{
+		std::lock_guard<std::mutex> guard( this->AccessMutex );
+		this->EvictionCallback = callback;
+		}
+
+	void EntityCache::SetBudget( u64 budget )
+		{
+		std::lock_guard<std::mutex> guard( this->AccessMutex );
+		this->Budget = budget;
+		this->Evict();
+		}
+
+	u64 EntityCache::GetBudget() const
+		{
+		std::lock_guard<std::mutex> guard( this->AccessMutex );
+		return this->Budget;
+		}
+
+	u64 EntityCache::GetUsedBytes() const
+		{
+		std::lock_guard<std::mutex> guard( this->AccessMutex );
+		return this->UsedBytes;
+		}
+
+	size_t EntityCache::GetEntityCount() const
+		{
+		std::lock_guard<std::mutex> guard( this->AccessMutex );
+		return this->Entities.size();
+		}
+
+	std::shared_ptr<const Entity> EntityCache::Find( const UUID &uuid )
+		{
+		std::lock_guard<std::mutex> guard( this->AccessMutex );
+		auto it = this->Lookup.find( uuid );
+		if( it == this->Lookup.end() )
+			{
+			return nullptr;
+			}
+
+		// move to the front of the list, as the most recently used
+		this->Entities.splice( this->Entities.begin(), this->Entities, it->second );
+		return *it->second;
+		}
+
+	bool EntityCache::Contains( const UUID &uuid ) const
+		{
+		std::lock_guard<std::mutex> guard( this->AccessMutex );
+		return this->Lookup.find( uuid ) != this->Lookup.end();
+		}
+
+	bool EntityCache::Insert( const std::shared_ptr<const Entity> &entity )
+		{
+		std::lock_guard<std::mutex> guard( this->AccessMutex );
+		if( this->Lookup.find( entity->GetUUID() ) != this->Lookup.end() )
+			{
+			return false;
+			}
+
+		this->Entities.push_front( entity );
+		this->Lookup.insert( std::make_pair( entity->GetUUID(), this->Entities.begin() ) );
+		this->UsedBytes += GetEntitySize( *entity );
+
+		this->Evict();
+		return true;
+		}
+	};
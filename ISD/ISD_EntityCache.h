@@ -0,0 +1,67 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#pragma once
+
+#include "ISD_Types.h"
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace ISD
+	{
+	class Entity;
+
+	// Cache of loaded entities, with a byte budget. When the budget is exceeded, the least recently used entities
+	// are evicted. The entities are handed out as shared pointers, and an entity is pinned for as long as any handle
+	// to it is alive, so eviction never frees an entity which is still used. Pinned entities can keep the cache over
+	// its budget, they are evicted later when they are unpinned and least recently used.
+	// All public methods are thread safe.
+	class EntityCache
+		{
+		public:
+			// called for each evicted entity. called while the cache is locked, so it must not call the cache
+			using eviction_callback = std::function<void( const Entity &entity )>;
+
+		private:
+			using entity_list = std::list<std::shared_ptr<const Entity>>;
+
+			mutable std::mutex AccessMutex;
+			entity_list Entities; // most recently used first
+			std::unordered_map<UUID, entity_list::iterator> Lookup;
+			u64 Budget = 0;
+			u64 UsedBytes = 0;
+			eviction_callback EvictionCallback;
+
+			// evict unpinned entities, from the least recently used, until the cache is within the budget. the mutex must be held
+			void Evict();
+
+		public:
+			// the size in bytes that an entity is accounted for in the cache
+			static u64 GetEntitySize( const Entity &entity );
+
+			// set the callback which is called for each evicted entity. should be set before the cache is used
+			void SetEvictionCallback( const eviction_callback &callback );
+
+			// set the budget in bytes. 0 means unlimited (the default). lowering the budget evicts entities directly
+			void SetBudget( u64 budget );
+			u64 GetBudget() const;
+
+			// the number of bytes and entities in the cache, including pinned entities
+			u64 GetUsedBytes() const;
+			size_t GetEntityCount() const;
+
+			// find the entity, and mark it as most recently used. returns nullptr if the entity is not in the cache
+			std::shared_ptr<const Entity> Find( const UUID &uuid );
+
+			// returns true if the entity is in the cache, without changing its use order
+			bool Contains( const UUID &uuid ) const;
+
+			// add the entity as the most recently used, and evict to stay within the budget.
+			// returns false if an entity with the same uuid is already in the cache
+			bool Insert( const std::shared_ptr<const Entity> &entity );
+		};
+	};
@@ -0,0 +1,207 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#include "ISD_EntityDependencies.h"
+#include "ISD_MemoryReadStream.h"
+
+namespace ISD
+	{
+	// the deepest nesting of sections which is walked, to guard against malformed data
+	static const uint max_section_depth = 64;
+
+	// returns true if all the bytes are printable characters, as used in keys
+	static bool is_key_data( const u8 *data, u64 size )
+		{
+		for( u64 i = 0; i < size; ++i )
+			{
+			if( data[i] < 0x20 || data[i] > 0x7e )
+				return false;
+			}
+		return true;
+		}
+
+	static void add_package_ref( const u8 *data, std::vector<hash> &dest_refs )
+		{
+		hash ref;
+		memcpy( &ref, data, sizeof( hash ) );
+		if( ref != hash_zero )
+			{
+			dest_refs.push_back( ref );
+			}
+		}
+
+	// skip over the array header, up to the items. returns false if the header is malformed
+	static bool skip_array_header( MemoryReadStream &sstream, u64 block_end_position, u64 &out_per_item_size, u64 &out_item_count )
+		{
+		if( sstream.GetPosition() + sizeof( u16 ) + sizeof( u64 ) > block_end_position )
+			{
+			return false;
+			}
+		const u16 array_flags = sstream.Read<u16>();
+		out_per_item_size = array_flags & 0xff;
+		out_item_count = sstream.Read<u64>();
+
+		if( array_flags & 0x200 )
+			{
+			// 64 bit index, not supported
+			return false;
+			}
+		if( array_flags & 0x100 )
+			{
+			if( sstream.GetPosition() + sizeof( u64 ) > block_end_position )
+				{
+				return false;
+				}
+			const u64 index_count = sstream.Read<u64>();
+			if( index_count > ( block_end_position - sstream.GetPosition() ) / sizeof( i32 ) )
+				{
+				return false;
+				}
+			sstream.SetPosition( sstream.GetPosition() + index_count * sizeof( i32 ) );
+			}
+		if( array_flags & 0x400 )
+			{
+			if( sstream.GetPosition() + sizeof( u8 ) > block_end_position )
+				{
+				return false;
+				}
+			const u64 padding = sstream.Read<u8>();
+			if( sstream.GetPosition() + padding > block_end_position )
+				{
+				return false;
+				}
+			sstream.SetPosition( sstream.GetPosition() + padding );
+			}
+		return true;
+		}
+
+	// walk the blocks up to end_position, and collect the refs
+	static bool collect_package_refs_in_blocks( MemoryReadStream &sstream, u64 end_position, uint depth, std::vector<hash> &dest_refs )
+		{
+		if( depth > max_section_depth )
+			{
+			return false;
+			}
+
+		while( sstream.GetPosition() < end_position )
+			{
+			const u8 value_type = sstream.Read<u8>();
+
+			// small blocks
+			if( value_type < 0x40 )
+				{
+				if( sstream.GetPosition() + sizeof( u8 ) > end_position )
+					{
+					return false;
+					}
+				const u64 block_size = sstream.Read<u8>();
+				if( sstream.GetPosition() + block_size > end_position )
+					{
+					return false;
+					}
+				const u8 *block_data = sstream.ReadRawDataView( block_size );
+				if( value_type == (u8)ValueType::VT_Hash && block_size >= sizeof( hash ) )
+					{
+					// an empty value only has the key
+					const bool is_empty = ( block_size <= EntityMaxKeyLength ) && is_key_data( block_data, block_size );
+					if( !is_empty )
+						{
+						add_package_ref( block_data, dest_refs );
+						}
+					}
+				continue;
+				}
+
+			// large blocks
+			if( sstream.GetPosition() + sizeof( u64 ) + sizeof( u8 ) > end_position )
+				{
+				return false;
+				}
+			const u64 block_size = sstream.Read<u64>();
+			if( block_size > end_position - sstream.GetPosition() )
+				{
+				return false;
+				}
+			const u64 block_end_position = sstream.GetPosition() + block_size;
+			const u64 key_size = sstream.Read<u8>();
+			if( sstream.GetPosition() + key_size > block_end_position )
+				{
+				return false;
+				}
+			sstream.SetPosition( sstream.GetPosition() + key_size );
+
+			// empty (null) values have no data after the key
+			if( sstream.GetPosition() < block_end_position )
+				{
+				if( value_type == (u8)ValueType::VT_Subsection )
+					{
+					if( !collect_package_refs_in_blocks( sstream, block_end_position, depth + 1, dest_refs ) )
+						{
+						return false;
+						}
+					}
+				else if( value_type == (u8)ValueType::VT_Array_Subsection )
+					{
+					u64 per_item_size = 0;
+					u64 item_count = 0;
+					if( !skip_array_header( sstream, block_end_position, per_item_size, item_count ) )
+						{
+						return false;
+						}
+					for( u64 i = 0; i < item_count; ++i )
+						{
+						if( sstream.GetPosition() + sizeof( u64 ) > block_end_position )
+							{
+							return false;
+							}
+						const u64 section_size = sstream.Read<u64>();
+						if( section_size > block_end_position - sstream.GetPosition() )
+							{
+							return false;
+							}
+						if( !collect_package_refs_in_blocks( sstream, sstream.GetPosition() + section_size, depth + 1, dest_refs ) )
+							{
+							return false;
+							}
+						}
+					}
+				else if( value_type == (u8)ValueType::VT_Array_Hash )
+					{
+					u64 per_item_size = 0;
+					u64 item_count = 0;
+					if( !skip_array_header( sstream, block_end_position, per_item_size, item_count )
+						|| per_item_size != sizeof( hash )
+						|| item_count > ( block_end_position - sstream.GetPosition() ) / sizeof( hash ) )
+						{
+						return false;
+						}
+					const u8 *items = sstream.ReadRawDataView( item_count * sizeof( hash ) );
+					for( u64 i = 0; i < item_count; ++i )
+						{
+						add_package_ref( &items[i * sizeof( hash )], dest_refs );
+						}
+					}
+				}
+
+			// move to the end of the block, skipping any data which is not walked
+			if( sstream.GetPosition() > block_end_position )
+				{
+				return false;
+				}
+			sstream.SetPosition( block_end_position );
+			}
+
+		return sstream.GetPosition() == end_position;
+		}
+
+	Status collect_package_refs( const u8 *data, u64 data_size, std::vector<hash> &dest_refs )
+		{
+		MemoryReadStream sstream( data, data_size );
+		if( !collect_package_refs_in_blocks( sstream, data_size, 0, dest_refs ) )
+			{
+			ISDErrorLog << "The blocks of the entity data are malformed" << ISDErrorLogEnd;
+			return Status::EInvalid;
+			}
+		return Status::Ok;
+		}
+	};
@@ -0,0 +1,17 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#pragma once
+
+#include "ISD_Types.h"
+
+namespace ISD
+	{
+	// Collect the package_refs of serialized entity data, without decoding the entity. The blocks of the data are walked
+	// generically, including nested sections and arrays of sections, and all VT_Hash values and VT_Array_Hash items
+	// are added to dest_refs (package_refs are stored as hashes). Zero hashes (null refs) are skipped, and the refs
+	// are added in the order they are found, including duplicates. The data must be in the byte order of the system.
+	// Since an empty VT_Hash block only contains the key, a block of 32 to 40 bytes which is all key characters is
+	// taken to be an empty value. Returns EInvalid if the blocks are malformed, the refs found before the error are kept.
+	Status collect_package_refs( const u8 *data, u64 data_size, std::vector<hash> &dest_refs );
+	};
@@ -5,6 +5,9 @@
 #include "ISD_MemoryReadStream.h"
 #include "ISD_Log.h"
 #include "ISD_DataValuePointers.h"
+#include "ISD_parallel_for.h"
+
+#include <algorithm>
 
 // value_type: the ValueType enum to read the block as
 // object_type: the C++ object that stores the data (can be a basic type), such as u32, or glm::vec3
@@ -78,6 +81,304 @@ namespace ISD
 		return (end_pos == expected_end_pos); // make sure we have read in the full block
 		}
 
+	// the size of a directory block without entries: the block header with an empty key, the entry count, the directory size and the magic value
+	const u64 directory_block_base_size = 10 + sizeof( u64 ) * 3;
+
+	// find the directory block at the end of the section which ends at end_pos, and check that it is consistent. 
+	// returns the stream position of the directory block, or 0 if the section has no directory. moves the stream position
+	u64 find_directory_block( MemoryReadStream &sstream, u64 end_pos, u64 &dest_entry_count )
+		{
+		if( end_pos < directory_block_base_size || end_pos > sstream.GetSize() )
+			{
+			return 0;
+			}
+
+		// the size and magic value are the last values of the directory
+		sstream.SetPosition( end_pos - sizeof( u64 ) * 2 );
+		const u64 directory_size = sstream.Read<u64>();
+		const u64 magic = sstream.Read<u64>();
+		if( magic != EntityDirectoryMagic 
+			|| directory_size < directory_block_base_size 
+			|| directory_size > end_pos 
+			|| ( directory_size - directory_block_base_size ) % ( sizeof( u64 ) * 2 ) != 0 )
+			{
+			return 0;
+			}
+
+		// check the block header and the entry count
+		const u64 directory_pos = end_pos - directory_size;
+		sstream.SetPosition( directory_pos );
+		const u8 value_type = sstream.Read<u8>();
+		const u64 block_size = sstream.Read<u64>();
+		const u8 key_size_in_bytes = sstream.Read<u8>();
+		const u64 entry_count = sstream.Read<u64>();
+		if( value_type != (u8)ValueType::VT_Directory 
+			|| block_size != directory_size - 9 
+			|| key_size_in_bytes != 0 
+			|| entry_count != ( directory_size - directory_block_base_size ) / ( sizeof( u64 ) * 2 ) )
+			{
+			return 0;
+			}
+
+		dest_entry_count = entry_count;
+		return directory_pos;
+		}
+
+	// called before the end of a section is checked. the sequential reads do not read the directory at the end of the section, 
+	// so move past it. if Seek was used in the section, the values may have been read in any order, and with tolerant reading,
+	// values which are not known by the reader may be left at the end. in both cases, move_to_end is set to move to the end of the section
+	void end_read_section_values( MemoryReadStream &sstream, u64 end_pos, bool move_to_end )
+		{
+		const u64 start_pos = sstream.GetPosition();
+		if( move_to_end )
+			{
+			sstream.SetPosition( end_pos );
+			return;
+			}
+		if( start_pos < end_pos && sstream.Peek() == (u8)ValueType::VT_Directory )
+			{
+			u64 entry_count = 0;
+			if( find_directory_block( sstream, end_pos, entry_count ) == start_pos )
+				{
+				sstream.SetPosition( end_pos );
+				return;
+				}
+			sstream.SetPosition( start_pos );
+			}
+		}
+
+	// find the block of the value type and key among the blocks from the current position up to end_pos, skipping over the blocks before it,
+	// which are values that the reader does not know of. small_value_size is the size of the value in small blocks (which can also be empty).
+	// if the block is found, the stream is positioned at the block and true is returned, otherwise the stream is not moved
+	bool find_value_block( MemoryReadStream &sstream, u64 end_pos, ValueType VT, const char *key, const u8 key_size_in_bytes, const u64 small_value_size )
+		{
+		const u64 start_pos = sstream.GetPosition();
+		if( end_pos > sstream.GetSize() )
+			{
+			end_pos = sstream.GetSize();
+			}
+
+		u64 block_pos = start_pos;
+		while( block_pos < end_pos )
+			{
+			// read the block header, blocks of types below 0x40 are small blocks, the rest are large blocks
+			sstream.SetPosition( block_pos );
+			const u8 value_type = sstream.Read<u8>();
+			const bool is_small_block = value_type < 0x40;
+			const u64 header_size = is_small_block ? ( sizeof( u8 ) * 2 ) : ( sizeof( u8 ) + sizeof( u64 ) );
+			if( header_size > end_pos - block_pos )
+				{
+				break;
+				}
+			const u64 block_size = is_small_block ? (u64)sstream.Read<u8>() : sstream.Read<u64>();
+			if( block_size > end_pos - block_pos - header_size )
+				{
+				break;
+				}
+			const u64 block_end_pos = block_pos + header_size + block_size;
+
+			// check the key. small blocks have the key after the value, large blocks have the key length and key first
+			const u8 *read_key = nullptr;
+			if( value_type == (u8)VT )
+				{
+				if( is_small_block )
+					{
+					if( block_size == key_size_in_bytes || block_size == small_value_size + key_size_in_bytes )
+						{
+						sstream.SetPosition( block_end_pos - key_size_in_bytes );
+						read_key = sstream.ReadRawDataView( key_size_in_bytes );
+						}
+					}
+				else if( block_size > key_size_in_bytes && sstream.Read<u8>() == key_size_in_bytes )
+					{
+					read_key = sstream.ReadRawDataView( key_size_in_bytes );
+					}
+				}
+			if( read_key && memcmp( read_key, key, key_size_in_bytes ) == 0 )
+				{
+				sstream.SetPosition( block_pos );
+				return true;
+				}
+
+			block_pos = block_end_pos;
+			}
+
+		sstream.SetPosition( start_pos );
+		return false;
+		}
+
+	// returns true if the block at block_pos has the key, without knowing the value type of the block. small blocks have the key
+	// in the last bytes of the block, large blocks have the key length and key first. the stream position is not restored
+	bool block_has_key( MemoryReadStream &sstream, u64 block_pos, u64 end_pos, const char *key, const u8 key_size_in_bytes )
+		{
+		if( end_pos > sstream.GetSize() || block_pos >= end_pos )
+			{
+			return false;
+			}
+		sstream.SetPosition( block_pos );
+		const u8 value_type = sstream.Read<u8>();
+		const bool is_small_block = value_type < 0x40;
+		const u64 header_size = is_small_block ? ( sizeof( u8 ) * 2 ) : ( sizeof( u8 ) + sizeof( u64 ) );
+		if( header_size > end_pos - block_pos )
+			{
+			return false;
+			}
+		const u64 block_size = is_small_block ? (u64)sstream.Read<u8>() : sstream.Read<u64>();
+		if( block_size > end_pos - block_pos - header_size )
+			{
+			return false;
+			}
+
+		const u8 *read_key = nullptr;
+		if( is_small_block )
+			{
+			if( block_size >= key_size_in_bytes )
+				{
+				sstream.SetPosition( block_pos + header_size + block_size - key_size_in_bytes );
+				read_key = sstream.ReadRawDataView( key_size_in_bytes );
+				}
+			}
+		else if( block_size > key_size_in_bytes && sstream.Read<u8>() == key_size_in_bytes )
+			{
+			read_key = sstream.ReadRawDataView( key_size_in_bytes );
+			}
+		return read_key && memcmp( read_key, key, key_size_in_bytes ) == 0;
+		}
+
+	// the deepest nesting of sections which is validated by validate_section_framing, to guard against malformed data
+	const uint max_validated_section_depth = 64;
+
+	// skip over the header of an array, up to the items. returns false if the header does not fit in the block
+	bool skip_array_header( MemoryReadStream &sstream, u64 block_end_position, u64 &out_item_count )
+		{
+		if( sstream.GetPosition() + sizeof( u16 ) + sizeof( u64 ) > block_end_position )
+			{
+			return false;
+			}
+		const u16 array_flags = sstream.Read<u16>();
+		out_item_count = sstream.Read<u64>();
+		if( array_flags & 0x100 )
+			{
+			if( sstream.GetPosition() + sizeof( u64 ) > block_end_position )
+				{
+				return false;
+				}
+			const u64 index_count = sstream.Read<u64>();
+			if( index_count > ( block_end_position - sstream.GetPosition() ) / sizeof( i32 ) )
+				{
+				return false;
+				}
+			sstream.SetPosition( sstream.GetPosition() + index_count * sizeof( i32 ) );
+			}
+		if( array_flags & 0x400 )
+			{
+			if( sstream.GetPosition() + sizeof( u8 ) > block_end_position )
+				{
+				return false;
+				}
+			const u64 padding = sstream.Read<u8>();
+			if( sstream.GetPosition() + padding > block_end_position )
+				{
+				return false;
+				}
+			sstream.SetPosition( sstream.GetPosition() + padding );
+			}
+		return true;
+		}
+
+	// check the framing of the blocks from the current position up to end_pos, without decoding any values: every block must fit 
+	// in its section, the keys of large blocks must fit in their blocks, and the blocks must end exactly at end_pos. nested sections
+	// and the sections of sections arrays are checked as well. the stream is left at an undefined position
+	bool validate_section_framing( MemoryReadStream &sstream, u64 end_pos, uint depth )
+		{
+		if( depth > max_validated_section_depth || end_pos > sstream.GetSize() )
+			{
+			return false;
+			}
+
+		while( sstream.GetPosition() < end_pos )
+			{
+			const u8 value_type = sstream.Read<u8>();
+
+			// small blocks
+			if( value_type < 0x40 )
+				{
+				if( sstream.GetPosition() + sizeof( u8 ) > end_pos )
+					{
+					return false;
+					}
+				const u64 block_size = sstream.Read<u8>();
+				if( block_size > end_pos - sstream.GetPosition() )
+					{
+					return false;
+					}
+				sstream.SetPosition( sstream.GetPosition() + block_size );
+				continue;
+				}
+
+			// large blocks
+			if( sstream.GetPosition() + sizeof( u64 ) + sizeof( u8 ) > end_pos )
+				{
+				return false;
+				}
+			const u64 block_size = sstream.Read<u64>();
+			if( block_size > end_pos - sstream.GetPosition() )
+				{
+				return false;
+				}
+			const u64 block_end_pos = sstream.GetPosition() + block_size;
+			const u64 key_size = sstream.Read<u8>();
+			if( key_size > EntityMaxKeyLength || sstream.GetPosition() + key_size > block_end_pos )
+				{
+				return false;
+				}
+			sstream.SetPosition( sstream.GetPosition() + key_size );
+
+			// empty (null) values have no data after the key
+			if( sstream.GetPosition() < block_end_pos )
+				{
+				if( value_type == (u8)ValueType::VT_Subsection )
+					{
+					if( !validate_section_framing( sstream, block_end_pos, depth + 1 ) )
+						{
+						return false;
+						}
+					}
+				else if( value_type == (u8)ValueType::VT_Array_Subsection )
+					{
+					u64 item_count = 0;
+					if( !skip_array_header( sstream, block_end_pos, item_count ) )
+						{
+						return false;
+						}
+					for( u64 i = 0; i < item_count; ++i )
+						{
+						if( sstream.GetPosition() + sizeof( u64 ) > block_end_pos )
+							{
+							return false;
+							}
+						const u64 section_size = sstream.Read<u64>();
+						if( section_size > block_end_pos - sstream.GetPosition() )
+							{
+							return false;
+							}
+						if( !validate_section_framing( sstream, sstream.GetPosition() + section_size, depth + 1 ) )
+							{
+							return false;
+							}
+						}
+					if( sstream.GetPosition() != block_end_pos )
+						{
+						return false;
+						}
+					}
+				}
+			sstream.SetPosition( block_end_pos );
+			}
+
+		return sstream.GetPosition() == end_pos;
+		}
+
 	// template method that Reads a small block of a specific ValueType VT to the stream. Since most value types 
 	// can have different bit depths, the second parameter I is the actual type of the data stored. The data can have more than one values of type I, the count is stored in IC.
 	template<ValueType VT, class T> reader_status read_single_item( MemoryReadStream &sstream, const char *key, const u8 key_size_in_bytes, const bool empty_value_is_allowed, T *dest_data )
@@ -280,8 +581,40 @@ namespace ISD
 			}
 		}
 
+	// reads the index values of an array into the dest vector
+	bool read_array_index_values( MemoryReadStream &sstream, std::vector<i32> *dest_index, const u64 index_count )
+		{
+		// resize the dest vector
+		dest_index->resize( index_count );
+
+		// read in the data
+		i32 *p_index_data = dest_index->data();
+		sstream.Read( p_index_data, index_count );
+		return true;
+		}
+
+	// sets up a view of the index values of an array, pointing directly into the stream. 
+	// only possible if the byte order is not flipped, and the index values are aligned in memory
+	bool read_array_index_values( MemoryReadStream &sstream, array_view<i32> *dest_index, const u64 index_count )
+		{
+		if( sstream.GetFlipByteOrder() )
+			{
+			return false;
+			}
+
+		const u8 *p_index_data = sstream.ReadRawDataView( index_count * sizeof( i32 ) );
+		if( !p_index_data || ((uintptr_t)p_index_data % alignof( i32 )) != 0 )
+			{
+			return false;
+			}
+
+		*dest_index = array_view<i32>( (const i32 *)p_index_data, (size_t)index_count );
+		return true;
+		}
+
 	// reads an array header and value size from the stream, and decodes into flags, then reads the index if one exists. 
-	bool read_array_metadata_and_index( MemoryReadStream &sstream, size_t &out_per_item_size, size_t &out_item_count, const u64 block_end_position , std::vector<i32> *dest_index )
+	// the index is either read into an std::vector<i32>, or set up as an array_view<i32> into the stream
+	template<class I> bool read_array_metadata_and_index( MemoryReadStream &sstream, size_t &out_per_item_size, size_t &out_item_count, const u64 block_end_position , I *dest_index )
 		{
 		static_assert(sizeof( u64 ) <= sizeof( size_t ), "Unsupported size_t, current code requires it to be at least 8 bytes in size, equal to u64");
 
@@ -292,6 +625,7 @@ namespace ISD
 		out_per_item_size = (size_t)(array_flags & 0xff);
 		const bool has_index = (array_flags & 0x100) != 0;
 		const bool index_is_64bit = (array_flags & 0x200) != 0;
+		const bool has_padding = (array_flags & 0x400) != 0;
 
 		// we don't support 64 bit index (yet)
 		if( index_is_64bit )
@@ -323,12 +657,11 @@ namespace ISD
 				return false;
 				}
 
-			// resize the dest vector
-			dest_index->resize( index_count );
-
-			// read in the data
-			i32 *p_index_data = dest_index->data();
-			sstream.Read( p_index_data, index_count );
+			// read in the index values
+			if( !read_array_index_values( sstream, dest_index, index_count ) )
+				{
+				return false;
+				}
 
 			// modify the expected end position
 			expected_end_position += sizeof( u64 ) + (index_count * sizeof( i32 ));
@@ -343,6 +676,21 @@ namespace ISD
 				}
 			}
 
+		// if the values are padded, skip over the padding
+		if( has_padding )
+			{
+			const u64 padding = sstream.Read<u8>();
+			if( sstream.GetPosition() + padding > block_end_position )
+				{
+				ISDErrorLog << "The array padding in the stream is invalid, it is beyond the size of the block" << ISDErrorLogEnd;
+				return false;
+				}
+			sstream.SetPosition( sstream.GetPosition() + padding );
+
+			// modify the expected end position
+			expected_end_position += sizeof( u8 ) + padding;
+			}
+
 		if( expected_end_position != sstream.GetPosition() )
 			{
 			ISDErrorLog << "Failed to read full array header from block." << ISDErrorLogEnd;
@@ -418,6 +766,93 @@ namespace ISD
 		return reader_status::success;
 		}
 
+	// reads an array block as views pointing directly into the stream data, without copying the values.
+	// the views are only possible if the byte order of the stream is not flipped, and the values (and index) are aligned in memory.
+	template<ValueType VT, class T> reader_status read_array_view_data( MemoryReadStream &sstream, const char *key, const u8 key_size_in_bytes, array_view<T> *dest_items, array_view<i32> *dest_index )
+		{
+		static_assert((VT >= ValueType::VT_Array_Bool) && (VT <= ValueType::VT_Array_Hash), "Invalid type for generic read_array_view_data template");
+		const size_t value_size = sizeof( data_type_information<T>::value_type );
+
+		ISDSanityCheckCoreDebugMacro( dest_items );
+
+		if( sstream.GetFlipByteOrder() )
+			{
+			return reader_status::fail;
+			}
+
+		// read block header. if we are already at the end, the block is empty, so return empty views
+		const u64 block_end_position = begin_read_large_block( sstream, VT, key, key_size_in_bytes );
+		if( block_end_position == 0 )
+			{
+			ISDErrorLog << "begin_read_large_block() failed unexpectedly" << ISDErrorLogEnd;
+			return reader_status::fail;
+			}
+		else if( block_end_position == sstream.GetPosition() )
+			{
+			dest_items->clear();
+			if( dest_index )
+				dest_index->clear();
+			return reader_status::success_empty;
+			}
+
+		// read item size & count and set up the index view if it exists, or make sure we do not expect an index
+		size_t per_item_size = 0;
+		size_t item_count = 0;
+		if( !read_array_metadata_and_index( sstream, per_item_size, item_count, block_end_position, dest_index ) )
+			{
+			return reader_status::fail;
+			}
+
+		// make sure we have the right item size
+		if( value_size != per_item_size )
+			{
+			ISDErrorLog << "The size of the items in the stream does not match the expected size" << ISDErrorLogEnd;
+			return reader_status::fail;
+			}
+
+		// make sure the item count is plausible
+		const u64 maximum_possible_item_count = (block_end_position - sstream.GetPosition()) / value_size;
+		if( item_count > maximum_possible_item_count )
+			{
+			ISDErrorLog << "The array item count in the stream is invalid, it is beyond the size of the block" << ISDErrorLogEnd;
+			return reader_status::fail;
+			}
+
+		// set up the view of the values, if they are aligned
+		const u8 *p_data = sstream.ReadRawDataView( item_count * value_size );
+		if( !p_data || ((uintptr_t)p_data % alignof( T )) != 0 )
+			{
+			return reader_status::fail;
+			}
+		const u64 type_count = item_count / data_type_information<T>::value_count;
+		*dest_items = array_view<T>( (const T *)p_data, (size_t)type_count );
+
+		// make sure we are at the expected end pos
+		if( !end_read_large_block( sstream, block_end_position ) )
+			{
+			ISDErrorLog << "End position of data " << sstream.GetPosition() << " does not equal the expected end position which is " << block_end_position << ISDErrorLogEnd;
+			return reader_status::fail;
+			}
+
+		return reader_status::success;
+		}
+
+	// reads an array block as views, see read_array_view_data. if the views are not possible, (or the 
+	// read fails) the stream position is restored, so the caller can fall back to reading with read_array
+	template<ValueType VT, class T> bool read_array_view( MemoryReadStream &sstream, const char *key, const u8 key_size_in_bytes, array_view<T> *dest_items, array_view<i32> *dest_index )
+		{
+		const u64 start_position = sstream.GetPosition();
+		if( read_array_view_data<VT,T>( sstream, key, key_size_in_bytes, dest_items, dest_index ) == reader_status::fail )
+			{
+			sstream.SetPosition( start_position );
+			dest_items->clear();
+			if( dest_index )
+				dest_index->clear();
+			return false;
+			}
+		return true;
+		}
+
 	// read_array implementation for bool arrays (which need specific packing)
 	template <> reader_status read_array<ValueType::VT_Array_Bool, bool>( MemoryReadStream &sstream, const char *key, const u8 key_size_in_bytes, const bool empty_value_is_allowed, std::vector<bool> *dest_items, std::vector<i32> *dest_index )
 		{
@@ -557,9 +992,200 @@ namespace ISD
 		return reader_status::success;
 		}
 
+	void EntityReader::SetTolerantReading( bool value )
+		{
+		this->tolerant_reading = value;
+		}
+
+	bool EntityReader::GetTolerantReading() const
+		{
+		return this->tolerant_reading;
+		}
+
+	void EntityReader::SetParallelThreadCount( uint thread_count )
+		{
+		this->parallel_thread_count = thread_count;
+		}
+
+	uint EntityReader::GetParallelThreadCount() const
+		{
+		return this->parallel_thread_count;
+		}
+
+	void EntityReader::SetLazyReading( bool value )
+		{
+		this->lazy_reading = value;
+		}
+
+	bool EntityReader::GetLazyReading() const
+		{
+		return this->lazy_reading;
+		}
+
+	bool EntityReader::skip_to_value( ValueType VT, const char *key, const u8 key_length, const u64 small_value_size )
+		{
+		if( !this->tolerant_reading )
+			{
+			return true;
+			}
+
+		// values are looked for up to the end of the section. sections arrays have no values of their own
+		if( this->section_end_position == 0 )
+			{
+			return true;
+			}
+		return find_value_block( this->sstream, this->section_end_position, VT, key, key_length, small_value_size );
+		}
+
+	bool EntityReader::ReadFixedLayout( const EntityFixedLayout &layout, void * const *dest_values )
+		{
+		ISDSanityCheckCoreDebugMacro( dest_values );
+
+		// the whole run must be within the section
+		const u64 start_pos = this->sstream.GetPosition();
+		if( start_pos > this->end_position || layout.size > this->end_position - start_pos )
+			{
+			return false;
+			}
+		const u8 *data = this->sstream.ReadRawDataView( layout.size );
+		if( !data )
+			{
+			return false;
+			}
+
+		// validate the fingerprint of the whole run before any value is read, so nothing is changed if the layout differs
+		const u8 *fingerprint = layout.fingerprint;
+		for( size_t field_index = 0; field_index < layout.field_count; ++field_index )
+			{
+			const EntityFixedLayoutField &field = layout.fields[field_index];
+			if( memcmp( &data[field.value_offset - 2], fingerprint, 2 ) != 0
+				|| memcmp( &data[field.value_offset + field.value_size], &fingerprint[2], field.key_size ) != 0 )
+				{
+				this->sstream.SetPosition( start_pos );
+				return false;
+				}
+			fingerprint += 2 + field.key_size;
+			}
+
+		// copy the values from their offsets
+		const bool flip_byte_order = this->sstream.GetFlipByteOrder();
+		for( size_t field_index = 0; field_index < layout.field_count; ++field_index )
+			{
+			const EntityFixedLayoutField &field = layout.fields[field_index];
+			const u8 *src = &data[field.value_offset];
+			void *dest = dest_values[field_index];
+			if( !flip_byte_order || field.item_size == 1 )
+				{
+				memcpy( dest, src, field.value_size );
+				}
+			else if( field.item_size == 2 )
+				{
+				copy_and_swap_byte_order<u16>( (u16 *)dest, (const u16 *)src, field.value_size / 2 );
+				}
+			else if( field.item_size == 4 )
+				{
+				copy_and_swap_byte_order<u32>( (u32 *)dest, (const u32 *)src, field.value_size / 4 );
+				}
+			else
+				{
+				copy_and_swap_byte_order<u64>( (u64 *)dest, (const u64 *)src, field.value_size / 8 );
+				}
+			}
+
+		return true;
+		}
+
+	bool EntityReader::Seek( const char *key, const u8 key_length )
+		{
+		if( this->active_subsection )
+			{
+			ISDErrorLog << "Can not seek while there is an active subsection." << ISDErrorLogEnd;
+			return false;
+			}
+
+		const u64 start_pos = sstream.GetPosition();
+		u64 entry_count = 0;
+		const u64 directory_pos = find_directory_block( this->sstream, this->section_end_position, entry_count );
+		if( directory_pos == 0 )
+			{
+			sstream.SetPosition( start_pos );
+			return false;
+			}
+
+		// binary search of the entries for the key hash
+		const u64 entries_pos = directory_pos + 10 + sizeof( u64 );
+		const u64 entry_size = sizeof( u64 ) * 2;
+		const u64 key_hash = directory_key_hash( key, key_length );
+		u64 first = 0;
+		u64 count = entry_count;
+		while( count > 0 )
+			{
+			const u64 step = count / 2;
+			const u64 middle = first + step;
+			sstream.SetPosition( entries_pos + middle * entry_size );
+			if( sstream.Read<u64>() < key_hash )
+				{
+				first = middle + 1;
+				count -= step + 1;
+				}
+			else
+				{
+				count = step;
+				}
+			}
+
+		// different keys can have the same hash, so check the key of the value of each entry with the hash, and move to the 
+		// value which has the key
+		for( u64 index = first; index < entry_count; ++index )
+			{
+			sstream.SetPosition( entries_pos + index * entry_size );
+			const u64 entry_key_hash = sstream.Read<u64>();
+			const u64 entry_offset = sstream.Read<u64>();
+			if( entry_key_hash != key_hash )
+				{
+				break;
+				}
+			if( entry_offset <= directory_pos
+				&& block_has_key( this->sstream, directory_pos - entry_offset, directory_pos, key, key_length ) )
+				{
+				sstream.SetPosition( directory_pos - entry_offset );
+				this->section_was_seeked = true;
+				return true;
+				}
+			}
+
+		sstream.SetPosition( start_pos );
+		return false;
+		}
+
 	// Read a section. 
 	// If the section is null, the section is directly closed, nullptr+success is returned 
 	// from BeginReadSection, and EndReadSection shall not be called.
+	EntityReader *EntityReader::begin_subsection( const u64 end_of_section )
+		{
+		// the reader is allocated by the first subsection, and is then kept for all the following subsections
+		if( !this->subsection_reader )
+			{
+			this->subsection_reader = std::unique_ptr<EntityReader>( new EntityReader( this->sstream, end_of_section ) );
+			}
+
+		// reset the reader to the state of a new reader, but keep its own subsection reader
+		EntityReader *subsection = this->subsection_reader.get();
+		subsection->end_position = end_of_section;
+		subsection->active_subsection = nullptr;
+		subsection->active_subsection_array_size = 0;
+		subsection->active_subsection_index = ~0;
+		subsection->active_subsection_end_pos = 0;
+		subsection->section_end_position = end_of_section;
+		subsection->section_was_seeked = false;
+		subsection->tolerant_reading = this->tolerant_reading;
+		subsection->lazy_reading = this->lazy_reading;
+		subsection->parallel_thread_count = this->parallel_thread_count;
+
+		this->active_subsection = subsection;
+		return subsection;
+		}
+
 	std::tuple<EntityReader *, bool> EntityReader::BeginReadSection( const char *key, const u8 key_length, const bool null_section_is_allowed )
 		{
 		if( this->active_subsection )
@@ -568,6 +1194,12 @@ namespace ISD
 			return std::tuple<EntityReader *, bool>( nullptr, false );
 			}
 
+		// a missing section is read as a null section, if it is allowed
+		if( !this->skip_to_value( ValueType::VT_Subsection, key, key_length, 0 ) && null_section_is_allowed )
+			{
+			return std::tuple<EntityReader *, bool>( nullptr, true );
+			}
+
 		// read block header
 		const u64 end_of_section = begin_read_large_block( sstream, ValueType::VT_Subsection, key, key_length );
 		if( end_of_section == 0 )
@@ -584,30 +1216,81 @@ namespace ISD
 			return std::tuple<EntityReader *, bool>( nullptr, true );
 			}
 
-		// allocate the subsection and return it to the caller to be used to read items in the subsection
-		this->active_subsection = std::unique_ptr<EntityReader>( new EntityReader( this->sstream , end_of_section ) );
-		return std::tuple<EntityReader *, bool>( this->active_subsection.get(), true );
+		// set up the subsection and return it to the caller to be used to read items in the subsection
+		return std::tuple<EntityReader *, bool>( this->begin_subsection( end_of_section ), true );
 		}
 
 	bool EntityReader::EndReadSection( const EntityReader *section_reader )
 		{
-		if( section_reader != this->active_subsection.get() )
+		if( section_reader != this->active_subsection )
 			{
 			ISDErrorLog << "Invalid parameter section_reader, it does not match the internal expected value." << ISDErrorLogEnd;
 			return false;
 			}
 
+		end_read_section_values( this->sstream, this->active_subsection->end_position, this->active_subsection->section_was_seeked || this->tolerant_reading );
 		if( !end_read_large_block( this->sstream, this->active_subsection->end_position ) )
 			{
 			ISDErrorLog << "end_read_large_block failed unexpectedly, the stream is probably corrupted." << ISDErrorLogEnd;
 			return false;
 			}
 
-		this->active_subsection.reset();
+		this->active_subsection = nullptr;
 		this->active_subsection_end_pos = 0;
 		return true;
 		}
 
+	bool EntityReader::SkipSection( const char *key, const u8 key_length, const bool null_section_is_allowed, const u8 *&dest_values, u64 &dest_values_size )
+		{
+		dest_values = nullptr;
+		dest_values_size = 0;
+
+		if( this->active_subsection )
+			{
+			ISDErrorLog << "There is already an active subsection." << ISDErrorLogEnd;
+			return false;
+			}
+
+		// a missing section is read as a null section, if it is allowed
+		if( !this->skip_to_value( ValueType::VT_Subsection, key, key_length, 0 ) && null_section_is_allowed )
+			{
+			return true;
+			}
+
+		// read block header
+		const u64 end_of_section = begin_read_large_block( sstream, ValueType::VT_Subsection, key, key_length );
+		if( end_of_section == 0 )
+			{
+			ISDErrorLog << "begin_read_large_block() failed unexpectedly, stream is probably corrupted" << ISDErrorLogEnd;
+			return false;
+			}
+		else if( end_of_section == sstream.GetPosition() )
+			{
+			return end_read_empty_large_block( sstream, key, null_section_is_allowed, end_of_section ) != reader_status::fail;
+			}
+
+		// the values of the section, including its directory (if any), are the rest of the block. the framing of the blocks in the 
+		// section is validated now, so a corrupted section fails the read of the entity, and only the decoding of the values is deferred
+		const u64 values_pos = sstream.GetPosition();
+		if( !validate_section_framing( sstream, end_of_section, 0 ) )
+			{
+			ISDErrorLog << "The blocks of the skipped section are malformed, the stream is probably corrupted." << ISDErrorLogEnd;
+			return false;
+			}
+		sstream.SetPosition( values_pos );
+		const u64 values_size = end_of_section - values_pos;
+		const u8 *values = sstream.ReadRawDataView( values_size );
+		if( !values || !end_read_large_block( this->sstream, end_of_section ) )
+			{
+			ISDErrorLog << "end_read_large_block failed unexpectedly, the stream is probably corrupted." << ISDErrorLogEnd;
+			return false;
+			}
+
+		dest_values = values;
+		dest_values_size = values_size;
+		return true;
+		}
+
 	// Build a sections array. 
 	// If the section is null, the section array is directly closed, nullptr+success is returned 
 	// from BeginReadSectionsArray, and EndReadSectionsArray shall not be called.
@@ -619,6 +1302,12 @@ namespace ISD
 			return std::tuple<EntityReader *, size_t, bool>( nullptr, 0, false );
 			}
 
+		// a missing sections array is read as a null sections array, if it is allowed
+		if( !this->skip_to_value( ValueType::VT_Array_Subsection, key, key_length, 0 ) && null_section_array_is_allowed )
+			{
+			return std::tuple<EntityReader *, size_t, bool>( nullptr, 0, true );
+			}
+
 		// read block header. if we are already at the end, the block is empty, end the block and make sure empty is allowed
 		const u64 end_of_section = begin_read_large_block( sstream, ValueType::VT_Array_Subsection, key, key_length );
 		if( end_of_section == 0 )
@@ -643,14 +1332,16 @@ namespace ISD
 			}
 		this->active_subsection_index = ~0;
 
-		// allocate the subsection and return it to the caller to be used to read items in the subsection
-		this->active_subsection = std::unique_ptr<EntityReader>( new EntityReader( this->sstream , end_of_section ) );
-		return std::tuple<EntityReader *, size_t, bool>( this->active_subsection.get(), this->active_subsection_array_size, true );
+		// set up the subsection and return it to the caller to be used to read items in the subsection
+		// (the array itself has no directory, only the sections in it)
+		this->begin_subsection( end_of_section );
+		this->active_subsection->section_end_position = 0;
+		return std::tuple<EntityReader *, size_t, bool>( this->active_subsection, this->active_subsection_array_size, true );
 		}
 
 	bool EntityReader::BeginReadSectionInArray( const EntityReader *sections_array_reader , const size_t section_index, bool *dest_section_has_data )
 		{
-		if( this->active_subsection.get() != sections_array_reader )
+		if( this->active_subsection != sections_array_reader )
 			{
 			ISDErrorLog << "Synch error, currently not writing a subsection array" << ISDErrorLogEnd;
 			return false;
@@ -670,6 +1361,10 @@ namespace ISD
 		const u64 section_size = sstream.Read<u64>();
 		this->active_subsection_end_pos = sstream.GetPosition() + section_size;
 
+		// the directory of the section in the array ends with the section
+		this->active_subsection->section_end_position = this->active_subsection_end_pos;
+		this->active_subsection->section_was_seeked = false;
+
 		if( dest_section_has_data == nullptr )
 			{
 			// make sure that the section size is not empty
@@ -689,12 +1384,13 @@ namespace ISD
 
 	bool EntityReader::EndReadSectionInArray( const EntityReader *sections_array_reader, const size_t section_index )
 		{
-		if( this->active_subsection.get() != sections_array_reader || this->active_subsection_index != section_index )
+		if( this->active_subsection != sections_array_reader || this->active_subsection_index != section_index )
 			{
 			ISDErrorLog << "Synch error, currently not reading a subsection array, or incorrect section index" << ISDErrorLogEnd;
 			return false;
 			}
 
+		end_read_section_values( this->sstream, this->active_subsection_end_pos, this->active_subsection->section_was_seeked || this->tolerant_reading );
 		const u64 end_pos = sstream.GetPosition();
 
 		if( end_pos != this->active_subsection_end_pos )
@@ -706,9 +1402,108 @@ namespace ISD
 		return true;
 		}
 
+	bool EntityReader::ReadSectionsInArray( const EntityReader *sections_array_reader, const size_t section_count, bool (*read_section)( void *context, size_t section_index, EntityReader *section_reader ), void *context )
+		{
+		if( this->active_subsection != sections_array_reader )
+			{
+			ISDErrorLog << "Synch error, currently not reading a subsection array" << ISDErrorLogEnd;
+			return false;
+			}
+		const size_t first_index = this->active_subsection_index+1;
+		if( section_count > this->active_subsection_array_size - first_index )
+			{
+			ISDErrorLog << "Incorrect section count, out of array bounds" << ISDErrorLogEnd;
+			return false;
+			}
+
+		// read serially if there is nothing to parallelize
+		if( this->parallel_thread_count <= 1 || section_count <= 1 )
+			{
+			for( size_t index = 0; index < section_count; ++index )
+				{
+				bool has_data = false;
+				if( !this->BeginReadSectionInArray( sections_array_reader, first_index + index, &has_data ) )
+					return false;
+				if( !read_section( context, index, has_data ? this->active_subsection : nullptr ) )
+					return false;
+				if( !this->EndReadSectionInArray( sections_array_reader, first_index + index ) )
+					return false;
+				}
+			return true;
+			}
+
+		// scan the sizes of the sections, to find the start of each section (and the end of the last section)
+		const u64 array_end = this->active_subsection->end_position;
+		std::vector<u64> section_positions( section_count + 1 );
+		u64 position = this->sstream.GetPosition();
+		for( size_t index = 0; index < section_count; ++index )
+			{
+			section_positions[index] = position;
+			if( position > array_end || array_end - position < sizeof( u64 ) || !this->sstream.SetPosition( position ) )
+				{
+				ISDErrorLog << "The sections array ends before all sections are read, the stream is probably corrupted." << ISDErrorLogEnd;
+				return false;
+				}
+			const u64 section_size = this->sstream.Read<u64>();
+			if( section_size > array_end - position - sizeof( u64 ) )
+				{
+				ISDErrorLog << "The size of a section in the array is beyond the end of the array, the stream is probably corrupted." << ISDErrorLogEnd;
+				return false;
+				}
+			position += sizeof( u64 ) + section_size;
+			}
+		section_positions[section_count] = position;
+
+		// split the sections into a few batches per thread, to balance sections of uneven size
+		const size_t batch_count = std::min( section_count, (size_t)this->parallel_thread_count * 4 );
+		std::atomic<bool> success( true );
+
+		// read each batch using a separate stream over the same data, and a sections array reader of the stream, 
+		// so the sections are read exactly as when read serially
+		parallel_for( batch_count, [&]( size_t batch_index )
+			{
+			const size_t batch_start = section_count * batch_index / batch_count;
+			const size_t batch_end = section_count * (batch_index+1) / batch_count;
+
+			MemoryReadStream batch_stream( this->sstream ); // copies the data view, byte order and owner of the data
+			batch_stream.SetPosition( section_positions[batch_start] );
+
+			EntityReader batch_reader( batch_stream, array_end );
+			batch_reader.tolerant_reading = this->tolerant_reading;
+			batch_reader.lazy_reading = this->lazy_reading;
+			batch_reader.parallel_thread_count = this->parallel_thread_count;
+			EntityReader *batch_sections_reader = batch_reader.begin_subsection( array_end );
+			batch_sections_reader->section_end_position = 0;
+			batch_reader.active_subsection_array_size = batch_end - batch_start;
+			for( size_t index = batch_start; index < batch_end; ++index )
+				{
+				bool has_data = false;
+				if( !batch_reader.BeginReadSectionInArray( batch_sections_reader, index - batch_start, &has_data ) 
+					|| !read_section( context, index, has_data ? batch_sections_reader : nullptr ) 
+					|| !batch_reader.EndReadSectionInArray( batch_sections_reader, index - batch_start ) )
+					{
+					success = false;
+					return;
+					}
+				}
+			}, this->parallel_thread_count );
+
+		if( !success )
+			{
+			ISDErrorLog << "Failed to read the sections of the array in parallel" << ISDErrorLogEnd;
+			return false;
+			}
+
+		// move past the sections
+		this->sstream.SetPosition( section_positions[section_count] );
+		this->active_subsection_index = first_index + section_count - 1;
+		this->active_subsection_end_pos = section_positions[section_count];
+		return true;
+		}
+
 	bool EntityReader::EndReadSectionsArray( const EntityReader *sections_array_reader )
 		{
-		if( this->active_subsection.get() != sections_array_reader )
+		if( this->active_subsection != sections_array_reader )
 			{
 			ISDErrorLog << "Invalid parameter section_reader, it does not match the internal expected value." << ISDErrorLogEnd;
 			return false;
@@ -725,7 +1520,7 @@ namespace ISD
 			return false;
 			}
 
-		this->active_subsection.reset();
+		this->active_subsection = nullptr;
 		this->active_subsection_array_size = 0;
 		this->active_subsection_index = ~0;
 		this->active_subsection_end_pos = 0;
@@ -0,0 +1,407 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#include "ISD_EntityStore.h"
+#include "ISD_BlobHash.h"
+#include "ISD_FileBatchReader.h"
+#include "ISD_MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+
+namespace ISD
+	{
+#ifdef _WIN32
+	static const char path_separator = '\\';
+#else
+	static const char path_separator = '/';
+#endif
+
+	static_assert( EntityIndexRecordSize == sizeof( UUID ) + sizeof( u64 ) * 2 + sizeof( hash ), "Error: the index record size does not match the entry" );
+
+	void write_entity_index_record( const entity_index_entry &entry, u8 *dest_record )
+		{
+		memcpy( &dest_record[0], &entry.uuid, sizeof( UUID ) );
+		memcpy( &dest_record[16], &entry.offset, sizeof( u64 ) );
+		memcpy( &dest_record[24], &entry.size, sizeof( u64 ) );
+		memcpy( &dest_record[32], &entry.root_hash, sizeof( hash ) );
+		}
+
+	void read_entity_index_record( const u8 *record, entity_index_entry &dest_entry )
+		{
+		memcpy( &dest_entry.uuid, &record[0], sizeof( UUID ) );
+		memcpy( &dest_entry.offset, &record[16], sizeof( u64 ) );
+		memcpy( &dest_entry.size, &record[24], sizeof( u64 ) );
+		memcpy( &dest_entry.root_hash, &record[32], sizeof( hash ) );
+		}
+
+	// the entries are ordered by the bytes of the uuid, so the order is the same on all platforms
+	bool entity_uuid_less( const UUID &left, const UUID &right )
+		{
+		return memcmp( &left, &right, sizeof( UUID ) ) < 0;
+		}
+
+	static bool entry_uuid_less( const entity_index_entry &entry, const UUID &uuid )
+		{
+		return entity_uuid_less( entry.uuid, uuid );
+		}
+
+	static std::string entity_file_name( const UUID &uuid )
+		{
+		return value_to_hex_string( uuid ) + ".dat";
+		}
+
+	std::string entity_store_relative_path( const UUID &uuid )
+		{
+		const std::string file_name = entity_file_name( uuid );
+		return file_name.substr( 0, 2 ) + path_separator + file_name.substr( 2, 2 ) + path_separator + file_name;
+		}
+
+	std::string entity_store_flat_relative_path( const UUID &uuid )
+		{
+		return entity_file_name( uuid );
+		}
+
+	static Status make_directory( const std::string &path )
+		{
+#ifdef _WIN32
+		if( !::CreateDirectoryW( widen( path ).c_str(), nullptr ) && ::GetLastError() != ERROR_ALREADY_EXISTS )
+			{
+			return Status::ECantWrite;
+			}
+#else
+		if( ::mkdir( path.c_str(), 0755 ) != 0 && errno != EEXIST )
+			{
+			return Status::ECantWrite;
+			}
+#endif
+		return Status::Ok;
+		}
+
+	Status create_entity_store_directories( const std::string &root_path, const UUID &uuid )
+		{
+		const std::string file_name = entity_file_name( uuid );
+		const std::string first_level = root_path + path_separator + file_name.substr( 0, 2 );
+		Status status = make_directory( first_level );
+		if( status != Status::Ok )
+			{
+			return status;
+			}
+		return make_directory( first_level + path_separator + file_name.substr( 2, 2 ) );
+		}
+
+	// list the names in the directory, excluding . and ..  returns false if the directory can not be listed
+	static bool list_directory( const std::string &path, std::vector<std::string> &dest_names )
+		{
+		dest_names.clear();
+#ifdef _WIN32
+		WIN32_FIND_DATAW find_data = {};
+		HANDLE find_handle = ::FindFirstFileW( widen( path + path_separator + "*" ).c_str(), &find_data );
+		if( find_handle == INVALID_HANDLE_VALUE )
+			{
+			return false;
+			}
+		do
+			{
+			std::string name = narrow( find_data.cFileName );
+			if( name != "." && name != ".." )
+				{
+				dest_names.push_back( name );
+				}
+			}
+		while( ::FindNextFileW( find_handle, &find_data ) );
+		::FindClose( find_handle );
+#else
+		DIR *directory = ::opendir( path.c_str() );
+		if( !directory )
+			{
+			return false;
+			}
+		while( const dirent *entry = ::readdir( directory ) )
+			{
+			std::string name = entry->d_name;
+			if( name != "." && name != ".." )
+				{
+				dest_names.push_back( name );
+				}
+			}
+		::closedir( directory );
+#endif
+		return true;
+		}
+
+	static int hex_digit_value( char c )
+		{
+		if( c >= '0' && c <= '9' )
+			return c - '0';
+		if( c >= 'a' && c <= 'f' )
+			return c - 'a' + 10;
+		return -1;
+		}
+
+	// parse the uuid from an entity file name. returns false if the name is not an entity file name
+	static bool parse_entity_file_name( const std::string &name, UUID &dest_uuid )
+		{
+		u8 bytes[16] = {};
+		uint byte_count = 0;
+		for( size_t i = 0; i + 1 < name.size() && byte_count < 16; )
+			{
+			if( name[i] == '-' )
+				{
+				++i;
+				continue;
+				}
+			const int high = hex_digit_value( name[i] );
+			const int low = hex_digit_value( name[i + 1] );
+			if( high < 0 || low < 0 )
+				{
+				return false;
+				}
+			bytes[byte_count++] = (u8)( ( high << 4 ) | low );
+			i += 2;
+			}
+		if( byte_count != 16 )
+			{
+			return false;
+			}
+
+		// the words are written big endian
+		dest_uuid.Data1 = ( (u32)bytes[0] << 24 ) | ( (u32)bytes[1] << 16 ) | ( (u32)bytes[2] << 8 ) | (u32)bytes[3];
+		dest_uuid.Data2 = (u16)( ( bytes[4] << 8 ) | bytes[5] );
+		dest_uuid.Data3 = (u16)( ( bytes[6] << 8 ) | bytes[7] );
+		memcpy( dest_uuid.Data4, &bytes[8], 8 );
+
+		// the name must be exactly the name the uuid is written to
+		return entity_file_name( dest_uuid ) == name;
+		}
+
+	Status EntityIndex::Load( const std::string &index_file_path )
+		{
+		std::vector<u8> file_data;
+		Status status = FileBatchReader::ReadWholeFile( index_file_path, file_data );
+		if( status != Status::Ok )
+			{
+			return status;
+			}
+
+		BlobVerifier verifier;
+		status = verifier.Setup( file_data.data(), file_data.size() );
+		if( status != Status::Ok )
+			{
+			return status;
+			}
+		status = verifier.VerifyAll();
+		if( status != Status::Ok )
+			{
+			return status;
+			}
+
+		// check the header, and that the size matches the entry count
+		const u64 data_size = verifier.GetDataSize();
+		u64 magic = 0;
+		u64 entry_count = 0;
+		if( data_size < sizeof( u64 ) * 2 )
+			{
+			return Status::EInvalid;
+			}
+		memcpy( &magic, &file_data[0], sizeof( u64 ) );
+		memcpy( &entry_count, &file_data[sizeof( u64 )], sizeof( u64 ) );
+		if( magic != IndexFileMagic || entry_count != ( data_size - sizeof( u64 ) * 2 ) / EntityIndexRecordSize
+			|| ( data_size - sizeof( u64 ) * 2 ) % EntityIndexRecordSize != 0 )
+			{
+			ISDErrorLog << "The file " << index_file_path << " is not a valid entity index file" << ISDErrorLogEnd;
+			return Status::EInvalid;
+			}
+
+		std::vector<entity_index_entry> entries( (size_t)entry_count );
+		for( size_t i = 0; i < entries.size(); ++i )
+			{
+			read_entity_index_record( &file_data[sizeof( u64 ) * 2 + i * EntityIndexRecordSize], entries[i] );
+
+			// the entries must be sorted, and unique
+			if( i > 0 && !entry_uuid_less( entries[i - 1], entries[i].uuid ) )
+				{
+				ISDErrorLog << "The entries of the entity index file " << index_file_path << " are not sorted" << ISDErrorLogEnd;
+				return Status::EInvalid;
+				}
+			}
+
+		this->Entries = std::move( entries );
+		return Status::Ok;
+		}
+
+	Status EntityIndex::Save( const std::string &index_file_path ) const
+		{
+		std::vector<u8> file_data( sizeof( u64 ) * 2 + this->Entries.size() * EntityIndexRecordSize );
+		const u64 magic = IndexFileMagic;
+		const u64 entry_count = this->Entries.size();
+		memcpy( &file_data[0], &magic, sizeof( u64 ) );
+		memcpy( &file_data[sizeof( u64 )], &entry_count, sizeof( u64 ) );
+		for( size_t i = 0; i < this->Entries.size(); ++i )
+			{
+			write_entity_index_record( this->Entries[i], &file_data[sizeof( u64 ) * 2 + i * EntityIndexRecordSize] );
+			}
+		const std::vector<u8> trailer = calculate_blob_trailer( file_data.data(), file_data.size() );
+
+		// write to a temporary file, and replace the index file with it
+		const std::string temp_file_path = index_file_path + ".tmp";
+#ifdef _WIN32
+		FILE *file = _wfopen( widen( temp_file_path ).c_str(), L"wb" );
+#else
+		FILE *file = fopen( temp_file_path.c_str(), "wb" );
+#endif
+		if( !file )
+			{
+			return Status::ECantOpen;
+			}
+		const bool written = fwrite( file_data.data(), 1, file_data.size(), file ) == file_data.size()
+			&& fwrite( trailer.data(), 1, trailer.size(), file ) == trailer.size();
+		if( fclose( file ) != 0 || !written )
+			{
+			remove( temp_file_path.c_str() );
+			return Status::ECantWrite;
+			}
+
+#ifdef _WIN32
+		if( !::MoveFileExW( widen( temp_file_path ).c_str(), widen( index_file_path ).c_str(), MOVEFILE_REPLACE_EXISTING ) )
+#else
+		if( rename( temp_file_path.c_str(), index_file_path.c_str() ) != 0 )
+#endif
+			{
+			remove( temp_file_path.c_str() );
+			return Status::ECantWrite;
+			}
+
+		return Status::Ok;
+		}
+
+	// read the trailer of the entity file, and add it to the entries. the data is verified when the entity is loaded
+	static void index_entity_file( const std::string &file_path, const std::string &file_name, const UUID &uuid, std::vector<entity_index_entry> &entries )
+		{
+		MappedFile mapping;
+		BlobVerifier verifier;
+		Status status = mapping.Open( file_path );
+		if( status == Status::Ok )
+			{
+			status = verifier.Setup( mapping.GetData(), mapping.GetSize() );
+			}
+		if( status != Status::Ok )
+			{
+			ISDErrorLog << "The entity file " << file_name << " can not be indexed, and is skipped" << ISDErrorLogEnd;
+			return;
+			}
+		entity_index_entry entry;
+		entry.uuid = uuid;
+		entry.size = mapping.GetSize();
+		entry.root_hash = verifier.GetRootHash();
+		entries.push_back( entry );
+		}
+
+	Status EntityIndex::Build( const std::string &root_path )
+		{
+		std::vector<entity_index_entry> entries;
+		std::vector<entity_index_entry> flat_entries;
+		std::vector<std::string> first_level_names;
+		std::vector<std::string> second_level_names;
+		std::vector<std::string> file_names;
+
+		if( !list_directory( root_path, first_level_names ) )
+			{
+			return Status::ECantOpen;
+			}
+		for( const std::string &first_level_name : first_level_names )
+			{
+			const std::string first_level_path = root_path + path_separator + first_level_name;
+
+			// entity files directly in the root are in the flat layout of older stores
+			UUID uuid;
+			if( parse_entity_file_name( first_level_name, uuid ) )
+				{
+				index_entity_file( first_level_path, first_level_name, uuid, flat_entries );
+				continue;
+				}
+
+			if( first_level_name.size() != 2 || !list_directory( first_level_path, second_level_names ) )
+				{
+				continue;
+				}
+			for( const std::string &second_level_name : second_level_names )
+				{
+				const std::string second_level_path = first_level_path + path_separator + second_level_name;
+				if( second_level_name.size() != 2 || !list_directory( second_level_path, file_names ) )
+					{
+					continue;
+					}
+				for( const std::string &file_name : file_names )
+					{
+					if( !parse_entity_file_name( file_name, uuid ) || entity_store_relative_path( uuid ) != first_level_name + path_separator + second_level_name + path_separator + file_name )
+						{
+						continue;
+						}
+					index_entity_file( second_level_path + path_separator + file_name, file_name, uuid, entries );
+					}
+				}
+			}
+
+		auto entries_less = []( const entity_index_entry &left, const entity_index_entry &right ) { return entry_uuid_less( left, right.uuid ); };
+		std::sort( entries.begin(), entries.end(), entries_less );
+
+		// the loader reads the sharded file if there is one, so a flat file is only indexed if the entity has no sharded file
+		if( !flat_entries.empty() )
+			{
+			const size_t sharded_count = entries.size();
+			for( const entity_index_entry &flat_entry : flat_entries )
+				{
+				if( !std::binary_search( entries.begin(), entries.begin() + sharded_count, flat_entry, entries_less ) )
+					{
+					entries.push_back( flat_entry );
+					}
+				}
+			std::sort( entries.begin(), entries.end(), entries_less );
+			}
+
+		this->Entries = std::move( entries );
+		return Status::Ok;
+		}
+
+	void EntityIndex::Insert( const entity_index_entry &entry )
+		{
+		auto it = std::lower_bound( this->Entries.begin(), this->Entries.end(), entry.uuid, entry_uuid_less );
+		if( it != this->Entries.end() && memcmp( &it->uuid, &entry.uuid, sizeof( UUID ) ) == 0 )
+			{
+			*it = entry;
+			return;
+			}
+		this->Entries.insert( it, entry );
+		}
+
+	bool EntityIndex::Erase( const UUID &uuid )
+		{
+		auto it = std::lower_bound( this->Entries.begin(), this->Entries.end(), uuid, entry_uuid_less );
+		if( it == this->Entries.end() || memcmp( &it->uuid, &uuid, sizeof( UUID ) ) != 0 )
+			{
+			return false;
+			}
+		this->Entries.erase( it );
+		return true;
+		}
+
+	const entity_index_entry *EntityIndex::Find( const UUID &uuid ) const
+		{
+		auto it = std::lower_bound( this->Entries.begin(), this->Entries.end(), uuid, entry_uuid_less );
+		if( it == this->Entries.end() || memcmp( &it->uuid, &uuid, sizeof( UUID ) ) != 0 )
+			{
+			return nullptr;
+			}
+		return &( *it );
+		}
+	};
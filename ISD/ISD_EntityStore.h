@@ -0,0 +1,82 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#pragma once
+
+#include "ISD_Types.h"
+
+namespace ISD
+	{
+	// The entity files of a store are sharded in two levels of directories, by the first two bytes of the file name:
+	//		<root>/<aa>/<bb>/<uuid>.dat
+	// so a store of millions of entities has at most 256 * 256 directories, with few files in each.
+	// Stores written before the sharding have all entity files directly in the root directory:
+	//		<root>/<uuid>.dat
+	// these are still read, the sharded path is tried first, and then the flat path.
+	// The store can have an index file in the root directory, which lists all the entities of the store, so
+	// the store does not need to be enumerated, or the files stat'ed, to know which entities there are.
+	const char *const EntityStoreIndexFileName = "entities.index";
+
+	// the path of the entity file, relative to the root of the store, with native separators
+	std::string entity_store_relative_path( const UUID &uuid );
+
+	// the path of the entity file in the flat layout of older stores, relative to the root of the store
+	std::string entity_store_flat_relative_path( const UUID &uuid );
+
+	// create the shard directories of the entity in the store, if they do not exist
+	Status create_entity_store_directories( const std::string &root_path, const UUID &uuid );
+
+	// an entry of the index. offset is the position of the entity blob in its file (0 for loose files),
+	// size is the size of the blob including the hash trailer, and root_hash is the root hash of the trailer
+	struct entity_index_entry
+		{
+		UUID uuid = {};
+		u64 offset = 0;
+		u64 size = 0;
+		hash root_hash = {};
+		};
+
+	// entries are written to files as 64 byte records: the uuid, offset, size and root hash, in the byte order of the system
+	const size_t EntityIndexRecordSize = 64;
+	void write_entity_index_record( const entity_index_entry &entry, u8 *dest_record );
+	void read_entity_index_record( const u8 *record, entity_index_entry &dest_entry );
+
+	// compare the uuids as bytes, which is the order of the entries in index files and pack files
+	bool entity_uuid_less( const UUID &left, const UUID &right );
+
+	// The index of a store, an array of entries sorted by uuid (ordered as bytes), which is searched with a binary search.
+	// The index file is the magic value and the entry count as u64s, followed by the entries as 64 byte records,
+	// and a blob hash trailer of all of it. It is written to a temporary file which is renamed over the index file,
+	// so readers never see a partially written index.
+	// The index is a snapshot, it must be rebuilt or updated when entities are added to or removed from the store.
+	class EntityIndex
+		{
+		private:
+			std::vector<entity_index_entry> Entries;
+
+		public:
+			static const u64 IndexFileMagic = 0x3158444e49445349; // "ISDINDX1"
+
+			// load the index file. returns ECantOpen if there is no index file, ECorrupted or EInvalid if it is not a valid index file
+			Status Load( const std::string &index_file_path );
+
+			// write the index file
+			Status Save( const std::string &index_file_path ) const;
+
+			// rebuild the index from the entity files of the store. the trailer of each file is read to get its root hash.
+			// files with names which are not entity file names are skipped
+			Status Build( const std::string &root_path );
+
+			// add an entry, or replace the entry of the same entity
+			void Insert( const entity_index_entry &entry );
+
+			// remove the entry of the entity. returns false if there is no entry
+			bool Erase( const UUID &uuid );
+
+			// find the entry of the entity, or nullptr if the entity is not in the index
+			const entity_index_entry *Find( const UUID &uuid ) const;
+
+			size_t GetEntryCount() const { return this->Entries.size(); }
+			const std::vector<entity_index_entry> &GetEntries() const { return this->Entries; }
+		};
+	};
@@ -79,6 +79,8 @@ namespace ISD
 			static bool Write( const _MgmCl &obj, EntityWriter &writer );
 			static bool Read( _MgmCl &obj, EntityReader &reader );
 
+			static bool MeasureSerializedSize( const _MgmCl &obj, const EntityWriter &writer, u64 &dest_size, std::vector<u64> *dest_block_sizes = nullptr );
+
 			static bool Validate( const _MgmCl &obj, EntityValidator &validator );
 		};
 
@@ -149,43 +151,46 @@ namespace ISD
 		}
 
 
+	template<class _Kty, class _Ty, uint _Flags, class _MapTy>
+	bool EntityTable<_Kty,_Ty,_Flags,_MapTy>::MF::MeasureSerializedSize( const _MgmCl &obj, const EntityWriter &writer, u64 &dest_size, std::vector<u64> *dest_block_sizes )
+		{
+		return writer.MeasureWrite( obj, dest_size, dest_block_sizes );
+		}
+
 	template<class _Kty, class _Ty, uint _Flags, class _MapTy>
 	bool EntityTable<_Kty,_Ty,_Flags,_MapTy>::MF::Write( const _MgmCl &obj, EntityWriter &writer )
 		{
 		// collect the keys into a vector, and store in stream as an array
+		// also collect the entities in the same order, so they can be written by index
 		std::vector<_Kty> keys(obj.v_Entries.size());
+		std::vector<const _Ty *> entities(obj.v_Entries.size());
 		size_t index = 0;
 		for( auto it = obj.v_Entries.begin(); it != obj.v_Entries.end(); ++it, ++index )
 			{
 			keys[index] = it->first;
+			entities[index] = it->second.get();
 			}
 		if( !writer.Write( ISDKeyMacro("IDs"), keys ) )
 			return false;
 		keys.clear();
 
 		// create a sections array for the entities
-		EntityWriter *section_writer = writer.BeginWriteSectionsArray( ISDKeyMacro("Entities"), obj.v_Entries.size() );
+		EntityWriter *section_writer = writer.BeginWriteSectionsArray( ISDKeyMacro("Entities"), entities.size() );
 		if( !section_writer )
 			return false;
 
-		// write out all the entities as an array
+		// write out all the entities as an array (in parallel, if the writer has a ParallelThreadCount)
 		// for each non-empty entity, call the write method of the entity
-		index = 0;
-		for( auto it = obj.v_Entries.begin(); it != obj.v_Entries.end(); ++it, ++index )
+		if( !writer.WriteSectionsInArray( section_writer, entities.size(), []( const void *context, size_t section_index, EntityWriter &entity_writer )
 			{
-			if( !writer.BeginWriteSectionInArray( section_writer, index ) )
-				return false;
-			if( it->second )
+			const _Ty *entity = (*(const std::vector<const _Ty *> *)context)[section_index];
+			if( entity )
 				{
-				if( !_Ty::MF::Write( *(it->second), *(section_writer) ) )
-					return false;
+				return _Ty::MF::Write( *entity, entity_writer );
 				}
-			if( !writer.EndWriteSectionInArray( section_writer, index ) )
-				return false;
-			}
-
-		// sanity check, make sure all sections were written
-		ISDSanityCheckDebugMacro( index == obj.v_Entries.size() );
+			return true;
+			}, &entities ) )
+			return false;
 
 		// end the Entries sections array
 		if( !writer.EndWriteSectionsArray( section_writer ) )
@@ -218,33 +223,31 @@ namespace ISD
 			return false;
 			}
 
-		// read in all the entities, push into map as key-value pairs
+		// read in all the entities by index (in parallel, if the reader has a ParallelThreadCount)
+		// null sections are null entities
+		std::vector<std::unique_ptr<_Ty>> entities( map_size );
+		if( !reader.ReadSectionsInArray( section_reader, map_size, []( void *context, size_t section_index, EntityReader *entity_reader )
+			{
+			if( !entity_reader )
+				{
+				return true;
+				}
+			std::unique_ptr<_Ty> &entity = (*(std::vector<std::unique_ptr<_Ty>> *)context)[section_index];
+			entity = std::make_unique<_Ty>();
+			return _Ty::MF::Read( *entity, *entity_reader );
+			}, &entities ) )
+			return false;
+
+		// push the entities into the map as key-value pairs
 		obj.v_Entries.clear();
 		for( size_t index = 0; index < map_size ; ++index )
 			{
-			bool has_data = false;
-			if( !reader.BeginReadSectionInArray( section_reader, index, &has_data ) )
-				return false;
-
-			if( has_data )
-				std::tie(it,success) = obj.v_Entries.emplace( keys[index], std::make_unique<_Ty>() );
-			else 
-				std::tie(it,success) = obj.v_Entries.emplace( keys[index], nullptr );
-
+			std::tie(it,success) = obj.v_Entries.emplace( keys[index], std::move( entities[index] ) );
 			if( !success )
 				{
 				ISDErrorLog << "Failed inserting key-value pair in EntityTable" << ISDErrorLogEnd;
 				return false;
 				}
-
-			if( it->second )
-				{
-				if( !_Ty::MF::Read( *(it->second), *(section_reader) ) )
-					return false;
-				}
-
-			if( !reader.EndReadSectionInArray( section_reader, index ) )
-				return false;
 			}
 
 		// end the sections array
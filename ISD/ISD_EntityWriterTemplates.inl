@@ -6,6 +6,9 @@
 #include "ISD_Types.h"
 #include "ISD_DataValuePointers.h"
 #include "ISD_Log.h"
+#include "ISD_parallel_for.h"
+
+#include <algorithm>
 
 namespace ISD
 	{
@@ -20,11 +23,9 @@ namespace ISD
 		// sizeof(value_type)=1 + sizeof(block_size)=8 + sizeof(key_size_in_bytes)=1 + key_size_in_bytes;
 		const u64 expected_end_pos = start_pos + key_size_in_bytes + 10; 
 
-		// write block header 
-		// write empty stand in value for now (MAXi64 on purpose), which is definitely 
-		// wrong, as to trigger any test if the value is not overwritten with the correct value
+		// write block header, the size of the block is written by the stream (see MemoryWriteStream::BeginBlock)
 		dstream.Write( value_type );
-		dstream.Write( (u64)MAXINT64 );
+		dstream.BeginBlock();
 		dstream.Write( key_size_in_bytes );
 		dstream.Write( (i8*)key, key_size_in_bytes );
 
@@ -37,12 +38,7 @@ namespace ISD
 	// writes the size of the block in the header of the block
 	bool end_write_large_block( MemoryWriteStream &dstream, u64 start_pos )
 		{
-		const u64 end_pos = dstream.GetPosition();
-		const u64 block_size = end_pos - start_pos - 9; // total block size - ( sizeof( valuetype )=1 + sizeof( block_size_variable )=8 )
-		dstream.SetPosition( start_pos + 1 ); // skip over the valuetype
-		dstream.Write( block_size );
-		dstream.SetPosition( end_pos ); // move back the where we were
-		return (end_pos > start_pos); // only thing we really can check
+		return dstream.EndBlock( start_pos + 1 ); // skip over the valuetype
 		}
 
 	// template method that writes a small block of a specific ValueType VT to the stream. Since most value types 
@@ -146,8 +142,9 @@ namespace ISD
 		return true;
 		}
 
-	// reads an array header and value size from the stream, and decodes into flags, then reads the index if one exists. 
-	bool write_array_metadata_and_index( MemoryWriteStream &dstream, size_t per_item_size, size_t item_count, const std::vector<i32> *index )
+	// writes an array header and value size to the stream, then writes the index if one exists. 
+	// if payload_alignment is set, the header is padded so that the values start at an aligned position in the stream
+	bool write_array_metadata_and_index( MemoryWriteStream &dstream, size_t per_item_size, size_t item_count, const std::vector<i32> *index, const u8 payload_alignment = 0 )
 		{
 		static_assert(sizeof( u64 ) <= sizeof( size_t ), "Unsupported size_t, current code requires it to be at least 8 bytes in size, equal to u64");
 		ISDSanityCheckDebugMacro( per_item_size <= 0xff );
@@ -157,7 +154,8 @@ namespace ISD
 		// indexed array flags: size of each item (if need to decode array outside regular decoding) and bit set if index is used 
 		const u16 has_index = (index) ? (0x100) : (0);
 		const u16 index_is_64bit = 0; // we do not support 64 bit indices yet
-		const u16 array_flags = has_index | index_is_64bit | u16(per_item_size);
+		const u16 has_padding = (payload_alignment > 1) ? (0x400) : (0);
+		const u16 array_flags = has_index | index_is_64bit | has_padding | u16(per_item_size);
 		dstream.Write( array_flags );
 
 		// write the number of items
@@ -174,12 +172,27 @@ namespace ISD
 			index_size = (index_count * sizeof( i32 )) + sizeof( u64 ); // the index values and the value count
 			}
 
+		// if we pad the values, write the size of the padding, and the padding
+		u64 padding_size = 0;
+		if( has_padding )
+			{
+			ISDSanityCheckDebugMacro( (payload_alignment & (payload_alignment-1)) == 0 ); // must be a power of 2
+			const u64 values_start_pos = dstream.GetPosition() + sizeof( u8 );
+			const u8 padding = (u8)((payload_alignment - (values_start_pos % payload_alignment)) % payload_alignment);
+			const u8 zeros[256] = {};
+			dstream.Write( padding );
+			dstream.Write( zeros, padding );
+
+			padding_size = sizeof( u8 ) + padding; // the padding size value and the padding
+			}
+
 		// make sure all data was written
 		const u64 expected_end_pos = 
 			start_pos
 			+ sizeof( u16 ) // the flags
 			+ sizeof( u64 ) // the item count
-			+ index_size; // the (optional) index
+			+ index_size // the (optional) index
+			+ padding_size; // the (optional) padding
 
 		const u64 end_pos = dstream.GetPosition();
 		if( end_pos != expected_end_pos )
@@ -194,7 +207,8 @@ namespace ISD
 
 
 	// write indexed array to stream
-	template<ValueType VT, class T> bool write_array( MemoryWriteStream &dstream, const char *key, const u8 key_size_in_bytes, const std::vector<T> *items, const std::vector<i32> *index )
+	// if payload_alignment is set, the values are padded to start at an aligned position in the stream
+	template<ValueType VT, class T> bool write_array( MemoryWriteStream &dstream, const char *key, const u8 key_size_in_bytes, const std::vector<T> *items, const std::vector<i32> *index, const u8 payload_alignment )
 		{
 		static_assert((VT >= ValueType::VT_Array_Bool) && (VT <= ValueType::VT_Array_Hash), "Invalid type for write_array");
 		static_assert(sizeof( data_type_information<T>::value_type ) <= 0xff, "Invalid value size, cannot exceed 255 bytes");
@@ -216,7 +230,7 @@ namespace ISD
 		if( items )
 			{
 			const u64 values_count = items->size() * values_per_type;
-			if( !write_array_metadata_and_index( dstream, value_size, values_count, index ) )
+			if( !write_array_metadata_and_index( dstream, value_size, values_count, index, payload_alignment ) )
 				{
 				return false;
 				}
@@ -250,8 +264,8 @@ namespace ISD
 		return true;
 		}
 
-	// specialization of write_array for bool arrays
-	template<> bool write_array<ValueType::VT_Array_Bool, bool>( MemoryWriteStream &dstream, const char *key, const u8 key_size_in_bytes, const std::vector<bool> *items, const std::vector<i32> *index )
+	// specialization of write_array for bool arrays (the values are packed, so they are never padded)
+	template<> bool write_array<ValueType::VT_Array_Bool, bool>( MemoryWriteStream &dstream, const char *key, const u8 key_size_in_bytes, const std::vector<bool> *items, const std::vector<i32> *index, const u8 /*payload_alignment*/ )
 		{
 		// record start position, we need this in the end block
 		const u64 start_pos = dstream.GetPosition();
@@ -314,8 +328,8 @@ namespace ISD
 		return true;
 		}
 
-	// specialization of write_array for string arrays
-	template<> bool write_array<ValueType::VT_Array_String, std::string>( MemoryWriteStream &dstream, const char *key, const u8 key_size_in_bytes, const std::vector<std::string> *items, const std::vector<i32> *index )
+	// specialization of write_array for string arrays (the values are variable length, so they are never padded)
+	template<> bool write_array<ValueType::VT_Array_String, std::string>( MemoryWriteStream &dstream, const char *key, const u8 key_size_in_bytes, const std::vector<std::string> *items, const std::vector<i32> *index, const u8 /*payload_alignment*/ )
 		{
 		// record start position, we need this in the end block
 		const u64 start_pos = dstream.GetPosition();
@@ -382,6 +396,138 @@ namespace ISD
 		return true;
 		}
 
+	bool EntityWriter::SetArrayPayloadAlignment( u8 alignment )
+		{
+		// must be 0 (no padding), or a power of 2
+		if( (alignment & (alignment-1)) != 0 )
+			{
+			ISDErrorLog << "Invalid array payload alignment: " << (u32)alignment << ", it must be a power of 2" << ISDErrorLogEnd;
+			return false;
+			}
+		this->array_payload_alignment = alignment;
+		return true;
+		}
+
+	u8 EntityWriter::GetArrayPayloadAlignment() const
+		{
+		return this->array_payload_alignment;
+		}
+
+	void EntityWriter::add_directory_entry( const char *key, const u8 key_length )
+		{
+		if( this->write_directory )
+			{
+			this->directory_entries.emplace_back( directory_key_hash( key, key_length ), this->dstream.GetPosition() );
+			}
+		}
+
+	void EntityWriter::SetWriteDirectory( bool value )
+		{
+		this->write_directory = value;
+		}
+
+	bool EntityWriter::GetWriteDirectory() const
+		{
+		return this->write_directory;
+		}
+
+	void EntityWriter::SetParallelThreadCount( uint thread_count )
+		{
+		this->parallel_thread_count = thread_count;
+		}
+
+	uint EntityWriter::GetParallelThreadCount() const
+		{
+		return this->parallel_thread_count;
+		}
+
+	bool EntityWriter::WriteDirectory()
+		{
+		// sections without values have no directory, so null sections stay empty
+		if( !this->write_directory || this->directory_entries.empty() )
+			{
+			return true;
+			}
+
+		const u64 start_pos = dstream.GetPosition();
+		if( !begin_write_large_block( this->dstream, ValueType::VT_Directory, "", 0 ) )
+			{
+			ISDErrorLog << "begin_write_large_block failed to write header." << ISDErrorLogEnd;
+			return false;
+			}
+
+		// write the entries sorted by key hash, with the offsets back from the start of the directory
+		std::sort( this->directory_entries.begin(), this->directory_entries.end() );
+		dstream.Write( (u64)this->directory_entries.size() );
+		for( const auto &entry : this->directory_entries )
+			{
+			dstream.Write( entry.first );
+			dstream.Write( start_pos - entry.second );
+			}
+		this->directory_entries.clear();
+
+		// write the size of the directory and the magic value last, so the directory can be found from the end of the section
+		dstream.Write( dstream.GetPosition() + sizeof( u64 ) * 2 - start_pos );
+		dstream.Write( EntityDirectoryMagic );
+
+		if( !end_write_large_block( this->dstream, start_pos ) )
+			{
+			ISDErrorLog << "end_write_large_block failed unexpectedly." << ISDErrorLogEnd;
+			return false;
+			}
+		return true;
+		}
+
+	bool EntityWriter::measure_write( bool (*write_function)( const void *object, EntityWriter &writer ), const void *object, u64 &dest_size, std::vector<u64> *dest_block_sizes ) const
+		{
+		// write to a measure only stream, starting at the same position as the stream of the writer, so that
+		// the padding of aligned arrays is the same as when the object is written
+		const u64 start_pos = this->dstream.GetPosition();
+		MemoryWriteStream measure_stream( 0, true );
+		measure_stream.SetPosition( start_pos );
+		if( dest_block_sizes )
+			{
+			dest_block_sizes->clear();
+			measure_stream.SetBlockSizes( dest_block_sizes );
+			}
+
+		EntityWriter measure_writer( measure_stream );
+		measure_writer.array_payload_alignment = this->array_payload_alignment;
+		measure_writer.write_directory = this->write_directory;
+		if( !write_function( object, measure_writer ) )
+			{
+			ISDErrorLog << "Failed to measure the size of the object" << ISDErrorLogEnd;
+			return false;
+			}
+
+		dest_size = measure_stream.GetSize() - start_pos;
+		return true;
+		}
+
+	EntityWriter *EntityWriter::begin_subsection()
+		{
+		// the writer is allocated by the first subsection, and is then kept for all the following subsections
+		if( !this->subsection_writer )
+			{
+			this->subsection_writer = std::unique_ptr<EntityWriter>( new EntityWriter( this->dstream ) );
+			}
+
+		// reset the writer to the state of a new writer, but keep its own subsection writer and the memory of its directory
+		EntityWriter *subsection = this->subsection_writer.get();
+		subsection->start_position = this->dstream.GetPosition();
+		subsection->active_subsection = nullptr;
+		subsection->active_array_size = 0;
+		subsection->active_array_index = ~0;
+		subsection->active_array_index_start_position = 0;
+		subsection->array_payload_alignment = this->array_payload_alignment;
+		subsection->write_directory = this->write_directory;
+		subsection->directory_entries.clear();
+		subsection->parallel_thread_count = this->parallel_thread_count;
+
+		this->active_subsection = subsection;
+		return subsection;
+		}
+
 	// Build a section. 
 	EntityWriter *EntityWriter::BeginWriteSection( const char *key, const u8 key_length )
 		{
@@ -390,9 +536,10 @@ namespace ISD
 			ISDErrorLog << "There is already an active subsection." << ISDErrorLogEnd;
 			return nullptr;
 			}
+		this->add_directory_entry( key, key_length );
 
-		// create a writer for the array, to store the start position before calling the begin large block 
-		this->active_subsection = std::unique_ptr<EntityWriter>(new EntityWriter( this->dstream ));
+		// set up the writer of the subsection, to store the start position before calling the begin large block 
+		this->begin_subsection();
 
 		if( !begin_write_large_block( this->dstream, ValueType::VT_Subsection, key, key_length ) )
 			{
@@ -400,24 +547,29 @@ namespace ISD
 			return nullptr;
 			}
 
-		return this->active_subsection.get();
+		return this->active_subsection;
 		}
 
 	bool EntityWriter::EndWriteSection( const EntityWriter *section_writer )
 		{
-		if( this->active_subsection.get() != section_writer )
+		if( this->active_subsection != section_writer )
 			{
 			ISDErrorLog << "Invalid parameter section_writer, it does not match the internal value." << ISDErrorLogEnd;
 			return false;
 			}
 
+		if( !this->active_subsection->WriteDirectory() )
+			{
+			return false;
+			}
+
 		if( !end_write_large_block( this->dstream, this->active_subsection->start_position ) )
 			{
 			ISDErrorLog << "end_write_large_block failed unexpectedly." << ISDErrorLogEnd;
 			return false;
 			}
 
-		this->active_subsection.reset();
+		this->active_subsection = nullptr;
 		return true;
 		}
 
@@ -438,9 +590,10 @@ namespace ISD
 			ISDErrorLog << "There is already an active subsection" << ISDErrorLogEnd;
 			return nullptr;
 			}
+		this->add_directory_entry( key, key_length );
 
-		// create a writer for the array, to store the start position before calling the begin large block 
-		this->active_subsection = std::unique_ptr<EntityWriter>(new EntityWriter( this->dstream ));
+		// set up the writer of the subsection, to store the start position before calling the begin large block 
+		this->begin_subsection();
 
 		if( !begin_write_large_block( this->dstream, ValueType::VT_Array_Subsection, key, key_length ) )
 			{
@@ -452,7 +605,7 @@ namespace ISD
 		if( array_size == ~0 )
 			{
 			this->active_array_size = 0;
-			return this->active_subsection.get();
+			return this->active_subsection;
 			}
 
 		// write out flags, index and array size
@@ -465,12 +618,12 @@ namespace ISD
 		this->active_array_size = array_size;
 		this->active_array_index = ~0;
 		this->active_array_index_start_position = 0;
-		return this->active_subsection.get();
+		return this->active_subsection;
 		}
 
 	bool EntityWriter::BeginWriteSectionInArray( const EntityWriter *sections_array_writer, const size_t section_index )
 		{
-		if( this->active_subsection.get() != sections_array_writer )
+		if( this->active_subsection != sections_array_writer )
 			{
 			ISDErrorLog << "Synch error, currently not writing a subsection array" << ISDErrorLogEnd;
 			return false;
@@ -488,32 +641,121 @@ namespace ISD
 
 		this->active_array_index = section_index;
 		this->active_array_index_start_position = this->dstream.GetPosition();
+		this->active_subsection->directory_entries.clear();
 
-		// write a temporary subsection size
-		dstream.Write( (u64)MAXINT64 );
+		// begin the block of the subsection, which starts with its size
+		this->dstream.BeginBlock();
 
 		return dstream.GetPosition() == (this->active_array_index_start_position + sizeof( u64 ));
 		}
 
 	bool EntityWriter::EndWriteSectionInArray( const EntityWriter *sections_array_writer, const size_t section_index )
 		{
-		if( this->active_subsection.get() != sections_array_writer || this->active_array_index != section_index )
+		if( this->active_subsection != sections_array_writer || this->active_array_index != section_index )
 			{
 			ISDErrorLog << "Synch error, currently not writing a subsection array, or incorrect section index" << ISDErrorLogEnd;
 			return false;
 			}
 
-		const u64 end_pos = dstream.GetPosition();
-		const u64 block_size = end_pos - this->active_array_index_start_position - sizeof(u64); // total block size - ( sizeof( section_size_value )=8 )
-		dstream.SetPosition( this->active_array_index_start_position ); 
-		dstream.Write( block_size );
-		dstream.SetPosition( end_pos ); // move back the where we were
-		return (end_pos > this->active_array_index_start_position); // only thing we really can check
+		// each section in the array has its own directory
+		if( !this->active_subsection->WriteDirectory() )
+			{
+			return false;
+			}
+
+		if( !this->dstream.EndBlock( this->active_array_index_start_position ) )
+			{
+			ISDErrorLog << "The size of the section does not match the precomputed size of the block" << ISDErrorLogEnd;
+			return false;
+			}
+		return true;
+		}
+
+	bool EntityWriter::WriteSectionsInArray( const EntityWriter *sections_array_writer, const size_t section_count, bool (*write_section)( const void *context, size_t section_index, EntityWriter &section_writer ), const void *context )
+		{
+		if( this->active_subsection != sections_array_writer )
+			{
+			ISDErrorLog << "Synch error, currently not writing a subsection array" << ISDErrorLogEnd;
+			return false;
+			}
+		const size_t first_index = this->active_array_index+1;
+		if( section_count > this->active_array_size - first_index )
+			{
+			ISDErrorLog << "Incorrect section count, out of array bounds" << ISDErrorLogEnd;
+			return false;
+			}
+
+		// write serially if there is nothing to parallelize, or if the data of the sections depends on the position in the stream
+		if( this->parallel_thread_count <= 1 
+			|| section_count <= 1
+			|| this->array_payload_alignment != 0 
+			|| this->dstream.GetMeasureOnly() 
+			|| this->dstream.GetBlockSizes() )
+			{
+			for( size_t index = 0; index < section_count; ++index )
+				{
+				if( !this->BeginWriteSectionInArray( sections_array_writer, first_index + index ) )
+					return false;
+				if( !write_section( context, index, *this->active_subsection ) )
+					return false;
+				if( !this->EndWriteSectionInArray( sections_array_writer, first_index + index ) )
+					return false;
+				}
+			return true;
+			}
+
+		// split the sections into a few batches per thread, to balance sections of uneven size
+		const size_t batch_count = std::min( section_count, (size_t)this->parallel_thread_count * 4 );
+		std::vector<std::unique_ptr<MemoryWriteStream>> batch_streams( batch_count );
+		std::atomic<bool> success( true );
+
+		// write each batch into a separate stream, using a sections array writer of the stream, so the sections are
+		// written exactly as in the array. (the directories of the sections use offsets relative to the directory)
+		parallel_for( batch_count, [&]( size_t batch_index )
+			{
+			const size_t batch_start = section_count * batch_index / batch_count;
+			const size_t batch_end = section_count * (batch_index+1) / batch_count;
+
+			batch_streams[batch_index] = std::unique_ptr<MemoryWriteStream>( new MemoryWriteStream( 64*1024 ) );
+			MemoryWriteStream &batch_stream = *batch_streams[batch_index];
+			batch_stream.SetFlipByteOrder( this->dstream.GetFlipByteOrder() );
+
+			EntityWriter batch_writer( batch_stream );
+			batch_writer.write_directory = this->write_directory;
+			batch_writer.parallel_thread_count = this->parallel_thread_count;
+			EntityWriter *batch_sections_writer = batch_writer.begin_subsection();
+			batch_writer.active_array_size = batch_end - batch_start;
+			for( size_t index = batch_start; index < batch_end; ++index )
+				{
+				if( !batch_writer.BeginWriteSectionInArray( batch_sections_writer, index - batch_start ) 
+					|| !write_section( context, index, *batch_sections_writer ) 
+					|| !batch_writer.EndWriteSectionInArray( batch_sections_writer, index - batch_start ) )
+					{
+					success = false;
+					return;
+					}
+				}
+			}, this->parallel_thread_count );
+
+		if( !success )
+			{
+			ISDErrorLog << "Failed to write the sections of the array in parallel" << ISDErrorLogEnd;
+			return false;
+			}
+
+		// append the batches in order
+		for( const std::unique_ptr<MemoryWriteStream> &batch_stream : batch_streams )
+			{
+			this->dstream.Write( (const u8 *)batch_stream->GetData(), batch_stream->GetSize() );
+			}
+
+		this->active_array_index = first_index + section_count - 1;
+		return true;
 		}
 
 	bool EntityWriter::EndWriteSectionsArray( const EntityWriter *sections_array_writer )
 		{
-		if( this->active_subsection.get() != sections_array_writer )
+		if( this->active_subsection != sections_array_writer )
 			{
 			ISDErrorLog << "Synch error, currently not writing a subsection array" << ISDErrorLogEnd;
 			return false;
@@ -531,7 +773,7 @@ namespace ISD
 			}
 
 		// release active subsection writer
-		this->active_subsection.reset();
+		this->active_subsection = nullptr;
 		this->active_array_size = 0;
 		this->active_array_index = ~0;
 		this->active_array_index_start_position = 0;
@@ -0,0 +1,474 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#include "ISD_FileBatchReader.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(ISD_USE_IO_URING) && defined(__linux__)
+#include <liburing.h>
+#define ISD_IO_URING_AVAILABLE
+#endif
+
+#include <algorithm>
+#include <climits>
+
+namespace ISD
+	{
+	Status FileBatchReader::ReadWholeFile( const std::string &file_path, std::vector<u8> &dest )
+		{
+#ifdef _WIN32
+		// open the file
+		HANDLE file_handle = ::CreateFileW( widen( file_path ).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_READONLY, nullptr );
+		if( file_handle == INVALID_HANDLE_VALUE )
+			{
+			// failed to open the file
+			return Status::ECantOpen;
+			}
+
+		// get the size
+		LARGE_INTEGER dfilesize = {};
+		if( !::GetFileSizeEx( file_handle, &dfilesize ) )
+			{
+			// failed to get the size
+			::CloseHandle( file_handle );
+			return Status::ECantOpen;
+			}
+		u64 total_bytes_to_read = dfilesize.QuadPart;
+#else
+		// open the file
+		int file_descriptor = ::open( file_path.c_str(), O_RDONLY | O_CLOEXEC );
+		if( file_descriptor < 0 )
+			{
+			// failed to open the file
+			return Status::ECantOpen;
+			}
+
+		// get the size
+		struct stat file_stat = {};
+		if( ::fstat( file_descriptor, &file_stat ) != 0 )
+			{
+			// failed to get the size
+			::close( file_descriptor );
+			return Status::ECantOpen;
+			}
+		u64 total_bytes_to_read = (u64)file_stat.st_size;
+#endif
+
+		// read in all of the file
+		dest.resize( total_bytes_to_read );
+		if( dest.size() != total_bytes_to_read )
+			{
+			// failed to allocate the memory
+			return Status::ECantAllocate;
+			}
+		u8 *buffer = dest.data();
+
+		Status status = Status::Ok;
+		u64 bytes_read = 0;
+		while( bytes_read < total_bytes_to_read )
+			{
+			// check how much to read and cap each read at INT_MAX
+			u64 bytes_left = total_bytes_to_read - bytes_read;
+			u32 bytes_to_read_this_time = INT_MAX;
+			if( bytes_left < INT_MAX )
+				bytes_to_read_this_time = (u32)bytes_left;
+
+			// read in bytes into the memory allocation
+#ifdef _WIN32
+			DWORD bytes_that_were_read = 0;
+			if( !::ReadFile( file_handle, &buffer[bytes_read], bytes_to_read_this_time, &bytes_that_were_read, nullptr ) )
+				{
+				// failed to read
+				status = Status::ECantRead;
+				break;
+				}
+#else
+			ssize_t bytes_that_were_read = ::pread( file_descriptor, &buffer[bytes_read], bytes_to_read_this_time, (off_t)bytes_read );
+			if( bytes_that_were_read < 0 )
+				{
+				if( errno == EINTR )
+					continue;
+
+				// failed to read
+				status = Status::ECantRead;
+				break;
+				}
+#endif
+			if( bytes_that_were_read == 0 )
+				{
+				// the file is shorter than its size
+				status = Status::ECantRead;
+				break;
+				}
+
+			// update number of bytes that were read
+			bytes_read += bytes_that_were_read;
+			}
+
+#ifdef _WIN32
+		::CloseHandle( file_handle );
+#else
+		::close( file_descriptor );
+#endif
+
+		return status;
+		}
+
+	FileBatchReader::~FileBatchReader()
+		{
+		this->ShutdownIoUring();
+		}
+
+	Status FileBatchReader::Initialize( uint queue_depth )
+		{
+		if( this->QueueDepth != 0 )
+			{
+			return Status::EAlreadyInitialized;
+			}
+		if( queue_depth == 0 )
+			{
+			return Status::EParam;
+			}
+		this->QueueDepth = queue_depth;
+
+#ifdef ISD_IO_URING_AVAILABLE
+		io_uring *ring = new io_uring();
+		if( io_uring_queue_init( queue_depth, ring, 0 ) < 0 )
+			{
+			// io_uring is not supported or not allowed, use the synchronous reads
+			delete ring;
+			return Status::Ok;
+			}
+		this->Ring = ring;
+#endif
+
+		return Status::Ok;
+		}
+
+	void FileBatchReader::ReadBatch( const std::vector<std::string> &file_paths, const completion_callback &callback )
+		{
+		if( this->Ring )
+			{
+			this->ReadBatchIoUring( file_paths, callback );
+			}
+		else
+			{
+			this->ReadBatchSynchronous( file_paths, callback );
+			}
+		}
+
+	void FileBatchReader::ReadBatchSynchronous( const std::vector<std::string> &file_paths, const completion_callback &callback )
+		{
+		for( size_t i = 0; i < file_paths.size(); ++i )
+			{
+			std::vector<u8> data;
+			Status status = ReadWholeFile( file_paths[i], data );
+			callback( i, status, data );
+			}
+		}
+
+#ifdef ISD_IO_URING_AVAILABLE
+	// the state of one file read in the io_uring batch
+	struct uring_file_read
+		{
+		int fd = -1;
+		u64 size = 0;
+		u64 bytes_read = 0;
+		std::vector<u8> data;
+		bool in_flight = false; // set while a request of the file is in the ring
+		bool finished = false; // set when the callback of the file has been called
+		};
+
+	// the user data of cancel requests, which is never the index of a file
+	static const uintptr_t uring_cancel_user_data = ~(uintptr_t)0;
+
+	// queue a read of the rest of the file
+	static void prep_uring_file_read( io_uring *ring, uring_file_read &file, size_t index )
+		{
+		// cap each read at 1GB, the rest is read by new submissions
+		const u64 bytes_left = file.size - file.bytes_read;
+		const unsigned bytes_to_read = (unsigned)std::min<u64>( bytes_left, 1ull << 30 );
+
+		io_uring_sqe *sqe = io_uring_get_sqe( ring );
+		io_uring_prep_read( sqe, file.fd, &file.data[(size_t)file.bytes_read], bytes_to_read, file.bytes_read );
+		io_uring_sqe_set_data( sqe, (void *)(uintptr_t)index );
+		file.in_flight = true;
+		}
+
+	// wait for the next completion. waits which are interrupted by a signal are retried
+	static int wait_uring_cqe( io_uring *ring, io_uring_cqe **cqe, __kernel_timespec *timeout = nullptr )
+		{
+		int ret = 0;
+		do
+			{
+			ret = timeout ? io_uring_wait_cqe_timeout( ring, cqe, timeout ) : io_uring_wait_cqe( ring, cqe );
+			}
+		while( ret == -EINTR );
+		return ret;
+		}
+
+	// cancel the requests of the files which are in flight, and reap all their completions, so the ring is empty and no buffer is 
+	// in use by the kernel. files which are opened by the reaped completions are closed. returns false if the completions can not be reaped
+	static bool cancel_uring_requests( io_uring *ring, std::vector<uring_file_read> &files, size_t file_count, bool opening )
+		{
+		size_t completions_left = 0;
+		for( size_t i = 0; i < file_count; ++i )
+			{
+			if( !files[i].in_flight )
+				continue;
+
+			io_uring_sqe *sqe = io_uring_get_sqe( ring );
+			if( !sqe )
+				{
+				io_uring_submit( ring );
+				sqe = io_uring_get_sqe( ring );
+				}
+			if( !sqe )
+				{
+				return false;
+				}
+			io_uring_prep_cancel( sqe, (void *)(uintptr_t)i, 0 );
+			io_uring_sqe_set_data( sqe, (void *)uring_cancel_user_data );
+			completions_left += 2; // the cancel request, and the cancelled request
+			}
+		io_uring_submit( ring );
+
+		while( completions_left > 0 )
+			{
+			io_uring_cqe *cqe = nullptr;
+			__kernel_timespec timeout = {};
+			timeout.tv_sec = 1;
+			if( wait_uring_cqe( ring, &cqe, &timeout ) < 0 && io_uring_peek_cqe( ring, &cqe ) != 0 )
+				{
+				// no completions can be waited for, and none are left in the ring
+				return false;
+				}
+			const uintptr_t user_data = (uintptr_t)io_uring_cqe_get_data( cqe );
+			if( user_data != uring_cancel_user_data && user_data < file_count )
+				{
+				uring_file_read &file = files[user_data];
+				file.in_flight = false;
+				if( opening && cqe->res >= 0 )
+					{
+					// the open completed before it was cancelled
+					file.fd = cqe->res;
+					}
+				}
+			io_uring_cqe_seen( ring, cqe );
+			--completions_left;
+			}
+		return true;
+		}
+#endif
+
+	void FileBatchReader::ShutdownIoUring()
+		{
+#ifdef ISD_IO_URING_AVAILABLE
+		if( this->Ring )
+			{
+			io_uring_queue_exit( (io_uring *)this->Ring );
+			delete (io_uring *)this->Ring;
+			this->Ring = nullptr;
+			}
+#endif
+		}
+
+	void FileBatchReader::ReadBatchIoUring( const std::vector<std::string> &file_paths, const completion_callback &callback )
+		{
+#ifdef ISD_IO_URING_AVAILABLE
+		std::vector<uring_file_read> files( std::min<size_t>( this->QueueDepth, file_paths.size() ) );
+
+		for( size_t batch_start = 0; batch_start < file_paths.size(); batch_start += this->QueueDepth )
+			{
+			// if the ring failed in an earlier batch, read the rest of the files synchronously
+			if( !this->Ring )
+				{
+				for( size_t i = batch_start; i < file_paths.size(); ++i )
+					{
+					std::vector<u8> data;
+					Status status = ReadWholeFile( file_paths[i], data );
+					callback( i, status, data );
+					}
+				return;
+				}
+
+			io_uring *ring = (io_uring *)this->Ring;
+			const size_t batch_count = std::min<size_t>( this->QueueDepth, file_paths.size() - batch_start );
+
+			// finish a file: close it, and pass the data on to the callback, which can take the allocation
+			auto finish_file = [&]( size_t index, Status status )
+				{
+				uring_file_read &file = files[index];
+				if( file.fd >= 0 )
+					{
+					::close( file.fd );
+					file.fd = -1;
+					}
+				if( status != Status::Ok )
+					{
+					file.data.clear();
+					}
+				file.finished = true;
+				callback( batch_start + index, status, file.data );
+				};
+
+			// if the ring fails, cancel the requests in flight, and fail all the files of the batch which are not finished
+			auto fail_batch = [&]( bool opening )
+				{
+				ISDErrorLog << "io_uring_wait_cqe failed, the files in flight are cancelled" << ISDErrorLogEnd;
+				if( !cancel_uring_requests( ring, files, batch_count, opening ) )
+					{
+					// the kernel may still use the buffers of the requests, so they are left allocated, 
+					// and the ring is shut down. the following files are read synchronously
+					ISDErrorLog << "The io_uring requests could not be cancelled, falling back to synchronous reads" << ISDErrorLogEnd;
+					for( size_t i = 0; i < batch_count; ++i )
+						{
+						if( files[i].in_flight )
+							{
+							new std::vector<u8>( std::move( files[i].data ) ); // intentionally leaked
+							}
+						}
+					this->ShutdownIoUring();
+					}
+				for( size_t i = 0; i < batch_count; ++i )
+					{
+					if( !files[i].finished )
+						{
+						finish_file( i, Status::ECantRead );
+						}
+					}
+				};
+
+			// submit the opens of all files in the batch
+			for( size_t i = 0; i < batch_count; ++i )
+				{
+				files[i] = uring_file_read();
+				io_uring_sqe *sqe = io_uring_get_sqe( ring );
+				io_uring_prep_openat( sqe, AT_FDCWD, file_paths[batch_start + i].c_str(), O_RDONLY | O_CLOEXEC, 0 );
+				io_uring_sqe_set_data( sqe, (void *)(uintptr_t)i );
+				files[i].in_flight = true;
+				}
+			io_uring_submit( ring );
+
+			bool ring_failed = false;
+			for( size_t i = 0; i < batch_count; ++i )
+				{
+				io_uring_cqe *cqe = nullptr;
+				if( wait_uring_cqe( ring, &cqe ) < 0 )
+					{
+					ring_failed = true;
+					break;
+					}
+				const size_t index = (size_t)(uintptr_t)io_uring_cqe_get_data( cqe );
+				files[index].in_flight = false;
+				if( cqe->res >= 0 )
+					{
+					files[index].fd = cqe->res;
+					}
+				io_uring_cqe_seen( ring, cqe );
+				}
+			if( ring_failed )
+				{
+				fail_batch( true );
+				continue;
+				}
+
+			// set up the reads of the opened files
+			size_t reads_in_flight = 0;
+			for( size_t i = 0; i < batch_count; ++i )
+				{
+				uring_file_read &file = files[i];
+				if( file.fd < 0 )
+					{
+					finish_file( i, Status::ECantOpen );
+					continue;
+					}
+
+				struct stat file_stat = {};
+				if( ::fstat( file.fd, &file_stat ) != 0 )
+					{
+					finish_file( i, Status::ECantOpen );
+					continue;
+					}
+				file.size = (u64)file_stat.st_size;
+				if( file.size == 0 )
+					{
+					finish_file( i, Status::Ok );
+					continue;
+					}
+
+				file.data.resize( (size_t)file.size );
+				if( file.data.size() != file.size )
+					{
+					finish_file( i, Status::ECantAllocate );
+					continue;
+					}
+
+				prep_uring_file_read( ring, file, i );
+				++reads_in_flight;
+				}
+			io_uring_submit( ring );
+
+			// handle the read completions, resubmitting partial reads
+			while( reads_in_flight > 0 )
+				{
+				io_uring_cqe *cqe = nullptr;
+				if( wait_uring_cqe( ring, &cqe ) < 0 )
+					{
+					ring_failed = true;
+					break;
+					}
+				const size_t index = (size_t)(uintptr_t)io_uring_cqe_get_data( cqe );
+				const int res = cqe->res;
+				io_uring_cqe_seen( ring, cqe );
+				--reads_in_flight;
+
+				uring_file_read &file = files[index];
+				file.in_flight = false;
+				if( res == -EINTR || res == -EAGAIN )
+					{
+					// retry
+					prep_uring_file_read( ring, file, index );
+					++reads_in_flight;
+					io_uring_submit( ring );
+					}
+				else if( res <= 0 )
+					{
+					// failed to read, or the file is shorter than its size
+					finish_file( index, Status::ECantRead );
+					}
+				else
+					{
+					file.bytes_read += (u64)res;
+					if( file.bytes_read == file.size )
+						{
+						finish_file( index, Status::Ok );
+						}
+					else
+						{
+						// short read, read the rest
+						prep_uring_file_read( ring, file, index );
+						++reads_in_flight;
+						io_uring_submit( ring );
+						}
+					}
+				}
+			if( ring_failed )
+				{
+				fail_batch( false );
+				}
+			}
+#else
+		this->ReadBatchSynchronous( file_paths, callback );
+#endif
+		}
+	};
@@ -0,0 +1,57 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#pragma once
+
+#include "ISD_Types.h"
+
+#include <functional>
+
+namespace ISD
+	{
+	// Reads whole files in batches. 
+	// On Linux, if the library is built with ISD_USE_IO_URING (and linked with liburing), the opens and reads of a 
+	// batch are submitted together through io_uring, so the device queue is kept full. The files are read directly 
+	// into the allocations which are passed to the callback. If io_uring is not built in, or not available on the 
+	// running kernel, the files are read one at a time with pread (ReadFile on Windows).
+	// The reader is not thread safe, each thread should use its own reader.
+	class FileBatchReader
+		{
+		public:
+			// called for each file in the batch as its read completes, with the index of the file in the batch, 
+			// the status of the read, and the data of the file. the callback can take the data by moving it.
+			using completion_callback = std::function<void( size_t file_index, Status status, std::vector<u8> &data )>;
+
+		private:
+			void *Ring = nullptr; // the io_uring, if used
+			uint QueueDepth = 0;
+
+			void ReadBatchSynchronous( const std::vector<std::string> &file_paths, const completion_callback &callback );
+			void ReadBatchIoUring( const std::vector<std::string> &file_paths, const completion_callback &callback );
+
+			// shut down the io_uring, after which the files are read synchronously
+			void ShutdownIoUring();
+
+		public:
+			FileBatchReader() = default;
+			FileBatchReader( const FileBatchReader & ) = delete;
+			FileBatchReader &operator=( const FileBatchReader & ) = delete;
+			~FileBatchReader();
+
+			// set up the reader, with at most queue_depth files in flight. 
+			// if io_uring can not be used, the reader falls back to synchronous reads, which is not an error
+			Status Initialize( uint queue_depth = 256 );
+
+			// returns true if the reader submits the reads through io_uring
+			bool IsUsingIoUring() const { return this->Ring != nullptr; }
+
+			// the most files in flight at once, as set in Initialize
+			uint GetQueueDepth() const { return this->QueueDepth; }
+
+			// read all the files, and call the callback for each file as it completes. returns when all files are done.
+			void ReadBatch( const std::vector<std::string> &file_paths, const completion_callback &callback );
+
+			// read one file synchronously into dest
+			static Status ReadWholeFile( const std::string &file_path, std::vector<u8> &dest );
+		};
+	};
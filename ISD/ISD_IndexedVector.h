@@ -46,6 +46,8 @@ namespace ISD
 			static bool Write( const _MgmCl &obj, EntityWriter &writer );
 			static bool Read( _MgmCl &obj, EntityReader &reader );
 
+			static bool MeasureSerializedSize( const _MgmCl &obj, const EntityWriter &writer, u64 &dest_size, std::vector<u64> *dest_block_sizes = nullptr );
+
 			static bool Validate( const _MgmCl &obj, EntityValidator &validator );
 		};
 
@@ -81,6 +83,12 @@ namespace ISD
 		return (_lval == _rval);
 		}
 
+	template<class _Ty, class _Base>
+	bool IndexedVector<_Ty,_Base>::MF::MeasureSerializedSize( const _MgmCl &obj, const EntityWriter &writer, u64 &dest_size, std::vector<u64> *dest_block_sizes )
+		{
+		return writer.MeasureWrite( obj, dest_size, dest_block_sizes );
+		}
+
 	template<class _Ty, class _Base>
 	bool IndexedVector<_Ty,_Base>::MF::Write( const _MgmCl &obj, EntityWriter &writer )
 		{
@@ -0,0 +1,300 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#include "ISD_MappedFile.h"
+#include "ISD_FileBatchReader.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <tuple>
+
+namespace ISD
+	{
+	bool operator<( const file_identity &left, const file_identity &right )
+		{
+		return std::tie( left.device, left.inode, left.modified_time, left.size ) < std::tie( right.device, right.inode, right.modified_time, right.size );
+		}
+
+	bool operator==( const file_identity &left, const file_identity &right )
+		{
+		return left.device == right.device
+			&& left.inode == right.inode
+			&& left.modified_time == right.modified_time
+			&& left.size == right.size;
+		}
+
+	MappedFile::~MappedFile()
+		{
+		if( this->Data )
+			{
+#ifdef _WIN32
+			::UnmapViewOfFile( this->Data );
+#else
+			::munmap( (void *)this->Data, (size_t)this->Size );
+#endif
+			}
+		}
+
+	Status MappedFile::Open( const std::string &file_path )
+		{
+		if( this->Data || this->Size )
+			{
+			return Status::EAlreadyInitialized;
+			}
+
+#ifdef _WIN32
+		HANDLE file_handle = ::CreateFileW( widen( file_path ).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_READONLY, nullptr );
+		if( file_handle == INVALID_HANDLE_VALUE )
+			{
+			return Status::ECantOpen;
+			}
+
+		BY_HANDLE_FILE_INFORMATION file_information = {};
+		if( !::GetFileInformationByHandle( file_handle, &file_information ) )
+			{
+			::CloseHandle( file_handle );
+			return Status::ECantOpen;
+			}
+		this->Identity.device = file_information.dwVolumeSerialNumber;
+		this->Identity.inode = ( (u64)file_information.nFileIndexHigh << 32 ) | file_information.nFileIndexLow;
+		this->Identity.modified_time = ( (u64)file_information.ftLastWriteTime.dwHighDateTime << 32 ) | file_information.ftLastWriteTime.dwLowDateTime;
+		this->Identity.size = ( (u64)file_information.nFileSizeHigh << 32 ) | file_information.nFileSizeLow;
+
+		if( this->Identity.size == 0 )
+			{
+			::CloseHandle( file_handle );
+			return Status::Ok;
+			}
+
+		// the view keeps the mapping and file open, so the handles can be closed directly
+		HANDLE mapping_handle = ::CreateFileMappingW( file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr );
+		::CloseHandle( file_handle );
+		if( !mapping_handle )
+			{
+			return Status::ECantRead;
+			}
+		const void *view = ::MapViewOfFile( mapping_handle, FILE_MAP_READ, 0, 0, 0 );
+		::CloseHandle( mapping_handle );
+		if( !view )
+			{
+			return Status::ECantRead;
+			}
+#else
+		int file_descriptor = ::open( file_path.c_str(), O_RDONLY | O_CLOEXEC );
+		if( file_descriptor < 0 )
+			{
+			return Status::ECantOpen;
+			}
+
+		struct stat file_stat = {};
+		if( ::fstat( file_descriptor, &file_stat ) != 0 )
+			{
+			::close( file_descriptor );
+			return Status::ECantOpen;
+			}
+		this->Identity.device = (u64)file_stat.st_dev;
+		this->Identity.inode = (u64)file_stat.st_ino;
+#ifdef __APPLE__
+		this->Identity.modified_time = (u64)file_stat.st_mtimespec.tv_sec * 1000000000ull + (u64)file_stat.st_mtimespec.tv_nsec;
+#else
+		this->Identity.modified_time = (u64)file_stat.st_mtim.tv_sec * 1000000000ull + (u64)file_stat.st_mtim.tv_nsec;
+#endif
+		this->Identity.size = (u64)file_stat.st_size;
+
+		if( this->Identity.size == 0 )
+			{
+			::close( file_descriptor );
+			return Status::Ok;
+			}
+
+		// the mapping keeps the file open, so the descriptor can be closed directly
+		void *view = ::mmap( nullptr, (size_t)this->Identity.size, PROT_READ, MAP_SHARED, file_descriptor, 0 );
+		::close( file_descriptor );
+		if( view == MAP_FAILED )
+			{
+			return Status::ECantRead;
+			}
+#endif
+
+		this->Data = (const u8 *)view;
+		this->Size = this->Identity.size;
+		return Status::Ok;
+		}
+
+	// the size of a record in the cache file
+	static const size_t verified_file_record_size = sizeof( u64 ) * 4 + sizeof( hash );
+
+	static void write_verified_file_record( u8 *dest, const file_identity &identity, const hash &root_hash )
+		{
+		memcpy( &dest[0], &identity.device, sizeof( u64 ) );
+		memcpy( &dest[8], &identity.inode, sizeof( u64 ) );
+		memcpy( &dest[16], &identity.modified_time, sizeof( u64 ) );
+		memcpy( &dest[24], &identity.size, sizeof( u64 ) );
+		memcpy( &dest[32], &root_hash, sizeof( hash ) );
+		}
+
+	// truncate the open file to size, but only if it still is expected_size, so records which have been appended by 
+	// other processes since the file was read are not cut. returns false if the file was not truncated
+	static bool truncate_file( FILE *file, u64 expected_size, u64 size )
+		{
+#ifdef _WIN32
+		struct _stat64 file_stat = {};
+		if( _fstat64( _fileno( file ), &file_stat ) != 0 || (u64)file_stat.st_size != expected_size )
+			{
+			return false;
+			}
+		return _chsize_s( _fileno( file ), (__int64)size ) == 0;
+#else
+		struct stat file_stat = {};
+		if( ::fstat( fileno( file ), &file_stat ) != 0 || (u64)file_stat.st_size != expected_size )
+			{
+			return false;
+			}
+		return ::ftruncate( fileno( file ), (off_t)size ) == 0;
+#endif
+		}
+
+	VerifiedFileCache::~VerifiedFileCache()
+		{
+		if( this->CacheFile )
+			{
+			fclose( this->CacheFile );
+			}
+		}
+
+	Status VerifiedFileCache::SetCacheFile( const std::string &cache_file_path )
+		{
+		std::lock_guard<std::mutex> guard( this->Mutex );
+		if( this->CacheFile )
+			{
+			return Status::EAlreadyInitialized;
+			}
+
+		// load the records, if there is a valid cache file. a partially written last record is ignored
+		std::vector<u8> cache_data;
+		size_t record_count = 0;
+		bool valid_cache_file = false;
+		if( FileBatchReader::ReadWholeFile( cache_file_path, cache_data ) == Status::Ok && cache_data.size() >= sizeof( u64 ) )
+			{
+			u64 magic = 0;
+			memcpy( &magic, cache_data.data(), sizeof( u64 ) );
+			valid_cache_file = ( magic == CacheFileMagic );
+			}
+		if( valid_cache_file )
+			{
+			record_count = ( cache_data.size() - sizeof( u64 ) ) / verified_file_record_size;
+			for( size_t i = 0; i < record_count; ++i )
+				{
+				const u8 *record = &cache_data[sizeof( u64 ) + i * verified_file_record_size];
+				file_identity identity;
+				hash root_hash;
+				memcpy( &identity.device, &record[0], sizeof( u64 ) );
+				memcpy( &identity.inode, &record[8], sizeof( u64 ) );
+				memcpy( &identity.modified_time, &record[16], sizeof( u64 ) );
+				memcpy( &identity.size, &record[24], sizeof( u64 ) );
+				memcpy( &root_hash, &record[32], sizeof( hash ) );
+				this->VerifiedFiles[identity] = root_hash;
+				}
+			}
+		else if( !cache_data.empty() )
+			{
+			ISDErrorLog << "The verified file cache " << cache_file_path << " is not valid, and is rewritten" << ISDErrorLogEnd;
+			}
+
+		// open for appending
+		bool rewrite = !valid_cache_file;
+		if( valid_cache_file )
+			{
+#ifdef _WIN32
+			this->CacheFile = _wfopen( widen( cache_file_path ).c_str(), L"ab" );
+#else
+			this->CacheFile = fopen( cache_file_path.c_str(), "ab" );
+#endif
+			if( !this->CacheFile )
+				{
+				return Status::ECantOpen;
+				}
+
+			// a partially written last record (of a process which stopped while appending) is cut, so the records which are 
+			// appended after it are aligned. if the file can not be truncated, or has been appended to since it was read, 
+			// it is rewritten with the loaded records instead
+			const u64 records_size = sizeof( u64 ) + (u64)record_count * verified_file_record_size;
+			if( (u64)cache_data.size() != records_size && !truncate_file( this->CacheFile, (u64)cache_data.size(), records_size ) )
+				{
+				ISDErrorLog << "The last record of the verified file cache " << cache_file_path << " is partially written, and the file is rewritten" << ISDErrorLogEnd;
+				fclose( this->CacheFile );
+				this->CacheFile = nullptr;
+				rewrite = true;
+				}
+			}
+
+		// create a new file with the magic value, and the loaded records
+		if( rewrite )
+			{
+#ifdef _WIN32
+			this->CacheFile = _wfopen( widen( cache_file_path ).c_str(), L"wb" );
+#else
+			this->CacheFile = fopen( cache_file_path.c_str(), "wb" );
+#endif
+			if( !this->CacheFile )
+				{
+				return Status::ECantOpen;
+				}
+			std::vector<u8> file_data( sizeof( u64 ) + this->VerifiedFiles.size() * verified_file_record_size );
+			memcpy( file_data.data(), &CacheFileMagic, sizeof( u64 ) );
+			u8 *dest = &file_data[sizeof( u64 )];
+			for( const auto &verified_file : this->VerifiedFiles )
+				{
+				write_verified_file_record( dest, verified_file.first, verified_file.second );
+				dest += verified_file_record_size;
+				}
+			if( fwrite( file_data.data(), file_data.size(), 1, this->CacheFile ) != 1 || fflush( this->CacheFile ) != 0 )
+				{
+				fclose( this->CacheFile );
+				this->CacheFile = nullptr;
+				return Status::ECantWrite;
+				}
+			}
+
+		return Status::Ok;
+		}
+
+	bool VerifiedFileCache::IsVerified( const file_identity &identity, const hash &root_hash ) const
+		{
+		std::lock_guard<std::mutex> guard( this->Mutex );
+		auto it = this->VerifiedFiles.find( identity );
+		return ( it != this->VerifiedFiles.end() ) && ( it->second == root_hash );
+		}
+
+	void VerifiedFileCache::SetVerified( const file_identity &identity, const hash &root_hash )
+		{
+		std::lock_guard<std::mutex> guard( this->Mutex );
+		auto it = this->VerifiedFiles.find( identity );
+		if( it != this->VerifiedFiles.end() && it->second == root_hash )
+			{
+			return;
+			}
+		this->VerifiedFiles[identity] = root_hash;
+
+		// append the record with one write, so records appended by other processes are not interleaved
+		if( this->CacheFile )
+			{
+			u8 record[verified_file_record_size];
+			write_verified_file_record( record, identity, root_hash );
+			if( fwrite( record, sizeof( record ), 1, this->CacheFile ) != 1 || fflush( this->CacheFile ) != 0 )
+				{
+				ISDErrorLog << "Failed to write to the verified file cache" << ISDErrorLogEnd;
+				}
+			}
+		}
+	};
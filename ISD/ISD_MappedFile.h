@@ -0,0 +1,81 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#pragma once
+
+#include "ISD_Types.h"
+
+#include <map>
+#include <mutex>
+#include <cstdio>
+
+namespace ISD
+	{
+	// identifies one version of a file on disk: the device and inode (volume serial and file index on Windows),
+	// the last modification time and the size. if the file is replaced or written to, the identity changes.
+	struct file_identity
+		{
+		u64 device = 0;
+		u64 inode = 0;
+		u64 modified_time = 0;
+		u64 size = 0;
+		};
+	bool operator<( const file_identity &left, const file_identity &right );
+	bool operator==( const file_identity &left, const file_identity &right );
+
+	// A read-only memory mapping of a whole file. The pages are shared with the page cache, so processes
+	// which map the same file share the memory.
+	// The file must not be modified in place while it is mapped, files should be replaced by renaming a new file over them.
+	class MappedFile
+		{
+		private:
+			const u8 *Data = nullptr;
+			u64 Size = 0;
+			file_identity Identity;
+
+		public:
+			MappedFile() = default;
+			MappedFile( const MappedFile & ) = delete;
+			MappedFile &operator=( const MappedFile & ) = delete;
+			~MappedFile();
+
+			// map all of the file. an empty file is not mapped, and has no data
+			Status Open( const std::string &file_path );
+
+			const u8 *GetData() const { return this->Data; }
+			u64 GetSize() const { return this->Size; }
+			const file_identity &GetIdentity() const { return this->Identity; }
+		};
+
+	// Remembers which files have been verified, keyed by the identity of the file and the root hash of its trailer,
+	// so an unchanged file does not need to be hashed again when it is mapped again.
+	// If a cache file is set, the records are loaded from it, and new records are appended, so the records are
+	// shared between processes. The cache file is only read in SetCacheFile, so records which other processes append
+	// after that are not seen, and those files are verified (and recorded) again. The methods are thread safe.
+	class VerifiedFileCache
+		{
+		private:
+			mutable std::mutex Mutex;
+			std::map<file_identity, hash> VerifiedFiles;
+			FILE *CacheFile = nullptr;
+
+		public:
+			// the cache file starts with the magic value, followed by 64 byte records: the file_identity as 4 u64s and the root hash
+			static const u64 CacheFileMagic = 0x3159465256445349; // "ISDVRFY1"
+
+			VerifiedFileCache() = default;
+			VerifiedFileCache( const VerifiedFileCache & ) = delete;
+			VerifiedFileCache &operator=( const VerifiedFileCache & ) = delete;
+			~VerifiedFileCache();
+
+			// load the records of the cache file, and append new records to it. the file is created if it does not exist,
+			// and rewritten if it is not a valid cache file. a partially written last record is truncated
+			Status SetCacheFile( const std::string &cache_file_path );
+
+			// returns true if the file, with the root hash, has been verified
+			bool IsVerified( const file_identity &identity, const hash &root_hash ) const;
+
+			// record that the file, with the root hash, has been verified
+			void SetVerified( const file_identity &identity, const hash &root_hash );
+		};
+	};
@@ -6,6 +6,7 @@
 #include "ISD_Types.h"
 
 #include <vector>
+#include <memory>
 
 namespace ISD
 	{
@@ -23,6 +24,7 @@ namespace ISD
 			u64 DataSize = 0;
 			u64 DataPosition = 0;
 			bool FlipByteOrder = false; // true if we should flip BE to LE or LE to BE
+			std::shared_ptr<const void> DataOwner; // optional owner of the data, which keeps it alive
 
 			// read raw bytes from the memory stream
 			u64 ReadRawData( void *dest, u64 count );
@@ -48,9 +50,18 @@ namespace ISD
 			bool GetFlipByteOrder() const;
 			void SetFlipByteOrder( bool value );
 
+			// DataOwner is an optional owner of the stream data. If set, values which are read from the stream can keep references 
+			// into the data after the stream is gone, by holding on to the owner (see lazy_section)
+			const std::shared_ptr<const void> &GetDataOwner() const { return this->DataOwner; }
+			void SetDataOwner( std::shared_ptr<const void> owner ) { this->DataOwner = std::move( owner ); }
+
 			// Peek at the next byte in the stream, without modifing the Position or any data. If the Position is beyond the end of the stream, the value will be 0
 			u8 Peek() const;
 
+			// get a pointer directly into the stream data at the current Position, and move the Position past count bytes. 
+			// no byte order conversion is done. if there are not count bytes left in the stream, nullptr is returned, and the Position is not moved
+			const u8 *ReadRawDataView( u64 count );
+
 			// read one item from the memory stream. makes sure to convert endianness
 			template <class T> T Read();
 			template <> i8 Read<i8>();
@@ -89,6 +100,18 @@ namespace ISD
 			return this->Data[this->DataPosition];
 		}
 
+	inline const u8 *MemoryReadStream::ReadRawDataView( u64 count )
+		{
+		if( count > this->DataSize - this->DataPosition )
+			{
+			return nullptr;
+			}
+
+		const u8 *ptr = &this->Data[this->DataPosition];
+		this->DataPosition += count;
+		return ptr;
+		}
+
 	inline u64 MemoryReadStream::ReadRawData( void *dest, u64 count )
 		{
 		// cap the end position
@@ -107,13 +130,21 @@ namespace ISD
 
 	template <class T> inline u64 MemoryReadStream::ReadValues( T *dest, u64 count )
 		{
-		u64 readc = this->ReadRawData( dest, count * sizeof(T) ) / sizeof(T);
 		if( !this->FlipByteOrder )
-			return readc;
+			return this->ReadRawData( dest, count * sizeof(T) ) / sizeof(T);
 
-		// flip the byte order of the words in the dest
-		swap_byte_order<T>( dest, count );
-		return readc;
+		// cap the count to the whole words left in the stream (like ReadRawData, a capped read moves the position to the end)
+		u64 end_pos = this->DataPosition + (count * sizeof(T));
+		if( end_pos > this->DataSize )
+			{
+			end_pos = this->DataSize;
+			count = (end_pos - this->DataPosition) / sizeof(T);
+			}
+
+		// copy the words to the dest and flip the byte order in the same pass
+		copy_and_swap_byte_order<T>( dest, (const T *)&this->Data[this->DataPosition], count );
+		this->DataPosition = end_pos;
+		return count;
 		}
 
 	template <> inline u64 MemoryReadStream::ReadValues<u8>( u8 *dest, u64 count ) 
@@ -4,9 +4,15 @@
 #pragma once
 
 #include "ISD_Types.h"
+#include "ISD_WriteSink.h"
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include <vector>
 
@@ -19,6 +25,12 @@ namespace ISD
 	// the above types.
 	// Caveat: The stream is NOT thread safe, and should be accessed by 
 	// only one thread at a time.
+	// If a WriteSink is set, the memory area is used as a bounded buffer, 
+	// and the data is flushed to the sink whenever the buffer is full. Writes 
+	// to positions that have already been flushed are passed on to the sink.
+	// A measure only stream does not store any data, it only moves the position
+	// and grows the size of the stream, so it is used to measure the size of 
+	// structured values before they are written.
 	class MemoryWriteStream
 		{
 		private:
@@ -27,12 +39,24 @@ namespace ISD
 			u8 *Data = nullptr; // the allocated data
 			u64 DataSize = 0; // the size of the memory stream (not the reserved allocation)
 			u64 Position = 0; // the write position in the memory stream
+			u64 DataOffset = 0; // the stream position of the first byte in Data. everything before it has been flushed to the sink
 			
 			u64 DataReservedSize = 0; // the reserved size of the allocation
 			u32 PageSize = 0; // size of each page of allocation
 			
 			bool FlipByteOrder = false; // true if we should flip BE to LE or LE to BE
 
+			WriteSink *Sink = nullptr; // if set, the data is flushed to the sink
+			u64 SinkBufferSize = 0; // the maximum amount of data to buffer before flushing to the sink
+			bool SinkFailed = false; // set if a write to the sink failed
+
+			bool MeasureOnly = false; // if set, no data is stored
+
+			std::vector<u64> *BlockSizes = nullptr; // if set, the sizes of the blocks are recorded in (measure only) or written from the list
+			size_t NextBlockSize = 0; // the index of the size of the next block in BlockSizes
+			std::vector<std::pair<u64,size_t>> OpenBlocks; // the positions and size indices of the blocks which are not ended yet
+			bool BlockSizeMismatch = false; // set if a block did not match its precomputed size
+
 			// reserve data for at least reserveSize.
 			void ReserveForSize( u64 reserveSize );
 			void FreeAllocation();
@@ -43,17 +67,42 @@ namespace ISD
 			// write raw bytes to the memory stream. this will increase reserved allocation of data as needed
 			void WriteRawData( const void *src, u64 count );
 
+			// write directly to the sink, bypassing the buffer
+			void WriteToSink( u64 offset, const void *src, u64 count );
+
 			// write 1,2,4 or 8 byte values and make sure they are in the correct byte order
 			template <class T> void WriteValues( const T *src, u64 count );
 			template <> void WriteValues<u8>( const u8 *src, u64 count );
 
 		public:
-			MemoryWriteStream( u64 _InitialAllocationSize = InitialAllocationSize ) { this->ReserveForSize( _InitialAllocationSize ); };
+			MemoryWriteStream( u64 _InitialAllocationSize = InitialAllocationSize, bool _MeasureOnly = false ) : MeasureOnly( _MeasureOnly ) { if( !this->MeasureOnly ) { this->ReserveForSize( _InitialAllocationSize ); } };
 			~MemoryWriteStream() { this->FreeAllocation(); };
 
 			// get a read-only pointer to the data
+			// note: if a sink is set, only the data which has not yet been flushed is available
 			const void *GetData() const { return this->Data; }
 
+			// reserve memory for the stream to grow to at least size bytes, so that it is not reallocated while writing
+			void Reserve( u64 size );
+
+			// MeasureOnly is set if the stream was created to only measure the data written to it. The data is never stored,
+			// (GetData returns nullptr) but the position and size of the stream are the same as if the data was written.
+			bool GetMeasureOnly() const { return this->MeasureOnly; }
+
+			// Sink is an optional destination of the data. The sink must be set before writing 
+			// to the stream, and the stream will then only buffer at most sink_buffer_size bytes
+			// before flushing to the sink. Call Flush when done writing, to write the last data.
+			void SetSink( WriteSink *sink, u64 sink_buffer_size = InitialAllocationSize );
+			WriteSink *GetSink() const;
+
+			// flush all buffered data to the sink. 
+			// returns ECantWrite if any write to the sink failed since the sink was set, or the stream has failed (see HasFailed)
+			Status Flush();
+
+			// returns true if a write to the sink failed since the sink was set, or if a block did not match its precomputed 
+			// size (see BeginBlock), in which case the data of the stream is invalid. once failed, nothing more is written to the sink
+			bool HasFailed() const { return this->SinkFailed || this->BlockSizeMismatch; }
+
 			// get the Size of the stream in bytes
 			u64 GetSize() const;
 
@@ -65,6 +114,19 @@ namespace ISD
 			bool GetFlipByteOrder() const;
 			void SetFlipByteOrder( bool value );
 
+			// Blocks are ranges of the stream which start with the size of the rest of the block as a u64 value. BeginBlock writes 
+			// the size, and returns the position of it, which is then passed to EndBlock. By default, BeginBlock writes a stand in 
+			// value, and EndBlock moves back to write the size of the block. 
+			// If a list of BlockSizes is set on a measure only stream, the sizes of the blocks are added to the list in the order the 
+			// blocks begin. If the list is set on a stream which is written, the sizes in the list are written directly by BeginBlock,
+			// so the stream is written in one forward pass. Since the size is then already written, a block which does not match its 
+			// size fails the stream (see HasFailed), and EndBlock returns false, which must be treated as a failed write. If the list 
+			// runs out of sizes, the blocks are written the default way. The list must be kept alive while it is set.
+			u64 BeginBlock();
+			bool EndBlock( u64 block_position );
+			void SetBlockSizes( std::vector<u64> *block_sizes );
+			std::vector<u64> *GetBlockSizes() const;
+
 			// write one item to the memory stream. makes sure to convert endianness
 			void Write( const i8 &src );
 			void Write( const i16 &src );
@@ -99,12 +161,14 @@ namespace ISD
 		{
 		// we need to resize the reserved data area, try doubling size
 		// and if that is not enough, set to the reserveSize
+		u64 prevReservedSize = this->DataReservedSize;
 		this->DataReservedSize *= 2;
 		if( this->DataReservedSize < reserveSize )
 			{
 			this->DataReservedSize = reserveSize;
 			}
 
+#ifdef _WIN32
 		// allocate a new area
 		u8 *pNewData = (u8*)::VirtualAlloc( nullptr, this->DataReservedSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
 		if( pNewData == nullptr )
@@ -116,9 +180,48 @@ namespace ISD
 		// the area can never shrink, so we don't need to worry about capping
 		if( this->Data )
 			{
-			memcpy( pNewData, this->Data, this->DataSize );
+			memcpy( pNewData, this->Data, this->DataSize - this->DataOffset );
 			::VirtualFree( this->Data, 0, MEM_RELEASE );
 			}
+#else
+		// round the reservation up to whole pages, mmap and mremap work on page granularity
+		if( this->PageSize == 0 )
+			{
+			this->PageSize = (u32)::sysconf( _SC_PAGESIZE );
+			}
+		this->DataReservedSize = ((this->DataReservedSize + this->PageSize - 1) / this->PageSize) * this->PageSize;
+
+		// anonymous mappings are only backed by physical pages once they are touched, so 
+		// the reservation itself does not add to the resident size of the process
+		u8 *pNewData = nullptr;
+		if( this->Data == nullptr )
+			{
+			void *ptr = ::mmap( nullptr, this->DataReservedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+			pNewData = (ptr != MAP_FAILED) ? (u8*)ptr : nullptr;
+			}
+		else
+			{
+#ifdef __linux__
+			// grow the mapping. mremap either extends the area in place, or moves the page table 
+			// entries to a new virtual range, so the written data is never copied
+			void *ptr = ::mremap( this->Data, prevReservedSize, this->DataReservedSize, MREMAP_MAYMOVE );
+			pNewData = (ptr != MAP_FAILED) ? (u8*)ptr : nullptr;
+#else
+			// no mremap available, allocate a new area and copy the data
+			void *ptr = ::mmap( nullptr, this->DataReservedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+			if( ptr != MAP_FAILED )
+				{
+				pNewData = (u8*)ptr;
+				memcpy( pNewData, this->Data, this->DataSize - this->DataOffset );
+				::munmap( this->Data, prevReservedSize );
+				}
+#endif
+			}
+		if( pNewData == nullptr )
+			{
+			throw std::bad_alloc();
+			}
+#endif
 
 		// set the new pointer
 		this->Data = pNewData;
@@ -128,43 +231,152 @@ namespace ISD
 		{
 		if( this->Data ) 
 			{ 
+#ifdef _WIN32
 			::VirtualFree( this->Data, 0, MEM_RELEASE ); 
+#else
+			::munmap( this->Data, this->DataReservedSize );
+#endif
 			}
 		}
 
 
 	inline void MemoryWriteStream::Resize( u64 newSize )
 		{
-		if( newSize > this->DataReservedSize )
+		// a measure only stream has no allocation
+		if( this->MeasureOnly )
+			{
+			this->DataSize = newSize;
+			return;
+			}
+
+		// the allocation only holds the data after the DataOffset
+		u64 newBufferSize = newSize - this->DataOffset;
+		if( newBufferSize > this->DataReservedSize )
 			{
-			this->ReserveForSize( newSize );
+			this->ReserveForSize( newBufferSize );
 			}
 
 		this->DataSize = newSize;
 		}
 
+	inline void MemoryWriteStream::WriteToSink( u64 offset, const void *src, u64 count )
+		{
+		if( this->HasFailed() )
+			{
+			return;
+			}
+		if( !this->Sink->WriteAt( offset, src, count ) )
+			{
+			this->SinkFailed = true;
+			}
+		}
+
 	inline void MemoryWriteStream::WriteRawData( const void *src, u64 count )
 		{
+		const u8 *psrc = (const u8 *)src;
+
+		// if measuring, just move the position
+		if( this->MeasureOnly )
+			{
+			this->Position += count;
+			if( this->Position > this->DataSize )
+				{
+				this->DataSize = this->Position;
+				}
+			return;
+			}
+
+		// if the position is in the area which has already been flushed, patch the data in the sink
+		if( this->Position < this->DataOffset )
+			{
+			u64 sink_count = this->DataOffset - this->Position;
+			if( sink_count > count )
+				{
+				sink_count = count;
+				}
+			this->WriteToSink( this->Position, psrc, sink_count );
+			this->Position += sink_count;
+			psrc += sink_count;
+			count -= sink_count;
+			if( count == 0 )
+				{
+				return;
+				}
+			}
+
 		// cap the end position
 		u64 end_pos = this->Position + count;
+
+		// if the buffer would grow past the sink buffer size, flush it first
+		if( this->Sink && ( end_pos - this->DataOffset ) > this->SinkBufferSize )
+			{
+			this->Flush();
+
+			// if the data is still too large to buffer, write it directly to the sink
+			if( count > this->SinkBufferSize )
+				{
+				this->WriteToSink( this->Position, psrc, count );
+				this->Position = end_pos;
+				if( end_pos > this->DataSize )
+					{
+					this->DataSize = end_pos;
+					}
+				this->DataOffset = this->DataSize;
+				return;
+				}
+
+			// if the position was before the end of the stream, the start of the data is now 
+			// in the flushed area, so write it through the sink as well
+			if( this->Position < this->DataOffset )
+				{
+				this->WriteRawData( psrc, count );
+				return;
+				}
+			}
+
 		if( end_pos > this->DataSize )
 			{
 			this->Resize( end_pos );
 			}
 
 		// copy the data and move the position
-		memcpy( &this->Data[this->Position] , src , count );
+		memcpy( &this->Data[this->Position - this->DataOffset] , psrc , count );
 		this->Position = end_pos;
 		}
 
 	template <class T> inline void MemoryWriteStream::WriteValues( const T *src, u64 count )
 		{
-		if( this->FlipByteOrder )
+		if( this->MeasureOnly )
 			{
-			// flip the byte order of the words in the dest 
-			u64 pos = this->Position;
+			// nothing is stored, so there is no need to flip the byte order
 			this->WriteRawData( src, count * sizeof(T) );
-			swap_byte_order<T>( (T*)(&this->Data[pos]), count );
+			}
+		else if( this->FlipByteOrder && !this->Sink )
+			{
+			// no sink, so the destination is always in the memory area. copy the words 
+			// into the stream and flip the byte order in the same pass
+			const u64 end_pos = this->Position + (count * sizeof(T));
+			if( end_pos > this->DataSize )
+				{
+				this->Resize( end_pos );
+				}
+			copy_and_swap_byte_order<T>( (T *)&this->Data[this->Position - this->DataOffset], src, count );
+			this->Position = end_pos;
+			}
+		else if( this->FlipByteOrder )
+			{
+			// flip the byte order of the words into a temporary buffer before writing, 
+			// since the destination may be in the sink and not in the memory area
+			const u64 buffer_count = 256;
+			T buffer[buffer_count];
+			while( count > 0 )
+				{
+				u64 write_count = ( count < buffer_count ) ? count : buffer_count;
+				copy_and_swap_byte_order<T>( buffer, src, write_count );
+				this->WriteRawData( buffer, write_count * sizeof(T) );
+				src += write_count;
+				count -= write_count;
+				}
 			}
 		else
 			{
@@ -197,6 +409,43 @@ namespace ISD
 		this->Position = new_pos; 
 		}
 
+	inline void MemoryWriteStream::Reserve( u64 size )
+		{
+		if( !this->MeasureOnly && size > this->DataOffset && ( size - this->DataOffset ) > this->DataReservedSize )
+			{
+			this->ReserveForSize( size - this->DataOffset );
+			}
+		}
+
+	inline void MemoryWriteStream::SetSink( WriteSink *sink, u64 sink_buffer_size )
+		{
+		this->Sink = sink;
+		this->SinkBufferSize = sink_buffer_size;
+		this->SinkFailed = false;
+		}
+
+	inline WriteSink *MemoryWriteStream::GetSink() const
+		{
+		return this->Sink;
+		}
+
+	inline Status MemoryWriteStream::Flush()
+		{
+		if( !this->Sink )
+			{
+			return Status::ENotInitialized;
+			}
+
+		// write the buffered data, and restart the buffer at the end of the stream
+		if( this->DataSize > this->DataOffset )
+			{
+			this->WriteToSink( this->DataOffset, this->Data, this->DataSize - this->DataOffset );
+			this->DataOffset = this->DataSize;
+			}
+
+		return ( this->HasFailed() ) ? Status::ECantWrite : Status::Ok;
+		}
+
 	inline bool MemoryWriteStream::GetFlipByteOrder() const 
 		{ 
 		return this->FlipByteOrder; 
@@ -207,6 +456,88 @@ namespace ISD
 		this->FlipByteOrder = value;
 		}
 
+	inline u64 MemoryWriteStream::BeginBlock()
+		{
+		const u64 block_position = this->Position;
+		if( !this->BlockSizes )
+			{
+			// write empty stand in value for now (MAXi64 on purpose), which is definitely 
+			// wrong, as to trigger any test if the value is not overwritten with the correct value
+			this->Write( (u64)MAXINT64 );
+			return block_position;
+			}
+
+		if( this->MeasureOnly )
+			{
+			// add a size to the list, which is set when the block ends
+			this->OpenBlocks.emplace_back( block_position, this->BlockSizes->size() );
+			this->BlockSizes->emplace_back( (u64)MAXINT64 );
+			this->Write( (u64)MAXINT64 );
+			}
+		else if( this->NextBlockSize < this->BlockSizes->size() )
+			{
+			// write the precomputed size directly
+			this->OpenBlocks.emplace_back( block_position, this->NextBlockSize );
+			this->Write( (*this->BlockSizes)[this->NextBlockSize] );
+			++this->NextBlockSize;
+			}
+		else
+			{
+			// out of sizes, write the stand in value, and write the size when the block ends
+			this->Write( (u64)MAXINT64 );
+			}
+		return block_position;
+		}
+
+	inline bool MemoryWriteStream::EndBlock( u64 block_position )
+		{
+		const u64 end_pos = this->Position;
+		if( end_pos < block_position + sizeof( u64 ) )
+			{
+			return false;
+			}
+		const u64 block_size = end_pos - block_position - sizeof( u64 );
+
+		// blocks which have their size in the list
+		if( !this->OpenBlocks.empty() && this->OpenBlocks.back().first == block_position )
+			{
+			const size_t size_index = this->OpenBlocks.back().second;
+			this->OpenBlocks.pop_back();
+			if( this->MeasureOnly )
+				{
+				(*this->BlockSizes)[size_index] = block_size;
+				return true;
+				}
+
+			// the precomputed size has already been written, so a mismatch can not be fixed, and fails the stream
+			if( (*this->BlockSizes)[size_index] != block_size )
+				{
+				ISDErrorLog << "The size of the block does not match its precomputed size, the stream has failed" << ISDErrorLogEnd;
+				this->BlockSizeMismatch = true;
+				return false;
+				}
+			return true;
+			}
+
+		// move back and write the size of the block
+		this->SetPosition( block_position );
+		this->Write( block_size );
+		this->SetPosition( end_pos ); // move back the where we were
+		return true;
+		}
+
+	inline void MemoryWriteStream::SetBlockSizes( std::vector<u64> *block_sizes )
+		{
+		this->BlockSizes = block_sizes;
+		this->NextBlockSize = 0;
+		this->OpenBlocks.clear();
+		}
+
+	inline std::vector<u64> *MemoryWriteStream::GetBlockSizes() const
+		{
+		return this->BlockSizes;
+		}
+
 	//// write one item of data, (but using the multi-values method)
 	inline void MemoryWriteStream::Write( const i8 &src ) { this->Write( &src, 1 ); }
 	inline void MemoryWriteStream::Write( const i16 &src ) { this->Write( &src, 1 ); }
@@ -0,0 +1,331 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#include "ISD_PackFile.h"
+#include "ISD_PacketSerializer.h"
+#include "ISD_BlobHash.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#endif
+
+#include <algorithm>
+
+namespace ISD
+	{
+#ifdef ISD_BIG_ENDIAN_SYSTEM
+	static const bool this_system_is_big_endian = true;
+#else//ISD_BIG_ENDIAN_SYSTEM
+	static const bool this_system_is_big_endian = false;
+#endif//ISD_BIG_ENDIAN_SYSTEM
+
+	// the size of the blob header and the pack header fields
+	static const u64 pack_header_size = sizeof( BlobHeader ) + sizeof( u64 ) * 4;
+	static_assert( sizeof( BlobHeader ) == 16, "Error: BlobHeader is assumed to be of size 16." );
+
+	static u64 align_position( u64 position, u64 alignment )
+		{
+		return ( position + alignment - 1 ) & ~( alignment - 1 );
+		}
+
+	static void write_pack_header( u8 *dest, u64 data_size, u64 entry_count, u64 table_offset, u64 blob_alignment )
+		{
+		BlobHeader header = {};
+		memcpy( header.Magic, "ISD", 3 );
+		header.Version = 0;
+		header.Flags = (u8)( BlobFlags::EntityPack | ( this_system_is_big_endian ? BlobFlags::BigEndian : 0 ) );
+		header.DataSize = data_size;
+
+		const u64 reserved = 0;
+		memcpy( &dest[0], &header, sizeof( BlobHeader ) );
+		memcpy( &dest[16], &entry_count, sizeof( u64 ) );
+		memcpy( &dest[24], &table_offset, sizeof( u64 ) );
+		memcpy( &dest[32], &blob_alignment, sizeof( u64 ) );
+		memcpy( &dest[40], &reserved, sizeof( u64 ) );
+		}
+
+	PackWriter::~PackWriter()
+		{
+		if( this->File )
+			{
+			fclose( this->File );
+			remove( ( this->FilePath + ".tmp" ).c_str() );
+			}
+		}
+
+	Status PackWriter::WriteData( const void *data, u64 size )
+		{
+		if( fwrite( data, 1, (size_t)size, this->File ) != (size_t)size )
+			{
+			return Status::ECantWrite;
+			}
+		this->Position += size;
+		return Status::Ok;
+		}
+
+	Status PackWriter::WritePadding()
+		{
+		static const u8 zeros[4096] = {};
+		u64 padding = align_position( this->Position, this->BlobAlignment ) - this->Position;
+		while( padding > 0 )
+			{
+			const u64 size = std::min<u64>( padding, sizeof( zeros ) );
+			Status status = this->WriteData( zeros, size );
+			if( status != Status::Ok )
+				{
+				return status;
+				}
+			padding -= size;
+			}
+		return Status::Ok;
+		}
+
+	Status PackWriter::Open( const std::string &pack_file_path, u64 blob_alignment )
+		{
+		if( this->File )
+			{
+			return Status::EAlreadyInitialized;
+			}
+		if( blob_alignment < 8 || ( blob_alignment & ( blob_alignment - 1 ) ) != 0 )
+			{
+			return Status::EParam;
+			}
+
+		this->FilePath = pack_file_path;
+		this->BlobAlignment = blob_alignment;
+		this->Position = 0;
+		this->Entries.clear();
+		this->EntryUuids.clear();
+
+#ifdef _WIN32
+		this->File = _wfopen( widen( pack_file_path + ".tmp" ).c_str(), L"wb" );
+#else
+		this->File = fopen( ( pack_file_path + ".tmp" ).c_str(), "wb" );
+#endif
+		if( !this->File )
+			{
+			return Status::ECantOpen;
+			}
+
+		// the header is written in Close, when the table offset is known
+		u8 header[pack_header_size] = {};
+		Status status = this->WriteData( header, sizeof( header ) );
+		if( status != Status::Ok )
+			{
+			return status;
+			}
+		return this->WritePadding();
+		}
+
+	Status PackWriter::AddEntity( const UUID &uuid, const u8 *blob, u64 blob_size )
+		{
+		if( !this->File )
+			{
+			return Status::ENotInitialized;
+			}
+		if( this->EntryUuids.find( uuid ) != this->EntryUuids.end() )
+			{
+			return Status::EParam;
+			}
+
+		// the root hash of the trailer is kept in the table, the data is verified when the entity is loaded
+		BlobVerifier verifier;
+		Status status = verifier.Setup( blob, blob_size );
+		if( status != Status::Ok )
+			{
+			return status;
+			}
+
+		entity_index_entry entry;
+		entry.uuid = uuid;
+		entry.offset = this->Position;
+		entry.size = blob_size;
+		entry.root_hash = verifier.GetRootHash();
+
+		status = this->WriteData( blob, blob_size );
+		if( status != Status::Ok )
+			{
+			return status;
+			}
+		status = this->WritePadding();
+		if( status != Status::Ok )
+			{
+			return status;
+			}
+
+		this->Entries.push_back( entry );
+		this->EntryUuids.insert( uuid );
+		return Status::Ok;
+		}
+
+	Status PackWriter::Close()
+		{
+		if( !this->File )
+			{
+			return Status::ENotInitialized;
+			}
+
+		// write the sorted table, and its trailer
+		std::sort( this->Entries.begin(), this->Entries.end(), []( const entity_index_entry &left, const entity_index_entry &right ) { return entity_uuid_less( left.uuid, right.uuid ); } );
+		std::vector<u8> table( this->Entries.size() * EntityIndexRecordSize );
+		for( size_t i = 0; i < this->Entries.size(); ++i )
+			{
+			write_entity_index_record( this->Entries[i], &table[i * EntityIndexRecordSize] );
+			}
+		const std::vector<u8> trailer = calculate_blob_trailer( table.data(), table.size() );
+
+		const u64 table_offset = this->Position;
+		Status status = this->WriteData( table.data(), table.size() );
+		if( status == Status::Ok )
+			{
+			status = this->WriteData( trailer.data(), trailer.size() );
+			}
+
+		// write the header, now that the table offset is known
+		if( status == Status::Ok )
+			{
+			u8 header[pack_header_size];
+			write_pack_header( header, this->Position - sizeof( BlobHeader ), this->Entries.size(), table_offset, this->BlobAlignment );
+			if( fseek( this->File, 0, SEEK_SET ) != 0 || fwrite( header, 1, sizeof( header ), this->File ) != sizeof( header ) )
+				{
+				status = Status::ECantWrite;
+				}
+			}
+
+		const bool closed = ( fclose( this->File ) == 0 );
+		this->File = nullptr;
+		const std::string temp_file_path = this->FilePath + ".tmp";
+		if( status != Status::Ok || !closed )
+			{
+			remove( temp_file_path.c_str() );
+			return Status::ECantWrite;
+			}
+
+#ifdef _WIN32
+		if( !::MoveFileExW( widen( temp_file_path ).c_str(), widen( this->FilePath ).c_str(), MOVEFILE_REPLACE_EXISTING ) )
+#else
+		if( rename( temp_file_path.c_str(), this->FilePath.c_str() ) != 0 )
+#endif
+			{
+			remove( temp_file_path.c_str() );
+			return Status::ECantWrite;
+			}
+
+		return Status::Ok;
+		}
+
+	Status PackFile::Open( const std::string &pack_file_path )
+		{
+		if( this->Mapping )
+			{
+			return Status::EAlreadyInitialized;
+			}
+
+		std::shared_ptr<MappedFile> mapping = std::make_shared<MappedFile>();
+		Status status = mapping->Open( pack_file_path );
+		if( status != Status::Ok )
+			{
+			return status;
+			}
+		const u8 *data = mapping->GetData();
+		const u64 size = mapping->GetSize();
+
+		// check the header. packs written in another byte order are not supported, since the entity data is not flipped
+		if( size < pack_header_size )
+			{
+			return Status::EInvalid;
+			}
+		BlobHeader header;
+		u64 entry_count = 0;
+		u64 table_offset = 0;
+		u64 blob_alignment = 0;
+		memcpy( &header, &data[0], sizeof( BlobHeader ) );
+		memcpy( &entry_count, &data[16], sizeof( u64 ) );
+		memcpy( &table_offset, &data[24], sizeof( u64 ) );
+		memcpy( &blob_alignment, &data[32], sizeof( u64 ) );
+		const bool pack_is_big_endian = ( header.Flags & BlobFlags::BigEndian ) != 0;
+		if( memcmp( header.Magic, "ISD", 3 ) != 0
+			|| ( header.Flags & BlobFlags::EntityPack ) == 0
+			|| pack_is_big_endian != this_system_is_big_endian
+			|| header.DataSize != size - sizeof( BlobHeader )
+			|| blob_alignment == 0 || ( blob_alignment & ( blob_alignment - 1 ) ) != 0
+			|| table_offset < pack_header_size
+			|| table_offset > size
+			|| entry_count > ( size - table_offset ) / EntityIndexRecordSize )
+			{
+			ISDErrorLog << "The file " << pack_file_path << " is not a valid pack file" << ISDErrorLogEnd;
+			return Status::EInvalid;
+			}
+
+		// verify the table, all of the file after the table is its trailer
+		const u8 *table = &data[table_offset];
+		BlobVerifier verifier;
+		status = verifier.Setup( table, size - table_offset );
+		if( status == Status::Ok )
+			{
+			status = verifier.VerifyAll();
+			}
+		if( status != Status::Ok || verifier.GetDataSize() != entry_count * EntityIndexRecordSize )
+			{
+			ISDErrorLog << "The table of the pack file " << pack_file_path << " is corrupted" << ISDErrorLogEnd;
+			return Status::ECorrupted;
+			}
+
+		// check that the entries are sorted, and the blobs are inside the blob area of the file
+		entity_index_entry previous_entry;
+		for( u64 i = 0; i < entry_count; ++i )
+			{
+			entity_index_entry entry;
+			read_entity_index_record( &table[i * EntityIndexRecordSize], entry );
+			if( ( i > 0 && !entity_uuid_less( previous_entry.uuid, entry.uuid ) )
+				|| entry.offset < pack_header_size
+				|| entry.offset > table_offset
+				|| entry.size > table_offset - entry.offset )
+				{
+				ISDErrorLog << "The table of the pack file " << pack_file_path << " is not valid" << ISDErrorLogEnd;
+				return Status::EInvalid;
+				}
+			previous_entry = entry;
+			}
+
+		this->Mapping = std::move( mapping );
+		this->Table = table;
+		this->EntryCount = entry_count;
+		this->VerifiedBlobs.reset( new std::atomic<bool>[(size_t)entry_count] );
+		for( u64 i = 0; i < entry_count; ++i )
+			{
+			this->VerifiedBlobs[i] = false;
+			}
+		return Status::Ok;
+		}
+
+	bool PackFile::Find( const UUID &uuid, entity_index_entry &dest_entry, u64 &dest_entry_index ) const
+		{
+		// binary search of the table, comparing the uuids directly in the records
+		u64 first = 0;
+		u64 count = this->EntryCount;
+		while( count > 0 )
+			{
+			const u64 step = count / 2;
+			const u64 middle = first + step;
+			if( memcmp( &this->Table[middle * EntityIndexRecordSize], &uuid, sizeof( UUID ) ) < 0 )
+				{
+				first = middle + 1;
+				count -= step + 1;
+				}
+			else
+				{
+				count = step;
+				}
+			}
+		if( first == this->EntryCount || memcmp( &this->Table[first * EntityIndexRecordSize], &uuid, sizeof( UUID ) ) != 0 )
+			{
+			return false;
+			}
+
+		read_entity_index_record( &this->Table[first * EntityIndexRecordSize], dest_entry );
+		dest_entry_index = first;
+		return true;
+		}
+	};
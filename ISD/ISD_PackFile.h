@@ -0,0 +1,97 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#pragma once
+
+#include "ISD_Types.h"
+#include "ISD_EntityStore.h"
+#include "ISD_MappedFile.h"
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <unordered_set>
+
+namespace ISD
+	{
+	// A pack file holds many entity blobs in one file, which is memory mapped when it is read, so small entities
+	// do not need a file each. The layout is:
+	//
+	//		BlobHeader Header; // Magic "ISD", with the EntityPack flag (and the BigEndian flag if written on a big endian system)
+	//		u64 EntryCount;
+	//		u64 TableOffset; // the position of the table in the file
+	//		u64 BlobAlignment; // the alignment of the blobs in the file
+	//		u64 Reserved;
+	//		(padding up to the first blob)
+	//		blobs; // each blob is the entity data followed by its hash trailer, exactly as a loose entity file, at aligned positions
+	//		u8 Table[EntryCount * EntityIndexRecordSize]; // the entries of the blobs, sorted by uuid, at an aligned position
+	//		trailer; // the blob hash trailer of the table
+	//
+	// The header DataSize is the size of the file after the header. The table is verified when the pack is opened,
+	// and each blob is verified with its own trailer the first time it is loaded.
+	const u64 PackDefaultBlobAlignment = 64;
+
+	// Writes a pack file. The pack is written to a temporary file, which is renamed to the pack file in Close.
+	class PackWriter
+		{
+		private:
+			FILE *File = nullptr;
+			std::string FilePath;
+			u64 Position = 0;
+			u64 BlobAlignment = PackDefaultBlobAlignment;
+			std::vector<entity_index_entry> Entries;
+			std::unordered_set<UUID> EntryUuids;
+
+			Status WriteData( const void *data, u64 size );
+			Status WritePadding();
+
+		public:
+			PackWriter() = default;
+			PackWriter( const PackWriter & ) = delete;
+			PackWriter &operator=( const PackWriter & ) = delete;
+
+			// a pack which is not closed is removed
+			~PackWriter();
+
+			// start writing the pack. blob_alignment must be a power of two, at least 8
+			Status Open( const std::string &pack_file_path, u64 blob_alignment = PackDefaultBlobAlignment );
+
+			// add the blob of an entity, the entity data followed by its hash trailer (the contents of a loose entity file).
+			// returns EParam if the entity is already in the pack, ECorrupted if the trailer of the blob is not valid
+			Status AddEntity( const UUID &uuid, const u8 *blob, u64 blob_size );
+
+			// write the table, and replace the pack file with the written pack
+			Status Close();
+		};
+
+	// A pack file which is memory mapped for reading. The entities are found in the table with a binary search,
+	// and their blobs are used directly from the mapping. The methods are thread safe.
+	class PackFile
+		{
+		private:
+			std::shared_ptr<MappedFile> Mapping;
+			const u8 *Table = nullptr;
+			u64 EntryCount = 0;
+			std::unique_ptr<std::atomic<bool>[]> VerifiedBlobs; // the blobs which have been verified, by entry index
+
+		public:
+			// map the pack file, and check the header and table. returns EInvalid if it is not a pack file, or is written
+			// in another byte order, and ECorrupted if the table does not match its hash
+			Status Open( const std::string &pack_file_path );
+
+			// find the entry of the entity. returns false if the entity is not in the pack
+			bool Find( const UUID &uuid, entity_index_entry &dest_entry, u64 &dest_entry_index ) const;
+
+			// the blob of the entry, pointing into the mapping
+			const u8 *GetBlob( const entity_index_entry &entry ) const { return this->Mapping->GetData() + entry.offset; }
+
+			// returns true if the blob of the entry has been verified
+			bool IsBlobVerified( u64 entry_index ) const { return this->VerifiedBlobs[entry_index].load(); }
+			void SetBlobVerified( u64 entry_index ) { this->VerifiedBlobs[entry_index] = true; }
+
+			// the mapping of the pack, which is shared by all entities loaded from the pack
+			const std::shared_ptr<MappedFile> &GetMapping() const { return this->Mapping; }
+
+			u64 GetEntryCount() const { return this->EntryCount; }
+		};
+	};
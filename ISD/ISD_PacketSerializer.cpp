@@ -4,6 +4,12 @@
 #include "ISD_PacketSerializer.h"
 #include "ISD_MemoryReadStream.h"
 #include "ISD_MemoryWriteStream.h"
+#include "ISD_EntityWriter.h"
+#include "ISD_EntityReader.h"
+#include "ISD_SHA256.h"
+
+#include <cstddef>
+#include <memory>
 
 using namespace ISD;
 
@@ -13,82 +19,145 @@ static const bool this_system_is_big_endian = true;
 static const bool this_system_is_big_endian = false;
 #endif//ISD_BIG_ENDIAN_SYSTEM
 
+static_assert( sizeof( BlobHeader ) == 16, "Error: BlobHeader is assumed to be of size 16." );
+
+// the smallest DataSize of a packet, the ids and the hash trailer, with an empty payload
+static const u64 packet_min_data_size = sizeof( UUID ) * 2 + sizeof( hash );
 
-// Blob is the serialized data (and header) of each entity in ISD
-enum BlobFlags
+bool ISD::PacketTypeRegistry::Register( const UUID &type_id, packet_factory factory )
 	{
-	BigEndian = 0x1, // if set, the data is stored in big endian format, if not set, stored in little endian
-	};
+	if( !factory )
+		{
+		return false;
+		}
+	return this->Factories.emplace( type_id, factory ).second;
+	}
 
-// header for each file blob
-struct BlobHeader
+PacketTypeRegistry::packet_factory ISD::PacketTypeRegistry::Find( const UUID &type_id ) const
 	{
-	u8 Magic[3]; // magic values of the ISD blob ( 0x49, 0x53, 0x44 )
-	u8 Version; // version of the blob header. Initial version is 0.
-	u8 Flags; // flags for the blob header
-	u8 _padding[3]; // padding reserved for possible future use
-	u64 DataSize; // size of the data, after the header
-	};
-
-//bool BlobHeader::WriteToStream( MemoryWriteStream &ostream )
-//	{
-//	u64 p = ostream.GetPosition();
-//	ostream.Write( this->Magic, 3 );
-//	ostream.Write( this->Version );
-//	ostream.Write( this->Flags );
-//	ostream.Write( this->_padding, 3 );
-//	ostream.Write( this->DataSize );
-//	return ostream.GetPosition() == (p + 16); // true if we have written 16 bytes
-//	}
+	auto it = this->Factories.find( type_id );
+	if( it == this->Factories.end() )
+		{
+		return nullptr;
+		}
+	return it->second;
+	}
 
 std::pair<Packet *, Status> ISD::PacketSerializer::FromMemoryStream( MemoryReadStream &input_stream )
 	{
-	Packet *entity = {};
-	u64 expected_pos = {};
-
-	// read in the first 8 bytes of the header
-	BlobHeader header;
-	input_stream.Read( header.Magic, 3 );
-	header.Version = input_stream.Read<u8>();
-	header.Flags = input_stream.Read<u8>();
-	input_stream.Read( header._padding, 3 );
-
-	// make sure it is an ISD file, and check flags
-
-	// read in the file header, make sure it is an ISD file
-	if( memcmp(header.Magic , "ISD" , 3) != 0 )
+	// load all of the header in one bounds checked read, directly from the stream memory
+	const u64 start_position = input_stream.GetPosition();
+	const u8 *header_data = input_stream.ReadRawDataView( sizeof( BlobHeader ) );
+	if( !header_data )
 		{
 		return std::pair<Packet *, Status>( nullptr, Status::EInvalid );
 		}
+	BlobHeader header;
+	memcpy( &header, header_data, sizeof( BlobHeader ) );
 
+	// make sure it is an ISD blob, and not a pack file.
 	// for now, the version does not matter, as we are only on first iteration, and future versions need to be backwards compatible 
-
-	// check known flags
+	if( memcmp( header.Magic, "ISD", 3 ) != 0 || ( header.Flags & BlobFlags::EntityPack ) != 0 )
+		{
+		input_stream.SetPosition( start_position );
+		return std::pair<Packet *, Status>( nullptr, Status::EInvalid );
+		}
 
 	// big/little endian, flip byte order if it does not match
-	const bool this_file_is_big_endian = (header.Flags & BlobFlags::BigEndian);
-	if( this_file_is_big_endian != this_system_is_big_endian )
+	const bool packet_is_big_endian = ( header.Flags & BlobFlags::BigEndian ) != 0;
+	const bool flip_byte_order = ( packet_is_big_endian != this_system_is_big_endian );
+	if( flip_byte_order )
 		{
-		input_stream.SetFlipByteOrder( true );
+		swap_byte_order<u64>( &header.DataSize );
 		}
 
-	// make sure the stream has all the data
-	header.DataSize = input_stream.Read<u64>();
-	if( (input_stream.GetPosition() + header.DataSize) > input_stream.GetSize() )
+	// make sure the stream has all the data, and get a view of it
+	const u8 *packet_data = nullptr;
+	if( header.DataSize >= packet_min_data_size )
+		{
+		packet_data = input_stream.ReadRawDataView( header.DataSize );
+		}
+	if( !packet_data )
 		{
+		input_stream.SetPosition( start_position );
 		return std::pair<Packet *, Status>( nullptr, Status::EInvalid );
 		}
-	
+
+	// check the hash of the packet, which covers the header as well
+	const u64 hashed_size = sizeof( BlobHeader ) + header.DataSize - sizeof( hash );
+	hash packet_hash;
+	SHA256 sha( header_data, (size_t)hashed_size );
+	sha.GetDigest( packet_hash.digest );
+	if( memcmp( packet_hash.digest, &header_data[hashed_size], sizeof( hash ) ) != 0 )
+		{
+		ISDErrorLog << "The packet does not match its hash" << ISDErrorLogEnd;
+		return std::pair<Packet *, Status>( nullptr, Status::ECorrupted );
+		}
+
 	// read in the Id of the Packet and the Packet type, which matches the class of the entity
-	UUID EntityId = input_stream.Read<UUID>();
-	UUID EntityTypeId = input_stream.Read<UUID>();
+	MemoryReadStream packet_stream( packet_data, header.DataSize - sizeof( hash ), flip_byte_order );
+	const UUID entity_id = packet_stream.Read<UUID>();
+	const UUID entity_type_id = packet_stream.Read<UUID>();
 
+	// create the packet of the type, and read the entity
+	PacketTypeRegistry::packet_factory factory = this->Registry.Find( entity_type_id );
+	if( !factory )
+		{
+		ISDErrorLog << "The entity type of the packet is not registered" << ISDErrorLogEnd;
+		return std::pair<Packet *, Status>( nullptr, Status::EInvalid );
+		}
+	std::unique_ptr<Packet> packet( factory() );
+	packet->EntityId = entity_id;
 
+	EntityReader reader( packet_stream );
+	if( !packet->ReadEntity( reader ) )
+		{
+		ISDErrorLog << "The entity of the packet could not be read" << ISDErrorLogEnd;
+		return std::pair<Packet *, Status>( nullptr, Status::EInvalid );
+		}
 
-	return std::pair<Packet *, Status>(entity,Status::Ok);
+	return std::pair<Packet *, Status>( packet.release(), Status::Ok );
 	}
 
-Status ISD::PacketSerializer::ToMemoryStream( const Packet *entity, MemoryWriteStream &output_stream )
+Status ISD::PacketSerializer::ToMemoryStream( const Packet *packet, MemoryWriteStream &output_stream )
 	{
+	if( !packet || output_stream.GetSink() )
+		{
+		return Status::EParam;
+		}
+
+	// write the header, the DataSize is written when the size is known. the packet is in the byte order of the stream
+	const u64 start_position = output_stream.GetPosition();
+	const bool stream_is_big_endian = ( this_system_is_big_endian != output_stream.GetFlipByteOrder() );
+	BlobHeader header = {};
+	memcpy( header.Magic, "ISD", 3 );
+	header.Version = 0;
+	header.Flags = (u8)( stream_is_big_endian ? BlobFlags::BigEndian : 0 );
+	header.DataSize = 0;
+	output_stream.Write( (const u8 *)&header, sizeof( BlobHeader ) );
+
+	// write the ids and the entity
+	output_stream.Write( packet->EntityId );
+	output_stream.Write( packet->GetEntityTypeId() );
+	EntityWriter writer( output_stream );
+	if( !packet->WriteEntity( writer ) )
+		{
+		ISDErrorLog << "The entity of the packet could not be written" << ISDErrorLogEnd;
+		return Status::ECantWrite;
+		}
+
+	// write the DataSize into the header
+	const u64 end_position = output_stream.GetPosition();
+	const u64 data_size = end_position - start_position - sizeof( BlobHeader ) + sizeof( hash );
+	output_stream.SetPosition( start_position + offsetof( BlobHeader, DataSize ) );
+	output_stream.Write( data_size );
+	output_stream.SetPosition( end_position );
+
+	// hash the packet, and write the hash trailer
+	hash packet_hash;
+	SHA256 sha( &( (const u8 *)output_stream.GetData() )[start_position], (size_t)( end_position - start_position ) );
+	sha.GetDigest( packet_hash.digest );
+	output_stream.Write( packet_hash );
+
 	return Status::Ok;
 	}
@@ -5,24 +5,109 @@
 
 #include "ISD_Types.h"
 
+#include <unordered_map>
+
 namespace ISD
 	{
 	class MemoryReadStream;
 	class MemoryWriteStream;
+	class EntityWriter;
+	class EntityReader;
+
+	// Blob is the serialized data (and header) of each entity in ISD
+	enum BlobFlags
+		{
+		BigEndian = 0x1, // if set, the data is stored in big endian format, if not set, stored in little endian
+		EntityPack = 0x2, // if set, the blob is a pack file of entity blobs, see ISD_PackFile.h
+		};
+
+	// header for each file blob
+	struct BlobHeader
+		{
+		u8 Magic[3]; // magic values of the ISD blob ( 0x49, 0x53, 0x44 )
+		u8 Version; // version of the blob header. Initial version is 0.
+		u8 Flags; // flags for the blob header
+		u8 _padding[3]; // padding reserved for possible future use
+		u64 DataSize; // size of the data, after the header
+		};
 
+	// A packet is one entity and its id, which is serialized by the PacketSerializer. 
+	// Entity packets of generated entity types are implemented by the EntityPacket template.
 	class Packet
 		{
 		public:
+			UUID EntityId = {};
+
+			virtual ~Packet() = default;
+
+			// the id of the entity type, which selects the packet type when the packet is read
+			virtual const UUID &GetEntityTypeId() const = 0;
+
+			// write or read the entity of the packet
+			virtual bool WriteEntity( EntityWriter &writer ) const = 0;
+			virtual bool ReadEntity( EntityReader &reader ) = 0;
+		};
+
+	// A packet of a generated entity type, which has a static TypeId, and MF::Write and MF::Read methods
+	template<class _Ty> class EntityPacket : public Packet
+		{
+		public:
+			_Ty Entity;
+
+			// the factory of the packet type, see PacketTypeRegistry
+			static Packet *New() { return new EntityPacket<_Ty>(); }
+
+			const UUID &GetEntityTypeId() const override { return _Ty::TypeId; }
+			bool WriteEntity( EntityWriter &writer ) const override { return _Ty::MF::Write( this->Entity, writer ); }
+			bool ReadEntity( EntityReader &reader ) override { return _Ty::MF::Read( this->Entity, reader ); }
 		};
 
+	// Maps entity type ids to the factories of the packet types, so the serializer can create the packet 
+	// of a serialized entity type with one lookup. The generated entity types are registered with 
+	// register_entity_packet_types (see ISD_EntityPacketTypes.h). 
+	// Caveat: Register is not thread safe, register all types before the registry is used by serializers.
+	class PacketTypeRegistry
+		{
+		public:
+			typedef Packet *(*packet_factory)();
+
+		private:
+			std::unordered_map<UUID, packet_factory> Factories;
+
+		public:
+			// register the factory of a type. returns false if the type id is already registered
+			bool Register( const UUID &type_id, packet_factory factory );
+			template<class _Ty> bool Register() { return this->Register( _Ty::TypeId, &EntityPacket<_Ty>::New ); }
+
+			// find the factory of a type, or nullptr if the type is not registered
+			packet_factory Find( const UUID &type_id ) const;
+		};
+
+	// Serializes packets to and from memory streams. A serialized packet is a single hash blob (see ISD_BlobHash.h):
+	//
+	//		BlobHeader Header; // Magic "ISD", with the BigEndian flag if the packet is big endian. DataSize is the size of the rest of the packet, including the trailer
+	//		UUID EntityId;
+	//		UUID EntityTypeId;
+	//		u8 Payload[]; // the entity, written with an EntityWriter
+	//		hash PacketHash; // sha256 of all of the packet before the hash, including the header
+	//
+	// so a serialized packet can be stored as is in an entity file or pack file.
 	class PacketSerializer
 		{
+		private:
+			const PacketTypeRegistry &Registry;
+
 		public:
-			// deserializes an Entity from a memory stream. The returned Entity is 
-			// handed over, and must be deleted by the caller.
+			PacketSerializer( const PacketTypeRegistry &_Registry ) : Registry( _Registry ) {}
+
+			// deserializes a Packet from a memory stream, and moves the stream past the packet. The returned Packet is 
+			// handed over, and must be deleted by the caller. Returns EInvalid if the data is not a packet, or the entity 
+			// type is not registered, and ECorrupted if the packet does not match its hash. (If only the contents of the
+			// packet are invalid, the stream is still moved past it, so the following packets can be read.)
 			std::pair<Packet *,Status> FromMemoryStream( MemoryReadStream &input_stream );
 
-			// serializes an Entity to a memory stream.
+			// serializes a Packet to a memory stream, at the current position, in the byte order of the stream. 
+			// The packet is hashed in the memory of the stream, so the stream can not have a sink. 
 			Status ToMemoryStream( const Packet *packet , MemoryWriteStream &output_stream );
 		};
-	};
\ No newline at end of file
+	};
@@ -2,15 +2,435 @@
 // Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
 
 #include "ISD_SHA256.h"
+#include "ISD_CpuFeatures.h"
 
 #include <librock_sha256.c>
 
+#include <algorithm>
+#include <atomic>
+
+#ifdef ISD_CPU_X86
+#include <immintrin.h>
+#endif
+
 namespace ISD
 	{
+	static const u32 sha256_initial_state[8] =
+		{
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+		};
+
+	alignas(16) static const u32 sha256_round_constants[64] =
+		{
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+		};
+
+	// the active implementation, Auto until resolved on first use
+	static std::atomic<SHA256::Implementation> sha256_implementation( SHA256::Implementation::Auto );
+
+	static bool is_implementation_supported( SHA256::Implementation impl )
+		{
+		const cpu_features &features = get_cpu_features();
+		switch( impl )
+			{
+			case SHA256::Implementation::Auto:
+			case SHA256::Implementation::Portable:
+				return true;
+#ifdef ISD_CPU_X86
+			case SHA256::Implementation::SHANI:
+				return features.sha && features.sse41 && features.ssse3;
+			case SHA256::Implementation::AVX2:
+				return features.avx2;
+#endif
+			default:
+				return false;
+			}
+		}
+
+	static SHA256::Implementation get_active_implementation()
+		{
+		SHA256::Implementation impl = sha256_implementation.load();
+		if( impl == SHA256::Implementation::Auto )
+			{
+			// SHA-NI is the fastest for single buffers, and even when hashing batches it is at least on par with
+			// the AVX2 multi-buffer lanes, so AVX2 is only selected on cpus without the SHA extensions
+			if( is_implementation_supported( SHA256::Implementation::SHANI ) )
+				impl = SHA256::Implementation::SHANI;
+			else if( is_implementation_supported( SHA256::Implementation::AVX2 ) )
+				impl = SHA256::Implementation::AVX2;
+			else
+				impl = SHA256::Implementation::Portable;
+			sha256_implementation.store( impl );
+			}
+		return impl;
+		}
+
+	bool SHA256::SetImplementation( Implementation impl )
+		{
+		if( !is_implementation_supported( impl ) )
+			{
+			return false;
+			}
+		sha256_implementation.store( impl );
+		return true;
+		}
+
+	SHA256::Implementation SHA256::GetImplementation()
+		{
+		return get_active_implementation();
+		}
+
+	inline void store_bigendian_u32( u8 *dest, u32 value )
+		{
+		dest[0] = u8( value >> 24 );
+		dest[1] = u8( value >> 16 );
+		dest[2] = u8( value >> 8 );
+		dest[3] = u8( value );
+		}
+
+	// builds the padded tail of a message: the remainder bytes after the last full block, the 0x80 end marker,
+	// zeros and the bit length of the whole message. returns the number of tail blocks (1 or 2)
+	static size_t build_padded_tail( u8 dest[128], const u8 *remainder, size_t remainder_length, u64 total_length )
+		{
+		const size_t tail_blocks = ( remainder_length < 56 ) ? 1 : 2;
+
+		memset( dest, 0, 128 );
+		memcpy( dest, remainder, remainder_length );
+		dest[remainder_length] = 0x80;
+		const u64 bit_length = total_length * 8;
+		u8 *length_dest = &dest[tail_blocks * 64 - 8];
+		store_bigendian_u32( &length_dest[0], u32( bit_length >> 32 ) );
+		store_bigendian_u32( &length_dest[4], u32( bit_length ) );
+		return tail_blocks;
+		}
+
+	////////////////////////////////////////////////////////////////////////
+	// SHA-NI single buffer implementation
+
+#ifdef ISD_CPU_X86
+	ISD_TARGET_SHANI static void sha256_blocks_shani( u32 state[8], const u8 *data, size_t block_count )
+		{
+		const __m128i byte_swap_mask = _mm_set_epi64x( 0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL );
+
+		// the sha instructions use the state as ABEF and CDGH
+		__m128i tmp = _mm_loadu_si128( (const __m128i *)&state[0] );
+		__m128i state1 = _mm_loadu_si128( (const __m128i *)&state[4] );
+		tmp = _mm_shuffle_epi32( tmp, 0xB1 ); // CDAB
+		state1 = _mm_shuffle_epi32( state1, 0x1B ); // EFGH
+		__m128i state0 = _mm_alignr_epi8( tmp, state1, 8 ); // ABEF
+		state1 = _mm_blend_epi16( state1, tmp, 0xF0 ); // CDGH
+
+		for( size_t block = 0; block < block_count; ++block, data += 64 )
+			{
+			const __m128i abef_save = state0;
+			const __m128i cdgh_save = state1;
+
+			// the message schedule, 4 words in each vector. only the last 4 vectors are needed
+			__m128i msg[4];
+
+			for( uint group = 0; group < 16; ++group )
+				{
+				__m128i words;
+				if( group < 4 )
+					{
+					words = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *)&data[group * 16] ), byte_swap_mask );
+					}
+				else
+					{
+					// W[t] = msg2( msg1( W[t-16], W[t-12] ) + W[t-7], W[t-4] )
+					words = _mm_sha256msg1_epu32( msg[group % 4], msg[(group + 1) % 4] );
+					words = _mm_add_epi32( words, _mm_alignr_epi8( msg[(group + 3) % 4], msg[(group + 2) % 4], 4 ) );
+					words = _mm_sha256msg2_epu32( words, msg[(group + 3) % 4] );
+					}
+				msg[group % 4] = words;
+
+				// 4 rounds, 2 in each sha256rnds2
+				__m128i wk = _mm_add_epi32( words, _mm_load_si128( (const __m128i *)&sha256_round_constants[group * 4] ) );
+				state1 = _mm_sha256rnds2_epu32( state1, state0, wk );
+				wk = _mm_shuffle_epi32( wk, 0x0E );
+				state0 = _mm_sha256rnds2_epu32( state0, state1, wk );
+				}
+
+			state0 = _mm_add_epi32( state0, abef_save );
+			state1 = _mm_add_epi32( state1, cdgh_save );
+			}
+
+		// back to ABCD and EFGH
+		tmp = _mm_shuffle_epi32( state0, 0x1B ); // FEBA
+		state1 = _mm_shuffle_epi32( state1, 0xB1 ); // DCHG
+		state0 = _mm_blend_epi16( tmp, state1, 0xF0 ); // DCBA
+		state1 = _mm_alignr_epi8( state1, tmp, 8 ); // ABEF
+		_mm_storeu_si128( (__m128i *)&state[0], state0 );
+		_mm_storeu_si128( (__m128i *)&state[4], state1 );
+		}
+#endif
+
+	// the hashing context used by the SHA256 object
+	struct sha256_context
+		{
+		SHA256::Implementation impl;
+
+		// used by the SHA-NI implementation
+		u32 state[8];
+		u8 block[64];
+		size_t block_length;
+		u64 total_length;
+
+		// used by the portable implementation
+		void *librock_ctx;
+		};
+
+	// update the context with data using the SHA-NI compress, buffering partial blocks
+	static void sha256_update_shani( sha256_context *ctx, const u8 *data, size_t data_length )
+		{
+#ifdef ISD_CPU_X86
+		ctx->total_length += data_length;
+
+		// fill up a partial block first
+		if( ctx->block_length > 0 )
+			{
+			const size_t fill = std::min( data_length, 64 - ctx->block_length );
+			memcpy( &ctx->block[ctx->block_length], data, fill );
+			ctx->block_length += fill;
+			data += fill;
+			data_length -= fill;
+			if( ctx->block_length < 64 )
+				return;
+			sha256_blocks_shani( ctx->state, ctx->block, 1 );
+			ctx->block_length = 0;
+			}
+
+		// hash the full blocks directly from the data
+		const size_t block_count = data_length / 64;
+		if( block_count > 0 )
+			{
+			sha256_blocks_shani( ctx->state, data, block_count );
+			data += block_count * 64;
+			data_length -= block_count * 64;
+			}
+
+		// keep the rest for the next update
+		memcpy( ctx->block, data, data_length );
+		ctx->block_length = data_length;
+#endif
+		}
+
+	static void sha256_final_shani( sha256_context *ctx, u8 dest_digest[32] )
+		{
+#ifdef ISD_CPU_X86
+		// pad the buffered data
+		u8 tail[128];
+		const size_t tail_blocks = build_padded_tail( tail, ctx->block, ctx->block_length, ctx->total_length );
+		sha256_blocks_shani( ctx->state, tail, tail_blocks );
+
+		for( uint i = 0; i < 8; ++i )
+			{
+			store_bigendian_u32( &dest_digest[i * 4], ctx->state[i] );
+			}
+#endif
+		}
+
+	////////////////////////////////////////////////////////////////////////
+	// AVX2 multi buffer implementation, hashing 8 buffers in parallel, one in each 32 bit lane
+
+#ifdef ISD_CPU_X86
+	static const size_t sha256_avx2_lanes = 8;
+
+	ISD_TARGET_AVX2 static inline __m256i rotr_avx2( __m256i x, int n )
+		{
+		return _mm256_or_si256( _mm256_srli_epi32( x, n ), _mm256_slli_epi32( x, 32 - n ) );
+		}
+
+	// transpose 8x8 32 bit words, so that rows become columns
+	ISD_TARGET_AVX2 static inline void transpose_8x8_avx2( __m256i r[8] )
+		{
+		const __m256i t0 = _mm256_unpacklo_epi32( r[0], r[1] );
+		const __m256i t1 = _mm256_unpackhi_epi32( r[0], r[1] );
+		const __m256i t2 = _mm256_unpacklo_epi32( r[2], r[3] );
+		const __m256i t3 = _mm256_unpackhi_epi32( r[2], r[3] );
+		const __m256i t4 = _mm256_unpacklo_epi32( r[4], r[5] );
+		const __m256i t5 = _mm256_unpackhi_epi32( r[4], r[5] );
+		const __m256i t6 = _mm256_unpacklo_epi32( r[6], r[7] );
+		const __m256i t7 = _mm256_unpackhi_epi32( r[6], r[7] );
+
+		const __m256i u0 = _mm256_unpacklo_epi64( t0, t2 );
+		const __m256i u1 = _mm256_unpackhi_epi64( t0, t2 );
+		const __m256i u2 = _mm256_unpacklo_epi64( t1, t3 );
+		const __m256i u3 = _mm256_unpackhi_epi64( t1, t3 );
+		const __m256i u4 = _mm256_unpacklo_epi64( t4, t6 );
+		const __m256i u5 = _mm256_unpackhi_epi64( t4, t6 );
+		const __m256i u6 = _mm256_unpacklo_epi64( t5, t7 );
+		const __m256i u7 = _mm256_unpackhi_epi64( t5, t7 );
+
+		r[0] = _mm256_permute2x128_si256( u0, u4, 0x20 );
+		r[1] = _mm256_permute2x128_si256( u1, u5, 0x20 );
+		r[2] = _mm256_permute2x128_si256( u2, u6, 0x20 );
+		r[3] = _mm256_permute2x128_si256( u3, u7, 0x20 );
+		r[4] = _mm256_permute2x128_si256( u0, u4, 0x31 );
+		r[5] = _mm256_permute2x128_si256( u1, u5, 0x31 );
+		r[6] = _mm256_permute2x128_si256( u2, u6, 0x31 );
+		r[7] = _mm256_permute2x128_si256( u3, u7, 0x31 );
+		}
+
+	// compress one block in each of the 8 lanes
+	ISD_TARGET_AVX2 static void sha256_block_avx2( __m256i state[8], const u8 *blocks[sha256_avx2_lanes] )
+		{
+		const __m256i byte_swap_mask = _mm256_set_epi64x(
+			0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL,
+			0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL
+			);
+
+		// load the message words, and transpose so each vector holds the same word of all lanes
+		__m256i w[16];
+		for( uint half = 0; half < 2; ++half )
+			{
+			__m256i *rows = &w[half * 8];
+			for( uint lane = 0; lane < sha256_avx2_lanes; ++lane )
+				{
+				rows[lane] = _mm256_shuffle_epi8( _mm256_loadu_si256( (const __m256i *)&blocks[lane][half * 32] ), byte_swap_mask );
+				}
+			transpose_8x8_avx2( rows );
+			}
+
+		__m256i a = state[0], b = state[1], c = state[2], d = state[3];
+		__m256i e = state[4], f = state[5], g = state[6], h = state[7];
+
+		for( uint t = 0; t < 64; ++t )
+			{
+			if( t >= 16 )
+				{
+				// extend the message schedule in place in the ring of 16 words
+				const __m256i w15 = w[(t - 15) & 15];
+				const __m256i w2 = w[(t - 2) & 15];
+				const __m256i s0 = _mm256_xor_si256( _mm256_xor_si256( rotr_avx2( w15, 7 ), rotr_avx2( w15, 18 ) ), _mm256_srli_epi32( w15, 3 ) );
+				const __m256i s1 = _mm256_xor_si256( _mm256_xor_si256( rotr_avx2( w2, 17 ), rotr_avx2( w2, 19 ) ), _mm256_srli_epi32( w2, 10 ) );
+				w[t & 15] = _mm256_add_epi32( _mm256_add_epi32( w[t & 15], s0 ), _mm256_add_epi32( w[(t - 7) & 15], s1 ) );
+				}
+
+			const __m256i sigma1 = _mm256_xor_si256( _mm256_xor_si256( rotr_avx2( e, 6 ), rotr_avx2( e, 11 ) ), rotr_avx2( e, 25 ) );
+			const __m256i ch = _mm256_xor_si256( _mm256_and_si256( e, f ), _mm256_andnot_si256( e, g ) );
+			const __m256i k = _mm256_set1_epi32( (int)sha256_round_constants[t] );
+			const __m256i t1 = _mm256_add_epi32( _mm256_add_epi32( _mm256_add_epi32( h, sigma1 ), _mm256_add_epi32( ch, k ) ), w[t & 15] );
+
+			const __m256i sigma0 = _mm256_xor_si256( _mm256_xor_si256( rotr_avx2( a, 2 ), rotr_avx2( a, 13 ) ), rotr_avx2( a, 22 ) );
+			const __m256i maj = _mm256_or_si256( _mm256_and_si256( a, b ), _mm256_and_si256( c, _mm256_or_si256( a, b ) ) );
+			const __m256i t2 = _mm256_add_epi32( sigma0, maj );
+
+			h = g;
+			g = f;
+			f = e;
+			e = _mm256_add_epi32( d, t1 );
+			d = c;
+			c = b;
+			b = a;
+			a = _mm256_add_epi32( t1, t2 );
+			}
+
+		state[0] = _mm256_add_epi32( state[0], a );
+		state[1] = _mm256_add_epi32( state[1], b );
+		state[2] = _mm256_add_epi32( state[2], c );
+		state[3] = _mm256_add_epi32( state[3], d );
+		state[4] = _mm256_add_epi32( state[4], e );
+		state[5] = _mm256_add_epi32( state[5], f );
+		state[6] = _mm256_add_epi32( state[6], g );
+		state[7] = _mm256_add_epi32( state[7], h );
+		}
+
+	// hash up to 8 buffers in parallel. the buffers may have different lengths, lanes that are done
+	// are fed a dummy block, and the digest of each lane is extracted after its last block
+	ISD_TARGET_AVX2 static void sha256_digests_avx2( size_t count, const u8 * const *data, const size_t *data_lengths, hash *dest_digests )
+		{
+		alignas(32) u8 tails[sha256_avx2_lanes][128];
+		alignas(32) static const u8 dummy_block[64] = {};
+		size_t full_blocks[sha256_avx2_lanes] = {};
+		size_t total_blocks[sha256_avx2_lanes] = {};
+		size_t max_blocks = 0;
+
+		for( size_t lane = 0; lane < count; ++lane )
+			{
+			full_blocks[lane] = data_lengths[lane] / 64;
+			const size_t full_blocks_size = full_blocks[lane] * 64;
+			total_blocks[lane] = full_blocks[lane] + build_padded_tail( tails[lane], &data[lane][full_blocks_size], data_lengths[lane] - full_blocks_size, data_lengths[lane] );
+			max_blocks = std::max( max_blocks, total_blocks[lane] );
+			}
+
+		__m256i state[8];
+		for( uint i = 0; i < 8; ++i )
+			{
+			state[i] = _mm256_set1_epi32( (int)sha256_initial_state[i] );
+			}
+
+		for( size_t block = 0; block < max_blocks; ++block )
+			{
+			const u8 *blocks[sha256_avx2_lanes];
+			bool lane_is_done = false;
+			for( size_t lane = 0; lane < sha256_avx2_lanes; ++lane )
+				{
+				if( lane >= count || block >= total_blocks[lane] )
+					blocks[lane] = dummy_block;
+				else if( block < full_blocks[lane] )
+					blocks[lane] = &data[lane][block * 64];
+				else
+					blocks[lane] = &tails[lane][(block - full_blocks[lane]) * 64];
+
+				if( lane < count && block + 1 == total_blocks[lane] )
+					lane_is_done = true;
+				}
+
+			sha256_block_avx2( state, blocks );
+
+			// extract the digests of the lanes which had their last block
+			if( lane_is_done )
+				{
+				alignas(32) u32 words[8][sha256_avx2_lanes];
+				for( uint i = 0; i < 8; ++i )
+					{
+					_mm256_store_si256( (__m256i *)words[i], state[i] );
+					}
+				for( size_t lane = 0; lane < count; ++lane )
+					{
+					if( block + 1 != total_blocks[lane] )
+						continue;
+					for( uint i = 0; i < 8; ++i )
+						{
+						store_bigendian_u32( &dest_digests[lane].digest[i * 4], words[i][lane] );
+						}
+					}
+				}
+			}
+		}
+#endif
+
+	////////////////////////////////////////////////////////////////////////
+
 	SHA256::SHA256( const u8 *Data , size_t DataLength )
 		{
-		this->MDData = malloc( librock_SHA256_Init(0) );
-		librock_SHA256_Init( (librock_SHA256_CTX*)this->MDData );
+		sha256_context *ctx = new sha256_context();
+		ctx->impl = get_active_implementation();
+		this->MDData = ctx;
+
+		if( ctx->impl == Implementation::SHANI )
+			{
+			memcpy( ctx->state, sha256_initial_state, sizeof( sha256_initial_state ) );
+			ctx->block_length = 0;
+			ctx->total_length = 0;
+			ctx->librock_ctx = nullptr;
+			}
+		else
+			{
+			// the portable implementation is also used for single buffers when AVX2 is selected
+			ctx->impl = Implementation::Portable;
+			ctx->librock_ctx = malloc( librock_SHA256_Init(0) );
+			librock_SHA256_Init( (librock_SHA256_CTX*)ctx->librock_ctx );
+			}
+
 		if( Data != nullptr )
 			{
 			this->Update( Data, DataLength );
@@ -19,11 +439,20 @@ namespace ISD
 
 	SHA256::~SHA256()
 		{
-		free( this->MDData );
+		sha256_context *ctx = (sha256_context *)this->MDData;
+		free( ctx->librock_ctx );
+		delete ctx;
 		}
 
 	void SHA256::Update( const u8 *Data, size_t DataLength )
 		{
+		sha256_context *ctx = (sha256_context *)this->MDData;
+		if( ctx->impl == Implementation::SHANI )
+			{
+			sha256_update_shani( ctx, Data, DataLength );
+			return;
+			}
+
 		const u8 *End = &Data[DataLength];
 
 		// run until end, in blocks of INT_MAX
@@ -35,7 +464,7 @@ namespace ISD
 			int int_data_len = (int)data_len;
 
 			// update sha hash
-			librock_SHA256_Update( (librock_SHA256_CTX *)this->MDData, Data, int_data_len );
+			librock_SHA256_Update( (librock_SHA256_CTX *)ctx->librock_ctx, Data, int_data_len );
 
 			Data += int_data_len;
 			}
@@ -43,9 +472,60 @@ namespace ISD
 		// done
 		}
 
-	// get the calculated digest 
+	// get the calculated digest
 	void SHA256::GetDigest( u8 DestDigest[32] )
 		{
-		librock_SHA256_StoreFinal( DestDigest, (librock_SHA256_CTX *)this->MDData );
+		sha256_context *ctx = (sha256_context *)this->MDData;
+		if( ctx->impl == Implementation::SHANI )
+			{
+			sha256_final_shani( ctx, DestDigest );
+			return;
+			}
+
+		librock_SHA256_StoreFinal( DestDigest, (librock_SHA256_CTX *)ctx->librock_ctx );
+		}
+
+	void SHA256::CalculateDigests( size_t Count, const u8 * const *Data, const size_t *DataLengths, hash *DestDigests )
+		{
+#ifdef ISD_CPU_X86
+		if( get_active_implementation() == Implementation::AVX2 )
+			{
+			// sort the buffers by length, so the lanes of each batch are of similar length and few dummy blocks are hashed
+			std::vector<size_t> order( Count );
+			for( size_t i = 0; i < Count; ++i )
+				{
+				order[i] = i;
+				}
+			std::sort( order.begin(), order.end(), [&]( size_t a, size_t b ) { return DataLengths[a] > DataLengths[b]; } );
+
+			for( size_t batch_start = 0; batch_start < Count; batch_start += sha256_avx2_lanes )
+				{
+				const size_t batch_count = std::min( sha256_avx2_lanes, Count - batch_start );
+				const u8 *batch_data[sha256_avx2_lanes];
+				size_t batch_lengths[sha256_avx2_lanes];
+				hash batch_digests[sha256_avx2_lanes];
+				for( size_t lane = 0; lane < batch_count; ++lane )
+					{
+					batch_data[lane] = Data[order[batch_start + lane]];
+					batch_lengths[lane] = DataLengths[order[batch_start + lane]];
+					}
+
+				sha256_digests_avx2( batch_count, batch_data, batch_lengths, batch_digests );
+
+				for( size_t lane = 0; lane < batch_count; ++lane )
+					{
+					DestDigests[order[batch_start + lane]] = batch_digests[lane];
+					}
+				}
+			return;
+			}
+#endif
+
+		// hash one buffer at a time
+		for( size_t i = 0; i < Count; ++i )
+			{
+			SHA256 sha( Data[i], DataLengths[i] );
+			sha.GetDigest( DestDigests[i].digest );
+			}
 		}
 	}
@@ -11,6 +11,16 @@ namespace ISD
 	{
 	class SHA256
 		{
+		public:
+			// the implementations which can calculate the hashes
+			enum class Implementation
+				{
+				Auto, // select the fastest implementation supported by the cpu
+				Portable, // the portable librock implementation
+				SHANI, // x86 SHA extensions, one buffer at a time
+				AVX2, // AVX2, hashing 8 buffers at a time in CalculateDigests. single buffers use the portable implementation
+				};
+
 		private:
 			void *MDData = nullptr;
 
@@ -23,5 +33,16 @@ namespace ISD
 
 			// get the calculated digest 
 			void GetDigest( u8 DestDigest[32] );
+
+			// calculate the digests of Count independent buffers, Data[i] with length DataLengths[i], into DestDigests[i].
+			// batches of buffers are hashed in parallel lanes if the AVX2 implementation is used
+			static void CalculateDigests( size_t Count, const u8 * const *Data, const size_t *DataLengths, hash *DestDigests );
+
+			// select the implementation to use for new SHA256 objects and calls to CalculateDigests. 
+			// returns false if the implementation is not supported by the cpu. (mainly used to test and benchmark the implementations)
+			static bool SetImplementation( Implementation impl );
+
+			// get the implementation which is used. (Auto is resolved to the actual implementation)
+			static Implementation GetImplementation();
 		};
-	};
\ No newline at end of file
+	};
@@ -4,9 +4,16 @@
 
 #include "ISD_Types.h"
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 #include <Rpc.h>
+#else
+#include <cstdlib>
+#include <random>
+#endif
+
+#include <stdexcept>
 
 namespace ISD
 	{
@@ -16,6 +23,7 @@ namespace ISD
 
 		if( !str.empty() )
 			{
+#ifdef _WIN32
 			size_t wsize;
 			mbstowcs_s( &wsize, nullptr, 0, str.c_str(), 0 );
 
@@ -23,6 +31,17 @@ namespace ISD
 			wchar_t *wstr = new wchar_t[alloc_wsize];
 			size_t conv_count;
 			mbstowcs_s( &conv_count, wstr, alloc_wsize, str.c_str(), wsize );
+#else
+			size_t wsize = mbstowcs( nullptr, str.c_str(), 0 );
+			if( wsize == (size_t)-1 )
+				{
+				return ret;
+				}
+
+			size_t alloc_wsize = wsize + 1;
+			wchar_t *wstr = new wchar_t[alloc_wsize];
+			mbstowcs( wstr, str.c_str(), alloc_wsize );
+#endif
 
 			ret = std::wstring( wstr );
 			delete[] wstr;
@@ -31,6 +50,39 @@ namespace ISD
 		return ret;
 		}
 
+	std::string narrow( const std::wstring &wstr )
+		{
+		std::string ret;
+
+		if( !wstr.empty() )
+			{
+#ifdef _WIN32
+			size_t size;
+			wcstombs_s( &size, nullptr, 0, wstr.c_str(), 0 );
+
+			size_t alloc_size = size + 1;
+			char *str = new char[alloc_size];
+			size_t conv_count;
+			wcstombs_s( &conv_count, str, alloc_size, wstr.c_str(), size );
+#else
+			size_t size = wcstombs( nullptr, wstr.c_str(), 0 );
+			if( size == (size_t)-1 )
+				{
+				return ret;
+				}
+
+			size_t alloc_size = size + 1;
+			char *str = new char[alloc_size];
+			wcstombs( str, wstr.c_str(), alloc_size );
+#endif
+
+			ret = std::string( str );
+			delete[] str;
+			}
+
+		return ret;
+		}
+
 	// writes array of bytes to string of hex values. the hex values will be
 	// in the same order as the bytes, so if you need to convert a litte-endian
 	// word into hex, be sure to flip the byte order before.
@@ -100,6 +152,7 @@ namespace ISD
 		{
 		std::wstring ret;
 
+#ifdef _WIN32
 		wchar_t *buffer = new wchar_t[32768];
 		DWORD len = GetFullPathNameW( path.c_str(), 32768, buffer, nullptr );
 		if( len > 0 )
@@ -107,6 +160,14 @@ namespace ISD
 			ret = std::wstring( buffer );
 			}
 		delete[] buffer;
+#else
+		char *buffer = ::realpath( narrow( path ).c_str(), nullptr );
+		if( buffer )
+			{
+			ret = widen( buffer );
+			free( buffer );
+			}
+#endif
 
 		return ret;
 		}
@@ -115,12 +176,29 @@ namespace ISD
 		{
 		entity_ref ref;
 
+#ifdef _WIN32
 		RPC_STATUS stat = ::UuidCreate( &ref.id_m );
 		if( stat != RPC_S_OK 
 			|| ref.id_m == uuid_zero )
 			{
-			throw std::exception( "Failed to generate a uuid through ::UuidCreate()" );
+			throw std::runtime_error( "Failed to generate a uuid through ::UuidCreate()" );
+			}
+#else
+		// random (version 4) uuid
+		static thread_local std::random_device random_device;
+		std::uniform_int_distribution<unsigned int> byte_distribution( 0, 255 );
+		u8 *bytes = (u8 *)&ref.id_m;
+		for( size_t i = 0; i < sizeof( ref.id_m ); ++i )
+			{
+			bytes[i] = (u8)byte_distribution( random_device );
+			}
+		ref.id_m.Data3 = (ref.id_m.Data3 & 0x0fff) | 0x4000; // version 4
+		ref.id_m.Data4[0] = (ref.id_m.Data4[0] & 0x3f) | 0x80; // variant 1
+		if( ref.id_m == uuid_zero )
+			{
+			throw std::runtime_error( "Failed to generate a random uuid" );
 			}
+#endif
 
 		return ref;
 		}
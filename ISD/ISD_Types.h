@@ -32,6 +32,7 @@
 #define ISDKeyMacro( name ) name , (u8)(strlen(name))
 
 #include "ISD_idx_vector.h"
+#include "ISD_array_view.h"
 #include "ISD_optional_idx_vector.h"
 #include "ISD_optional_value.h"
 #include "ISD_optional_vector.h"
@@ -45,6 +46,20 @@ namespace ISD
 	// maximum size of a name of a value of subchunk in the entities
 	const size_t EntityMaxKeyLength = 40; 
 
+	// magic value at the end of section directories, "ISDDIR01"
+	const u64 EntityDirectoryMagic = 0x3130524944445349;
+
+	// the hash of a key in section directories, 64 bit FNV-1a
+	inline u64 directory_key_hash( const char *key, const u8 key_length )
+		{
+		u64 value = 0xcbf29ce484222325;
+		for( u8 i = 0; i < key_length; ++i )
+			{
+			value = ( value ^ (u8)key[i] ) * 0x100000001b3;
+			}
+		return value;
+		}
+
 	// status message for functions that return more than a bool status
 	enum class Status
 		{
@@ -58,6 +73,8 @@ namespace ISD
 		ECantRead = -7, // cant read from file or handle
 		ECorrupted = -8, // a filed is corrupted (failes sha256 test)
 		EInvalid = -9, // invalid file, not an ISD file
+		ECantWrite = -10, // cant write to file or handle
+		ECancelled = -11, // the operation was cancelled before it completed
 		};
 
 	// A Note on how types are either stored in small encoding chunks, or large encoding chunks in the binary files:
@@ -84,6 +101,25 @@ namespace ISD
 	//		u8 KeySizeInBytes; // the size of the key of the value (EntityMaxKeyLength is the max length of any key)
 	//		u8 KeyData[]; // the key of the value 
 	//		u8 Value[]; // <- defined size, equal to the rest of SizeInBytes after the key data ( sizeof(KeySizeInBytes)=1 + KeySizeInBytes bytes) 
+	//
+	// Arrays are stored in large encoding chunks, where the Value starts with a header:
+	//		u16 Flags; // bits 0-7: size of each item, 0x100: has index, 0x200: 64 bit index (not supported), 0x400: has padding
+	//		u64 ItemCount; // the number of items in the array
+	//		u64 IndexCount; // <- only if has index
+	//		i32 Index[]; // <- only if has index
+	//		u8 PaddingSize; // <- only if has padding
+	//		u8 Padding[]; // <- only if has padding. pads the items to start at an aligned position, relative to the start of the stream
+	//		u8 Items[]; 
+	// The padding is written if the EntityWriter has an array payload alignment set. Since the padding is within the block, 
+	// readers which do not support padding can still skip over the block using the SizeInBytes of the block.
+	//
+	// If the EntityWriter has WriteDirectory set, each section ends with a directory, a large encoding chunk of type VT_Directory
+	// with an empty key, which lists the values of the section, so a value can be found without reading the values before it:
+	//		u64 EntryCount;
+	//		struct { u64 KeyHash; u64 Offset; } Entries[EntryCount]; // sorted by KeyHash. Offset is the distance back from the start of the directory chunk to the value chunk 
+	//		u64 DirectorySize; // the size of the whole directory chunk, so it can be found from the end of the section
+	//		u64 Magic; // EntityDirectoryMagic
+	// The KeyHash is directory_key_hash of the key. Sequential readers skip the directory when the section ends.
 
 	// reflection and serialization value types
 	enum class ValueType
@@ -139,10 +175,29 @@ namespace ISD
 		// --- Specific types: 0xd0 - 0xff
 		VT_Subsection = 0xd0, // a named subsection, containins named values and nested subsections. 
 		VT_Array_Subsection = 0xd1, // array of (unnamed) subsections
+		VT_Directory = 0xd2, // the directory of the values of a section, see above
 		VT_String = 0xe0, // a UTF-8 encoded string
 		VT_Array_String = 0xe1, // array of strings
 		};
 
+	// A fixed layout is a run of small encoding chunks of fixed size values, which an entity always writes in the same order, so
+	// the only bytes of the run which differ between entities are the values. The code generator emits the layout of the runs of
+	// each entity, and EntityReader::ReadFixedLayout reads all the values of a run at once (see EntityReader::ReadFixedLayout).
+	struct EntityFixedLayoutField
+		{
+		u16 value_offset; // the offset of the value from the start of the run
+		u8 value_size; // the size of the value in bytes
+		u8 item_size; // the size of each item of the value, which is byte swapped if the byte order is flipped
+		u8 key_size; // the size of the key of the value
+		};
+	struct EntityFixedLayout
+		{
+		u64 size; // the size of the whole run in bytes
+		const u8 *fingerprint; // the bytes of the run which are not values, in order: the type and size of each chunk, followed by its key
+		const EntityFixedLayoutField *fields;
+		size_t field_count;
+		};
+
 	// all container type indices
 	enum class container_type_index
 		{
@@ -157,6 +212,9 @@ namespace ISD
 	// widens utf-8 char string to wstring
 	std::wstring widen( const std::string &str );
 
+	// narrows wstring to utf-8 char string
+	std::string narrow( const std::wstring &wstr );
+
 	// creates values from big-endian raw 2, 4 or 8 byte data (template implemented for u16, u32 and u64)
 	template <class T> T value_from_bigendian( const u8 *src ) { static_assert(false, "value_from_bigendian template can only be used with u16, u32 or u64"); }
 	template <> inline u16 value_from_bigendian<u16>( const u8 *src ) { return (u16(src[0]) << 8) | u16(src[1]); }
@@ -207,34 +265,26 @@ namespace ISD
 		swap_bytes( &((u8 *)dest)[2], &((u8 *)dest)[5] );
 		swap_bytes( &((u8 *)dest)[3], &((u8 *)dest)[4] );
 		}
+
+	// copy count words from src to dest, and swap the byte order of each word. src and dest may be the same 
+	// pointer (swapping in place), but must otherwise not overlap. uses SIMD (SSSE3/AVX2 or NEON) if supported by the CPU
+	template <class T> void copy_and_swap_byte_order( T *dest , const T *src , size_t count ) { static_assert(false, "copy_and_swap_byte_order template can only be used with u16, u32 or u64"); }
+	template<> void copy_and_swap_byte_order<u16>( u16 *dest , const u16 *src , size_t count );
+	template<> void copy_and_swap_byte_order<u32>( u32 *dest , const u32 *src , size_t count );
+	template<> void copy_and_swap_byte_order<u64>( u64 *dest , const u64 *src , size_t count );
+
 	template <class T> void swap_byte_order( T *dest , size_t count ) { static_assert(false, "swap_byte_order template can only be used with u16, u32 or u64"); }
 	template<> inline void swap_byte_order<u16>( u16 *dest , size_t count )
 		{
-		for( size_t i = 0; i < count; ++i )
-			{
-			swap_bytes( &((u8 *)dest)[0], &((u8 *)dest)[1] );
-			++dest;
-			}
+		copy_and_swap_byte_order<u16>( dest, dest, count );
 		}
 	template<> inline void swap_byte_order<u32>( u32 *dest , size_t count )
 		{
-		for( size_t i = 0; i < count; ++i )
-			{
-			swap_bytes( &((u8 *)dest)[0], &((u8 *)dest)[3] );
-			swap_bytes( &((u8 *)dest)[1], &((u8 *)dest)[2] );
-			++dest;
-			}
+		copy_and_swap_byte_order<u32>( dest, dest, count );
 		}
 	template<> inline void swap_byte_order<u64>( u64 *dest , size_t count )
 		{
-		for( size_t i = 0; i < count; ++i )
-			{
-			swap_bytes( &((u8 *)dest)[0], &((u8 *)dest)[7] );
-			swap_bytes( &((u8 *)dest)[1], &((u8 *)dest)[6] );
-			swap_bytes( &((u8 *)dest)[2], &((u8 *)dest)[5] );
-			swap_bytes( &((u8 *)dest)[3], &((u8 *)dest)[4] );
-			++dest;
-			}
+		copy_and_swap_byte_order<u64>( dest, dest, count );
 		}
 
 
@@ -152,6 +152,11 @@ namespace ISD
         return dynamic_types::equals( lvar->type_m, lvar->container_type_m, lvar->data_m, rvar->data_m );
         }
 
+    bool Varying::MF::MeasureSerializedSize( const Varying &obj, const EntityWriter &writer, u64 &dest_size, std::vector<u64> *dest_block_sizes )
+        {
+        return writer.MeasureWrite( obj, dest_size, dest_block_sizes );
+        }
+
     bool Varying::MF::Write( const Varying &obj, EntityWriter &writer )
         {
         if( !obj.IsInitialized() )
@@ -65,6 +65,8 @@ namespace ISD
             static bool Write( const Varying &obj, EntityWriter &writer );
             static bool Read( Varying &obj, EntityReader &reader );
 
+            static bool MeasureSerializedSize( const Varying &obj, const EntityWriter &writer, u64 &dest_size, std::vector<u64> *dest_block_sizes = nullptr );
+
             static bool Validate( const Varying &obj, EntityValidator &validator );
 
             // Method to set the type of the data in the varying object, either using a parameter, or as a template method
@@ -0,0 +1,126 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#include "ISD_WriteSink.h"
+#include "ISD_Log.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <climits>
+
+namespace ISD
+	{
+	FileWriteSink::~FileWriteSink()
+		{
+		this->Close();
+		}
+
+	Status FileWriteSink::Open( const std::string &file_path )
+		{
+		if( this->IsOpen() )
+			{
+			return Status::EAlreadyInitialized;
+			}
+
+#ifdef _WIN32
+		std::wstring wfile_path = widen( file_path );
+		HANDLE file_handle = ::CreateFileW( wfile_path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr );
+		if( file_handle == INVALID_HANDLE_VALUE )
+			{
+			return Status::ECantOpen;
+			}
+		this->FileHandle = file_handle;
+#else
+		int file_descriptor = ::open( file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+		if( file_descriptor < 0 )
+			{
+			return Status::ECantOpen;
+			}
+		this->FileDescriptor = file_descriptor;
+#endif
+
+		return Status::Ok;
+		}
+
+	void FileWriteSink::Close()
+		{
+#ifdef _WIN32
+		if( this->FileHandle )
+			{
+			::CloseHandle( (HANDLE)this->FileHandle );
+			this->FileHandle = nullptr;
+			}
+#else
+		if( this->FileDescriptor >= 0 )
+			{
+			::close( this->FileDescriptor );
+			this->FileDescriptor = -1;
+			}
+#endif
+		}
+
+	bool FileWriteSink::IsOpen() const
+		{
+#ifdef _WIN32
+		return this->FileHandle != nullptr;
+#else
+		return this->FileDescriptor >= 0;
+#endif
+		}
+
+	bool FileWriteSink::WriteAt( u64 offset, const void *src, u64 count )
+		{
+		if( !this->IsOpen() )
+			{
+			ISDErrorLog << "The file is not open" << ISDErrorLogEnd;
+			return false;
+			}
+
+		const u8 *data = (const u8 *)src;
+		while( count > 0 )
+			{
+			// cap each write at INT_MAX
+			u64 bytes_to_write = ( count < INT_MAX ) ? count : INT_MAX;
+
+#ifdef _WIN32
+			// positioned write, using the offset in the overlapped struct
+			OVERLAPPED overlapped = {};
+			overlapped.Offset = (DWORD)( offset & 0xffffffff );
+			overlapped.OffsetHigh = (DWORD)( offset >> 32 );
+			DWORD bytes_written = 0;
+			if( !::WriteFile( (HANDLE)this->FileHandle, data, (DWORD)bytes_to_write, &bytes_written, &overlapped ) )
+				{
+				ISDErrorLog << "Failed to write to file" << ISDErrorLogEnd;
+				return false;
+				}
+#else
+			ssize_t bytes_written = ::pwrite( this->FileDescriptor, data, (size_t)bytes_to_write, (off_t)offset );
+			if( bytes_written < 0 )
+				{
+				if( errno == EINTR )
+					continue;
+				ISDErrorLog << "Failed to write to file, errno: " << errno << ISDErrorLogEnd;
+				return false;
+				}
+#endif
+			if( bytes_written == 0 )
+				{
+				ISDErrorLog << "Failed to write to file, no bytes were written" << ISDErrorLogEnd;
+				return false;
+				}
+
+			data += bytes_written;
+			offset += bytes_written;
+			count -= bytes_written;
+			}
+
+		return true;
+		}
+	};
@@ -0,0 +1,52 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#pragma once
+
+#include "ISD_Types.h"
+
+namespace ISD
+	{
+	// A write sink receives the data which is flushed out of a MemoryWriteStream.
+	// Data is always written at an explicit offset, so the stream can patch values
+	// (such as the size of a large block) which have already been flushed to the sink.
+	class WriteSink
+		{
+		public:
+			virtual ~WriteSink() = default;
+
+			// write count bytes from src at the offset in the sink. returns false if the write failed
+			virtual bool WriteAt( u64 offset, const void *src, u64 count ) = 0;
+		};
+
+	// File write sink, writes the flushed data to a file on disk.
+	// Patching already written data is done using positioned writes (pwrite), so
+	// the file position is never moved back and forth.
+	class FileWriteSink : public WriteSink
+		{
+		private:
+#ifdef _WIN32
+			void *FileHandle = nullptr;
+#else
+			int FileDescriptor = -1;
+#endif
+
+		public:
+			FileWriteSink() = default;
+			FileWriteSink( const FileWriteSink & ) = delete;
+			FileWriteSink &operator=( const FileWriteSink & ) = delete;
+			~FileWriteSink();
+
+			// create (or truncate) the file at file_path, and open it for writing
+			Status Open( const std::string &file_path );
+
+			// close the file, if open
+			void Close();
+
+			// returns true if the file is open
+			bool IsOpen() const;
+
+			// write count bytes from src at the offset in the file
+			virtual bool WriteAt( u64 offset, const void *src, u64 count ) override;
+		};
+	};
@@ -0,0 +1,65 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#pragma once
+
+#include "ISD_DataTypes.h"
+
+namespace ISD
+	{
+	// array_view: read-only view of a contiguous array of values. The view does not own the values,
+	// so the memory that it points into must outlive the view.
+	template <class _Ty>
+	class array_view
+		{
+		public:
+			using value_type = _Ty;
+			using size_type = size_t;
+			using const_pointer = const _Ty *;
+			using const_reference = const _Ty &;
+			using const_iterator = const _Ty *;
+
+		private:
+			const _Ty *data_m = nullptr;
+			size_t size_m = 0;
+
+		public:
+			array_view() = default;
+			array_view( const _Ty *_data, size_t _size ) noexcept : data_m( _data ) , size_m( _size ) {}
+
+			void clear() { this->data_m = nullptr; this->size_m = 0; }
+
+			const _Ty *data() const noexcept { return this->data_m; }
+			size_t size() const noexcept { return this->size_m; }
+			bool empty() const noexcept { return this->size_m == 0; }
+
+			const _Ty &operator[]( size_t index ) const { return this->data_m[index]; }
+
+			const_iterator begin() const noexcept { return this->data_m; }
+			const_iterator end() const noexcept { return this->data_m + this->size_m; }
+		};
+
+	// idx_array_view: read-only view of values, with a view of the int index into the values. The view form of idx_vector.
+	template <class _Ty>
+	class idx_array_view
+		{
+		public:
+			using value_type = _Ty;
+
+		private:
+			array_view<_Ty> values_m;
+			array_view<i32> index_m;
+
+		public:
+			idx_array_view() = default;
+			idx_array_view( const array_view<_Ty> &_values, const array_view<i32> &_index ) noexcept : values_m( _values ) , index_m( _index ) {}
+
+			void clear() { this->values_m.clear(); this->index_m.clear(); }
+
+			array_view<_Ty> &values() { return this->values_m; }
+			const array_view<_Ty> &values() const { return this->values_m; }
+
+			array_view<i32> &index() { return this->index_m; }
+			const array_view<i32> &index() const { return this->index_m; }
+		};
+	};
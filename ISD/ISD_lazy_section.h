@@ -0,0 +1,187 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include "ISD_Types.h"
+#include "ISD_MemoryReadStream.h"
+#include "ISD_EntityReader.h"
+
+namespace ISD
+	{
+	// lazy_section holds a section of an entity which is read from the stream when it is first accessed, instead of when the
+	// entity is read, if the entity is read with EntityReader::SetLazyReading. Until then, the section references the values in 
+	// the stream, and holds on to the data owner of the stream (see MemoryReadStream::SetDataOwner) to keep them alive. If the 
+	// stream has no data owner, the section is read directly. The section is read with the settings of the reader of the entity.
+	// The first access is thread safe, and the section is read only once. A copy of a section which is not read yet
+	// shares the values in the stream, and is read on its own first access.
+	// The framing of the blocks of the section is validated when the entity is read (see EntityReader::SkipSection), so 
+	// only the decoding of the values can fail on first access. Use read() to check for the failure, value() reports it 
+	// as a debug sanity check, and returns the empty value.
+	template<class T> class lazy_section
+		{
+		private:
+			mutable T value_m = {};
+			mutable std::atomic<bool> is_read_m = { true };
+			mutable bool read_failed_m = false;
+			mutable std::mutex read_mutex_m;
+
+			// the values of the section in the stream, while the section is not read
+			mutable std::shared_ptr<const void> source_owner_m;
+			mutable const u8 *source_values_m = nullptr;
+			mutable u64 source_values_size_m = 0;
+			mutable bool source_flip_byte_order_m = false;
+			mutable bool source_tolerant_reading_m = false;
+			mutable bool source_lazy_reading_m = false;
+			mutable uint source_parallel_thread_count_m = 0;
+
+			void read_source() const;
+			void read_checked() const { this->read_source(); ISDSanityCheckDebugMacro( !this->read_failed_m ); }
+			void clear_source() const;
+			void copy_from( const lazy_section &other );
+			void move_from( lazy_section &other );
+
+		public:
+			lazy_section() = default;
+			lazy_section( const lazy_section &other ) { this->copy_from( other ); }
+			lazy_section &operator = ( const lazy_section &other ) { if( this != &other ) { this->copy_from( other ); } return *this; }
+			lazy_section( lazy_section &&other ) noexcept { this->move_from( other ); }
+			lazy_section &operator = ( lazy_section &&other ) noexcept { if( this != &other ) { this->move_from( other ); } return *this; }
+
+			// set the values of the section in the stream of the reader, which are read on first access with the settings of the 
+			// reader. if the stream has no data owner, the values are read directly, and false is returned if the read fails
+			bool set_source( const EntityReader &reader, const u8 *values, u64 values_size );
+
+			// drop the values in the stream, if the section is not read yet. the current value is kept
+			void reset_source();
+
+			// returns true if the section is read, or was never set up from a stream
+			bool is_read() const { return this->is_read_m.load( std::memory_order_acquire ); }
+
+			// read the section, if it is not read yet. returns false if the read failed, in which case the value is cleared
+			bool read() const { this->read_source(); return !this->read_failed_m; }
+
+			// access the value, reads the section on first access. the value is empty if the read failed
+			T &value() { this->read_checked(); return this->value_m; }
+			const T &value() const { this->read_checked(); return this->value_m; }
+		};
+
+	template<class T>
+	void lazy_section<T>::read_source() const
+		{
+		if( this->is_read_m.load( std::memory_order_acquire ) )
+			return;
+
+		std::lock_guard<std::mutex> lock( this->read_mutex_m );
+		if( this->is_read_m.load( std::memory_order_relaxed ) )
+			return;
+
+		MemoryReadStream sstream( this->source_values_m, this->source_values_size_m, this->source_flip_byte_order_m );
+		EntityReader reader( sstream );
+		reader.SetTolerantReading( this->source_tolerant_reading_m );
+		reader.SetLazyReading( this->source_lazy_reading_m );
+		reader.SetParallelThreadCount( this->source_parallel_thread_count_m );
+		if( !T::MF::Read( this->value_m, reader ) )
+			{
+			ISDErrorLog << "Failed to read the lazy section, the stream is probably corrupted" << ISDErrorLogEnd;
+			T::MF::Clear( this->value_m );
+			this->read_failed_m = true;
+			}
+
+		this->clear_source();
+		this->is_read_m.store( true, std::memory_order_release );
+		}
+
+	template<class T>
+	void lazy_section<T>::clear_source() const
+		{
+		this->source_owner_m.reset();
+		this->source_values_m = nullptr;
+		this->source_values_size_m = 0;
+		this->source_flip_byte_order_m = false;
+		this->source_tolerant_reading_m = false;
+		this->source_lazy_reading_m = false;
+		this->source_parallel_thread_count_m = 0;
+		}
+
+	template<class T>
+	void lazy_section<T>::copy_from( const lazy_section &other )
+		{
+		std::lock_guard<std::mutex> lock( other.read_mutex_m );
+		if( other.is_read_m.load( std::memory_order_relaxed ) )
+			{
+			this->value_m = other.value_m;
+			this->read_failed_m = other.read_failed_m;
+			this->clear_source();
+			this->is_read_m.store( true, std::memory_order_release );
+			}
+		else
+			{
+			T::MF::Clear( this->value_m );
+			this->read_failed_m = false;
+			this->source_owner_m = other.source_owner_m;
+			this->source_values_m = other.source_values_m;
+			this->source_values_size_m = other.source_values_size_m;
+			this->source_flip_byte_order_m = other.source_flip_byte_order_m;
+			this->source_tolerant_reading_m = other.source_tolerant_reading_m;
+			this->source_lazy_reading_m = other.source_lazy_reading_m;
+			this->source_parallel_thread_count_m = other.source_parallel_thread_count_m;
+			this->is_read_m.store( false, std::memory_order_release );
+			}
+		}
+
+	template<class T>
+	void lazy_section<T>::move_from( lazy_section &other )
+		{
+		this->value_m = std::move( other.value_m );
+		this->read_failed_m = other.read_failed_m;
+		this->source_owner_m = std::move( other.source_owner_m );
+		this->source_values_m = other.source_values_m;
+		this->source_values_size_m = other.source_values_size_m;
+		this->source_flip_byte_order_m = other.source_flip_byte_order_m;
+		this->source_tolerant_reading_m = other.source_tolerant_reading_m;
+		this->source_lazy_reading_m = other.source_lazy_reading_m;
+		this->source_parallel_thread_count_m = other.source_parallel_thread_count_m;
+		this->is_read_m.store( other.is_read_m.load( std::memory_order_acquire ), std::memory_order_release );
+
+		// the moved-from section is left empty and read
+		other.clear_source();
+		other.read_failed_m = false;
+		other.is_read_m.store( true, std::memory_order_release );
+		}
+
+	template<class T>
+	bool lazy_section<T>::set_source( const EntityReader &reader, const u8 *values, u64 values_size )
+		{
+		T::MF::Clear( this->value_m );
+		this->read_failed_m = false;
+		this->source_owner_m = reader.GetStream().GetDataOwner();
+		this->source_values_m = values;
+		this->source_values_size_m = values_size;
+		this->source_flip_byte_order_m = reader.GetStream().GetFlipByteOrder();
+		this->source_tolerant_reading_m = reader.GetTolerantReading();
+		this->source_lazy_reading_m = reader.GetLazyReading();
+		this->source_parallel_thread_count_m = reader.GetParallelThreadCount();
+		this->is_read_m.store( false, std::memory_order_release );
+
+		// if there is no owner, the values in the stream can not be referenced later, so read them now
+		if( !this->source_owner_m )
+			{
+			return this->read();
+			}
+		return true;
+		}
+
+	template<class T>
+	void lazy_section<T>::reset_source()
+		{
+		std::lock_guard<std::mutex> lock( this->read_mutex_m );
+		this->clear_source();
+		this->read_failed_m = false;
+		this->is_read_m.store( true, std::memory_order_release );
+		}
+	};
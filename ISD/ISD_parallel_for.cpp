@@ -0,0 +1,126 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#include "ISD_parallel_for.h"
+
+#include <algorithm>
+
+namespace ISD
+	{
+	thread_pool::thread_pool( unsigned int thread_count )
+		{
+		this->Threads.reserve( thread_count );
+		for( unsigned int t = 0; t < thread_count; ++t )
+			{
+			this->Threads.emplace_back( &thread_pool::ThreadProcedure, this );
+			}
+		}
+
+	thread_pool::~thread_pool()
+		{
+			{
+			std::lock_guard<std::mutex> guard( this->Mutex );
+			this->Stop = true;
+			}
+		this->JobsCondition.notify_all();
+		for( std::thread &thread : this->Threads )
+			{
+			thread.join();
+			}
+		}
+
+	void thread_pool::RunJob( job &j )
+		{
+		for(;;)
+			{
+			const size_t index = j.next_index.fetch_add( 1 );
+			if( index >= j.count )
+				break;
+			try
+				{
+				j.run_index( j.context, index );
+				}
+			catch( ... )
+				{
+				// keep the first exception, and stop handing out indices
+				if( !j.failed.exchange( true ) )
+					{
+					j.exception = std::current_exception();
+					}
+				j.next_index.store( j.count );
+				}
+			}
+		}
+
+	void thread_pool::ThreadProcedure()
+		{
+		for(;;)
+			{
+			job *j = nullptr;
+				{
+				std::unique_lock<std::mutex> lock( this->Mutex );
+				this->JobsCondition.wait( lock, [this]() { return this->Stop || !this->Jobs.empty(); } );
+				if( this->Stop )
+					{
+					return;
+					}
+
+				// jobs which have no indices left, or no more room for helpers, are taken out of the queue
+				j = this->Jobs.front();
+				if( --j->helper_slots == 0 || j->next_index.load() >= j->count )
+					{
+					this->Jobs.pop_front();
+					}
+				++j->active_helpers;
+				}
+
+			RunJob( *j );
+
+				{
+				std::lock_guard<std::mutex> guard( this->Mutex );
+				--j->active_helpers;
+				}
+			this->HelpersCondition.notify_all();
+			}
+		}
+
+	void thread_pool::Run( job &j, unsigned int helper_count )
+		{
+		if( helper_count > 0 && !this->Threads.empty() )
+			{
+				{
+				std::lock_guard<std::mutex> guard( this->Mutex );
+				j.helper_slots = helper_count;
+				this->Jobs.push_back( &j );
+				}
+			if( helper_count == 1 )
+				this->JobsCondition.notify_one();
+			else
+				this->JobsCondition.notify_all();
+			}
+
+		RunJob( j );
+
+		// take the job out of the queue, so no more threads join it, and wait for the threads which are still working on it
+			{
+			std::unique_lock<std::mutex> lock( this->Mutex );
+			auto it = std::find( this->Jobs.begin(), this->Jobs.end(), &j );
+			if( it != this->Jobs.end() )
+				{
+				this->Jobs.erase( it );
+				}
+			this->HelpersCondition.wait( lock, [&j]() { return j.active_helpers == 0; } );
+			}
+
+		if( j.exception )
+			{
+			std::rethrow_exception( j.exception );
+			}
+		}
+
+	thread_pool &thread_pool::shared()
+		{
+		static thread_pool pool( std::max( std::thread::hardware_concurrency(), 2u ) - 1 );
+		return pool;
+		}
+	};
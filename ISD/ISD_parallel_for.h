@@ -0,0 +1,95 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ISD
+	{
+	// A fixed set of threads which help out with the parallel_for calls. Each call hands out its indices from a shared counter, and
+	// the calling thread always takes part in the work, so a call never waits for threads which are busy elsewhere, and calls can be
+	// nested, or made from the pool threads. Idle pool threads join the queued calls which still have indices left.
+	class thread_pool
+		{
+		public:
+			// the work of a parallel_for call. the pool threads which join the job are counted, so the caller can wait for them
+			struct job
+				{
+				void (*run_index)( void *context, size_t index ) = nullptr;
+				void *context = nullptr;
+				size_t count = 0;
+				std::atomic<size_t> next_index{ 0 };
+				unsigned int helper_slots = 0; // number of pool threads which may still join the job, guarded by the pool mutex
+				unsigned int active_helpers = 0; // number of pool threads working on the job, guarded by the pool mutex
+				std::atomic<bool> failed{ false };
+				std::exception_ptr exception; // the first exception thrown by the job, set by the thread which set failed
+				};
+
+		private:
+			std::vector<std::thread> Threads;
+			std::deque<job *> Jobs;
+			std::mutex Mutex;
+			std::condition_variable JobsCondition;
+			std::condition_variable HelpersCondition;
+			bool Stop = false;
+
+			void ThreadProcedure();
+			static void RunJob( job &j );
+
+		public:
+			explicit thread_pool( unsigned int thread_count );
+			thread_pool( const thread_pool & ) = delete;
+			thread_pool &operator=( const thread_pool & ) = delete;
+			~thread_pool();
+
+			// the number of threads in the pool, not counting the calling threads
+			unsigned int GetThreadCount() const { return (unsigned int)this->Threads.size(); }
+
+			// run the job on the calling thread, with the help of at most helper_count pool threads, and wait for all to finish.
+			// if any index throws, no more indices are handed out, and the first exception is rethrown on the calling thread
+			void Run( job &j, unsigned int helper_count );
+
+			// the pool used by parallel_for, with one thread less than the number of hardware threads
+			static thread_pool &shared();
+		};
+
+	// run func( index ) for all indices in [0, count), spread over up to thread_count threads, and wait for all to finish.
+	// the calling thread takes part in the work, and the other threads are taken from the shared thread_pool. indices are handed
+	// out one at a time from a shared counter, so items of uneven cost are balanced over the threads. thread_count 0 uses the
+	// number of hardware threads. an exception thrown by func is rethrown on the calling thread, once all threads are done.
+	template<class _Func> void parallel_for( size_t count, _Func func, unsigned int thread_count = 0 )
+		{
+		thread_pool &pool = thread_pool::shared();
+		if( thread_count == 0 || thread_count > pool.GetThreadCount() + 1 )
+			{
+			thread_count = pool.GetThreadCount() + 1;
+			}
+		if( thread_count > count )
+			{
+			thread_count = (unsigned int)count;
+			}
+
+		// run on the calling thread if there is nothing to parallelize
+		if( thread_count <= 1 )
+			{
+			for( size_t index = 0; index < count; ++index )
+				{
+				func( index );
+				}
+			return;
+			}
+
+		thread_pool::job j;
+		j.run_index = []( void *context, size_t index ) { ( *(_Func *)context )( index ); };
+		j.context = &func;
+		j.count = count;
+		pool.Run( j, thread_count - 1 );
+		}
+	};
@@ -3,33 +3,52 @@
 
 #pragma once
 
-#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
 #include "ISD_DataTypes.h"
 
 namespace ISD
 	{
-	// thread safe map, does not allow access to 
-	// items, only insert, erase and find with value returned as copy 
-	// all public methods are thread safe 
-	// TODO: The inner workings of this class should be replaced with a lock-free substitute
-	template<class _Kty, class _Ty> class thread_safe_map
+	// thread safe map, does not allow access to
+	// items, only insert, erase and find with value returned as copy
+	// all public methods are thread safe
+	// The map is split into shards, selected by the hash of the key, each shard is a hash map with its own
+	// reader/writer lock. Lookups only take a shared lock, so concurrent finds do not block each other, and
+	// inserts and erases only block the accesses which hash into the same shard.
+	template<class _Kty, class _Ty, class _Hasher = std::hash<_Kty>> class thread_safe_map
 		{
 		private:
-			using _Mybase = std::map<_Kty, _Ty>;
+			using _Mybase = std::unordered_map<_Kty, _Ty, _Hasher>;
 			using key_type = _Kty;
 			using mapped_type = _Ty;
 			using iterator = typename _Mybase::iterator;
 			using value_type = std::pair<const _Kty, _Ty>;
 
-			std::map<_Kty, _Ty> Data;
-			std::mutex AccessMutex;
+			static const size_t ShardCount = 64; // must be a power of 2
+
+			// the shards are aligned to cache lines, so the locks of neighboring shards do not share a cache line
+			struct alignas( 64 ) shard
+				{
+				_Mybase Data;
+				std::shared_timed_mutex AccessMutex;
+				};
+			shard Shards[ShardCount];
+
+			shard &get_shard( const _Kty &key )
+				{
+				// mix the hash, so keys with identity hashes (such as integers) are spread over the shards
+				const u64 hash_value = (u64)_Hasher()( key ) * 0x9e3779b97f4a7c15ull;
+				return this->Shards[( hash_value >> 32 ) & ( ShardCount - 1 )];
+				}
 
 		public:
 			std::pair<_Ty, bool> find( const _Kty &key )
 				{
-				std::lock_guard<std::mutex> guard( this->AccessMutex );
-				iterator it = this->Data.find( key );
-				if( it != this->Data.end() )
+				shard &sh = this->get_shard( key );
+				std::shared_lock<std::shared_timed_mutex> guard( sh.AccessMutex );
+				iterator it = sh.Data.find( key );
+				if( it != sh.Data.end() )
 					{
 					return std::make_pair( it->second, true );
 					}
@@ -38,14 +57,38 @@ namespace ISD
 
 			bool insert( const value_type &value )
 				{
-				std::lock_guard<std::mutex> guard( this->AccessMutex );
-				return this->Data.insert( value ).second;
+				shard &sh = this->get_shard( value.first );
+				std::lock_guard<std::shared_timed_mutex> guard( sh.AccessMutex );
+				return sh.Data.insert( value ).second;
+				}
+
+			// find the value of the key, or insert the value if the key is not in the map.
+			// returns a copy of the value in the map, and true if the value was inserted
+			std::pair<_Ty, bool> find_or_insert( const value_type &value )
+				{
+				shard &sh = this->get_shard( value.first );
+
+				// most calls are expected to find the key, so try with a shared lock first
+					{
+					std::shared_lock<std::shared_timed_mutex> guard( sh.AccessMutex );
+					iterator it = sh.Data.find( value.first );
+					if( it != sh.Data.end() )
+						{
+						return std::make_pair( it->second, false );
+						}
+					}
+
+				// insert, unless another thread inserted the key in between
+				std::lock_guard<std::shared_timed_mutex> guard( sh.AccessMutex );
+				std::pair<iterator, bool> res = sh.Data.insert( value );
+				return std::make_pair( res.first->second, res.second );
 				}
 
 			size_t erase( const _Kty &key )
 				{
-				std::lock_guard<std::mutex> guard( this->AccessMutex );
-				return this->Data.erase( key );
+				shard &sh = this->get_shard( key );
+				std::lock_guard<std::shared_timed_mutex> guard( sh.AccessMutex );
+				return sh.Data.erase( key );
 				}
 		};
 	};
@@ -28,12 +28,19 @@
 #include "../ISD/ISD_CombinedTypes.h"
 #include "../ISD/ISD_Varying.h"
 
+#include <cstring>
 #include <unordered_map>
 
 extern void safe_thread_map_test();
+extern void memory_write_stream_benchmark();
+extern void byte_swap_benchmark();
+extern void entity_loader_test();
+extern void packet_serializer_benchmark();
+extern void file_batch_reader_test();
 
 using namespace ISD;
 
+bool large_system_tests = false;
 
 #define RUN_TEST( name )\
 	printf("Running test: " #name "\n");\
@@ -93,8 +100,14 @@ using namespace ISD;
 //		mapped_type &Insert( const key_type &key ) { this->v_Entries.emplace( key, std::make_unique<mapped_type>() ); return *(this->v_Entries[key].get()); }
 //	};
 
-int main()
+int main( int argc, char *argv[] )
 	{
+	for( int i = 1; i < argc; ++i )
+		{
+		if( strcmp( argv[i], "--large" ) == 0 )
+			large_system_tests = true;
+		}
+
 	ISD::EntityTable<ISD::package_ref, int> refint;
 
 	for( uint i = 0; i < 20; ++i )
@@ -102,6 +115,13 @@ int main()
 		refint.Insert( random_value<ISD::package_ref>() ) = random_value<int>();
 		}
 
+	RUN_TEST( safe_thread_map_test );
+	RUN_TEST( memory_write_stream_benchmark );
+	RUN_TEST( byte_swap_benchmark );
+	RUN_TEST( file_batch_reader_test );
+	RUN_TEST( entity_loader_test );
+	RUN_TEST( packet_serializer_benchmark );
+
 	return 0;
 	}
 
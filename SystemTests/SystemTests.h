@@ -8,7 +8,9 @@
 #include "../ISD/ISD_MemoryReadStream.h"
 #include "../ISD/ISD_MemoryWriteStream.h"
 
+#ifdef _WIN32
 #include <Rpc.h>
+#endif
 
 using namespace ISD;
 
@@ -18,3 +20,7 @@ using namespace ISD;
 		printf("Test failed: file:%s line: %d \n", __FILE__ , __LINE__ );\
 		exit(-1);\
 		}
+
+// set by the --large command line flag. the benchmarks and tests which write gigabytes of data, or a very large
+// number of files, only run their full sizes if set, and otherwise run small sizes which are quick enough for every run
+extern bool large_system_tests;
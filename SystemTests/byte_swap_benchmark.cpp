@@ -0,0 +1,103 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#include "SystemTests.h"
+
+#include <chrono>
+
+// number of bytes swapped per measured run, and the number of runs
+static const u64 benchmark_data_size = 256ull * 1024 * 1024;
+static const uint benchmark_runs = 8;
+
+// the reference path: the byte by byte swap which the streams used before 
+template <class T> static void swap_bytewise( T *dest, size_t count )
+	{
+	for( size_t i = 0; i < count; ++i )
+		{
+		u8 *p = (u8 *)&dest[i];
+		for( size_t a = 0, b = sizeof( T ) - 1; a < b; ++a, --b )
+			{
+			swap_bytes( &p[a], &p[b] );
+			}
+		}
+	}
+
+static void print_result( const char *path_name, u64 total_size, double seconds )
+	{
+	const double gb = 1024.0 * 1024.0 * 1024.0;
+	printf( "    %-32s %7.3f s, %7.2f GB/s\n", path_name, seconds, (total_size / gb) / seconds );
+	}
+
+template <class T> static void byte_swap_word_size_benchmark()
+	{
+	const size_t count = benchmark_data_size / sizeof( T );
+	std::vector<T> src( count );
+	std::vector<T> dest( count );
+	for( size_t i = 0; i < count; ++i )
+		{
+		src[i] = (T)( i * 0x0102030405060708ull );
+		}
+	const u64 total_size = (u64)benchmark_runs * count * sizeof( T );
+
+	printf( "  Swapping %d bit words\n", (int)( sizeof( T ) * 8 ) );
+
+	// the byte by byte reference, copy then swap in place (two passes)
+		{
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for( uint r = 0; r < benchmark_runs; ++r )
+			{
+			memcpy( dest.data(), src.data(), count * sizeof( T ) );
+			swap_bytewise<T>( dest.data(), count );
+			}
+		auto t1 = std::chrono::high_resolution_clock::now();
+		print_result( "bytewise copy + swap", total_size, std::chrono::duration<double>( t1 - t0 ).count() );
+		}
+
+	// the fused copy and swap, using the kernel selected for the cpu
+		{
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for( uint r = 0; r < benchmark_runs; ++r )
+			{
+			copy_and_swap_byte_order<T>( dest.data(), src.data(), count );
+			}
+		auto t1 = std::chrono::high_resolution_clock::now();
+		print_result( "copy_and_swap_byte_order", total_size, std::chrono::duration<double>( t1 - t0 ).count() );
+		}
+
+	// validate the result against the reference
+	std::vector<T> ref( src );
+	swap_bytewise<T>( ref.data(), count );
+	TEST_ASSERT( ref == dest );
+
+	// reading the words through a flipped read stream
+		{
+		MemoryReadStream rs( src.data(), count * sizeof( T ), true );
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for( uint r = 0; r < benchmark_runs; ++r )
+			{
+			rs.SetPosition( 0 );
+			TEST_ASSERT( rs.Read( dest.data(), count ) == count );
+			}
+		auto t1 = std::chrono::high_resolution_clock::now();
+		print_result( "MemoryReadStream (flipped)", total_size, std::chrono::duration<double>( t1 - t0 ).count() );
+		TEST_ASSERT( ref == dest );
+		}
+
+	// plain memcpy, as the upper bound
+		{
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for( uint r = 0; r < benchmark_runs; ++r )
+			{
+			memcpy( dest.data(), src.data(), count * sizeof( T ) );
+			}
+		auto t1 = std::chrono::high_resolution_clock::now();
+		print_result( "memcpy (no swap)", total_size, std::chrono::duration<double>( t1 - t0 ).count() );
+		}
+	}
+
+void byte_swap_benchmark()
+	{
+	byte_swap_word_size_benchmark<u16>();
+	byte_swap_word_size_benchmark<u32>();
+	byte_swap_word_size_benchmark<u64>();
+	}
@@ -0,0 +1,801 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#include "SystemTests.h"
+
+#include "../ISD/ISD_BlobHash.h"
+#include "../ISD/ISD_EntityWriter.h"
+#include "../ISD/ISD_EntityReader.h"
+#include "../ISD/ISD_Mesh.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <thread>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// number of entity files written and loaded by the test, the large count is only written if the large system tests are enabled
+static const uint large_entity_count = 100000;
+static const uint small_entity_count = 5000;
+static uint entity_count = 0;
+
+// the test writes all its files into a new directory in the temp directory, which is removed when the test is done. the entity
+// store is a directory in it, and the other files are named after the store
+static std::string test_directory;
+static std::string entity_directory;
+
+static void make_directory( const char *path )
+	{
+#ifdef _WIN32
+	_mkdir( path );
+#else
+	mkdir( path, 0755 );
+#endif
+	}
+
+// create a new, uniquely named directory in the temp directory
+static std::string make_temp_directory()
+	{
+#ifdef _WIN32
+	char temp_path[MAX_PATH + 1] = {};
+	TEST_ASSERT( ::GetTempPathA( MAX_PATH + 1, temp_path ) != 0 );
+	const std::string path = std::string( temp_path ) + "isd_entity_loader_test_" + std::to_string( ::GetCurrentProcessId() );
+	TEST_ASSERT( _mkdir( path.c_str() ) == 0 );
+	return path;
+#else
+	const char *temp_path = getenv( "TMPDIR" );
+	std::string path_template = std::string( ( temp_path && temp_path[0] ) ? temp_path : "/tmp" ) + "/isd_entity_loader_test_XXXXXX";
+	TEST_ASSERT( mkdtemp( &path_template[0] ) != nullptr );
+	return path_template;
+#endif
+	}
+
+// remove the directory, and all files and directories in it
+static void remove_directory_tree( const std::string &path )
+	{
+#ifdef _WIN32
+	WIN32_FIND_DATAA find_data = {};
+	HANDLE find_handle = ::FindFirstFileA( ( path + "\\*" ).c_str(), &find_data );
+	if( find_handle != INVALID_HANDLE_VALUE )
+		{
+		do
+			{
+			const std::string name = find_data.cFileName;
+			if( name == "." || name == ".." )
+				{
+				continue;
+				}
+			const std::string sub_path = path + "\\" + name;
+			if( find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY )
+				{
+				remove_directory_tree( sub_path );
+				}
+			else
+				{
+				::DeleteFileA( sub_path.c_str() );
+				}
+			}
+		while( ::FindNextFileA( find_handle, &find_data ) );
+		::FindClose( find_handle );
+		}
+	::RemoveDirectoryA( path.c_str() );
+#else
+	DIR *directory = ::opendir( path.c_str() );
+	if( directory )
+		{
+		while( const dirent *entry = ::readdir( directory ) )
+			{
+			const std::string name = entry->d_name;
+			if( name == "." || name == ".." )
+				{
+				continue;
+				}
+			const std::string sub_path = path + "/" + name;
+			struct stat file_stat = {};
+			if( ::lstat( sub_path.c_str(), &file_stat ) == 0 && S_ISDIR( file_stat.st_mode ) )
+				{
+				remove_directory_tree( sub_path );
+				}
+			else
+				{
+				::unlink( sub_path.c_str() );
+				}
+			}
+		::closedir( directory );
+		}
+	::rmdir( path.c_str() );
+#endif
+	}
+
+static UUID entity_uuid( uint index )
+	{
+	UUID uuid = {};
+	uuid.Data1 = index + 1;
+	uuid.Data2 = 0x1234;
+	return uuid;
+	}
+
+// write an entity file, which is random data followed by a hash trailer
+static void write_entity_file( const std::string &file_path, uint index )
+	{
+	std::vector<u8> data( 256 + (rand() % 4096) );
+	for( u8 &b : data )
+		{
+		b = (u8)rand();
+		}
+	std::vector<u8> trailer = calculate_blob_trailer( data.data(), data.size(), ( index & 1 ) ? BlobDefaultChunkSize : 0, 1 );
+
+	std::ofstream file( file_path, std::ios::binary );
+	file.write( (const char *)data.data(), data.size() );
+	file.write( (const char *)trailer.data(), trailer.size() );
+	TEST_ASSERT( file.good() );
+	}
+
+static void write_entity_files()
+	{
+	make_directory( entity_directory.c_str() );
+	for( uint i = 0; i < entity_count; ++i )
+		{
+		TEST_ASSERT( create_entity_store_directories( entity_directory, entity_uuid( i ) ) == Status::Ok );
+		write_entity_file( std::string( entity_directory ) + "/" + entity_store_relative_path( entity_uuid( i ) ), i );
+		}
+	}
+
+// load all the entities, and check for errors
+static void load_entities( EntityLoader &loader, const char *description )
+	{
+	auto t0 = std::chrono::high_resolution_clock::now();
+
+	// request all entities, twice, the second requests must be ignored since they are in flight or loaded
+	for( uint pass = 0; pass < 2; ++pass )
+		{
+		for( uint i = 0; i < entity_count; ++i )
+			{
+			TEST_ASSERT( loader.AsyncLoadEntity( entity_uuid( i ) ) == Status::Ok );
+			}
+		}
+
+	// wait for all of them
+	for( uint i = 0; i < entity_count; ++i )
+		{
+		for(;;)
+			{
+			std::pair<std::shared_ptr<const Entity>, Status> entity = loader.GetLoadedEntity( entity_uuid( i ) );
+			TEST_ASSERT( entity.second == Status::Ok );
+			if( entity.first )
+				{
+				TEST_ASSERT( entity.first->GetUUID() == entity_uuid( i ) );
+				break;
+				}
+
+			// if the cache has a budget, the entity may have been evicted before it was checked, so request it again
+			TEST_ASSERT( loader.AsyncLoadEntity( entity_uuid( i ) ) == Status::Ok );
+			std::this_thread::yield();
+			}
+		}
+
+	auto t1 = std::chrono::high_resolution_clock::now();
+	const double seconds = std::chrono::duration<double>( t1 - t0 ).count();
+	printf( "    %s: Loaded %d entities in %.2f s, %.0f entities/s\n", description, (int)entity_count, seconds, entity_count / seconds );
+
+	// a missing entity must report an error
+	TEST_ASSERT( loader.AsyncLoadEntity( entity_uuid( entity_count ) ) == Status::Ok );
+	for(;;)
+		{
+		std::pair<bool, Status> loaded = loader.IsEntityLoaded( entity_uuid( entity_count ) );
+		TEST_ASSERT( !loaded.first );
+		if( loaded.second != Status::Ok )
+			{
+			TEST_ASSERT( loaded.second == Status::ECantOpen );
+			break;
+			}
+		std::this_thread::yield();
+		}
+	}
+
+// request loads with callbacks at different priorities, re-prioritize and cancel some of them, and check that
+// every callback is called exactly once, with the entity or ECancelled
+static void priority_and_cancel_test( EntityLoader::LoadMode load_mode )
+	{
+	const uint request_count = ( entity_count < 10000 ) ? entity_count : 10000;
+	const uint cancel_begin = request_count / 5;
+	const uint cancel_end = request_count * 3 / 10;
+	const uint promoted_begin = request_count - request_count / 100;
+
+	EntityLoader loader;
+	TEST_ASSERT( loader.Initialize( entity_directory, 0, load_mode ) == Status::Ok );
+
+	std::atomic<uint> loaded_count( 0 );
+	std::atomic<uint> cancelled_count( 0 );
+	std::atomic<uint> failed_count( 0 );
+	auto callback = [&]( const UUID &uuid, Status status, const std::shared_ptr<const Entity> &entity )
+		{
+		if( status == Status::Ok )
+			{
+			TEST_ASSERT( entity && entity->GetUUID() == uuid );
+			++loaded_count;
+			}
+		else if( status == Status::ECancelled )
+			{
+			TEST_ASSERT( !entity );
+			++cancelled_count;
+			}
+		else
+			{
+			++failed_count;
+			}
+		};
+
+	for( uint i = 0; i < request_count; ++i )
+		{
+		TEST_ASSERT( loader.AsyncLoadEntity( entity_uuid( i ), EntityLoader::LoadPriority::Low, callback ) == Status::Ok );
+		}
+
+	// move the last requests to the front, and cancel a range. loads which have already started can not be re-prioritized
+	for( uint i = promoted_begin; i < request_count; ++i )
+		{
+		loader.SetLoadPriority( entity_uuid( i ), EntityLoader::LoadPriority::Interactive );
+		}
+	uint cancel_count = 0;
+	for( uint i = cancel_begin; i < cancel_end; ++i )
+		{
+		if( loader.CancelLoad( entity_uuid( i ) ) )
+			{
+			++cancel_count;
+			}
+		}
+
+	// a future of an entity which is already requested is completed with the same load
+	std::future<std::pair<std::shared_ptr<const Entity>, Status>> future = loader.AsyncLoadEntityFuture( entity_uuid( 0 ), EntityLoader::LoadPriority::Interactive );
+	std::pair<std::shared_ptr<const Entity>, Status> result = future.get();
+	TEST_ASSERT( result.second == Status::Ok );
+	TEST_ASSERT( result.first && result.first->GetUUID() == entity_uuid( 0 ) );
+
+	// a missing entity completes with the error
+	future = loader.AsyncLoadEntityFuture( entity_uuid( entity_count ) );
+	result = future.get();
+	TEST_ASSERT( !result.first );
+	TEST_ASSERT( result.second == Status::ECantOpen );
+
+	while( loaded_count.load() + cancelled_count.load() + failed_count.load() < request_count )
+		{
+		std::this_thread::yield();
+		}
+	TEST_ASSERT( cancelled_count.load() == cancel_count );
+	TEST_ASSERT( loaded_count.load() == request_count - cancel_count );
+	TEST_ASSERT( failed_count.load() == 0 );
+
+	// the cancelled entities are not loaded or failed, and can be requested again
+	for( uint i = cancel_begin; i < cancel_end; ++i )
+		{
+		std::pair<bool, Status> loaded = loader.IsEntityLoaded( entity_uuid( i ) );
+		TEST_ASSERT( loaded.second == Status::Ok );
+		}
+
+	// the callback of a loaded entity is called directly, and it can not be cancelled
+	bool called = false;
+	TEST_ASSERT( loader.AsyncLoadEntity( entity_uuid( 0 ), EntityLoader::LoadPriority::Normal, [&called]( const UUID &, Status status, const std::shared_ptr<const Entity> &entity )
+		{
+		called = ( status == Status::Ok && entity );
+		} ) == Status::Ok );
+	TEST_ASSERT( called );
+	TEST_ASSERT( !loader.CancelLoad( entity_uuid( 0 ) ) );
+	TEST_ASSERT( !loader.SetLoadPriority( entity_uuid( 0 ), EntityLoader::LoadPriority::High ) );
+	}
+
+// build and save the index of the store, and check that the loader answers queries from it, like from the files
+static void entity_index_test()
+	{
+	const std::string index_file_path = std::string( entity_directory ) + "/" + EntityStoreIndexFileName;
+	remove( index_file_path.c_str() );
+
+	// without an index, the files are stat'ed
+	std::vector<u64> file_sizes( entity_count );
+		{
+		EntityLoader loader;
+		TEST_ASSERT( loader.Initialize( entity_directory ) == Status::Ok );
+		TEST_ASSERT( !loader.HasEntityIndex() );
+		for( uint i = 0; i < entity_count; ++i )
+			{
+			entity_index_entry entry;
+			TEST_ASSERT( loader.FindStoredEntity( entity_uuid( i ), entry ) == Status::Ok );
+			file_sizes[i] = entry.size;
+			}
+		}
+
+	auto t0 = std::chrono::high_resolution_clock::now();
+	EntityIndex index;
+	TEST_ASSERT( index.Build( entity_directory ) == Status::Ok );
+	TEST_ASSERT( index.GetEntryCount() == entity_count );
+	TEST_ASSERT( index.Save( index_file_path ) == Status::Ok );
+	auto t1 = std::chrono::high_resolution_clock::now();
+	printf( "    Built the index of %d entities in %.2f s\n", (int)entity_count, std::chrono::duration<double>( t1 - t0 ).count() );
+
+		{
+		t0 = std::chrono::high_resolution_clock::now();
+		EntityLoader loader;
+		TEST_ASSERT( loader.Initialize( entity_directory ) == Status::Ok );
+		TEST_ASSERT( loader.HasEntityIndex() );
+		for( uint i = 0; i < entity_count; ++i )
+			{
+			entity_index_entry entry;
+			TEST_ASSERT( loader.FindStoredEntity( entity_uuid( i ), entry ) == Status::Ok );
+			TEST_ASSERT( entry.uuid == entity_uuid( i ) );
+			TEST_ASSERT( entry.offset == 0 );
+			TEST_ASSERT( entry.size == file_sizes[i] );
+			TEST_ASSERT( entry.root_hash != hash_zero );
+			}
+		entity_index_entry entry;
+		TEST_ASSERT( loader.FindStoredEntity( entity_uuid( entity_count ), entry ) == Status::ECantOpen );
+		t1 = std::chrono::high_resolution_clock::now();
+		printf( "    Loaded the index and queried %d entities in %.2f s\n", (int)entity_count, std::chrono::duration<double>( t1 - t0 ).count() );
+		}
+
+	// an entity which is added after the index was built is not in the index, but is still found and loaded
+	const UUID added_uuid = entity_uuid( entity_count );
+	const std::string added_file_path = std::string( entity_directory ) + "/" + entity_store_relative_path( added_uuid );
+	TEST_ASSERT( create_entity_store_directories( entity_directory, added_uuid ) == Status::Ok );
+	write_entity_file( added_file_path, entity_count );
+		{
+		EntityLoader loader;
+		TEST_ASSERT( loader.Initialize( entity_directory ) == Status::Ok );
+		TEST_ASSERT( loader.HasEntityIndex() );
+		entity_index_entry entry;
+		TEST_ASSERT( loader.FindStoredEntity( added_uuid, entry ) == Status::Ok );
+		TEST_ASSERT( entry.uuid == added_uuid );
+		TEST_ASSERT( entry.root_hash == hash_zero );
+		TEST_ASSERT( loader.AsyncLoadEntityFuture( added_uuid ).get().second == Status::Ok );
+		TEST_ASSERT( loader.FindStoredEntity( entity_uuid( entity_count + 1 ), entry ) == Status::ECantOpen );
+		}
+	remove( added_file_path.c_str() );
+
+	// a damaged index file is ignored
+		{
+		std::fstream file( index_file_path, std::ios::binary | std::ios::in | std::ios::out );
+		file.seekp( 100 );
+		file.put( (char)0xff );
+		}
+		{
+		EntityLoader loader;
+		TEST_ASSERT( loader.Initialize( entity_directory ) == Status::Ok );
+		TEST_ASSERT( !loader.HasEntityIndex() );
+		}
+	remove( index_file_path.c_str() );
+	}
+
+// pack half of the entities, and load all of them, with the packed entities served from the mapped pack
+static void pack_file_test( EntityLoader::LoadMode load_mode )
+	{
+	const std::string pack_file_path = std::string( entity_directory ) + ".isdpack";
+	const uint packed_count = entity_count / 2;
+
+	// pack the even entities, by copying their loose files
+		{
+		PackWriter writer;
+		TEST_ASSERT( writer.Open( pack_file_path ) == Status::Ok );
+		for( uint i = 0; i < entity_count; i += 2 )
+			{
+			std::vector<u8> blob;
+			TEST_ASSERT( FileBatchReader::ReadWholeFile( std::string( entity_directory ) + "/" + entity_store_relative_path( entity_uuid( i ) ), blob ) == Status::Ok );
+			TEST_ASSERT( writer.AddEntity( entity_uuid( i ), blob.data(), blob.size() ) == Status::Ok );
+			}
+		TEST_ASSERT( writer.AddEntity( entity_uuid( 0 ), nullptr, 0 ) == Status::EParam );
+		TEST_ASSERT( writer.Close() == Status::Ok );
+		}
+
+	EntityLoader loader;
+	TEST_ASSERT( loader.Initialize( entity_directory, 0, load_mode ) == Status::Ok );
+	TEST_ASSERT( loader.AddPackFile( pack_file_path ) == Status::Ok );
+
+	// the packed entities are found in the pack, at aligned positions
+	for( uint i = 0; i < entity_count; ++i )
+		{
+		entity_index_entry entry;
+		TEST_ASSERT( loader.FindStoredEntity( entity_uuid( i ), entry ) == Status::Ok );
+		TEST_ASSERT( ( entry.offset != 0 ) == ( ( i & 1 ) == 0 ) );
+		TEST_ASSERT( ( entry.offset % PackDefaultBlobAlignment ) == 0 );
+		}
+
+	load_entities( loader, ( load_mode == EntityLoader::LoadMode::Read ) ? "Read, half packed" : "Mapped, half packed" );
+
+	// the packed entities are mapped, and share the mapping of the pack
+	uint mapped_count = 0;
+	for( uint i = 0; i < entity_count; ++i )
+		{
+		std::pair<std::shared_ptr<const Entity>, Status> entity = loader.GetLoadedEntity( entity_uuid( i ) );
+		TEST_ASSERT( entity.first );
+		if( ( i & 1 ) == 0 )
+			{
+			TEST_ASSERT( entity.first->IsMapped() );
+			}
+		if( entity.first->IsMapped() )
+			{
+			++mapped_count;
+			}
+		}
+	TEST_ASSERT( mapped_count >= packed_count );
+
+	remove( pack_file_path.c_str() );
+	}
+
+// a store written before the sharding has the files directly in the root, and must still load. the second half of the
+// entities is written in the sharded layout, as if the store was partly rewritten
+static void flat_store_test( EntityLoader::LoadMode load_mode )
+	{
+	const uint flat_count = 100;
+	const std::string flat_directory = std::string( entity_directory ) + "_flat";
+	make_directory( flat_directory.c_str() );
+	for( uint i = 0; i < flat_count; ++i )
+		{
+		if( i < flat_count / 2 )
+			{
+			write_entity_file( flat_directory + "/" + entity_store_flat_relative_path( entity_uuid( i ) ), i );
+			}
+		else
+			{
+			TEST_ASSERT( create_entity_store_directories( flat_directory, entity_uuid( i ) ) == Status::Ok );
+			write_entity_file( flat_directory + "/" + entity_store_relative_path( entity_uuid( i ) ), i );
+			}
+		}
+
+	// the index lists the entities of both layouts
+	EntityIndex index;
+	TEST_ASSERT( index.Build( flat_directory ) == Status::Ok );
+	TEST_ASSERT( index.GetEntryCount() == flat_count );
+
+	EntityLoader loader;
+	TEST_ASSERT( loader.Initialize( flat_directory, 0, load_mode ) == Status::Ok );
+	for( uint i = 0; i < flat_count; ++i )
+		{
+		entity_index_entry entry;
+		TEST_ASSERT( loader.FindStoredEntity( entity_uuid( i ), entry ) == Status::Ok );
+		TEST_ASSERT( entry.size == index.Find( entity_uuid( i ) )->size );
+		TEST_ASSERT( loader.AsyncLoadEntity( entity_uuid( i ) ) == Status::Ok );
+		}
+	for( uint i = 0; i < flat_count; ++i )
+		{
+		std::future<std::pair<std::shared_ptr<const Entity>, Status>> future = loader.AsyncLoadEntityFuture( entity_uuid( i ) );
+		std::pair<std::shared_ptr<const Entity>, Status> result = future.get();
+		TEST_ASSERT( result.second == Status::Ok );
+		TEST_ASSERT( result.first && result.first->GetUUID() == entity_uuid( i ) );
+		}
+
+	// missing in both layouts is still an error
+	std::pair<std::shared_ptr<const Entity>, Status> missing = loader.AsyncLoadEntityFuture( entity_uuid( flat_count ) ).get();
+	TEST_ASSERT( !missing.first );
+	TEST_ASSERT( missing.second == Status::ECantOpen );
+
+	for( uint i = 0; i < flat_count; ++i )
+		{
+		remove( ( flat_directory + "/" + entity_store_flat_relative_path( entity_uuid( i ) ) ).c_str() );
+		remove( ( flat_directory + "/" + entity_store_relative_path( entity_uuid( i ) ) ).c_str() );
+		}
+	}
+
+// the root entity references the other entities with hash values, which are resolved to the entities by the index in the hash. 
+// only the referenced entities which fit in the budget of the prefetch are loaded, also when they are all queued at once
+static void prefetch_budget_test( EntityLoader::LoadMode load_mode )
+	{
+	const std::string prefetch_directory = std::string( entity_directory ) + "_prefetch";
+	const uint ref_count = 16;
+	const uint budget_count = 3;
+	const u64 data_size = 4096;
+	make_directory( prefetch_directory.c_str() );
+	for( uint i = 0; i <= ref_count; ++i )
+		{
+		std::vector<u8> data;
+		if( i == 0 )
+			{
+			// small VT_Hash blocks, with the hash and a one character key
+			for( uint r = 1; r <= ref_count; ++r )
+				{
+				hash ref = {};
+				ref.digest[0] = 0xff;
+				memcpy( &ref.digest[1], &r, sizeof( r ) );
+				data.push_back( (u8)ValueType::VT_Hash );
+				data.push_back( (u8)( sizeof( hash ) + 1 ) );
+				data.insert( data.end(), ref.digest, ref.digest + sizeof( hash ) );
+				data.push_back( 'r' );
+				}
+			}
+		else
+			{
+			data.resize( (size_t)data_size );
+			for( u8 &b : data )
+				{
+				b = (u8)rand();
+				}
+			}
+		std::vector<u8> trailer = calculate_blob_trailer( data.data(), data.size(), 0, 1 );
+		TEST_ASSERT( create_entity_store_directories( prefetch_directory, entity_uuid( i ) ) == Status::Ok );
+		std::ofstream file( prefetch_directory + "/" + entity_store_relative_path( entity_uuid( i ) ), std::ios::binary );
+		file.write( (const char *)data.data(), data.size() );
+		file.write( (const char *)trailer.data(), trailer.size() );
+		TEST_ASSERT( file.good() );
+		}
+
+	// the queued prefetches are counted with the size of the file, so only budget_count of them fit
+	const u64 stored_entity_size = sizeof( Entity ) + data_size + sizeof( hash );
+	EntityLoader loader;
+	TEST_ASSERT( loader.Initialize( prefetch_directory, 0, load_mode ) == Status::Ok );
+	loader.SetPrefetchPolicy( 1, stored_entity_size * budget_count + stored_entity_size / 2, []( const hash &package_ref, UUID &dest_uuid )
+		{
+		uint index = 0;
+		memcpy( &index, &package_ref.digest[1], sizeof( index ) );
+		dest_uuid = entity_uuid( index );
+		return true;
+		} );
+	TEST_ASSERT( loader.AsyncLoadEntityFuture( entity_uuid( 0 ) ).get().second == Status::Ok );
+
+	// wait for the prefetches to load, and give any prefetch over the budget time to show up
+	uint loaded_count = 0;
+	for( uint wait = 0; wait < 1000 && loaded_count < budget_count; ++wait )
+		{
+		std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+		loaded_count = 0;
+		for( uint i = 1; i <= ref_count; ++i )
+			{
+			loaded_count += loader.IsEntityLoaded( entity_uuid( i ) ).first ? 1 : 0;
+			}
+		}
+	std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+	loaded_count = 0;
+	for( uint i = 1; i <= ref_count; ++i )
+		{
+		loaded_count += loader.IsEntityLoaded( entity_uuid( i ) ).first ? 1 : 0;
+		}
+	TEST_ASSERT( loaded_count == budget_count );
+
+	for( uint i = 0; i <= ref_count; ++i )
+		{
+		remove( ( prefetch_directory + "/" + entity_store_relative_path( entity_uuid( i ) ) ).c_str() );
+		}
+	}
+
+// with verify on access, a mapped entity with a corrupted chunk is loaded, and only the ranges which overlap the chunk fail to verify.
+// entities which are read into memory are still verified when loaded
+static void verify_on_access_test()
+	{
+	const std::string corrupted_directory = std::string( entity_directory ) + "_corrupted";
+	const UUID corrupted_uuid = entity_uuid( 0 );
+	const u64 chunk_size = 4096;
+	const u64 data_size = chunk_size * 4;
+	make_directory( corrupted_directory.c_str() );
+	TEST_ASSERT( create_entity_store_directories( corrupted_directory, corrupted_uuid ) == Status::Ok );
+		{
+		std::vector<u8> data( (size_t)data_size );
+		for( u8 &b : data )
+			{
+			b = (u8)rand();
+			}
+		std::vector<u8> trailer = calculate_blob_trailer( data.data(), data.size(), chunk_size, 1 );
+		data[(size_t)( data_size - 1 )] ^= 0x1;
+		std::ofstream file( corrupted_directory + "/" + entity_store_relative_path( corrupted_uuid ), std::ios::binary );
+		file.write( (const char *)data.data(), data.size() );
+		file.write( (const char *)trailer.data(), trailer.size() );
+		TEST_ASSERT( file.good() );
+		}
+
+	for( uint pass = 0; pass < 3; ++pass )
+		{
+		const EntityLoader::LoadMode load_mode = ( pass == 2 ) ? EntityLoader::LoadMode::Read : EntityLoader::LoadMode::Mapped;
+		const bool verify_on_access = ( pass != 0 );
+		EntityLoader loader;
+		TEST_ASSERT( loader.Initialize( corrupted_directory, 0, load_mode ) == Status::Ok );
+		loader.SetVerifyOnAccess( verify_on_access );
+		std::pair<std::shared_ptr<const Entity>, Status> entity = loader.AsyncLoadEntityFuture( corrupted_uuid ).get();
+		if( load_mode == EntityLoader::LoadMode::Mapped && verify_on_access )
+			{
+			TEST_ASSERT( entity.second == Status::Ok );
+			TEST_ASSERT( entity.first->IsVerifiedOnAccess() );
+			TEST_ASSERT( entity.first->GetDataSize() == data_size );
+			TEST_ASSERT( entity.first->VerifyRange( 0, chunk_size * 3 ) == Status::Ok );
+			TEST_ASSERT( entity.first->VerifyRange( chunk_size * 3 - 1, 2 ) == Status::ECorrupted );
+			TEST_ASSERT( entity.first->VerifyRange( 0, data_size ) == Status::ECorrupted );
+			TEST_ASSERT( entity.first->VerifyRange( data_size, 1 ) == Status::EParam );
+			}
+		else
+			{
+			TEST_ASSERT( !entity.first );
+			TEST_ASSERT( entity.second == Status::ECorrupted );
+			}
+		}
+
+	remove( ( corrupted_directory + "/" + entity_store_relative_path( corrupted_uuid ) ).c_str() );
+	}
+
+// a mesh loaded by the loader is read lazily from the read stream of the entity, so its lazy sections reference the entity data, and 
+// keep it alive after the loader and the entity handle are gone
+static void lazy_mesh_test( EntityLoader::LoadMode load_mode )
+	{
+	const std::string mesh_directory = std::string( entity_directory ) + "_mesh";
+	const UUID mesh_uuid = entity_uuid( 0 );
+	make_directory( mesh_directory.c_str() );
+	TEST_ASSERT( create_entity_store_directories( mesh_directory, mesh_uuid ) == Status::Ok );
+
+	ISD::Mesh mesh;
+	for( uint i = 0; i < 4; ++i )
+		{
+		IndexedVector<fvec3> &normals = mesh.NormalsData().Insert( entity_ref::make_ref() );
+		for( uint v = 0; v < 100; ++v )
+			{
+			normals.values().push_back( fvec3( (float)v, (float)i, 1.f ) );
+			normals.index().push_back( (i32)( 99 - v ) );
+			}
+		}
+	MemoryWriteStream ws;
+	EntityWriter ew( ws );
+	TEST_ASSERT( ISD::Mesh::MF::Write( mesh, ew ) );
+	std::vector<u8> trailer = calculate_blob_trailer( (const u8 *)ws.GetData(), ws.GetSize(), 0, 1 );
+		{
+		std::ofstream file( mesh_directory + "/" + entity_store_relative_path( mesh_uuid ), std::ios::binary );
+		file.write( (const char *)ws.GetData(), ws.GetSize() );
+		file.write( (const char *)trailer.data(), trailer.size() );
+		TEST_ASSERT( file.good() );
+		}
+
+	ISD::Mesh loaded_mesh;
+	std::weak_ptr<const Entity> weak_entity;
+		{
+		EntityLoader loader;
+		TEST_ASSERT( loader.Initialize( mesh_directory, 0, load_mode ) == Status::Ok );
+		std::pair<std::shared_ptr<const Entity>, Status> entity = loader.AsyncLoadEntityFuture( mesh_uuid ).get();
+		TEST_ASSERT( entity.second == Status::Ok );
+		MemoryReadStream rs = entity.first->GetReadStream();
+		TEST_ASSERT( rs.GetDataOwner() );
+		EntityReader er( rs );
+		er.SetLazyReading( true );
+		TEST_ASSERT( ISD::Mesh::MF::Read( loaded_mesh, er ) );
+		weak_entity = entity.first;
+		}
+
+	// the sections are read from the entity data, which is released when all of them are read
+	TEST_ASSERT( !weak_entity.expired() );
+	TEST_ASSERT( ISD::Mesh::MF::ReadLazySections( loaded_mesh ) );
+	TEST_ASSERT( weak_entity.expired() );
+	TEST_ASSERT( ISD::Mesh::MF::Equals( &mesh, &loaded_mesh ) );
+
+	remove( ( mesh_directory + "/" + entity_store_relative_path( mesh_uuid ) ).c_str() );
+	}
+
+void entity_loader_test()
+	{
+	entity_count = large_system_tests ? large_entity_count : small_entity_count;
+	test_directory = make_temp_directory();
+	entity_directory = test_directory + "/entity_loader_test";
+	write_entity_files();
+
+	// read the files into memory
+		{
+		EntityLoader loader;
+		TEST_ASSERT( loader.Initialize( entity_directory ) == Status::Ok );
+		load_entities( loader, "Read" );
+		}
+
+	// map the files, the first loader verifies all files and fills the cache file, the second only maps them
+	const std::string cache_file_path = std::string( entity_directory ) + ".verified";
+	remove( cache_file_path.c_str() );
+	for( uint pass = 0; pass < 2; ++pass )
+		{
+		EntityLoader loader;
+		TEST_ASSERT( loader.Initialize( entity_directory, 0, EntityLoader::LoadMode::Mapped ) == Status::Ok );
+		TEST_ASSERT( loader.SetVerifiedFileCache( cache_file_path ) == Status::Ok );
+		load_entities( loader, ( pass == 0 ) ? "Mapped" : "Mapped, verified" );
+		}
+
+	// a partially written last record of the cache file is cut, so the records which are appended after it are read back
+		{
+		file_identity identity = {};
+		identity.device = 1;
+		identity.inode = 2;
+		identity.modified_time = 3;
+		identity.size = 4;
+		hash root_hash = {};
+		root_hash.digest[0] = 0x5;
+
+		std::ifstream cache_file( cache_file_path, std::ios::binary | std::ios::ate );
+		const u64 cache_file_size = (u64)cache_file.tellg();
+		cache_file.close();
+		TEST_ASSERT( ( cache_file_size - sizeof( u64 ) ) % 64 == 0 );
+			{
+			std::ofstream torn_file( cache_file_path, std::ios::binary | std::ios::app );
+			torn_file.write( "torn", 4 );
+			TEST_ASSERT( torn_file.good() );
+			}
+			{
+			VerifiedFileCache cache;
+			TEST_ASSERT( cache.SetCacheFile( cache_file_path ) == Status::Ok );
+			TEST_ASSERT( !cache.IsVerified( identity, root_hash ) );
+			cache.SetVerified( identity, root_hash );
+			}
+			{
+			VerifiedFileCache cache;
+			TEST_ASSERT( cache.SetCacheFile( cache_file_path ) == Status::Ok );
+			TEST_ASSERT( cache.IsVerified( identity, root_hash ) );
+			}
+		cache_file.open( cache_file_path, std::ios::binary | std::ios::ate );
+		TEST_ASSERT( (u64)cache_file.tellg() == cache_file_size + 64 );
+		}
+
+	// priorities, cancellation and completion callbacks
+	priority_and_cancel_test( EntityLoader::LoadMode::Read );
+	priority_and_cancel_test( EntityLoader::LoadMode::Mapped );
+
+	// load with a cache budget, which is much smaller than the total size of the entities
+		{
+		const u64 cache_budget = ( large_system_tests ? 16 : 1 ) * 1024 * 1024;
+		EntityLoader loader;
+		TEST_ASSERT( loader.Initialize( entity_directory ) == Status::Ok );
+		loader.SetCacheBudget( cache_budget );
+
+		// pin some entities with handles
+		std::vector<std::shared_ptr<const Entity>> pinned;
+		u64 pinned_size = 0;
+		for( uint i = 0; i < 100; ++i )
+			{
+			TEST_ASSERT( loader.AsyncLoadEntity( entity_uuid( i ) ) == Status::Ok );
+			for(;;)
+				{
+				std::pair<std::shared_ptr<const Entity>, Status> entity = loader.GetLoadedEntity( entity_uuid( i ) );
+				TEST_ASSERT( entity.second == Status::Ok );
+				if( entity.first )
+					{
+					pinned_size += EntityCache::GetEntitySize( *entity.first );
+					pinned.push_back( entity.first );
+					break;
+					}
+				TEST_ASSERT( loader.AsyncLoadEntity( entity_uuid( i ) ) == Status::Ok );
+				std::this_thread::yield();
+				}
+			}
+
+		load_entities( loader, large_system_tests ? "Read, 16MB cache" : "Read, 1MB cache" );
+		TEST_ASSERT( loader.GetCacheUsedBytes() <= cache_budget + pinned_size );
+
+		// the pinned entities must never have been evicted
+		for( uint i = 0; i < 100; ++i )
+			{
+			TEST_ASSERT( pinned[i]->GetUUID() == entity_uuid( i ) );
+			std::pair<bool, Status> loaded = loader.IsEntityLoaded( entity_uuid( i ) );
+			TEST_ASSERT( loaded.first );
+			}
+
+		// unpinned, they can be evicted
+		pinned.clear();
+		loader.SetCacheBudget( 1 );
+		TEST_ASSERT( loader.GetCacheUsedBytes() <= cache_budget );
+		}
+
+	// the index of the store
+	entity_index_test();
+
+	// pack files
+	pack_file_test( EntityLoader::LoadMode::Read );
+	pack_file_test( EntityLoader::LoadMode::Mapped );
+
+	// stores in the flat layout of older versions
+	flat_store_test( EntityLoader::LoadMode::Read );
+	flat_store_test( EntityLoader::LoadMode::Mapped );
+
+	// prefetching within the budget
+	prefetch_budget_test( EntityLoader::LoadMode::Read );
+	prefetch_budget_test( EntityLoader::LoadMode::Mapped );
+
+	// entities verified on access
+	verify_on_access_test();
+
+	// entities read with lazy sections
+	lazy_mesh_test( EntityLoader::LoadMode::Read );
+	lazy_mesh_test( EntityLoader::LoadMode::Mapped );
+
+	remove_directory_tree( test_directory );
+	}
@@ -0,0 +1,94 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#include "SystemTests.h"
+
+#include "../ISD/ISD_FileBatchReader.h"
+
+#include <fstream>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char *batch_reader_directory = "file_batch_reader_test";
+
+// read a batch of files, which is larger than the queue depth, with empty, missing, small and large files.
+// each file must complete exactly once, with its data or an error. if the library is built with ISD_USE_IO_URING
+// on Linux, the files are read through io_uring, else the files are read synchronously.
+void file_batch_reader_test()
+	{
+	const uint queue_depth = 8;
+	const size_t file_sizes[] = { 0, 1, 100, 4096, 65535, 65536, 65537, 200000, 3000000 };
+	const size_t size_count = sizeof( file_sizes ) / sizeof( file_sizes[0] );
+
+#ifdef _WIN32
+	_mkdir( batch_reader_directory );
+#else
+	mkdir( batch_reader_directory, 0755 );
+#endif
+
+	// write the files, every 7th file is missing
+	std::vector<std::string> file_paths;
+	std::vector<std::vector<u8>> file_contents;
+	for( size_t i = 0; i < queue_depth * 8 + 3; ++i )
+		{
+		file_paths.push_back( std::string( batch_reader_directory ) + "/file_" + std::to_string( i ) );
+		file_contents.emplace_back( ( i % 7 == 3 ) ? 0 : file_sizes[i % size_count] );
+		if( i % 7 == 3 )
+			{
+			remove( file_paths.back().c_str() );
+			continue;
+			}
+
+		std::vector<u8> &data = file_contents.back();
+		for( size_t b = 0; b < data.size(); ++b )
+			{
+			data[b] = (u8)( b * 31 + i );
+			}
+		std::ofstream file( file_paths.back(), std::ios::binary );
+		file.write( (const char *)data.data(), data.size() );
+		TEST_ASSERT( file.good() );
+		}
+
+	FileBatchReader reader;
+	TEST_ASSERT( reader.Initialize( queue_depth ) == Status::Ok );
+	printf( "    Reading with %s\n", reader.IsUsingIoUring() ? "io_uring" : "synchronous reads" );
+
+	// read the batch twice, to make sure the reader is left in a usable state
+	for( uint pass = 0; pass < 2; ++pass )
+		{
+		std::vector<uint> completion_counts( file_paths.size(), 0 );
+		reader.ReadBatch( file_paths, [&]( size_t file_index, Status status, std::vector<u8> &data )
+			{
+			TEST_ASSERT( file_index < file_paths.size() );
+			++completion_counts[file_index];
+			if( file_index % 7 == 3 )
+				{
+				TEST_ASSERT( status == Status::ECantOpen );
+				}
+			else
+				{
+				TEST_ASSERT( status == Status::Ok );
+				TEST_ASSERT( data == file_contents[file_index] );
+				}
+			} );
+		for( uint count : completion_counts )
+			{
+			TEST_ASSERT( count == 1 );
+			}
+		}
+
+	for( const std::string &file_path : file_paths )
+		{
+		remove( file_path.c_str() );
+		}
+#ifdef _WIN32
+	_rmdir( batch_reader_directory );
+#else
+	rmdir( batch_reader_directory );
+#endif
+	}
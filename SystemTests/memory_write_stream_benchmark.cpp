@@ -0,0 +1,168 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#include "SystemTests.h"
+
+#include "../ISD/ISD_EntityWriter.h"
+
+#include <algorithm>
+#include <chrono>
+
+#ifdef _WIN32
+#include <Psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <fstream>
+#include <string>
+#endif
+
+// size of each VT_Array_Vec3 block written by the benchmark, and the total sizes written, in MB. the large sizes
+// need tens of GB of memory, and are only written if the large system tests are enabled
+static const u64 benchmark_block_size = 256ull * 1024 * 1024;
+static const u64 benchmark_sizes_in_mb[] = { 1024, 4096, 16384 };
+static const u64 small_benchmark_block_size = 16ull * 1024 * 1024;
+static const u64 small_benchmark_sizes_in_mb[] = { 64, 256 };
+
+// reset the peak resident set size of the process, if the platform supports it
+static void reset_peak_rss()
+	{
+#ifndef _WIN32
+	// writing 5 to clear_refs resets the VmHWM peak counter (Linux 4.0 and later)
+	std::ofstream clear_refs( "/proc/self/clear_refs" );
+	clear_refs << "5";
+#endif
+	}
+
+// get the peak resident set size of the process, in bytes
+static u64 get_peak_rss()
+	{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters = {};
+	if( !::GetProcessMemoryInfo( ::GetCurrentProcess(), &counters, sizeof( counters ) ) )
+		return 0;
+	return (u64)counters.PeakWorkingSetSize;
+#else
+	std::ifstream status( "/proc/self/status" );
+	std::string line;
+	while( std::getline( status, line ) )
+		{
+		if( line.compare( 0, 6, "VmHWM:" ) == 0 )
+			{
+			return std::stoull( line.substr( 6 ) ) * 1024;
+			}
+		}
+	return 0;
+#endif
+	}
+
+// the reference path: a buffer which doubles its allocation and copies all data on growth,
+// which is how the stream grew when it was backed by VirtualAlloc + memcpy
+class copy_on_growth_buffer
+	{
+	private:
+		u8 *Data = nullptr;
+		u64 DataSize = 0;
+		u64 DataReservedSize = 0;
+
+	public:
+		copy_on_growth_buffer( u64 initial_size )
+			{
+			this->reserve( initial_size );
+			}
+		~copy_on_growth_buffer()
+			{
+			free( this->Data );
+			}
+
+		void reserve( u64 reserve_size )
+			{
+			this->DataReservedSize = std::max( this->DataReservedSize * 2, reserve_size );
+			u8 *new_data = (u8*)malloc( this->DataReservedSize );
+			TEST_ASSERT( new_data != nullptr );
+			if( this->Data )
+				{
+				memcpy( new_data, this->Data, this->DataSize );
+				free( this->Data );
+				}
+			this->Data = new_data;
+			}
+
+		void write( const void *src, u64 count )
+			{
+			if( this->DataSize + count > this->DataReservedSize )
+				this->reserve( this->DataSize + count );
+			memcpy( &this->Data[this->DataSize], src, count );
+			this->DataSize += count;
+			}
+
+		u64 size() const
+			{
+			return this->DataSize;
+			}
+	};
+
+static void print_result( const char *path_name, u64 total_size, double seconds, u64 peak_rss )
+	{
+	const double gb = 1024.0 * 1024.0 * 1024.0;
+	printf( "    %-24s %6.2f GB in %7.2f s, %7.2f GB/s, peak RSS %6.2f GB\n", path_name, total_size / gb, seconds, (total_size / gb) / seconds, peak_rss / gb );
+	}
+
+static void write_vec3_arrays( u64 total_size, const std::vector<fvec3> &block )
+	{
+	const u64 block_count = total_size / ( block.size() * sizeof( fvec3 ) );
+
+	// MemoryWriteStream through the EntityWriter, writing VT_Array_Vec3 blocks
+		{
+		reset_peak_rss();
+		auto t0 = std::chrono::high_resolution_clock::now();
+
+		MemoryWriteStream ws;
+		EntityWriter writer( ws );
+		for( u64 i = 0; i < block_count; ++i )
+			{
+			TEST_ASSERT( writer.Write( "Vertices", 8, block ) );
+			}
+
+		auto t1 = std::chrono::high_resolution_clock::now();
+		print_result( "MemoryWriteStream", ws.GetSize(), std::chrono::duration<double>( t1 - t0 ).count(), get_peak_rss() );
+		}
+
+	// the copy-on-growth reference, writing the same raw payload
+		{
+		reset_peak_rss();
+		auto t0 = std::chrono::high_resolution_clock::now();
+
+		copy_on_growth_buffer buffer( 1024 * 1024 * 64 );
+		for( u64 i = 0; i < block_count; ++i )
+			{
+			buffer.write( block.data(), block.size() * sizeof( fvec3 ) );
+			}
+
+		auto t1 = std::chrono::high_resolution_clock::now();
+		print_result( "copy-on-growth reference", buffer.size(), std::chrono::duration<double>( t1 - t0 ).count(), get_peak_rss() );
+		}
+	}
+
+void memory_write_stream_benchmark()
+	{
+	const u64 block_size = large_system_tests ? benchmark_block_size : small_benchmark_block_size;
+
+	// setup one block of vertex data, which is written repeatedly
+	std::vector<fvec3> block( block_size / sizeof( fvec3 ) );
+	for( size_t i = 0; i < block.size(); ++i )
+		{
+		block[i] = fvec3( (float)i, (float)( i + 1 ), (float)( i + 2 ) );
+		}
+
+	std::vector<u64> sizes_in_mb;
+	if( large_system_tests )
+		sizes_in_mb.assign( std::begin( benchmark_sizes_in_mb ), std::end( benchmark_sizes_in_mb ) );
+	else
+		sizes_in_mb.assign( std::begin( small_benchmark_sizes_in_mb ), std::end( small_benchmark_sizes_in_mb ) );
+
+	for( u64 size_in_mb : sizes_in_mb )
+		{
+		printf( "  Writing %d MB of VT_Array_Vec3 data\n", (int)size_in_mb );
+		write_vec3_arrays( size_in_mb * 1024 * 1024, block );
+		}
+	}
@@ -0,0 +1,86 @@
+// ISD Copyright (c) 2021 Ulrik Lindahl
+// Licensed under the MIT license https://github.com/Cooolrik/ISD/blob/main/LICENSE
+
+#include "SystemTests.h"
+
+#include "../ISD/ISD_PacketSerializer.h"
+#include "../ISD/ISD_EntityPacketTypes.h"
+#include "../ISD/ISD_Node.h"
+
+#include "../TestHelpers/random_vals.h"
+
+#include <chrono>
+#include <string>
+
+// number of packets serialized per measured run, and the number of distinct packets which are cycled through. the
+// large packet count is only serialized if the large system tests are enabled
+static const u64 large_benchmark_packet_count = 1000000;
+static const u64 small_benchmark_packet_count = 20000;
+static u64 benchmark_packet_count = 0;
+static const size_t benchmark_distinct_packets = 1024;
+
+static void print_result( const char *path_name, u64 total_size, double seconds )
+	{
+	const double mb = 1024.0 * 1024.0;
+	printf( "    %-24s %7.3f s, %10.0f packets/s, %8.2f MB/s\n", path_name, seconds, benchmark_packet_count / seconds, (total_size / mb) / seconds );
+	}
+
+static void serialize_node_packets( PacketSerializer &serializer, const std::vector<EntityPacket<Node>> &packets, bool flip_byte_order )
+	{
+	MemoryWriteStream ws;
+	ws.SetFlipByteOrder( flip_byte_order );
+
+	// write the packets after each other into one stream
+		{
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for( u64 i = 0; i < benchmark_packet_count; ++i )
+			{
+			TEST_ASSERT( serializer.ToMemoryStream( &packets[i % packets.size()], ws ) == Status::Ok );
+			}
+		auto t1 = std::chrono::high_resolution_clock::now();
+		print_result( "ToMemoryStream", ws.GetSize(), std::chrono::duration<double>( t1 - t0 ).count() );
+		}
+
+	// read them back, and check the ids
+		{
+		MemoryReadStream rs( ws.GetData(), ws.GetSize() );
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for( u64 i = 0; i < benchmark_packet_count; ++i )
+			{
+			std::pair<Packet *, Status> ret = serializer.FromMemoryStream( rs );
+			TEST_ASSERT( ret.second == Status::Ok );
+			TEST_ASSERT( ret.first->EntityId == packets[i % packets.size()].EntityId );
+			delete ret.first;
+			}
+		auto t1 = std::chrono::high_resolution_clock::now();
+		TEST_ASSERT( rs.IsEOF() );
+		print_result( "FromMemoryStream", ws.GetSize(), std::chrono::duration<double>( t1 - t0 ).count() );
+		}
+
+	printf( "    (%d bytes per packet)\n", (int)( ws.GetSize() / benchmark_packet_count ) );
+	}
+
+void packet_serializer_benchmark()
+	{
+	benchmark_packet_count = large_system_tests ? large_benchmark_packet_count : small_benchmark_packet_count;
+
+	PacketTypeRegistry registry;
+	register_entity_packet_types( registry );
+	PacketSerializer serializer( registry );
+
+	// small entities, nodes with a short name and a transform
+	std::vector<EntityPacket<Node>> packets( benchmark_distinct_packets );
+	for( size_t i = 0; i < packets.size(); ++i )
+		{
+		packets[i].EntityId = random_value<UUID>();
+		packets[i].Entity.Name() = "node_" + std::to_string( i );
+		packets[i].Entity.Translation() = fvec3( (float)i, (float)( i + 1 ), (float)( i + 2 ) );
+		packets[i].Entity.Scale() = fvec3( 1.f, 1.f, 1.f );
+		}
+
+	printf( "  Serializing %d Node packets\n", (int)benchmark_packet_count );
+	serialize_node_packets( serializer, packets, false );
+
+	printf( "  Serializing %d Node packets, flipped byte order\n", (int)benchmark_packet_count );
+	serialize_node_packets( serializer, packets, true );
+	}
@@ -1,78 +1,179 @@
 
 #include "SystemTests.h"
 
+#include <atomic>
+#include <chrono>
+#include <thread>
 
-class uint_string_map_test_class
+// the original implementation, one std::map behind one mutex, used as the reference in the benchmark
+template<class _Kty, class _Ty> class single_mutex_map
 	{
-	thread_safe_map<uint, std::string> *object = nullptr;
-	uint index = 0;
-	static const uint num_iters = 10000;
-	bool done = false;
+	private:
+		std::map<_Kty, _Ty> Data;
+		std::mutex AccessMutex;
 
 	public:
-		static void uint_string_map_test_thread( void * ptr )
+		std::pair<_Ty, bool> find( const _Kty &key )
 			{
-			std::vector<uint> list(num_iters);
-			uint_string_map_test_class *pthis = (uint_string_map_test_class *)ptr;
-
-			// insert values into list
-			for( uint i = 0; i < num_iters; ++i )
-				{
-				list[i] = rand() << 16 | pthis->index;
-				char num[20];
-				sprintf_s( num, "%d", list[i] );
-				std::string str = num;
-				pthis->object->insert( std::pair<uint,std::string>(list[i],str));
-				}
-
-			// make sure that the values exist, (do random lookup)
-			for( uint i = 0; i < num_iters; ++i )
-				{
-				uint look_for = rand() % num_iters;
-				char num[20];
-				sprintf_s( num, "%d", list[look_for] );
-				std::string str = num;
-				auto val = pthis->object->find( list[look_for] );
-				TEST_ASSERT( val.second ); // make sure we found it
-				TEST_ASSERT( str == val.first );
-				}
-
-			// erase all values
-			for( uint i = 0; i < num_iters; ++i )
+			std::lock_guard<std::mutex> guard( this->AccessMutex );
+			auto it = this->Data.find( key );
+			if( it != this->Data.end() )
 				{
-				pthis->object->erase( list[i] );
+				return std::make_pair( it->second, true );
 				}
-
-			pthis->done = true;
+			return std::make_pair( _Ty(), false );
 			}
 
-		HANDLE run( uint _index , thread_safe_map<uint, std::string> *_object )
+		bool insert( const std::pair<const _Kty, _Ty> &value )
 			{
-			this->done = false;
-			this->index = _index;
-			this->object = _object;
-			return (HANDLE)_beginthread( &uint_string_map_test_thread, 0, (void *)this );
+			std::lock_guard<std::mutex> guard( this->AccessMutex );
+			return this->Data.insert( value ).second;
 			}
 
-		bool is_done() const
+		size_t erase( const _Kty &key )
 			{
-			return this->done;
+			std::lock_guard<std::mutex> guard( this->AccessMutex );
+			return this->Data.erase( key );
 			}
 	};
 
+static const uint num_iters = 10000;
+
+// insert, find and erase values which are unique to the thread, and check that the map is consistent
+static void uint_string_map_test_thread( thread_safe_map<uint, std::string> *object, uint index )
+	{
+	std::vector<uint> list( num_iters );
+
+	// insert values into list
+	for( uint i = 0; i < num_iters; ++i )
+		{
+		list[i] = i << 8 | index;
+		TEST_ASSERT( object->insert( std::pair<uint, std::string>( list[i], std::to_string( list[i] ) ) ) );
+		}
+
+	// make sure that the values exist, (do random lookup)
+	for( uint i = 0; i < num_iters; ++i )
+		{
+		uint look_for = rand() % num_iters;
+		auto val = object->find( list[look_for] );
+		TEST_ASSERT( val.second ); // make sure we found it
+		TEST_ASSERT( std::to_string( list[look_for] ) == val.first );
+
+		// find_or_insert must find the existing value, and not replace it
+		auto found = object->find_or_insert( std::pair<uint, std::string>( list[look_for], "replaced" ) );
+		TEST_ASSERT( !found.second );
+		TEST_ASSERT( std::to_string( list[look_for] ) == found.first );
+		}
+
+	// erase all values
+	for( uint i = 0; i < num_iters; ++i )
+		{
+		TEST_ASSERT( object->erase( list[i] ) == 1 );
+		}
+
+	// find_or_insert must insert missing values
+	for( uint i = 0; i < num_iters; ++i )
+		{
+		auto inserted = object->find_or_insert( std::pair<uint, std::string>( list[i], "inserted" ) );
+		TEST_ASSERT( inserted.second );
+		TEST_ASSERT( inserted.first == "inserted" );
+		TEST_ASSERT( object->erase( list[i] ) == 1 );
+		}
+	}
+
+// the uuid of a benchmark key
+static UUID benchmark_uuid( uint index )
+	{
+	UUID uuid = {};
+	uuid.Data1 = index * 2654435761u;
+	uuid.Data2 = (u16)index;
+	uuid.Data3 = 0x4000;
+	return uuid;
+	}
+
+// run a loader-like mix of operations on the map: mostly lookups of loaded entities,
+// with inserts and erases of entities which are in flight. returns the number of operations per second
+template<class _Map> static double run_map_benchmark( uint thread_count )
+	{
+	static const uint key_count = 1 << 16;
+	static const uint ops_per_thread = 1 << 18;
+
+	_Map map;
+	for( uint i = 0; i < key_count; ++i )
+		{
+		map.insert( std::pair<const UUID, uint>( benchmark_uuid( i ), i ) );
+		}
+
+	std::atomic<uint> threads_ready( 0 );
+	std::atomic<bool> start( false );
+	std::vector<std::thread> threads;
+	for( uint t = 0; t < thread_count; ++t )
+		{
+		threads.emplace_back( [&map, &threads_ready, &start, t]()
+			{
+			++threads_ready;
+			while( !start.load() )
+				{
+				std::this_thread::yield();
+				}
+
+			uint random = 0x12345 + t * 0x9e3779b9u;
+			for( uint i = 0; i < ops_per_thread; ++i )
+				{
+				random = random * 1664525u + 1013904223u;
+				const uint op = ( random >> 24 ) & 0xf;
+				if( op == 0 )
+					{
+					// in flight keys are unique to each thread
+					map.insert( std::pair<const UUID, uint>( benchmark_uuid( key_count + t * ops_per_thread + i ), i ) );
+					}
+				else if( op == 1 && i > 0 )
+					{
+					map.erase( benchmark_uuid( key_count + t * ops_per_thread + i - 1 ) );
+					}
+				else
+					{
+					map.find( benchmark_uuid( random % key_count ) );
+					}
+				}
+			} );
+		}
+	while( threads_ready.load() < thread_count )
+		{
+		std::this_thread::yield();
+		}
+
+	auto t0 = std::chrono::high_resolution_clock::now();
+	start = true;
+	for( std::thread &thread : threads )
+		{
+		thread.join();
+		}
+	auto t1 = std::chrono::high_resolution_clock::now();
+
+	return ( (double)ops_per_thread * thread_count ) / std::chrono::duration<double>( t1 - t0 ).count();
+	}
+
 void safe_thread_map_test()
 	{
+	// correctness, with many threads accessing the map at the same time
 	thread_safe_map<uint, std::string> uint_string_map;
-	std::vector<uint_string_map_test_class> test_objects( MAXIMUM_WAIT_OBJECTS );
-	std::vector<HANDLE> thread_handles( test_objects.size() );
-	for( size_t i = 0; i < test_objects.size(); ++i )
+	std::vector<std::thread> threads;
+	for( uint i = 0; i < 64; ++i )
 		{
-		thread_handles[i] = test_objects[i].run( (uint)i, &uint_string_map );
+		threads.emplace_back( uint_string_map_test_thread, &uint_string_map, i );
 		}
-	DWORD val = WaitForMultipleObjects( (uint)thread_handles.size(), thread_handles.data(), TRUE, INFINITE );
-	TEST_ASSERT( val == 0 );
-	for( size_t i = 0; i < test_objects.size(); ++i )
+	for( std::thread &thread : threads )
+		{
+		thread.join();
+		}
+
+	// contention benchmark, compared to a single mutex map
+	printf( "    threads    single mutex map (Mops/s)    thread_safe_map (Mops/s)\n" );
+	for( uint thread_count = 1; thread_count <= 64; thread_count *= 2 )
 		{
-		TEST_ASSERT( test_objects[i].is_done() );
+		const double single_mutex_ops = run_map_benchmark<single_mutex_map<UUID, uint>>( thread_count );
+		const double sharded_ops = run_map_benchmark<thread_safe_map<UUID, uint>>( thread_count );
+		printf( "    %7d    %25.2f    %24.2f\n", (int)thread_count, single_mutex_ops / 1e6, sharded_ops / 1e6 );
 		}
 	}
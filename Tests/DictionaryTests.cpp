@@ -13,6 +13,8 @@ using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 #include "..\ISD\ISD_EntityReader.h"
 #include "..\ISD\ISD_EntityTable.h"
 #include "..\ISD\ISD_EntityValidator.h"
+#include "..\ISD\ISD_Mesh.h"
+#include "..\ISD\ISD_Node.h"
 
 #include "..\TestHelpers\structure_generation.h"
 
@@ -259,5 +261,157 @@ namespace BasicEntitiesTests
 				}
 			}
 
+		typedef EntityTable<u64, ISD::Mesh> MeshDict;
+
+		// create a dictionary of meshes, which have lazy sections, and sections arrays of their own
+		static void GenerateRandomMeshDictionary( MeshDict &dest_dict )
+			{
+			for( uint i = 0; i < 20; ++i )
+				{
+				std::unique_ptr<ISD::Mesh> mesh = std::make_unique<ISD::Mesh>();
+				random_idx_vector<fvec3>( mesh->NormalsData().Insert( entity_ref::make_ref() ), 10, 100 );
+				random_idx_vector<fvec2>( mesh->TextureCoordsData().Insert( entity_ref::make_ref() ), 10, 100 );
+				dest_dict.Entries()[random_value<u64>()] = std::move( mesh );
+				}
+			}
+
+		// write the dictionary serially, with the settings of the pass, and check that the data is identical when written in parallel
+		template<class Dict> void DictionaryParallelTests_Write( const Dict &dict, uint pass_index, MemoryWriteStream &ws )
+			{
+			ws.SetFlipByteOrder( (pass_index & 0x1) != 0 );
+			EntityWriter ew( ws );
+			ew.SetWriteDirectory( (pass_index & 0x2) != 0 );
+			Assert::IsTrue( Dict::MF::Write( dict, ew ) );
+
+			for( uint thread_count = 2; thread_count <= 8; thread_count *= 2 )
+				{
+				MemoryWriteStream parallel_ws;
+				parallel_ws.SetFlipByteOrder( ws.GetFlipByteOrder() );
+				EntityWriter parallel_ew( parallel_ws );
+				parallel_ew.SetWriteDirectory( ew.GetWriteDirectory() );
+				parallel_ew.SetParallelThreadCount( thread_count );
+				Assert::IsTrue( Dict::MF::Write( dict, parallel_ew ) );
+				Assert::IsTrue( parallel_ws.GetSize() == ws.GetSize() );
+				Assert::IsTrue( memcmp( parallel_ws.GetData(), ws.GetData(), ws.GetSize() ) == 0 );
+				}
+			}
+
+		TEST_METHOD( DictionaryParallelWriteTests )
+			{
+			setup_random_seed();
+
+			typedef EntityTable<u64, TestEntity> Dict;
+			Dict random_dict;
+			GenerateRandomDictionary<Dict>( random_dict, 100, 1000 );
+
+			// the meshes have sections arrays of their own, which are written in parallel as well
+			MeshDict mesh_dict;
+			GenerateRandomMeshDictionary( mesh_dict );
+
+			for( uint pass_index=0; pass_index<4; ++pass_index )
+				{
+				MemoryWriteStream ws;
+				DictionaryParallelTests_Write( random_dict, pass_index, ws );
+				MemoryWriteStream mesh_ws;
+				DictionaryParallelTests_Write( mesh_dict, pass_index, mesh_ws );
+				}
+
+			// an exception thrown while writing a section on any thread is rethrown on the calling thread
+			MemoryWriteStream ws;
+			EntityWriter ew( ws );
+			ew.SetParallelThreadCount( 4 );
+			EntityWriter *sections_writer = ew.BeginWriteSectionsArray( "Sections", 8, 16 );
+			Assert::IsTrue( sections_writer != nullptr );
+			Assert::ExpectException<std::bad_alloc>( [&]()
+				{
+				ew.WriteSectionsInArray( sections_writer, 16, []( const void *, size_t section_index, EntityWriter & ) -> bool
+					{
+					if( section_index == 11 )
+						throw std::bad_alloc();
+					return true;
+					}, nullptr );
+				} );
+			}
+
+		// read the dictionary on thread_count threads, with lazy reading, from a stream which is set as the owner of the data
+		template<class Dict> bool DictionaryParallelTests_Read( Dict &dest_dict, const std::shared_ptr<std::vector<u8>> &data, bool flip_byte_order, uint thread_count, bool tolerant_reading )
+			{
+			MemoryReadStream rs( data->data(), data->size(), flip_byte_order );
+			rs.SetDataOwner( data );
+			EntityReader er( rs );
+			er.SetParallelThreadCount( thread_count );
+			er.SetTolerantReading( tolerant_reading );
+			er.SetLazyReading( true );
+			if( !Dict::MF::Read( dest_dict, er ) )
+				return false;
+			return rs.IsEOF();
+			}
+
+		TEST_METHOD( DictionaryParallelReadTests )
+			{
+			setup_random_seed();
+
+			typedef EntityTable<u64, TestEntity> Dict;
+			Dict random_dict;
+			GenerateRandomDictionary<Dict>( random_dict, 100, 1000 );
+
+			MeshDict mesh_dict;
+			GenerateRandomMeshDictionary( mesh_dict );
+
+			// a newer version of the entities, with values which TestEntity does not know about
+			typedef EntityTable<u64, ISD::Node> NodeDict;
+			NodeDict node_dict;
+			for( uint i = 0; i < 100; ++i )
+				{
+				std::unique_ptr<ISD::Node> node = std::make_unique<ISD::Node>();
+				node->Name() = random_value<string>();
+				node->Translation() = random_value<fvec3>();
+				node_dict.Entries()[random_value<u64>()] = std::move( node );
+				}
+
+			for( uint pass_index=0; pass_index<4; ++pass_index )
+				{
+				MemoryWriteStream ws;
+				DictionaryParallelTests_Write( random_dict, pass_index, ws );
+				MemoryWriteStream mesh_ws;
+				DictionaryParallelTests_Write( mesh_dict, pass_index, mesh_ws );
+				MemoryWriteStream node_ws;
+				DictionaryParallelTests_Write( node_dict, pass_index, node_ws );
+
+				for( uint thread_count = 2; thread_count <= 8; thread_count *= 2 )
+					{
+					std::shared_ptr<std::vector<u8>> data = std::make_shared<std::vector<u8>>( (const u8 *)ws.GetData(), (const u8 *)ws.GetData() + ws.GetSize() );
+					Dict readback_dict;
+					Assert::IsTrue( DictionaryParallelTests_Read( readback_dict, data, ws.GetFlipByteOrder(), thread_count, false ) );
+					Assert::IsTrue( readback_dict == random_dict );
+
+					// the lazy sections of the meshes reference the data, and keep it alive until they are read
+					data = std::make_shared<std::vector<u8>>( (const u8 *)mesh_ws.GetData(), (const u8 *)mesh_ws.GetData() + mesh_ws.GetSize() );
+					MeshDict readback_mesh_dict;
+					Assert::IsTrue( DictionaryParallelTests_Read( readback_mesh_dict, data, mesh_ws.GetFlipByteOrder(), thread_count, false ) );
+					std::weak_ptr<std::vector<u8>> weak_data = data;
+					data.reset();
+					Assert::IsFalse( weak_data.expired() );
+					Assert::IsTrue( readback_mesh_dict == mesh_dict );
+					Assert::IsTrue( weak_data.expired() );
+
+					// the nodes can only be read as TestEntities by a tolerant reader, which skips the unknown values in each section
+					data = std::make_shared<std::vector<u8>>( (const u8 *)node_ws.GetData(), (const u8 *)node_ws.GetData() + node_ws.GetSize() );
+					Dict readback_node_dict;
+					Assert::IsFalse( DictionaryParallelTests_Read( readback_node_dict, data, node_ws.GetFlipByteOrder(), thread_count, false ) );
+					readback_node_dict.Entries().clear();
+					Assert::IsTrue( DictionaryParallelTests_Read( readback_node_dict, data, node_ws.GetFlipByteOrder(), thread_count, true ) );
+					Assert::IsTrue( readback_node_dict.Entries().size() == node_dict.Entries().size() );
+					for( const auto &entry : node_dict.Entries() )
+						{
+						auto it = readback_node_dict.Entries().find( entry.first );
+						Assert::IsTrue( it != readback_node_dict.Entries().end() && it->second != nullptr );
+						Assert::IsTrue( it->second->Name() == entry.second->Name() );
+						Assert::IsTrue( !it->second->OptionalText().has_value() );
+						}
+					}
+				}
+			}
+
 		};
 	}
@@ -11,6 +11,7 @@ using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 #include "..\ISD\ISD_MemoryWriteStream.h"
 #include "..\ISD\ISD_EntityWriter.h"
 #include "..\ISD\ISD_EntityReader.h"
+#include "..\ISD\ISD_EntityDependencies.h"
 
 namespace TestEntityTests
 	{
@@ -213,5 +214,416 @@ namespace TestEntityTests
 				}
 			}
 
+		TEST_METHOD( TestEntityReaderViews )
+			{
+			for( uint pass_index=0; pass_index<(2*global_number_of_passes); ++pass_index )
+				{
+				MemoryWriteStream ws;
+				EntityWriter ew( ws );
+
+				ws.SetFlipByteOrder( (pass_index & 0x1) != 0 );
+
+				std::vector<fvec3> value_vec;
+				random_vector<fvec3>( value_vec, 10, 100 );
+				idx_vector<u32> value_inxarr;
+				random_idx_vector<u32>( value_inxarr, 10, 100 );
+
+				// use 4 character keys, so the payloads are 4-byte aligned in the stream
+				Assert::IsTrue( ew.Write( "Vrts", 4, value_vec ) );
+				Assert::IsTrue( ew.Write( "Inds", 4, value_inxarr ) );
+
+				// copy to an allocation, which is at least 4-byte aligned
+				std::vector<u8> memdata( ws.GetSize() );
+				memcpy( memdata.data(), ws.GetData(), ws.GetSize() );
+				MemoryReadStream rs( memdata.data(), memdata.size(), ws.GetFlipByteOrder() );
+				EntityReader er( rs );
+
+				array_view<fvec3> value_vec_view;
+				idx_array_view<u32> value_inxarr_view;
+				if( rs.GetFlipByteOrder() )
+					{
+					// views are not possible, make sure the stream is not moved, and fall back to reading
+					Assert::IsFalse( er.ReadView( "Vrts", 4, value_vec_view ) );
+					Assert::IsTrue( rs.GetPosition() == 0 );
+					std::vector<fvec3> read_back_value_vec;
+					Assert::IsTrue( er.Read( "Vrts", 4, read_back_value_vec ) );
+					Assert::IsTrue( value_vec == read_back_value_vec );
+					}
+				else
+					{
+					// views must point into the stream data, and have the same values
+					Assert::IsTrue( er.ReadView( "Vrts", 4, value_vec_view ) );
+					Assert::IsTrue( (const u8*)value_vec_view.data() >= memdata.data() && (const u8*)value_vec_view.data() < memdata.data() + memdata.size() );
+					Assert::IsTrue( value_vec_view.size() == value_vec.size() );
+					Assert::IsTrue( std::equal( value_vec_view.begin(), value_vec_view.end(), value_vec.begin() ) );
+
+					Assert::IsTrue( er.ReadView( "Inds", 4, value_inxarr_view ) );
+					Assert::IsTrue( value_inxarr_view.values().size() == value_inxarr.values().size() );
+					Assert::IsTrue( value_inxarr_view.index().size() == value_inxarr.index().size() );
+					Assert::IsTrue( std::equal( value_inxarr_view.values().begin(), value_inxarr_view.values().end(), value_inxarr.values().begin() ) );
+					Assert::IsTrue( std::equal( value_inxarr_view.index().begin(), value_inxarr_view.index().end(), value_inxarr.index().begin() ) );
+					}
+				}
+			}
+
+		TEST_METHOD( TestEntityWriterArrayPayloadAlignment )
+			{
+			const u8 alignments[] = { 16, 64 };
+			for( uint pass_index=0; pass_index<global_number_of_passes; ++pass_index )
+				{
+				for( u8 alignment : alignments )
+					{
+					MemoryWriteStream ws;
+					EntityWriter ew( ws );
+					Assert::IsFalse( ew.SetArrayPayloadAlignment( 24 ) );
+					Assert::IsTrue( ew.SetArrayPayloadAlignment( alignment ) );
+
+					// write some values first, so the arrays start at arbitrary positions
+					std::vector<u8> prefix_vec;
+					random_vector<u8>( prefix_vec, 0, 100 );
+					Assert::IsTrue( ew.Write( "Prefix", 6, prefix_vec ) );
+
+					std::vector<fvec3> value_vec;
+					random_vector<fvec3>( value_vec, 10, 100 );
+					idx_vector<u32> value_inxarr;
+					random_idx_vector<u32>( value_inxarr, 10, 100 );
+
+					// use keys of odd lengths, the padding must align the payloads anyway
+					Assert::IsTrue( ew.Write( "Vertices1", 9, value_vec ) );
+					Assert::IsTrue( ew.Write( "Ind", 3, value_inxarr ) );
+
+					// copy to a buffer which is aligned to the max alignment
+					std::vector<u8> memdata( ws.GetSize() + 64 );
+					u8 *aligned_data = (u8*)( ((uintptr_t)memdata.data() + 63) & ~((uintptr_t)63) );
+					memcpy( aligned_data, ws.GetData(), ws.GetSize() );
+					MemoryReadStream rs( aligned_data, ws.GetSize(), ws.GetFlipByteOrder() );
+					EntityReader er( rs );
+
+					std::vector<u8> read_back_prefix_vec;
+					Assert::IsTrue( er.Read( "Prefix", 6, read_back_prefix_vec ) );
+					Assert::IsTrue( prefix_vec == read_back_prefix_vec );
+
+					// the view must be aligned, relative to the start of the stream
+					array_view<fvec3> value_vec_view;
+					Assert::IsTrue( er.ReadView( "Vertices1", 9, value_vec_view ) );
+					Assert::IsTrue( (((const u8*)value_vec_view.data() - aligned_data) % alignment) == 0 );
+					Assert::IsTrue( value_vec_view.size() == value_vec.size() );
+					Assert::IsTrue( std::equal( value_vec_view.begin(), value_vec_view.end(), value_vec.begin() ) );
+
+					// the padded indexed array must read back as normal
+					idx_vector<u32> read_back_value_inxarr;
+					Assert::IsTrue( er.Read( "Ind", 3, read_back_value_inxarr ) );
+					Assert::IsTrue( value_inxarr == read_back_value_inxarr );
+					Assert::IsTrue( rs.GetPosition() == rs.GetSize() );
+					}
+				}
+			}
+
+		TEST_METHOD( TestEntityWriterDirectory )
+			{
+			for( uint pass_index=0; pass_index<(2*global_number_of_passes); ++pass_index )
+				{
+				MemoryWriteStream ws;
+				EntityWriter ew( ws );
+				ws.SetFlipByteOrder( (pass_index & 0x1) != 0 );
+				ew.SetWriteDirectory( true );
+
+				const u32 first_value = random_value<u32>();
+				const std::string name = random_value<std::string>();
+				std::vector<fvec3> value_vec;
+				random_vector<fvec3>( value_vec, 10, 100 );
+				const u64 sub_value = random_value<u64>();
+				const u64 item_value = random_value<u64>();
+				const u32 last_value = random_value<u32>();
+
+				Assert::IsTrue( ew.Write<u32>( "First", 5, first_value ) );
+				Assert::IsTrue( ew.Write<std::string>( "Name", 4, name ) );
+				Assert::IsTrue( ew.Write<std::vector<fvec3>>( "Vec", 3, value_vec ) );
+				EntityWriter *sub = ew.BeginWriteSection( "Sub", 3 );
+				Assert::IsTrue( sub != nullptr );
+				Assert::IsTrue( sub->Write<u32>( "A", 1, first_value ) );
+				Assert::IsTrue( sub->Write<u64>( "B", 1, sub_value ) );
+				Assert::IsTrue( ew.EndWriteSection( sub ) );
+				EntityWriter *arr = ew.BeginWriteSectionsArray( "Arr", 3, 2 );
+				Assert::IsTrue( arr != nullptr );
+				Assert::IsTrue( ew.BeginWriteSectionInArray( arr, 0 ) );
+				Assert::IsTrue( ew.EndWriteSectionInArray( arr, 0 ) );
+				Assert::IsTrue( ew.BeginWriteSectionInArray( arr, 1 ) );
+				Assert::IsTrue( arr->Write<u32>( "A", 1, first_value ) );
+				Assert::IsTrue( arr->Write<u64>( "B", 1, item_value ) );
+				Assert::IsTrue( ew.EndWriteSectionInArray( arr, 1 ) );
+				Assert::IsTrue( ew.EndWriteSectionsArray( arr ) );
+				Assert::IsTrue( ew.Write<u32>( "Last", 4, last_value ) );
+				Assert::IsTrue( ew.WriteDirectory() );
+
+				// a sequential read must skip over the directories
+				u32 read_back_u32;
+				u64 read_back_u64;
+				std::string read_back_name;
+				std::vector<fvec3> read_back_value_vec;
+					{
+					MemoryReadStream rs( ws.GetData(), ws.GetSize(), ws.GetFlipByteOrder() );
+					EntityReader er( rs );
+					Assert::IsTrue( er.Read( "First", 5, read_back_u32 ) && read_back_u32 == first_value );
+					Assert::IsTrue( er.Read( "Name", 4, read_back_name ) && read_back_name == name );
+					Assert::IsTrue( er.Read( "Vec", 3, read_back_value_vec ) && read_back_value_vec == value_vec );
+					EntityReader *sub_reader = nullptr;
+					bool success = false;
+					std::tie( sub_reader, success ) = er.BeginReadSection( "Sub", 3, false );
+					Assert::IsTrue( sub_reader != nullptr && success );
+					Assert::IsTrue( sub_reader->Read( "A", 1, read_back_u32 ) && read_back_u32 == first_value );
+					Assert::IsTrue( sub_reader->Read( "B", 1, read_back_u64 ) && read_back_u64 == sub_value );
+					Assert::IsTrue( er.EndReadSection( sub_reader ) );
+					size_t item_count = 0;
+					std::tie( sub_reader, item_count, success ) = er.BeginReadSectionsArray( "Arr", 3, false );
+					Assert::IsTrue( sub_reader != nullptr && success && item_count == 2 );
+					bool has_item = false;
+					Assert::IsTrue( er.BeginReadSectionInArray( sub_reader, 0, &has_item ) && !has_item );
+					Assert::IsTrue( er.EndReadSectionInArray( sub_reader, 0 ) );
+					Assert::IsTrue( er.BeginReadSectionInArray( sub_reader, 1, &has_item ) && has_item );
+					Assert::IsTrue( sub_reader->Read( "A", 1, read_back_u32 ) && read_back_u32 == first_value );
+					Assert::IsTrue( sub_reader->Read( "B", 1, read_back_u64 ) && read_back_u64 == item_value );
+					Assert::IsTrue( er.EndReadSectionInArray( sub_reader, 1 ) );
+					Assert::IsTrue( er.EndReadSectionsArray( sub_reader ) );
+					Assert::IsTrue( er.Read( "Last", 4, read_back_u32 ) && read_back_u32 == last_value );
+					}
+
+				// read by key, out of order. missing keys must not move the stream
+				MemoryReadStream rs( ws.GetData(), ws.GetSize(), ws.GetFlipByteOrder() );
+				EntityReader er( rs );
+				Assert::IsFalse( er.Seek( "Missing", 7 ) );
+				Assert::IsTrue( rs.GetPosition() == 0 );
+				Assert::IsTrue( er.ReadByKey( "Last", 4, read_back_u32 ) && read_back_u32 == last_value );
+				Assert::IsTrue( er.ReadByKey( "Vec", 3, read_back_value_vec ) && read_back_value_vec == value_vec );
+				Assert::IsTrue( er.Seek( "Sub", 3 ) );
+				EntityReader *sub_reader = nullptr;
+				bool success = false;
+				std::tie( sub_reader, success ) = er.BeginReadSection( "Sub", 3, false );
+				Assert::IsTrue( sub_reader != nullptr && success );
+				Assert::IsTrue( sub_reader->ReadByKey( "B", 1, read_back_u64 ) && read_back_u64 == sub_value );
+				Assert::IsTrue( er.EndReadSection( sub_reader ) );
+				Assert::IsTrue( er.Seek( "Arr", 3 ) );
+				size_t item_count = 0;
+				std::tie( sub_reader, item_count, success ) = er.BeginReadSectionsArray( "Arr", 3, false );
+				Assert::IsTrue( sub_reader != nullptr && success && item_count == 2 );
+				bool has_item = false;
+				Assert::IsTrue( er.BeginReadSectionInArray( sub_reader, 0, &has_item ) && !has_item );
+				Assert::IsFalse( sub_reader->Seek( "A", 1 ) );
+				Assert::IsTrue( er.EndReadSectionInArray( sub_reader, 0 ) );
+				Assert::IsTrue( er.BeginReadSectionInArray( sub_reader, 1, &has_item ) && has_item );
+				Assert::IsTrue( sub_reader->ReadByKey( "B", 1, read_back_u64 ) && read_back_u64 == item_value );
+				Assert::IsTrue( er.EndReadSectionInArray( sub_reader, 1 ) );
+				Assert::IsTrue( er.EndReadSectionsArray( sub_reader ) );
+				Assert::IsTrue( er.ReadByKey( "Name", 4, read_back_name ) && read_back_name == name );
+				Assert::IsTrue( er.ReadByKey( "First", 5, read_back_u32 ) && read_back_u32 == first_value );
+				}
+			}
+
+		TEST_METHOD( TestEntityReaderSeekHashCollision )
+			{
+			MemoryWriteStream ws;
+			EntityWriter ew( ws );
+			ew.SetWriteDirectory( true );
+			const u32 a_value = random_value<u32>();
+			const u64 b_value = random_value<u64>();
+			const std::string name = random_value<std::string>();
+			Assert::IsTrue( ew.Write<u32>( "A", 1, a_value ) );
+			Assert::IsTrue( ew.Write<u64>( "B", 1, b_value ) );
+			Assert::IsTrue( ew.Write<std::string>( "Name", 4, name ) );
+			Assert::IsTrue( ew.WriteDirectory() );
+
+			// find the entries of the directory, which are at the end of the stream, after the block header and the entry count
+			std::vector<u8> data( (const u8 *)ws.GetData(), (const u8 *)ws.GetData() + ws.GetSize() );
+			u64 directory_size = 0;
+			memcpy( &directory_size, &data[data.size() - sizeof( u64 ) * 2], sizeof( u64 ) );
+			const size_t entries_pos = (size_t)( data.size() - directory_size ) + 10 + sizeof( u64 );
+			std::vector<std::pair<u64, u64>> entries( 3 );
+			memcpy( entries.data(), &data[entries_pos], sizeof( u64 ) * 2 * entries.size() );
+
+			// give the entry of B the hash of A, and sort it before the entry of A, so the first entry with the hash of A is B
+			const u64 a_hash = directory_key_hash( "A", 1 );
+			const u64 b_hash = directory_key_hash( "B", 1 );
+			for( auto &entry : entries )
+				{
+				if( entry.first == b_hash )
+					entry.first = a_hash - 1;
+				}
+			std::sort( entries.begin(), entries.end() );
+			for( auto &entry : entries )
+				{
+				if( entry.first == a_hash - 1 )
+					entry.first = a_hash;
+				}
+			memcpy( &data[entries_pos], entries.data(), sizeof( u64 ) * 2 * entries.size() );
+
+			// the seek must skip the entry of B, which has the same hash but another key
+			u32 read_back_u32 = 0;
+			u64 read_back_u64 = 0;
+			std::string read_back_name;
+			MemoryReadStream rs( data.data(), data.size(), false );
+			EntityReader er( rs );
+			Assert::IsTrue( er.ReadByKey( "Name", 4, read_back_name ) && read_back_name == name );
+			Assert::IsTrue( er.ReadByKey( "A", 1, read_back_u32 ) && read_back_u32 == a_value );
+			Assert::IsFalse( er.Seek( "B", 1 ) );
+			Assert::IsFalse( er.Seek( "C", 1 ) );
+			Assert::IsTrue( er.Read( "B", 1, read_back_u64 ) && read_back_u64 == b_value );
+			}
+
+		TEST_METHOD( TestEntityReaderTolerantReading )
+			{
+			for( uint pass_index=0; pass_index<(2*global_number_of_passes); ++pass_index )
+				{
+				// write a newer version of a section, with values which the reader does not know about
+				MemoryWriteStream ws;
+				EntityWriter ew( ws );
+				ws.SetFlipByteOrder( (pass_index & 0x1) != 0 );
+				ew.SetWriteDirectory( (pass_index & 0x2) != 0 );
+
+				const u32 first_value = random_value<u32>();
+				const std::string name = random_value<std::string>();
+				std::vector<fvec3> value_vec;
+				random_vector<fvec3>( value_vec, 10, 100 );
+				const u64 sub_value = random_value<u64>();
+				const u32 last_value = random_value<u32>();
+
+				Assert::IsTrue( ew.Write<u32>( "First", 5, first_value ) );
+				Assert::IsTrue( ew.Write<u64>( "NewValue", 8, sub_value ) );
+				Assert::IsTrue( ew.Write<u32>( "AB", 2, last_value ) );
+				Assert::IsTrue( ew.Write<u32>( "B", 1, first_value ) );
+				Assert::IsTrue( ew.Write<std::string>( "Name", 4, name ) );
+				Assert::IsTrue( ew.Write<std::vector<fvec3>>( "NewVec", 6, value_vec ) );
+				EntityWriter *sub = ew.BeginWriteSection( "Sub", 3 );
+				Assert::IsTrue( sub != nullptr );
+				Assert::IsTrue( sub->Write<u64>( "A", 1, sub_value ) );
+				Assert::IsTrue( sub->Write<std::string>( "NewName", 7, name ) );
+				Assert::IsTrue( ew.EndWriteSection( sub ) );
+				sub = ew.BeginWriteSection( "NewSub", 6 );
+				Assert::IsTrue( sub != nullptr );
+				Assert::IsTrue( sub->Write<u64>( "A", 1, sub_value ) );
+				Assert::IsTrue( ew.EndWriteSection( sub ) );
+				EntityWriter *arr = ew.BeginWriteSectionsArray( "Arr", 3, 2 );
+				Assert::IsTrue( arr != nullptr );
+				for( size_t item_index = 0; item_index < 2; ++item_index )
+					{
+					Assert::IsTrue( ew.BeginWriteSectionInArray( arr, item_index ) );
+					Assert::IsTrue( arr->Write<u64>( "A", 1, sub_value + item_index ) );
+					Assert::IsTrue( arr->Write<u32>( "NewValue", 8, first_value ) );
+					Assert::IsTrue( ew.EndWriteSectionInArray( arr, item_index ) );
+					}
+				Assert::IsTrue( ew.EndWriteSectionsArray( arr ) );
+				Assert::IsTrue( ew.Write<u32>( "Last", 4, last_value ) );
+				Assert::IsTrue( ew.Write<std::string>( "NewLast", 7, name ) );
+				Assert::IsTrue( ew.WriteDirectory() );
+
+				u32 read_back_u32;
+				u64 read_back_u64;
+				std::string read_back_name;
+				optional_value<u32> read_back_opt_u32;
+
+				// a strict reader fails on the unknown values
+					{
+					MemoryReadStream rs( ws.GetData(), ws.GetSize(), ws.GetFlipByteOrder() );
+					EntityReader er( rs );
+					Assert::IsTrue( er.Read( "First", 5, read_back_u32 ) && read_back_u32 == first_value );
+					Assert::IsFalse( er.Read( "B", 1, read_back_u32 ) );
+					}
+
+				// a tolerant reader skips over the unknown values, and reads missing optional values and sections as empty
+				MemoryReadStream rs( ws.GetData(), ws.GetSize(), ws.GetFlipByteOrder() );
+				EntityReader er( rs );
+				er.SetTolerantReading( true );
+				Assert::IsTrue( er.Read( "First", 5, read_back_u32 ) && read_back_u32 == first_value );
+				read_back_opt_u32.set( first_value );
+				Assert::IsTrue( er.Read( "Optional", 8, read_back_opt_u32 ) && !read_back_opt_u32.has_value() );
+				Assert::IsTrue( er.Read( "B", 1, read_back_u32 ) && read_back_u32 == first_value );
+				Assert::IsTrue( er.Read( "Name", 4, read_back_name ) && read_back_name == name );
+				EntityReader *sub_reader = nullptr;
+				bool success = false;
+				std::tie( sub_reader, success ) = er.BeginReadSection( "Missing", 7, true );
+				Assert::IsTrue( sub_reader == nullptr && success );
+				std::tie( sub_reader, success ) = er.BeginReadSection( "Sub", 3, false );
+				Assert::IsTrue( sub_reader != nullptr && success );
+				Assert::IsTrue( sub_reader->Read( "A", 1, read_back_u64 ) && read_back_u64 == sub_value );
+				Assert::IsTrue( er.EndReadSection( sub_reader ) );
+				size_t item_count = 0;
+				std::tie( sub_reader, item_count, success ) = er.BeginReadSectionsArray( "Arr", 3, false );
+				Assert::IsTrue( sub_reader != nullptr && success && item_count == 2 );
+				for( size_t item_index = 0; item_index < 2; ++item_index )
+					{
+					bool has_item = false;
+					Assert::IsTrue( er.BeginReadSectionInArray( sub_reader, item_index, &has_item ) && has_item );
+					Assert::IsTrue( sub_reader->Read( "A", 1, read_back_u64 ) && read_back_u64 == sub_value + item_index );
+					Assert::IsTrue( er.EndReadSectionInArray( sub_reader, item_index ) );
+					}
+				Assert::IsTrue( er.EndReadSectionsArray( sub_reader ) );
+
+				// a missing required value is still an error
+				const u64 position = rs.GetPosition();
+				Assert::IsFalse( er.Read( "Required", 8, read_back_u32 ) );
+				rs.SetPosition( position );
+				Assert::IsTrue( er.Read( "Last", 4, read_back_u32 ) && read_back_u32 == last_value );
+				}
+			}
+
+		TEST_METHOD( TestCollectPackageRefs )
+			{
+			for( uint pass_index=0; pass_index<global_number_of_passes; ++pass_index )
+				{
+				MemoryWriteStream ws;
+				EntityWriter ew( ws );
+				std::vector<hash> expected_refs;
+
+				// single refs, and an empty ref with a key long enough to be mistaken for a value
+				const package_ref geometry = random_value<package_ref>();
+				Assert::IsTrue( ew.Write( "Geometry", 8, geometry ) );
+				expected_refs.push_back( hash( geometry ) );
+				const optional_value<package_ref> empty_ref;
+				Assert::IsTrue( ew.Write( "EmptyGeometryReferenceWithALongKey", 34, empty_ref ) );
+
+				// values which are not refs must be skipped
+				std::vector<u64> value_vec;
+				random_vector<u64>( value_vec, 10, 100 );
+				Assert::IsTrue( ew.Write( "Values", 6, value_vec ) );
+
+				// an array of refs
+				std::vector<package_ref> layers;
+				random_vector<package_ref>( layers, 10, 100 );
+				Assert::IsTrue( ew.Write( "Layers", 6, layers ) );
+				for( const package_ref &ref : layers )
+					{
+					expected_refs.push_back( hash( ref ) );
+					}
+
+				// refs in a section, and in an array of sections
+				EntityWriter *section_writer = ew.BeginWriteSection( "Section", 7 );
+				Assert::IsTrue( section_writer != nullptr );
+				const package_ref section_ref = random_value<package_ref>();
+				Assert::IsTrue( section_writer->Write( "Ref", 3, section_ref ) );
+				expected_refs.push_back( hash( section_ref ) );
+				Assert::IsTrue( ew.EndWriteSection( section_writer ) );
+
+				const size_t section_count = 5;
+				EntityWriter *section_array_writer = ew.BeginWriteSectionsArray( "Sections", 8, section_count );
+				Assert::IsTrue( section_array_writer != nullptr );
+				for( size_t i = 0; i < section_count; ++i )
+					{
+					Assert::IsTrue( ew.BeginWriteSectionInArray( section_array_writer, i ) );
+					const package_ref array_ref = random_value<package_ref>();
+					Assert::IsTrue( section_array_writer->Write( "Ref", 3, array_ref ) );
+					expected_refs.push_back( hash( array_ref ) );
+					Assert::IsTrue( ew.EndWriteSectionInArray( section_array_writer, i ) );
+					}
+				Assert::IsTrue( ew.EndWriteSectionsArray( section_array_writer ) );
+
+				std::vector<hash> refs;
+				Assert::IsTrue( collect_package_refs( ws.GetData(), ws.GetSize(), refs ) == Status::Ok );
+				Assert::IsTrue( refs == expected_refs );
+
+				// truncated data is malformed
+				refs.clear();
+				Assert::IsTrue( collect_package_refs( ws.GetData(), ws.GetSize() - 1, refs ) == Status::EInvalid );
+				}
+			}
+
 		};
 	}
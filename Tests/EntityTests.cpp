@@ -13,11 +13,41 @@ using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 #include "..\ISD\ISD_EntityReader.h"
 #include "..\ISD\ISD_Registry.h"
 #include "..\ISD\ISD_EntityValidator.h"
+#include "..\ISD\ISD_PacketSerializer.h"
+#include "..\ISD\ISD_Mesh.h"
+#include "..\ISD\ISD_Node.h"
+#include "..\ISD\ISD_FixedLayoutTestEntity.h"
 
 #include "..\TestHelpers\structure_generation.h"
 
 namespace TestEntityTests
 	{
+	// find the position of the values of the section with the key in the stream, right after the key of the section block
+	static size_t find_section_values( const std::vector<u8> &data, const char *key )
+		{
+		const size_t key_length = strlen( key );
+		for( size_t pos = 0; pos + 10 + key_length <= data.size(); ++pos )
+			{
+			if( data[pos] == (u8)ISD::ValueType::VT_Subsection 
+				&& data[pos + 9] == key_length 
+				&& memcmp( &data[pos + 10], key, key_length ) == 0 )
+				{
+				return pos + 10 + key_length;
+				}
+			}
+		return 0;
+		}
+
+	// write the table as a section, followed by a value which the readers of the table do not know of, as a newer version would
+	template<class T> static void write_newer_table_section( EntityWriter &ew, const char *key, const T &table )
+		{
+		EntityWriter *section_writer = ew.BeginWriteSection( key, (u8)strlen( key ) );
+		Assert::IsTrue( section_writer != nullptr );
+		Assert::IsTrue( T::MF::Write( table, *section_writer ) );
+		Assert::IsTrue( section_writer->Write<u32>( "NewValue", 8, random_value<u32>() ) );
+		Assert::IsTrue( ew.EndWriteSection( section_writer ) );
+		}
+
 	TEST_CLASS( EntityTests )
 		{
 		STANDARD_TEST_INIT()
@@ -66,5 +96,328 @@ namespace TestEntityTests
 			Assert::IsTrue( TestEntity::MF::Equals( &ent1, &ent2 ) );
 			}
 
+		TEST_METHOD( PacketSerializerRoundTripTests )
+			{
+			ISD::PacketTypeRegistry registry;
+			Assert::IsTrue( registry.Register<TestEntity>() );
+			Assert::IsTrue( !registry.Register<TestEntity>() );
+			ISD::PacketSerializer serializer( registry );
+
+			for( uint flip = 0; flip < 2; ++flip )
+				{
+				// write two packets after each other
+				ISD::EntityPacket<TestEntity> packets[2];
+				for( uint i = 0; i < 2; ++i )
+					{
+					packets[i].EntityId = random_value<ISD::UUID>();
+					packets[i].Entity.Name() = random_value<string>();
+					packets[i].Entity.OptionalText().set( random_value<string>() );
+					}
+				MemoryWriteStream ws;
+				ws.SetFlipByteOrder( flip != 0 );
+				Assert::IsTrue( serializer.ToMemoryStream( &packets[0], ws ) == ISD::Status::Ok );
+				Assert::IsTrue( serializer.ToMemoryStream( &packets[1], ws ) == ISD::Status::Ok );
+
+				// read them back
+				std::vector<u8> data( (const u8 *)ws.GetData(), (const u8 *)ws.GetData() + ws.GetSize() );
+				MemoryReadStream rs( data.data(), data.size() );
+				for( uint i = 0; i < 2; ++i )
+					{
+					ISD::Packet *packet;
+					ISD::Status status;
+					std::tie( packet, status ) = serializer.FromMemoryStream( rs );
+					Assert::IsTrue( status == ISD::Status::Ok );
+					Assert::IsTrue( packet->EntityId == packets[i].EntityId );
+					Assert::IsTrue( packet->GetEntityTypeId() == TestEntity::TypeId );
+					Assert::IsTrue( TestEntity::MF::Equals( &( (ISD::EntityPacket<TestEntity> *)packet )->Entity, &packets[i].Entity ) );
+					delete packet;
+					}
+				Assert::IsTrue( rs.IsEOF() );
+
+				// a changed byte in the payload is detected by the hash, and the stream is moved to the next packet
+				data[sizeof( ISD::BlobHeader ) + sizeof( ISD::UUID ) * 2] ^= 0x1;
+				MemoryReadStream corrupted_rs( data.data(), data.size() );
+				Assert::IsTrue( serializer.FromMemoryStream( corrupted_rs ).second == ISD::Status::ECorrupted );
+				auto next_packet = serializer.FromMemoryStream( corrupted_rs );
+				Assert::IsTrue( next_packet.second == ISD::Status::Ok );
+				Assert::IsTrue( next_packet.first->EntityId == packets[1].EntityId );
+				delete next_packet.first;
+
+				// a truncated packet is not valid
+				MemoryReadStream truncated_rs( data.data(), 40 );
+				Assert::IsTrue( serializer.FromMemoryStream( truncated_rs ).second == ISD::Status::EInvalid );
+				Assert::IsTrue( truncated_rs.GetPosition() == 0 );
+				}
+
+			// an unregistered type is not valid
+			ISD::PacketTypeRegistry empty_registry;
+			ISD::PacketSerializer empty_serializer( empty_registry );
+			ISD::EntityPacket<TestEntity> packet;
+			MemoryWriteStream ws;
+			Assert::IsTrue( empty_serializer.ToMemoryStream( &packet, ws ) == ISD::Status::Ok );
+			MemoryReadStream rs( ws.GetData(), ws.GetSize() );
+			Assert::IsTrue( empty_serializer.FromMemoryStream( rs ).second == ISD::Status::EInvalid );
+			}
+
+		TEST_METHOD( LazySectionTests )
+			{
+			for( uint flip = 0; flip < 2; ++flip )
+				{
+				// the attribute data tables of the mesh are lazy sections, which are only read lazily by a reader with lazy reading
+				ISD::Mesh mesh;
+				for( uint i = 0; i < 4; ++i )
+					{
+					random_idx_vector<fvec3>( mesh.NormalsData().Insert( entity_ref::make_ref() ), 10, 100 );
+					random_idx_vector<fvec2>( mesh.TextureCoordsData().Insert( entity_ref::make_ref() ), 10, 100 );
+					}
+				MemoryWriteStream ws;
+				ws.SetFlipByteOrder( flip != 0 );
+				EntityWriter ew( ws );
+				Assert::IsTrue( ISD::Mesh::MF::Write( mesh, ew ) );
+				std::shared_ptr<std::vector<u8>> data = std::make_shared<std::vector<u8>>( (const u8 *)ws.GetData(), (const u8 *)ws.GetData() + ws.GetSize() );
+
+				// without a data owner, the sections are read directly
+				ISD::Mesh direct_mesh;
+					{
+					MemoryReadStream rs( data->data(), data->size(), ws.GetFlipByteOrder() );
+					EntityReader er( rs );
+					Assert::IsTrue( ISD::Mesh::MF::Read( direct_mesh, er ) );
+					Assert::IsTrue( rs.IsEOF() );
+					}
+				Assert::IsTrue( ISD::Mesh::MF::Equals( &mesh, &direct_mesh ) );
+
+				// without lazy reading, the sections are read with the mesh, and do not reference the data
+					{
+					std::shared_ptr<std::vector<u8>> eager_data = std::make_shared<std::vector<u8>>( *data );
+					MemoryReadStream rs( eager_data->data(), eager_data->size(), ws.GetFlipByteOrder() );
+					rs.SetDataOwner( eager_data );
+					EntityReader er( rs );
+					ISD::Mesh eager_mesh;
+					Assert::IsTrue( ISD::Mesh::MF::Read( eager_mesh, er ) );
+					Assert::IsTrue( rs.IsEOF() );
+					rs.SetDataOwner( nullptr );
+					std::weak_ptr<std::vector<u8>> weak_eager_data = eager_data;
+					eager_data.reset();
+					Assert::IsTrue( weak_eager_data.expired() );
+					Assert::IsTrue( ISD::Mesh::MF::Equals( &mesh, &eager_mesh ) );
+					}
+
+				// with a data owner, the sections reference the data, which is kept alive by the sections until they are read
+				ISD::Mesh lazy_mesh;
+					{
+					MemoryReadStream rs( data->data(), data->size(), ws.GetFlipByteOrder() );
+					rs.SetDataOwner( data );
+					EntityReader er( rs );
+					er.SetLazyReading( true );
+					Assert::IsTrue( ISD::Mesh::MF::Read( lazy_mesh, er ) );
+					Assert::IsTrue( rs.IsEOF() );
+					}
+				ISD::Mesh lazy_mesh_copy = lazy_mesh;
+				std::weak_ptr<std::vector<u8>> weak_data = data;
+				data.reset();
+				Assert::IsFalse( weak_data.expired() );
+				Assert::IsTrue( lazy_mesh.NormalsData() == mesh.NormalsData() );
+				Assert::IsTrue( ISD::Mesh::MF::Equals( &mesh, &lazy_mesh ) );
+				Assert::IsTrue( ISD::Mesh::MF::Equals( &mesh, &lazy_mesh_copy ) );
+				Assert::IsTrue( weak_data.expired() );
+
+				// the framing of the lazy sections is validated when the mesh is read, so a section with a malformed block fails the read.
+				// the first block of the section is the "IDs" array of the table
+				const std::vector<u8> written( (const u8 *)ws.GetData(), (const u8 *)ws.GetData() + ws.GetSize() );
+				const size_t values_pos = find_section_values( written, "NormalsData" );
+				Assert::IsTrue( values_pos != 0 );
+					{
+					std::shared_ptr<std::vector<u8>> corrupted = std::make_shared<std::vector<u8>>( written );
+					memset( &(*corrupted)[values_pos + 1], 0xff, sizeof( u64 ) );
+					MemoryReadStream rs( corrupted->data(), corrupted->size(), ws.GetFlipByteOrder() );
+					rs.SetDataOwner( corrupted );
+					EntityReader er( rs );
+					er.SetLazyReading( true );
+					ISD::Mesh corrupted_mesh;
+					Assert::IsFalse( ISD::Mesh::MF::Read( corrupted_mesh, er ) );
+					}
+
+				// a value which can not be decoded in a well framed section fails when the section is read
+					{
+					std::shared_ptr<std::vector<u8>> corrupted = std::make_shared<std::vector<u8>>( written );
+					(*corrupted)[values_pos + 10] = 'X';
+					MemoryReadStream rs( corrupted->data(), corrupted->size(), ws.GetFlipByteOrder() );
+					rs.SetDataOwner( corrupted );
+					EntityReader er( rs );
+					er.SetLazyReading( true );
+					ISD::Mesh corrupted_mesh;
+					Assert::IsTrue( ISD::Mesh::MF::Read( corrupted_mesh, er ) );
+					Assert::IsFalse( ISD::Mesh::MF::ReadLazySections( corrupted_mesh ) );
+					}
+
+				// a newer version of the mesh, with a value in a lazy section which the reader does not know of. the lazy sections are 
+				// read with the settings of the reader of the mesh, so only a tolerant reader reads them
+				MemoryWriteStream newer_ws;
+				newer_ws.SetFlipByteOrder( flip != 0 );
+					{
+					EntityWriter newer_ew( newer_ws );
+					EntityWriter *section_writer = newer_ew.BeginWriteSection( "Layers", 6 );
+					Assert::IsTrue( section_writer != nullptr );
+					Assert::IsTrue( ISD::Mesh::attribute_layers::MF::Write( mesh.Layers(), *section_writer ) );
+					Assert::IsTrue( newer_ew.EndWriteSection( section_writer ) );
+					write_newer_table_section( newer_ew, "TextureCoordsData", mesh.TextureCoordsData() );
+					write_newer_table_section( newer_ew, "TangentsData", mesh.TangentsData() );
+					write_newer_table_section( newer_ew, "BitangentsData", mesh.BitangentsData() );
+					write_newer_table_section( newer_ew, "NormalsData", mesh.NormalsData() );
+					write_newer_table_section( newer_ew, "ColorsData", mesh.ColorsData() );
+					write_newer_table_section( newer_ew, "CustomData", mesh.CustomData() );
+					}
+				std::shared_ptr<std::vector<u8>> newer_data = std::make_shared<std::vector<u8>>( (const u8 *)newer_ws.GetData(), (const u8 *)newer_ws.GetData() + newer_ws.GetSize() );
+				for( uint tolerant = 0; tolerant < 2; ++tolerant )
+					{
+					MemoryReadStream rs( newer_data->data(), newer_data->size(), newer_ws.GetFlipByteOrder() );
+					rs.SetDataOwner( newer_data );
+					EntityReader er( rs );
+					er.SetLazyReading( true );
+					er.SetTolerantReading( tolerant != 0 );
+					ISD::Mesh newer_mesh;
+					Assert::IsTrue( ISD::Mesh::MF::Read( newer_mesh, er ) );
+					Assert::IsTrue( ISD::Mesh::MF::ReadLazySections( newer_mesh ) == ( tolerant != 0 ) );
+					if( tolerant != 0 )
+						{
+						Assert::IsTrue( ISD::Mesh::MF::Equals( &mesh, &newer_mesh ) );
+						}
+					}
+				}
+			}
+
+		TEST_METHOD( FixedLayoutTests )
+			{
+			for( uint flip = 0; flip < 2; ++flip )
+				{
+				// the transform of the node is read as a fixed layout
+				ISD::Node node;
+				node.Name() = random_value<string>();
+				node.Translation() = random_value<fvec3>();
+				node.Rotation() = random_value<fvec3>();
+				node.Scale() = random_value<fvec3>();
+				MemoryWriteStream ws;
+				ws.SetFlipByteOrder( flip != 0 );
+				EntityWriter ew( ws );
+				Assert::IsTrue( ISD::Node::MF::Write( node, ew ) );
+
+				ISD::Node read_node;
+					{
+					MemoryReadStream rs( ws.GetData(), ws.GetSize(), ws.GetFlipByteOrder() );
+					EntityReader er( rs );
+					Assert::IsTrue( ISD::Node::MF::Read( read_node, er ) );
+					Assert::IsTrue( rs.IsEOF() );
+					}
+				Assert::IsTrue( ISD::Node::MF::Equals( &node, &read_node ) );
+
+				// a stream with another value within the layout is read one value at a time
+				MemoryWriteStream newer_ws;
+				newer_ws.SetFlipByteOrder( flip != 0 );
+				EntityWriter newer_ew( newer_ws );
+				Assert::IsTrue( newer_ew.Write<string>( "Name", 4, node.Name() ) );
+				Assert::IsTrue( newer_ew.Write<fvec3>( "Translation", 11, node.Translation() ) );
+				Assert::IsTrue( newer_ew.Write<u32>( "NewValue", 8, random_value<u32>() ) );
+				Assert::IsTrue( newer_ew.Write<fvec3>( "Rotation", 8, node.Rotation() ) );
+				Assert::IsTrue( newer_ew.Write<fvec3>( "Scale", 5, node.Scale() ) );
+					{
+					MemoryReadStream rs( newer_ws.GetData(), newer_ws.GetSize(), newer_ws.GetFlipByteOrder() );
+					EntityReader er( rs );
+					Assert::IsFalse( ISD::Node::MF::Read( read_node, er ) );
+					}
+				MemoryReadStream rs( newer_ws.GetData(), newer_ws.GetSize(), newer_ws.GetFlipByteOrder() );
+				EntityReader er( rs );
+				er.SetTolerantReading( true );
+				ISD::Node::MF::Clear( read_node );
+				Assert::IsTrue( ISD::Node::MF::Read( read_node, er ) );
+				Assert::IsTrue( ISD::Node::MF::Equals( &node, &read_node ) );
+				}
+			}
+
+		TEST_METHOD( FixedLayoutHashTests )
+			{
+			for( uint flip = 0; flip < 2; ++flip )
+				{
+				// the hashes are read in the same fixed layout as the values around them
+				ISD::FixedLayoutTestEntity entity;
+				entity.Name() = random_value<string>();
+				entity.Flags() = random_value<u32>();
+				entity.ContentHash() = random_value<hash>();
+				entity.Position() = random_value<fvec3>();
+				entity.SourceHash() = random_value<hash>();
+				MemoryWriteStream ws;
+				ws.SetFlipByteOrder( flip != 0 );
+				EntityWriter ew( ws );
+				Assert::IsTrue( ISD::FixedLayoutTestEntity::MF::Write( entity, ew ) );
+
+				ISD::FixedLayoutTestEntity read_entity;
+				MemoryReadStream rs( ws.GetData(), ws.GetSize(), ws.GetFlipByteOrder() );
+				EntityReader er( rs );
+				Assert::IsTrue( ISD::FixedLayoutTestEntity::MF::Read( read_entity, er ) );
+				Assert::IsTrue( rs.IsEOF() );
+				Assert::IsTrue( read_entity == entity );
+				}
+			}
+
+		TEST_METHOD( SerializedSizeTests )
+			{
+			ISD::Mesh mesh;
+			for( uint i = 0; i < 4; ++i )
+				{
+				random_idx_vector<fvec3>( mesh.NormalsData().Insert( entity_ref::make_ref() ), 10, 100 );
+				random_idx_vector<fvec2>( mesh.TextureCoordsData().Insert( entity_ref::make_ref() ), 10, 100 );
+				}
+
+			for( uint flip = 0; flip < 2; ++flip )
+				{
+				for( uint settings = 0; settings < 4; ++settings )
+					{
+					// write the mesh the default way, after some data so the padding of arrays is not at the start of the stream
+					MemoryWriteStream ws;
+					ws.SetFlipByteOrder( flip != 0 );
+					ws.Write( (u8)1 );
+					EntityWriter ew( ws );
+					Assert::IsTrue( ew.SetArrayPayloadAlignment( ( settings & 1 ) ? 64 : 0 ) );
+					ew.SetWriteDirectory( ( settings & 2 ) != 0 );
+					Assert::IsTrue( ISD::Mesh::MF::Write( mesh, ew ) );
+
+					// compute the size and block sizes, and write the mesh in one pass into a reserved stream
+					MemoryWriteStream sized_ws;
+					sized_ws.SetFlipByteOrder( flip != 0 );
+					sized_ws.Write( (u8)1 );
+					EntityWriter sized_ew( sized_ws );
+					Assert::IsTrue( sized_ew.SetArrayPayloadAlignment( ew.GetArrayPayloadAlignment() ) );
+					sized_ew.SetWriteDirectory( ew.GetWriteDirectory() );
+					u64 size = 0;
+					std::vector<u64> block_sizes;
+					Assert::IsTrue( ISD::Mesh::MF::MeasureSerializedSize( mesh, sized_ew, size, &block_sizes ) );
+					Assert::IsTrue( size == ws.GetSize() - 1 );
+					sized_ws.Reserve( sized_ws.GetPosition() + size );
+					const void *data = sized_ws.GetData();
+					sized_ws.SetBlockSizes( &block_sizes );
+					Assert::IsTrue( ISD::Mesh::MF::Write( mesh, sized_ew ) );
+					Assert::IsFalse( sized_ws.HasFailed() );
+					sized_ws.SetBlockSizes( nullptr );
+
+					// the stream is not reallocated, and the data is the same
+					Assert::IsTrue( sized_ws.GetData() == data );
+					Assert::IsTrue( sized_ws.GetSize() == ws.GetSize() );
+					Assert::IsTrue( memcmp( sized_ws.GetData(), ws.GetData(), ws.GetSize() ) == 0 );
+
+					// a changed mesh does not match the sizes
+					ISD::Mesh changed_mesh = mesh;
+					random_idx_vector<fvec3>( changed_mesh.NormalsData().Insert( entity_ref::make_ref() ), 10, 100 );
+					MemoryWriteStream changed_ws;
+					changed_ws.SetFlipByteOrder( flip != 0 );
+					changed_ws.Write( (u8)1 );
+					EntityWriter changed_ew( changed_ws );
+					Assert::IsTrue( changed_ew.SetArrayPayloadAlignment( ew.GetArrayPayloadAlignment() ) );
+					changed_ew.SetWriteDirectory( ew.GetWriteDirectory() );
+					changed_ws.SetBlockSizes( &block_sizes );
+					Assert::IsFalse( ISD::Mesh::MF::Write( changed_mesh, changed_ew ) );
+					Assert::IsTrue( changed_ws.HasFailed() );
+					}
+				}
+			}
+
 		};
 	}
@@ -13,6 +13,21 @@ using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 
 namespace MemoryStreamTests
 	{
+	// sink which stores the flushed data in memory, for comparing with the stream
+	class MemoryWriteSink : public WriteSink
+		{
+		public:
+			std::vector<u8> Data;
+
+			virtual bool WriteAt( u64 offset, const void *src, u64 count ) override
+				{
+				if( this->Data.size() < offset + count )
+					this->Data.resize( offset + count );
+				memcpy( &this->Data[offset], src, count );
+				return true;
+				}
+		};
+
 	TEST_CLASS( ReadWriteTests )
 		{
 		STANDARD_TEST_INIT()
@@ -144,5 +159,166 @@ namespace MemoryStreamTests
 				}
 			}
 
+		template<class T> void TestCopyAndSwapByteOrder()
+			{
+			// use unaligned src and dest, and all counts which exercise the vector tails
+			std::vector<u8> src_data( 1000 * sizeof(T) + 16 );
+			std::vector<u8> dest_data( 1000 * sizeof(T) + 16 );
+			for( u8 &b : src_data )
+				b = u8_rand();
+
+			for( size_t offset = 0; offset < sizeof(T); ++offset )
+				{
+				for( size_t count = 0; count < 1000; count += (count < 200) ? 1 : 97 )
+					{
+					const T *src = (const T *)&src_data[offset];
+					T *dest = (T *)&dest_data[offset + 1];
+					copy_and_swap_byte_order<T>( dest, src, count );
+
+					// swap in place as well
+					std::vector<u8> inplace_data( src_data );
+					swap_byte_order<T>( (T *)&inplace_data[offset], count );
+
+					for( size_t i = 0; i < count * sizeof(T); ++i )
+						{
+						const size_t word_start = i - (i % sizeof(T));
+						const size_t swapped_i = word_start + (sizeof(T) - 1 - (i % sizeof(T)));
+						Assert::IsTrue( dest_data[offset + 1 + i] == src_data[offset + swapped_i] );
+						Assert::IsTrue( inplace_data[offset + i] == src_data[offset + swapped_i] );
+						}
+					}
+				}
+			}
+
+		TEST_METHOD( CopyAndSwapByteOrder )
+			{
+			TestCopyAndSwapByteOrder<u16>();
+			TestCopyAndSwapByteOrder<u32>();
+			TestCopyAndSwapByteOrder<u64>();
+			}
+
+		TEST_METHOD( MemoryWriteStreamWithSink )
+			{
+			// run twice, one with flipped, one with non-flipped byte order
+			for( uint pass_index = 0; pass_index < 2*global_number_of_passes; ++pass_index )
+				{
+				// write the same data to a plain stream, and to a stream with a small sink buffer
+				MemoryWriteStream ws;
+				MemoryWriteStream sink_ws;
+				MemoryWriteSink sink;
+				sink_ws.SetSink( &sink, 1024 + (rand() % 1024) );
+				ws.SetFlipByteOrder( (pass_index & 0x1) != 0 );
+				sink_ws.SetFlipByteOrder( (pass_index & 0x1) != 0 );
+
+				std::vector<u64> block_starts;
+				for( uint i = 0; i < 10000; ++i )
+					{
+					int item_type = rand() % 4;
+					switch( item_type )
+						{
+						case 0:
+							{
+							// begin a block, with a placeholder size
+							block_starts.push_back( ws.GetPosition() );
+							ws.Write( (u64)MAXINT64 );
+							sink_ws.Write( (u64)MAXINT64 );
+							break;
+							}
+						case 1:
+							{
+							// end a block, and patch the size, (which is usually flushed to the sink already)
+							if( block_starts.empty() )
+								break;
+							u64 start_pos = block_starts.back();
+							block_starts.pop_back();
+							u64 end_pos = ws.GetPosition();
+							ws.SetPosition( start_pos );
+							sink_ws.SetPosition( start_pos );
+							ws.Write( end_pos - start_pos );
+							sink_ws.Write( end_pos - start_pos );
+							ws.SetPosition( end_pos );
+							sink_ws.SetPosition( end_pos );
+							break;
+							}
+						case 2:
+							{
+							// write an array of values, sometimes larger than the sink buffer
+							std::vector<u32> values;
+							random_vector( values, 0, 1000 );
+							ws.Write( values.data(), values.size() );
+							sink_ws.Write( values.data(), values.size() );
+							break;
+							}
+						case 3:
+							{
+							const u16 u16val = u16_rand();
+							ws.Write( u16val );
+							sink_ws.Write( u16val );
+							break;
+							}
+						}
+					}
+
+				// flush the last of the data, and compare
+				Assert::IsTrue( sink_ws.Flush() == Status::Ok );
+				Assert::IsTrue( ws.GetSize() == sink_ws.GetSize() );
+				Assert::IsTrue( ws.GetSize() == sink.Data.size() );
+				Assert::IsTrue( memcmp( ws.GetData(), sink.Data.data(), sink.Data.size() ) == 0 );
+				}
+			}
+
+		// write an outer block with an inner block of value_count values
+		static bool WriteNestedBlocks( MemoryWriteStream &ws, u64 value_count )
+			{
+			const u64 outer_block = ws.BeginBlock();
+			ws.Write( (u32)0x12345678 );
+			const u64 inner_block = ws.BeginBlock();
+			for( u64 i = 0; i < value_count; ++i )
+				{
+				ws.Write( (u16)i );
+				}
+			const bool inner_ended = ws.EndBlock( inner_block );
+			const bool outer_ended = ws.EndBlock( outer_block );
+			return inner_ended && outer_ended;
+			}
+
+		TEST_METHOD( MemoryWriteStreamBlockSizes )
+			{
+			// measure the sizes of the blocks
+			std::vector<u64> block_sizes;
+			MemoryWriteStream measure_ws( 0, true );
+			measure_ws.SetBlockSizes( &block_sizes );
+			Assert::IsTrue( WriteNestedBlocks( measure_ws, 100 ) );
+			Assert::IsTrue( block_sizes.size() == 2 );
+
+			// written in one pass with the sizes, the stream is the same as when the sizes are written at the end of the blocks
+			MemoryWriteStream ws;
+			Assert::IsTrue( WriteNestedBlocks( ws, 100 ) );
+			MemoryWriteStream sized_ws;
+			sized_ws.SetBlockSizes( &block_sizes );
+			Assert::IsTrue( WriteNestedBlocks( sized_ws, 100 ) );
+			Assert::IsFalse( sized_ws.HasFailed() );
+			Assert::IsTrue( sized_ws.GetSize() == ws.GetSize() );
+			Assert::IsTrue( memcmp( sized_ws.GetData(), ws.GetData(), (size_t)ws.GetSize() ) == 0 );
+
+			// blocks which do not match the sizes fail the write, and the stream
+			MemoryWriteStream mismatched_ws;
+			mismatched_ws.SetBlockSizes( &block_sizes );
+			Assert::IsFalse( WriteNestedBlocks( mismatched_ws, 101 ) );
+			Assert::IsTrue( mismatched_ws.HasFailed() );
+
+			// with a sink, the data is flushed before the mismatch is found, so the flush must fail, and nothing more is written
+			MemoryWriteStream sink_ws;
+			MemoryWriteSink sink;
+			sink_ws.SetSink( &sink, 16 );
+			sink_ws.SetBlockSizes( &block_sizes );
+			Assert::IsFalse( WriteNestedBlocks( sink_ws, 101 ) );
+			Assert::IsTrue( sink_ws.HasFailed() );
+			const size_t sink_size = sink.Data.size();
+			sink_ws.Write( (u64)0 );
+			Assert::IsTrue( sink_ws.Flush() == Status::ECantWrite );
+			Assert::IsTrue( sink.Data.size() == sink_size );
+			}
+
 		};
 	}
\ No newline at end of file
@@ -11,8 +11,54 @@ using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 #include "..\ISD\ISD_EntityWriter.h"
 #include "..\ISD\ISD_EntityReader.h"
 
+#include <crtdbg.h>
+
 namespace EntityManagementTests
 	{
+	// counts the heap allocations of the calling thread while in scope, to measure the allocations done when writing and reading
+	// sections. the allocation hook of the debug CRT is only installed for the scope, so the rest of the tests are not affected.
+	// release builds have no allocation hook, and count nothing
+	class scoped_allocation_counter
+		{
+		private:
+			static thread_local u64 *ThreadCount;
+			u64 Count = 0;
+#ifdef _DEBUG
+			_CRT_ALLOC_HOOK PreviousHook = nullptr;
+
+			static int __cdecl AllocationHook( int alloc_type, void *, size_t, int block_type, long, const unsigned char *, int )
+				{
+				if( ThreadCount && block_type != _CRT_BLOCK && ( alloc_type == _HOOK_ALLOC || alloc_type == _HOOK_REALLOC ) )
+					{
+					++( *ThreadCount );
+					}
+				return TRUE;
+				}
+#endif
+
+		public:
+			scoped_allocation_counter()
+				{
+				ThreadCount = &this->Count;
+#ifdef _DEBUG
+				this->PreviousHook = _CrtSetAllocHook( &AllocationHook );
+#endif
+				}
+			scoped_allocation_counter( const scoped_allocation_counter & ) = delete;
+			scoped_allocation_counter &operator=( const scoped_allocation_counter & ) = delete;
+			~scoped_allocation_counter()
+				{
+#ifdef _DEBUG
+				_CrtSetAllocHook( this->PreviousHook );
+#endif
+				ThreadCount = nullptr;
+				}
+
+			u64 GetCount() const { return this->Count; }
+		};
+
+	thread_local u64 *scoped_allocation_counter::ThreadCount = nullptr;
+
 	class section_array;
 
 	class section_object
@@ -311,6 +357,100 @@ namespace EntityManagementTests
 				readback_hierarchy.Compare( &my_hierarchy );
 				}
 			}
+
+		TEST_METHOD( TestEntitySectionAllocations )
+			{
+			const size_t section_count = 1000;
+			for( uint flip = 0; flip < 2; ++flip )
+				{
+				// reserve the whole stream up front, so only the writers and readers can allocate
+				MemoryWriteStream ws( 1024 * 1024 );
+				EntityWriter ew( ws );
+				ws.SetFlipByteOrder( flip != 0 );
+
+				// write sections with nested sections, and a sections array with nested sections
+				u64 write_allocations = 0;
+					{
+					scoped_allocation_counter allocation_counter;
+					for( size_t section_index = 0; section_index < section_count; ++section_index )
+						{
+						EntityWriter *section_writer = ew.BeginWriteSection( "sub", 3 );
+						Assert::IsTrue( section_writer != nullptr );
+						EntityWriter *nested_writer = section_writer->BeginWriteSection( "nested", 6 );
+						Assert::IsTrue( nested_writer != nullptr );
+						Assert::IsTrue( nested_writer->Write( "value", 5, (u32)section_index ) );
+						Assert::IsTrue( section_writer->EndWriteSection( nested_writer ) );
+						Assert::IsTrue( ew.EndWriteSection( section_writer ) );
+						}
+					EntityWriter *section_array_writer = ew.BeginWriteSectionsArray( "vec", 3, section_count );
+					Assert::IsTrue( section_array_writer != nullptr );
+					for( size_t section_index = 0; section_index < section_count; ++section_index )
+						{
+						Assert::IsTrue( ew.BeginWriteSectionInArray( section_array_writer, section_index ) );
+						EntityWriter *nested_writer = section_array_writer->BeginWriteSection( "nested", 6 );
+						Assert::IsTrue( nested_writer != nullptr );
+						Assert::IsTrue( nested_writer->Write( "value", 5, (u32)section_index ) );
+						Assert::IsTrue( section_array_writer->EndWriteSection( nested_writer ) );
+						Assert::IsTrue( ew.EndWriteSectionInArray( section_array_writer, section_index ) );
+						}
+					Assert::IsTrue( ew.EndWriteSectionsArray( section_array_writer ) );
+					write_allocations = allocation_counter.GetCount();
+					}
+
+				// read it back
+				MemoryReadStream rs( ws.GetData(), ws.GetSize(), ws.GetFlipByteOrder() );
+				EntityReader er( rs );
+				u64 read_allocations = 0;
+					{
+					scoped_allocation_counter allocation_counter;
+					EntityReader *section_reader = nullptr;
+					EntityReader *nested_reader = nullptr;
+					bool success = false;
+					u32 value = 0;
+					for( size_t section_index = 0; section_index < section_count; ++section_index )
+						{
+						std::tie( section_reader, success ) = er.BeginReadSection( "sub", 3, false );
+						Assert::IsTrue( section_reader != nullptr && success );
+						std::tie( nested_reader, success ) = section_reader->BeginReadSection( "nested", 6, false );
+						Assert::IsTrue( nested_reader != nullptr && success );
+						Assert::IsTrue( nested_reader->Read( "value", 5, value ) && value == (u32)section_index );
+						Assert::IsTrue( section_reader->EndReadSection( nested_reader ) );
+						Assert::IsTrue( er.EndReadSection( section_reader ) );
+						}
+					size_t array_size = 0;
+					std::tie( section_reader, array_size, success ) = er.BeginReadSectionsArray( "vec", 3, false );
+					Assert::IsTrue( section_reader != nullptr && success && array_size == section_count );
+					for( size_t section_index = 0; section_index < section_count; ++section_index )
+						{
+						bool section_has_data = false;
+						Assert::IsTrue( er.BeginReadSectionInArray( section_reader, section_index, &section_has_data ) && section_has_data );
+						std::tie( nested_reader, success ) = section_reader->BeginReadSection( "nested", 6, false );
+						Assert::IsTrue( nested_reader != nullptr && success );
+						Assert::IsTrue( nested_reader->Read( "value", 5, value ) && value == (u32)section_index );
+						Assert::IsTrue( section_reader->EndReadSection( nested_reader ) );
+						Assert::IsTrue( er.EndReadSectionInArray( section_reader, section_index ) );
+						}
+					Assert::IsTrue( er.EndReadSectionsArray( section_reader ) );
+					read_allocations = allocation_counter.GetCount();
+					}
+				Assert::IsTrue( rs.IsEOF() );
+
+				// the writers and readers of the sections are allocated once per depth, and are then reused by all 
+				// the sections, where they used to be allocated for each section (3 * section_count + 1 allocations).
+				// the allocations are only counted in debug builds, which have the allocation hook
+#ifdef _DEBUG
+				std::stringstream ss;
+				ss << "\tAllocations when writing: " << write_allocations << " reading: " << read_allocations << " (" << section_count << " sections)\n";
+				Logger::WriteMessage( ss.str().c_str() );
+				Assert::IsTrue( write_allocations <= 2 );
+				Assert::IsTrue( read_allocations <= 2 );
+#else
+				(void)write_allocations;
+				(void)read_allocations;
+				Logger::WriteMessage( "\tAllocations not measured, the allocation hook is only available in debug builds\n" );
+#endif
+				}
+			}
 		};
 	}
 
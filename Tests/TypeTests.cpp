@@ -8,6 +8,7 @@
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 
 #include "..\ISD\ISD_SHA256.h"
+#include "..\ISD\ISD_BlobHash.h"
 
 namespace TypeTests
 	{
@@ -172,6 +173,120 @@ namespace TypeTests
 				}
 			}
 
+		TEST_METHOD( SHA256Implementations )
+			{
+			// random buffers, with lengths around the padding edge cases
+			std::vector<std::vector<u8>> buffers;
+			const size_t edge_lengths[] = { 0, 1, 55, 56, 63, 64, 65, 119, 120, 128 };
+			for( size_t length : edge_lengths )
+				{
+				buffers.emplace_back( length );
+				}
+			for( uint i = 0; i < 27; ++i )
+				{
+				buffers.emplace_back( rand() % 10000 );
+				}
+
+			std::vector<const u8 *> data;
+			std::vector<size_t> data_lengths;
+			for( std::vector<u8> &buffer : buffers )
+				{
+				for( u8 &b : buffer )
+					b = u8_rand();
+				data.push_back( buffer.data() );
+				data_lengths.push_back( buffer.size() );
+				}
+
+			// reference digests, using the portable implementation
+			Assert::IsTrue( SHA256::SetImplementation( SHA256::Implementation::Portable ) );
+			std::vector<hash> reference_digests( buffers.size() );
+			SHA256::CalculateDigests( buffers.size(), data.data(), data_lengths.data(), reference_digests.data() );
+
+			// all supported implementations must match the reference, both in batches and when hashed in random pieces 
+			const SHA256::Implementation implementations[] = { SHA256::Implementation::SHANI, SHA256::Implementation::AVX2 };
+			for( SHA256::Implementation impl : implementations )
+				{
+				if( !SHA256::SetImplementation( impl ) )
+					{
+					Logger::WriteMessage( "SHA256 implementation is not supported by the CPU, skipping\n" );
+					continue;
+					}
+
+				std::vector<hash> digests( buffers.size() );
+				SHA256::CalculateDigests( buffers.size(), data.data(), data_lengths.data(), digests.data() );
+				Assert::IsTrue( digests == reference_digests );
+
+				for( size_t i = 0; i < buffers.size(); ++i )
+					{
+					SHA256 sha;
+					size_t pos = 0;
+					while( pos < data_lengths[i] )
+						{
+						size_t piece = std::min( (size_t)(rand() % 200), data_lengths[i] - pos );
+						sha.Update( &data[i][pos], piece );
+						pos += piece;
+						}
+					hash digest;
+					sha.GetDigest( digest.digest );
+					Assert::IsTrue( digest == reference_digests[i] );
+					}
+				}
+
+			Assert::IsTrue( SHA256::SetImplementation( SHA256::Implementation::Auto ) );
+			}
+
+		TEST_METHOD( BlobHashTrailers )
+			{
+			const u64 data_sizes[] = { 0, 1, 4096, 4097, 100000 };
+			const u64 chunk_sizes[] = { 0, 1000, 4096 }; // 0 is the single hash trailer
+			for( u64 chunk_size : chunk_sizes )
+				{
+				for( u64 data_size : data_sizes )
+					{
+					std::vector<u8> blob( data_size );
+					for( u8 &b : blob )
+						b = u8_rand();
+					std::vector<u8> trailer = calculate_blob_trailer( blob.data(), data_size, chunk_size );
+					blob.insert( blob.end(), trailer.begin(), trailer.end() );
+
+					BlobVerifier verifier;
+					Assert::IsTrue( verifier.Setup( blob.data(), blob.size() ) == Status::Ok );
+					Assert::IsTrue( verifier.GetDataSize() == data_size );
+					Assert::IsTrue( verifier.IsChunked() == (chunk_size != 0) );
+					Assert::IsTrue( verifier.VerifyRange( 0, data_size ) == Status::Ok );
+					Assert::IsTrue( verifier.VerifyAll( 4 ) == Status::Ok );
+					Assert::IsTrue( verifier.VerifyRange( data_size, 1 ) == Status::EParam );
+					Assert::IsTrue( verifier.VerifyAll() == Status::Ok );
+
+					if( data_size == 0 )
+						continue;
+
+					// corrupt the last byte of the data. only the range with the last chunk must fail, and verifying all
+					// must fail on any number of threads, also when verified again
+					std::vector<u8> corrupted_blob( blob );
+					corrupted_blob[data_size-1] ^= 0x1;
+					BlobVerifier corrupted_verifier;
+					Assert::IsTrue( corrupted_verifier.Setup( corrupted_blob.data(), corrupted_blob.size() ) == Status::Ok );
+					if( chunk_size != 0 && data_size > chunk_size )
+						{
+						Assert::IsTrue( corrupted_verifier.VerifyRange( 0, 1 ) == Status::Ok );
+						}
+					Assert::IsTrue( corrupted_verifier.VerifyRange( data_size-1, 1 ) == Status::ECorrupted );
+					Assert::IsTrue( corrupted_verifier.VerifyAll( 1 ) == Status::ECorrupted );
+					Assert::IsTrue( corrupted_verifier.VerifyAll() == Status::ECorrupted );
+
+					// corrupt the chunk hashes, which must be caught by the root hash
+					if( chunk_size != 0 )
+						{
+						std::vector<u8> corrupted_trailer_blob( blob );
+						corrupted_trailer_blob[data_size] ^= 0x1;
+						BlobVerifier corrupted_trailer_verifier;
+						Assert::IsTrue( corrupted_trailer_verifier.Setup( corrupted_trailer_blob.data(), corrupted_trailer_blob.size() ) == Status::ECorrupted );
+						}
+					}
+				}
+			}
+
 		TEST_METHOD( Test_entity_ref )
 			{
 			entity_ref ref;